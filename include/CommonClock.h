@@ -0,0 +1,160 @@
+/*
+ * \file Name: CommonClock.h
+ *
+ * \brief 64-bit nanosecond monotonic time and its clock sources
+ *
+ * \details
+ * CmTimeNs is a monotonic time in nanoseconds, compared and added as a
+ * plain integer. cmTimeNow() reads it from the selected clock source:
+ *  - CM_CLOCK_MONOTONIC  clock_gettime(CLOCK_MONOTONIC), the default
+ *  - CM_CLOCK_COARSE     CLOCK_MONOTONIC_COARSE, cheaper, tick resolution
+ *  - CM_CLOCK_TSC        time stamp counter calibrated against
+ *                        CLOCK_MONOTONIC, invariant TSC on x86 only
+ *  - CM_CLOCK_VIRTUAL    simulation time, only moves when advanced, see
+ *                        cmClockVirtStart() and the CM_IDLE_SIM strategy
+ * All the sources count from the CLOCK_MONOTONIC epoch, so deadlines
+ * stay valid across a source switch.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_CLOCK_H
+#define _COMMON_CLOCK_H
+
+#include <time.h>
+#include "CommonInc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+ #include <x86intrin.h>
+ #define CM_CLOCK_HAS_TSC
+#endif
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_TIME_NS_PER_US    (1000ULL)
+#define CM_TIME_NS_PER_MS    (1000000ULL)
+#define CM_TIME_NS_PER_SEC   (1000000000ULL)
+
+#define CM_TIME_FROM_MS(ms)  ((CmTimeNs)(ms) * CM_TIME_NS_PER_MS)
+#define CM_TIME_FROM_SEC(s)  ((CmTimeNs)(s) * CM_TIME_NS_PER_SEC)
+#define CM_TIME_TO_US(ns)    ((ns) / CM_TIME_NS_PER_US)
+#define CM_TIME_TO_MS(ns)    ((ns) / CM_TIME_NS_PER_MS)
+
+#define CM_CLOCK_TSC_CAL_MS  (20)  /* TSC calibration length           */
+#define CM_CLOCK_TSC_SHIFT   (24)  /* Fixed point of the ns per cycle  */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+typedef U64 CmTimeNs;   /* Monotonic time in nanoseconds */
+
+typedef enum CM_CLOCK_SOURCE_TAG
+{
+    CM_CLOCK_MONOTONIC = 0,
+    CM_CLOCK_COARSE,
+    CM_CLOCK_TSC,
+    CM_CLOCK_VIRTUAL,
+    CM_CLOCK_MAX
+} CM_CLOCK_SOURCE_t;
+
+typedef struct cmClock
+{
+    CM_CLOCK_SOURCE_t source;     /* Source read by cmTimeNow()           */
+    CM_CLOCK_SOURCE_t realSource; /* Source restored by cmClockVirtStop() */
+    CmTimeNs  virtNs;     /* CM_CLOCK_VIRTUAL time                   */
+    CmTimeNs  virtStart;  /* Virtual time when started               */
+    U64       virtJumps;  /* Number of virtual time forward moves    */
+    U64       tscBase;    /* TSC read at calibration                 */
+    CmTimeNs  tscNsBase;  /* CLOCK_MONOTONIC at tscBase              */
+    U32       tscMult;    /* ns per cycle << CM_CLOCK_TSC_SHIFT      */
+} CmClock;
+
+EXTERN CmClock g_cmClock;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+INLINE CmTimeNs cmTimeNow(void) __attribute__((always_inline));
+INLINE U32 cmTimeCompare(CmTimeNs tsNow, CmTimeNs tsCmp) __attribute__((always_inline));
+
+S16  cmClockSetSource( CM_CLOCK_SOURCE_t source );
+S16  cmClockStrToSource( const S8 *str, CM_CLOCK_SOURCE_t *source );
+const S8 *cmClockSourceStr( CM_CLOCK_SOURCE_t source );
+
+S16  cmClockVirtStart( CmTimeNs start );
+void cmClockVirtStop( void );
+bool cmClockIsVirtual( void );
+void cmClockVirtAdvanceTo( CmTimeNs ts );
+void cmClockVirtAdvanceMs( U32 ms );
+void cmClockVirtDumpStats( void );
+
+/**
+ * Inline function to read the selected clock source
+ * @param: None
+ * @return: monotonic time in nanoseconds
+ */
+INLINE CmTimeNs cmTimeNow(void)
+{
+    struct timespec ts;
+#ifdef CM_CLOCK_HAS_TSC
+    U64 delta;
+#endif
+
+    switch (g_cmClock.source)
+    {
+#ifdef CM_CLOCK_HAS_TSC
+    case CM_CLOCK_TSC:
+        /* Split so that the product never overflows 64 bits */
+        delta = __rdtsc() - g_cmClock.tscBase;
+        return g_cmClock.tscNsBase +
+               (delta >> CM_CLOCK_TSC_SHIFT) * g_cmClock.tscMult +
+               (((delta & ((1ULL << CM_CLOCK_TSC_SHIFT) - 1)) * g_cmClock.tscMult)
+                >> CM_CLOCK_TSC_SHIFT);
+#endif
+    case CM_CLOCK_VIRTUAL:
+        return __atomic_load_n(&g_cmClock.virtNs, __ATOMIC_ACQUIRE);
+    case CM_CLOCK_COARSE:
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        break;
+    default:
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        break;
+    }
+
+    return (CmTimeNs)ts.tv_sec * CM_TIME_NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Inline function to compare two monotonic times, without branches
+ * @param: tsNow - the time to compare
+ * @param: tsCmp - the time to be compared, e.g. a deadline
+ * @return: TIME_EQUAL       - same time
+ *          TIME_EXPIRED     - tsNow after tsCmp
+ *          TIME_NOT_EXPIRED - tsNow before tsCmp
+ */
+INLINE U32 cmTimeCompare(CmTimeNs tsNow, CmTimeNs tsCmp)
+{
+    return (U32)(tsNow > tsCmp) * TIME_EXPIRED |
+           (U32)(tsNow < tsCmp) * TIME_NOT_EXPIRED;
+}
+
+#endif
@@ -3,11 +3,16 @@
  * Created:  Grant Zhou 08/05/2014
  * Modified: Grant Zhou 08/06/2014 22:30>
  * 
- * \brief Simple non-event triggerred FSM implementation
+ * \brief Simple FSM implementation, polling or event triggerred
  * 
  * \details
  * This module provide one simple FSM implementation.
- * It is not an event triggerred FSM, only simple timeout mechnism provided.
+ * In polling mode only simple timeout mechnism provided, in event mode
+ * each instance owns an event queue and only runs when events are posted
+ * or its state timer expires. State timers of all the instances are kept
+ * in one timing wheel per control point and expired in bulk per pass.
+ * A pooled control point can run its instances earliest state deadline
+ * first within a time budget per pass, deferring the rest on overload.
  */
 
 /* 
@@ -28,6 +33,9 @@
 #define _COMMON_FSM_H
 
 #include "CommonInc.h"
+#include "CommonClock.h"
+#include "CommonTmrWheel.h"
+#include "CommonSlab.h"
 
 /**
 ************************************************************
@@ -37,6 +45,85 @@
 #define CM_FSM_ID_STR_LEN   (20)  /* Max FSM Instance Name Length */
 #define CM_FSM_INST_STR_LEN (40)
 
+#define CM_FSM_EVT_QUEUE_LEN (8)   /* Pending events per FSM instance */
+#define CM_FSM_STATE_NONE    (0xFFFF) /* nextState: output function decides */
+
+/* FSM Control Point Modes */
+#define CM_FSM_MODE_POLL   0  /* Polling, NORMAL column runs on every pass */
+#define CM_FSM_MODE_EVENT  1  /* Event driven, only posted events and timers run */
+
+/* FSM Entity Flags */
+#define CM_FSM_ENT_FLAG_ACTIVE  0x01  /* Instance is runnable by the driver */
+#define CM_FSM_ENT_FLAG_READY   0x02  /* Instance is on the ready list      */
+#define CM_FSM_ENT_FLAG_TMO     0x04  /* State timed out, TIMEOUT column due */
+#define CM_FSM_ENT_FLAG_WAIT    0x08  /* Output function suspended          */
+#define CM_FSM_ENT_FLAG_WAKE    0x10  /* State timer armed to the wait deadline */
+
+/* Output function return: suspended, resume at the saved point later */
+#define CM_FSM_SUSPEND     (1)
+
+/*
+ * Suspendable output functions, stackless: locals do not survive a
+ * suspension, keep what is needed after it in the context. The output
+ * function reruns from its last wait point on every later pass (polling
+ * mode) or posted event/wake-up (event mode) until it returns anything
+ * but CM_FSM_SUSPEND. No transition is taken while it is suspended, a
+ * state timeout aborts it and runs the TIMEOUT column.
+ *
+ *   CM_FSM_CO_BEGIN(ent);
+ *   ...
+ *   CM_FSM_CO_WAIT_UNTIL(ent, keyReady(ctx), &ctx->gate);
+ *   ...
+ *   CM_FSM_CO_END(ent);
+ */
+#define CM_FSM_CO_BEGIN(ent)  switch ((ent)->coPt) { case 0:
+#define CM_FSM_CO_END(ent)    }
+
+/* Suspend until cond holds or the deadline (CmTimeNs *, NULL for none) passes */
+#define CM_FSM_CO_WAIT_UNTIL(ent, cond, deadline)                       \
+    do {                                                                \
+        (ent)->coPt = __LINE__;                                         \
+        case __LINE__:                                                  \
+        if (!(cond) && cmFsmInstWait((ent), (deadline)) == CM_FSM_SUSPEND) \
+            return CM_FSM_SUSPEND;                                      \
+    } while (0)
+
+/* Batch mode */
+#define CM_FSM_BATCH_IDLE      (0xFFFF)  /* batchState of a stopped instance   */
+#define CM_FSM_BATCH_CHUNK     (256)     /* Instances grouped together by state */
+
+/* EDF mode */
+#define CM_FSM_EDF_NO_DEADLINE (1ULL << 63)  /* Key base of instances without deadline */
+#define CM_FSM_EDF_CHECK       (16)          /* Instances run between two clock reads */
+#define CM_FSM_EDF_SLACK       CM_TIME_FROM_MS(CM_TMR_TICK_MS) /* Lateness not counted as a miss */
+
+/* Checkpoint image */
+#define CM_FSM_CKPT_MAGIC     (0x464D5343)  /* "CSMF" */
+#define CM_FSM_CKPT_VERSION   (2)
+#define CM_FSM_CKPT_ALIGN     (64)          /* Record alignment in the image */
+#define CM_FSM_CKPT_NO_TMR    (0xFFFFFFFF)  /* remainMs: state without timer  */
+#define CM_FSM_CKPT_PERIOD    CM_TIME_FROM_SEC(1)  /* Longest age of an unchanged image */
+
+/* Context of record i in a restored image */
+#define CM_FSM_IMAGE_CTX(img, i)                                        \
+    ((void *)((U8 *)(img)->base + sizeof(CmFsmCkptHdr) +                \
+              (size_t)(i) * (img)->stride + sizeof(CmFsmCkptRec)))
+
+/* Control point lock, only taken once an executor made it multi-threaded */
+#define CM_FSM_CP_LOCK(cp)                                              \
+    do {                                                                \
+        if ((cp)->mtSafe)                                               \
+            while (__atomic_test_and_set(&(cp)->lock, __ATOMIC_ACQUIRE)) ; \
+    } while (0)
+#define CM_FSM_CP_UNLOCK(cp)                                            \
+    do {                                                                \
+        if ((cp)->mtSafe)                                               \
+            __atomic_clear(&(cp)->lock, __ATOMIC_RELEASE);              \
+    } while (0)
+
+/* Matrix column of an event, events start from CM_FSM_CTRL_NORMAL */
+#define CM_FSM_EVT_COL(evt) ((evt) - CM_FSM_CTRL_NORMAL)
+
 #define CM_FSM_GET_CONTEXT(ent) ((void *)((U8 *)ent - ent->fsmCp->offset))
 #define GET_FSM_ENT_FROM_CONTEXT(fsmCp, context) ((CmFsmEntity *)((U8 *)context + fsmCp->offset))
 #define GET_CONTEXT_FROM_FSM_ENT(fsmEnt) ((void *)((U8 *)fsmEnt - fsmEnt->fsmCp->offset))
@@ -48,17 +135,27 @@
 */
 typedef S16 (*CmFsmFp)(void *outputFn, void *context);
 
+/* Typed dispatcher running the output function of a matrix cell, see CommonFsmGen.h */
+typedef S16 (*CmFsmDispFn)(void *context, U16 state, U16 col);
+
 enum
 {
     CM_FSM_CTRL_NORMAL = 1,
     CM_FSM_CTRL_TIMEOUT,
-    CM_FSM_CTRL_MAX = CM_FSM_CTRL_TIMEOUT
+    CM_FSM_CTRL_MAX = CM_FSM_CTRL_TIMEOUT,
+    CM_FSM_EVT_USER             /* First application event in event mode */
 };
 
+typedef struct cmFsmEvt
+{
+    U16   eventId;  /* CM_FSM_CTRL_xxx or application event */
+    void  *payload; /* Event data, owned by the poster       */
+} CmFsmEvt;
+
 typedef struct cmFsmEntry
 {
     void *outputFn;
-    U8    nextState;
+    U16   nextState;
 } CmFsmEntry;
 
 typedef struct cmFsmStatDesc
@@ -68,27 +165,112 @@ typedef struct cmFsmStatDesc
 } CmFsmStatDesc;
 
 typedef struct cmFsmCp CmFsmCp;
+typedef struct cmFsmSparse CmFsmSparse;   /* see CommonFsmSparse.h */
+
+typedef struct cmFsmCkptHdr
+{
+    U32  magic;       /* CM_FSM_CKPT_MAGIC                  */
+    U16  version;     /* CM_FSM_CKPT_VERSION                */
+    U16  numStates;
+    U32  ctxSize;     /* Instance context size              */
+    U32  offset;      /* CmFsmEntity offset in the context  */
+    U32  stride;      /* Record size, CM_FSM_CKPT_ALIGN aligned */
+    U32  numInst;     /* Records following the header       */
+    U32  entSize;     /* sizeof(CmFsmEntity) of the writer  */
+    S8   fsmStr[CM_FSM_ID_STR_LEN];
+} __attribute__((aligned(CM_FSM_CKPT_ALIGN))) CmFsmCkptHdr;
+
+/* Record header, the instance context follows as is */
+typedef struct cmFsmCkptRec
+{
+    U32  remainMs;    /* State timer left, CM_FSM_CKPT_NO_TMR if none */
+    U32  reserved[3];
+} CmFsmCkptRec;
+
+/* Checkpoint image mapped by cmFsmRestore(), holds the restored contexts */
+typedef struct cmFsmImage
+{
+    void    *base;
+    size_t  len;
+    U32     stride;
+    U32     numInst;
+} CmFsmImage;
 
 typedef struct cmFsmEntity
 {
     S8        instName[CM_FSM_INST_STR_LEN]; /* FSM name string, used for logging */
     U16       lastState;   /* last FSM instance state    */
     U16       state;       /* current FSM instance state */
-    TIMESTAMP timestamp;  /* FSM creation time          */
+    CmTimeNs  timestamp;   /* State deadline, monotonic ns */
     U32       timeout;     /* Timeout for this state, 0 for infinite */
     U32       fsmCnt;      /* FSM execution count, used for logging  */
+    U32       poolIdx;     /* Slot index in the control point pool   */
+    U64       enterUs;     /* Current state entered, monotonic us    */
+    U8        flags;       /* CM_FSM_ENT_FLAG_xxx                    */
+    U8        evtHead;     /* First pending event in evtQ            */
+    U8        evtCnt;      /* Number of pending events               */
+    U16       coPt;        /* Resume point of a suspended output function */
+    U16       coRow;       /* Matrix cell of the suspended output function */
+    U16       coCol;
+    CmFsmEvt  curEvt;      /* Event being processed                  */
+    CmFsmEvt  evtQ[CM_FSM_EVT_QUEUE_LEN]; /* Pending event ring      */
+    struct cmFsmEntity *readyNext;   /* Ready list link              */
+    CmTmrNode tmrNode;     /* State timer in the control point wheel */
     CmFsmCp   *fsmCp;
 } CmFsmEntity;
 
+/* Runnable instance in the EDF heap */
+typedef struct cmFsmEdfNode
+{
+    CmTimeNs     key;      /* State deadline, or CM_FSM_EDF_NO_DEADLINE + last run pass */
+    CmFsmEntity  *fsmEnt;
+} CmFsmEdfNode;
+
+/* Earliest deadline first run queue of a pooled control point */
+typedef struct cmFsmEdf
+{
+    CmFsmEdfNode *heap;      /* Min-heap on key, rebuilt every pass      */
+    U64          *lastRun;   /* Pass each pool slot last ran in          */
+    CmTimeNs     budget;     /* Run time of one pass, 0 for unlimited    */
+    U64          passCnt;    /* Driver passes                            */
+    U64          runCnt;     /* Instances run                            */
+    U64          deferCnt;   /* Instances deferred to a later pass       */
+    U64          overCnt;    /* Passes that ran out of budget            */
+    U64          missCnt;    /* Instances run past deadline + slack      */
+    CmTimeNs     lateMax;    /* Worst lateness of a run (ns)             */
+} CmFsmEdf;
+
 typedef struct cmFsmCp
 {
     S8              fsmStr[CM_FSM_ID_STR_LEN];
     CmFsmFp         fsmFp;       /* Save the function pointer */
+    CmFsmDispFn     dispFn;      /* Generated dispatcher, NULL to use fsmFp */
     U32             offset;      /* offset of entity in FSM context */
-    U8              numStates;
+    U16             numStates;
+    U8              mode;        /* CM_FSM_MODE_xxx         */
+    bool            mtSafe;      /* Instances run on several threads */
+    bool            lock;        /* Guards wheel, ready list, queues and counters */
+    U16             numCols;     /* Columns of fsmMt        */
     CmFsmStatDesc   *states;
     CmFsmEntry      *fsmMt;      /* FSM state matrix        */
+    const CmFsmSparse *sparse;   /* Compressed table, replaces fsmMt */
     CmFsmEntity     *fsmEnt;     /* Point to the FSM entity */
+    CmFsmEntity     **entPool;   /* Instance pool, NULL for single instance */
+    U32             maxInst;     /* Instance pool capacity  */
+    U32             numInst;     /* Instances in the pool   */
+    U32             numActive;   /* Runnable instances      */
+    U32             numWaiting;  /* Instances with a suspended output function */
+    U32             evtDropCnt;  /* Events dropped on full queues */
+    CmFsmEntity     *readyHead;  /* Instances with pending events */
+    CmFsmEntity     *readyTail;
+    U16             *batchState; /* State of each pool slot, batch mode  */
+    CmFsmEntity     **batchEnts; /* Chunk of instances grouped by state  */
+    U32             *batchEnd;   /* End of each state group in batchEnts */
+    CmFsmEdf        *edf;        /* EDF run queue, NULL for pool order   */
+    CmTmrWheel      tmrWheel;    /* State timers of all the instances */
+    U64             chgCnt;      /* States entered, outputs ended, stops */
+    U64             ckptChgCnt;  /* chgCnt saved by the last checkpoint  */
+    CmTimeNs        ckptTs;      /* Time of the last checkpoint, 0 none  */
 } CmFsmCp;
 
 /**
@@ -114,12 +296,117 @@ S16 cmFsmInstInit(
     U16      initState    /* initial state for this FSM instance */
 );
 
+S16 cmFsmCpEvtInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    U16      numCols      /* matrix columns, NORMAL, TIMEOUT then user events */
+);
+
+S16 cmFsmCpSetSparse(
+    CmFsmCp            *fsmCp,   /* FSM control point */
+    const CmFsmSparse  *sparse   /* compressed table, NULL for fsmMt */
+);
+
+S16 cmFsmCpSetDispatch(
+    CmFsmCp      *fsmCp,    /* FSM control point */
+    CmFsmDispFn  dispFn     /* generated dispatcher, NULL for fsmFp */
+);
+
+S16 cmFsmPostEvent(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    U16         eventId,  /* CM_FSM_CTRL_NORMAL or application event */
+    void        *payload  /* event data */
+);
+
+S16 cmFsmInstWait(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    CmTimeNs    *deadline /* monotonic wake-up deadline, NULL for none */
+);
+
+S16 cmFsmInstWake( CmFsmEntity *fsmEnt );
+
+S16 cmFsmGetEvent(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    U16         *eventId, /* event being processed */
+    void        **payload /* event data */
+);
+
+S16 cmFsmCpPoolInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    U32      maxInst      /* maximum instances driven by this CP */
+);
+
+S16 cmFsmCpBatchInit( CmFsmCp *fsmCp );
+
+S16 cmFsmCpEdfInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    U32      budgetUs     /* run time of one driver pass, 0 for unlimited */
+);
+
+void cmFsmEdfDumpStats( CmFsmCp *fsmCp );
+
+void cmFsmCpDeinit( CmFsmCp *fsmCp );
+
+S16 cmFsmCheckpoint(
+    CmFsmCp    *fsmCp,    /* FSM control point */
+    const S8   *path,     /* image file */
+    U32        ctxSize    /* instance context size */
+);
+
+bool cmFsmCheckpointDue( CmFsmCp *fsmCp, CmTimeNs tsNow );
+
+S16 cmFsmRestore(
+    CmFsmCp    *fsmCp,    /* FSM control point, no instance yet */
+    const S8   *path,     /* image file */
+    U32        ctxSize    /* instance context size */,
+    CmFsmImage *image     /* mapped image, contexts in place */
+);
+
+void cmFsmImageRelease( CmFsmImage *image );
+
+S16 cmFsmInstDeinit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    void     *context     /* user context for FSM instance */
+);
+
+void *cmFsmInstAlloc(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    CmSlab   *slab,       /* context slab */
+    S8       *instName,   /* instance name */
+    U16      initState    /* initial state for this FSM instance */
+);
+
+S16 cmFsmInstFree(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    CmSlab   *slab,       /* context slab */
+    void     *context     /* context from cmFsmInstAlloc() */
+);
+
 S16 cmFsmSetState(
     CmFsmCp  *fsmCp,      /* FSM control point */
     U16      state        /* new state */
 );
 
+S16 cmFsmInstSetState(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    U16         state     /* new state */
+);
+
+S16 cmFsmGetState(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    void     *context,    /* user context for FSM instance */
+    U16      *state,      /* state to be returned */
+    U16      *lastState   /* last state to be returned */
+);
+
 S16 cmFsmDriver( CmFsmCp *fsmCp );
+S32 cmFsmDriverAll( CmFsmCp *fsmCp );
+S16 cmFsmNextDeadline( CmFsmCp *fsmCp, CmTimeNs *deadline );
+
+/* Building blocks for executors running the instances on other threads */
+S16  cmFsmInstStep( CmFsmEntity *fsmEnt, CmTimeNs tsNow );
+void cmFsmCollectTmrs( CmFsmCp *fsmCp, CmTimeNs tsNow );
+U32  cmFsmTakeReady( CmFsmCp *fsmCp, CmFsmEntity **ents, U32 maxEnts );
 U32 cmFsmCheckTmr( CmFsmCp *fsmCp );
+U32 cmFsmInstCheckTmr( CmFsmEntity *fsmEnt, CmTimeNs tsNow );
 
 #endif
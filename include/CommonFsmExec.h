@@ -0,0 +1,96 @@
+/*
+ * \file Name: CommonFsmExec.h
+ *
+ * \brief Multi-threaded executor for FSM instance pools
+ *
+ * \details
+ * The runnable instances of one pass are split into per-worker deques.
+ * A worker runs its own deque from the bottom and, once empty, steals
+ * from the top of the other workers' deques, so long running instances
+ * do not leave the other cores idle. One instance is never run by two
+ * workers at the same time. Output functions run on the workers and
+ * must change states with cmFsmInstSetState(), fsmCp->fsmEnt is not
+ * meaningful while the executor runs.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_FSM_EXEC_H
+#define _COMMON_FSM_EXEC_H
+
+#include <pthread.h>
+#include "CommonInc.h"
+#include "CommonFsm.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_FSM_EXEC_MAX_WORKERS  (64)
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+struct cmFsmExec;
+
+/* Work-stealing deque, filled before a pass and only drained during it */
+typedef struct cmFsmExecWorker
+{
+    pthread_t         tid;
+    U32               id;
+    struct cmFsmExec  *exec;
+    CmFsmEntity       **tasks;    /* Deque storage, maxInst entries     */
+    volatile S64      top;        /* Steal end, advanced by thieves (CAS) */
+    volatile S64      bottom;     /* Owner end                           */
+    U64               runCnt;     /* Instances stepped                   */
+    U64               stealCnt;   /* Instances stolen from other workers */
+    U64               busyUs;     /* Time spent running passes (us)      */
+} __attribute__((aligned(64))) CmFsmExecWorker;
+
+typedef struct cmFsmExec
+{
+    CmFsmCp          *fsmCp;
+    U32              numWorkers;
+    CmFsmExecWorker  *workers;
+    CmFsmEntity      **ready;     /* Event mode ready list snapshot */
+    pthread_mutex_t  mutex;
+    pthread_cond_t   startCond;   /* New pass or quit               */
+    pthread_cond_t   doneCond;    /* Last worker finished the pass  */
+    U64              passId;
+    U32              numRunning;  /* Workers still in the pass      */
+    bool             quit;
+    CmTimeNs         tsNow;       /* Clock of the current pass      */
+    CmTimeNs         tsStart;     /* Executor start, for busy ratio */
+} CmFsmExec;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+S16 cmFsmExecInit(
+    CmFsmExec  *exec,        /* executor */
+    CmFsmCp    *fsmCp,       /* control point with an instance pool */
+    U32        numWorkers    /* worker threads */
+);
+
+S32  cmFsmExecDriverAll( CmFsmExec *exec );
+void cmFsmExecDumpStats( CmFsmExec *exec );
+void cmFsmExecDeinit( CmFsmExec *exec );
+
+#endif
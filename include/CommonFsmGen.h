@@ -0,0 +1,148 @@
+/*
+ * \file Name: CommonFsmGen.h
+ *
+ * \brief X-macro generator for static FSM definitions
+ *
+ * \details
+ * An FSM known at compile time is written once as two X-macro lists:
+ *
+ *   #define MY_FSM_STATES(S)  S(ST_IDLE, 0) S(ST_WAIT, 5000) S(ST_DONE, 0)
+ *   #define MY_FSM_TRANS(T)                                     \
+ *       T(ST_IDLE, CM_FSM_CTRL_NORMAL,  myStart,   ST_WAIT)      \
+ *       T(ST_WAIT, CM_FSM_CTRL_TIMEOUT, myTimeout, ST_DONE)
+ *
+ *   CM_FSM_GEN_DEFINE(myFsm, MY_CTX_t, ST_DONE, CM_FSM_CTRL_MAX,
+ *                     MY_FSM_STATES, MY_FSM_TRANS)
+ *
+ * which emits myFsmDesc[] (CmFsmStatDesc), myFsmMt[][] (CmFsmEntry),
+ * myFsmMtInit() filling the matrix, and myFsmDisp(), a switch calling
+ * the output functions with their real context type. Output functions
+ * are type checked against S16 fn(MY_CTX_t *) and, when defined in the
+ * same file, inlined into the switch. Register the dispatcher with
+ * cmFsmCpSetDispatch() after cmFsmCpInit(myFsmDesc, myFsmMt).
+ *
+ * Every listed transition has an output function. Cells not listed
+ * have no output function and no transition. Dynamic FSMs keep using
+ * hand written matrices and the fsmFp wrapper.
+ *
+ * FSMs with many states and columns use CM_FSM_GEN_DEFINE_SPARSE()
+ * instead, with the same lists. It emits myFsmDesc[], myFsmTrans[] (the
+ * transition list), myFsmSparseInit() building the compressed table of
+ * CommonFsmSparse.h, and myFsmDisp(). Give the table to
+ * cmFsmCpSetSparse() after cmFsmCpInit(myFsmDesc, NULL).
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_FSM_GEN_H
+#define _COMMON_FSM_GEN_H
+
+#include "CommonFsm.h"
+#include "CommonFsmSparse.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+/* Switch key of a matrix cell */
+#define CM_FSM_GEN_KEY(state, col)  (((U32)(state) << 16) | (U32)(col))
+
+/* S(state, timeout) -> CmFsmStatDesc entry */
+#define CM_FSM_GEN_DESC_ENTRY(state, timeout)  { #state, (timeout) },
+
+/* T(state, event, outputFn, nextState) -> matrix cell assignment */
+#define CM_FSM_GEN_MT_ENTRY(state, event, fn, next)                     \
+    cm_genMt[(state) * cm_genCols + CM_FSM_EVT_COL(event)].outputFn =   \
+        (void *)(fn);                                                   \
+    cm_genMt[(state) * cm_genCols + CM_FSM_EVT_COL(event)].nextState =  \
+        (next);
+
+/* T(state, event, outputFn, nextState) -> CmFsmTrans entry */
+#define CM_FSM_GEN_TRANS_ENTRY(state, event, fn, next)                  \
+    { (state), CM_FSM_EVT_COL(event), (void *)(fn), (next) },
+
+/* T(state, event, outputFn, nextState) -> typed dispatcher case */
+#define CM_FSM_GEN_CASE(state, event, fn, next)                         \
+    case CM_FSM_GEN_KEY(state, CM_FSM_EVT_COL(event)):                  \
+        return fn(cm_genCtx);
+
+/* Emit the typed dispatcher */
+#define CM_FSM_GEN_DISP(name, ctxType, TRANS)                               \
+    S16 name##Disp(void *context, U16 state, U16 col)                       \
+    {                                                                       \
+        ctxType *cm_genCtx = (ctxType *)context;                            \
+                                                                            \
+        switch (CM_FSM_GEN_KEY(state, col))                                 \
+        {                                                                   \
+            TRANS(CM_FSM_GEN_CASE)                                          \
+        default:                                                            \
+            break;                                                          \
+        }                                                                   \
+        SLOGERR("FSM " #name " has no output in state %d column %d",       \
+                state, col);                                                \
+        return FAILURE;                                                     \
+    }
+
+/* Emit the state table, matrix, matrix init and typed dispatcher */
+#define CM_FSM_GEN_DEFINE(name, ctxType, numStates, numCols, STATES, TRANS) \
+    CmFsmStatDesc name##Desc[] = { STATES(CM_FSM_GEN_DESC_ENTRY) };         \
+    CmFsmEntry    name##Mt[(numStates)+1][numCols];                         \
+                                                                            \
+    void name##MtInit(void)                                                 \
+    {                                                                       \
+        CmFsmEntry *cm_genMt = &name##Mt[0][0];                             \
+        const U32  cm_genCols = (numCols);                                  \
+        U32        cm_genIdx;                                               \
+                                                                            \
+        for (cm_genIdx = 0; cm_genIdx < ((numStates)+1) * cm_genCols;       \
+             cm_genIdx++)                                                   \
+        {                                                                   \
+            cm_genMt[cm_genIdx].outputFn  = NULL;                           \
+            cm_genMt[cm_genIdx].nextState = CM_FSM_STATE_NONE;              \
+        }                                                                   \
+        TRANS(CM_FSM_GEN_MT_ENTRY)                                          \
+    }                                                                       \
+                                                                            \
+    CM_FSM_GEN_DISP(name, ctxType, TRANS)
+
+/* Emit the state table, transition list, compressed table init and dispatcher */
+#define CM_FSM_GEN_DEFINE_SPARSE(name, ctxType, numStates, numCols, STATES, TRANS) \
+    CmFsmStatDesc    name##Desc[]  = { STATES(CM_FSM_GEN_DESC_ENTRY) };     \
+    const CmFsmTrans name##Trans[] = { TRANS(CM_FSM_GEN_TRANS_ENTRY) };     \
+                                                                            \
+    S16 name##SparseInit(CmFsmSparse *sp)                                   \
+    {                                                                       \
+        return cmFsmSparseInit(sp, (numStates)+1, (numCols), name##Trans,   \
+                               sizeof(name##Trans) / sizeof(CmFsmTrans));   \
+    }                                                                       \
+                                                                            \
+    CM_FSM_GEN_DISP(name, ctxType, TRANS)
+
+/* Prototypes of the objects emitted by CM_FSM_GEN_DEFINE() */
+#define CM_FSM_GEN_DECLARE(name, numStates, numCols)                        \
+    extern CmFsmStatDesc name##Desc[];                                      \
+    extern CmFsmEntry    name##Mt[(numStates)+1][numCols];                  \
+    void name##MtInit(void);                                                \
+    S16  name##Disp(void *context, U16 state, U16 col);
+
+/* Prototypes of the objects emitted by CM_FSM_GEN_DEFINE_SPARSE() */
+#define CM_FSM_GEN_DECLARE_SPARSE(name)                                     \
+    extern CmFsmStatDesc    name##Desc[];                                   \
+    extern const CmFsmTrans name##Trans[];                                  \
+    S16  name##SparseInit(CmFsmSparse *sp);                                 \
+    S16  name##Disp(void *context, U16 state, U16 col);
+
+#endif
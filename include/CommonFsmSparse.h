@@ -0,0 +1,142 @@
+/*
+ * \file Name: CommonFsmSparse.h
+ *
+ * \brief Compressed transition table for large FSMs
+ *
+ * \details
+ * A dense matrix costs numStates x numCols cells even when most states
+ * only react to a few events. The compressed table keeps one default
+ * cell per row, the most frequent cell of that row, and a list of the
+ * cells differing from it sorted by column. Cells are 4 bytes: an index
+ * into the table of distinct output functions and the next state.
+ *
+ * Short exception lists are scanned, longer ones are bisected first, so
+ * a lookup touches the row offsets, a few packed columns and one cell.
+ * All the arrays live in one allocation.
+ *
+ * Build a table from a transition list with cmFsmSparseInit(), or from
+ * an existing dense matrix with cmFsmSparseFromDense(), then give it to
+ * cmFsmCpInitSparse() instead of a matrix.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_FSM_SPARSE_H
+#define _COMMON_FSM_SPARSE_H
+
+#include "CommonInc.h"
+#include "CommonFsm.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_FSM_SPARSE_SCAN    (8)       /* Exceptions scanned without bisecting */
+#define CM_FSM_SPARSE_NO_FN   (0)       /* fnIdx of cells without output function */
+#define CM_FSM_SPARSE_MAX_FN  (0xFFFF)  /* Distinct output functions per table    */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* One listed transition */
+typedef struct cmFsmTrans
+{
+    U16   state;
+    U16   col;        /* Matrix column, see CM_FSM_EVT_COL() */
+    void  *outputFn;
+    U16   nextState;  /* CM_FSM_STATE_NONE for no transition */
+} CmFsmTrans;
+
+typedef struct cmFsmSparseCell
+{
+    U16   fnIdx;      /* Output function in fnTab */
+    U16   nextState;
+} CmFsmSparseCell;
+
+/* CmFsmSparse, declared in CommonFsm.h */
+struct cmFsmSparse
+{
+    U16              numRows;
+    U16              numCols;
+    U32              numFn;     /* Distinct output functions, fnTab[0] is NULL */
+    U32              numExc;    /* Cells differing from their row default      */
+    U32              *rowStart; /* Exceptions of row r: [rowStart[r], rowStart[r+1]) */
+    CmFsmSparseCell  *rowDef;   /* Default cell of each row                    */
+    U16              *excCol;   /* Exception columns, ascending within a row   */
+    CmFsmSparseCell  *excCell;  /* Exception cells                             */
+    void             **fnTab;   /* Output functions                            */
+    void             *mem;      /* The single allocation behind the arrays     */
+    size_t           memLen;
+};
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+S16 cmFsmSparseInit(
+    CmFsmSparse       *sp,       /* table to build */
+    U16               numRows,   /* states, including the final one */
+    U16               numCols,   /* columns, NORMAL, TIMEOUT then user events */
+    const CmFsmTrans  *trans,    /* listed transitions */
+    U32               numTrans   /* number of listed transitions */
+);
+
+S16 cmFsmSparseFromDense(
+    CmFsmSparse       *sp,       /* table to build */
+    const CmFsmEntry  *fsmMt,    /* dense matrix, numRows x numCols */
+    U16               numRows,
+    U16               numCols
+);
+
+void cmFsmSparseDeinit( CmFsmSparse *sp );
+void cmFsmSparseDumpStats( CmFsmSparse *sp );
+
+INLINE const CmFsmSparseCell *cmFsmSparseGet(
+    const CmFsmSparse *sp, U16 row, U16 col) __attribute__((always_inline));
+
+/**
+ * Inline function to look up one cell
+ * @param: sp  - compressed table
+ * @param: row - state, below numRows
+ * @param: col - column, below numCols
+ * @return: the cell
+ */
+INLINE const CmFsmSparseCell *cmFsmSparseGet(const CmFsmSparse *sp, U16 row, U16 col)
+{
+    const U16 *cols = sp->excCol;
+    U32       lo = sp->rowStart[row], hi = sp->rowStart[row + 1], mid;
+
+    while (hi - lo > CM_FSM_SPARSE_SCAN)
+    {
+        mid = (lo + hi) >> 1;
+        if (cols[mid] > col)
+            hi = mid;
+        else
+            lo = mid;
+    }
+
+    for (; lo < hi; lo++)
+    {
+        if (cols[lo] == col)
+            return &sp->excCell[lo];
+    }
+    return &sp->rowDef[row];
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * \file Name: CommonFsmTrace.h
+ *
+ * \brief Binary FSM transition trace
+ *
+ * \details
+ * Every state change is written as one fixed size record into a ring
+ * owned by the calling thread, no formatting and no lock on the FSM
+ * path. A background aggregator drains the rings and keeps per-state
+ * dwell time histograms and per-transition counts, which are logged by
+ * cmFsmTraceDump(). Records are dropped and counted when a ring is full.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_FSM_TRACE_H
+#define _COMMON_FSM_TRACE_H
+
+#include "CommonInc.h"
+#include "CommonFsm.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_FSM_TRACE_RING_LEN    (8192)  /* Records per thread, power of 2   */
+#define CM_FSM_TRACE_MAX_CP      (8)     /* Control points aggregated        */
+#define CM_FSM_TRACE_MAX_STATES  (32)    /* States aggregated per CP         */
+#define CM_FSM_TRACE_HIST_BKTS   (32)    /* Dwell buckets, [2^(i-1), 2^i) us */
+#define CM_FSM_TRACE_AGG_MS      (100)   /* Aggregator period                */
+
+#define CM_FSM_TRACE_COL_SET     (0xFFFF) /* Record column of cmFsmInstSetState() */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+typedef struct cmFsmTraceRec
+{
+    U64          tsUs;      /* Transition time, monotonic us */
+    U64          dwellUs;   /* Time spent in the from state  */
+    CmFsmCp      *fsmCp;    /* Control point of the instance, the
+                             * instance may be freed before aggregation */
+    U16          from;
+    U16          to;
+    U16          col;       /* Matrix column or CM_FSM_TRACE_COL_SET */
+} CmFsmTraceRec;
+
+typedef struct cmFsmTraceRing
+{
+    volatile U32           tail __attribute__((aligned(64)));  /* Recording thread */
+    U64                    dropCnt;
+    volatile U32           head __attribute__((aligned(64)));  /* Aggregator       */
+    struct cmFsmTraceRing  *next;                              /* Registered rings */
+    CmFsmTraceRec          recs[CM_FSM_TRACE_RING_LEN];
+} CmFsmTraceRing;
+
+typedef struct cmFsmTraceStateStat
+{
+    U64  enterCnt;
+    U64  exitCnt;
+    U64  dwellSumUs;
+    U64  dwellMaxUs;
+    U64  hist[CM_FSM_TRACE_HIST_BKTS];
+} CmFsmTraceStateStat;
+
+typedef struct cmFsmTraceCpStat
+{
+    CmFsmCp              *fsmCp;
+    U64                  firstUs;     /* First record aggregated   */
+    U64                  lastUs;      /* Latest record aggregated  */
+    U64                  peakRate;    /* Busiest aggregator period, per second */
+    CmFsmTraceStateStat  states[CM_FSM_TRACE_MAX_STATES];
+    U64                  trans[CM_FSM_TRACE_MAX_STATES][CM_FSM_TRACE_MAX_STATES];
+} CmFsmTraceCpStat;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+S16  cmFsmTraceInit( void );
+void cmFsmTraceRecord(
+    CmFsmEntity *fsmEnt,   /* FSM instance */
+    U16         from,      /* left state */
+    U16         to,        /* entered state */
+    U16         col,       /* matrix column or CM_FSM_TRACE_COL_SET */
+    CmTimeNs    tsNow      /* transition time */
+);
+void cmFsmTraceDump( void );
+void cmFsmTraceDeinit( void );
+
+#endif
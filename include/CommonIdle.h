@@ -0,0 +1,94 @@
+/*
+ * \file Name: CommonIdle.h
+ *
+ * \brief Idle strategies for the driver loops
+ *
+ * \details
+ * A driver loop with nothing to run waits for its next deadline or for
+ * one watched file descriptor to become readable. The waiting can spin,
+ * spin then yield the CPU, or block in epoll on a timerfd armed to the
+ * deadline. The wake-up latency on deadlines is measured per context.
+ * In simulation the deadline is never waited for, the virtual clock of
+ * CommonClock.h jumps to it instead.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_IDLE_H
+#define _COMMON_IDLE_H
+
+#include "CommonInc.h"
+#include "CommonClock.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_IDLE_SPIN_DEFAULT  (1000)  /* Spins before yielding the CPU */
+
+/* cmIdleWait() wake-up reasons */
+#define CM_IDLE_WAKE_FD   1  /* Watched descriptor readable */
+#define CM_IDLE_WAKE_TMR  2  /* Deadline reached            */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+typedef enum CM_IDLE_STRATEGY_TAG
+{
+    CM_IDLE_SPIN = 0,   /* Busy poll, for dedicated cores          */
+    CM_IDLE_YIELD,      /* Busy poll then sched_yield()            */
+    CM_IDLE_BLOCK,      /* Block in epoll until deadline or fd     */
+    CM_IDLE_SIM,        /* Virtual clock, jump to the deadline     */
+    CM_IDLE_MAX
+} CM_IDLE_STRATEGY_t;
+
+typedef struct cmIdleCtx
+{
+    CM_IDLE_STRATEGY_t strategy;
+    U32   spinCnt;      /* Spins before yielding, CM_IDLE_YIELD only  */
+    S32   watchFd;      /* Descriptor waited for, -1 for none         */
+    bool  watchPoll;    /* watchFd cannot be polled, always readable  */
+    S32   epFd;         /* epoll descriptor, CM_IDLE_BLOCK only       */
+    S32   tmrFd;        /* timerfd armed to the deadline              */
+    U64   wakeCnt;      /* Deadline wake-ups measured                 */
+    U64   latSumUs;     /* Sum of wake-up latencies (us)              */
+    U64   latMaxUs;     /* Worst wake-up latency (us)                 */
+} CmIdleCtx;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+S16 cmIdleInit(
+    CmIdleCtx          *idle,     /* idle context */
+    CM_IDLE_STRATEGY_t strategy,  /* CM_IDLE_xxx  */
+    S32                watchFd    /* descriptor to wait for, -1 for none */
+);
+
+void cmIdleDeinit( CmIdleCtx *idle );
+
+S32 cmIdleWait(
+    CmIdleCtx  *idle,     /* idle context */
+    CmTimeNs   *deadline  /* monotonic deadline, NULL for none */
+);
+
+S16 cmIdleStrToStrategy( const S8 *str, CM_IDLE_STRATEGY_t *strategy );
+void cmIdleDumpStats( CmIdleCtx *idle );
+
+#endif
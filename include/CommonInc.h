@@ -143,27 +143,18 @@ INLINE S32 SCharIncluded(const S8 chr,const S8 *str)  __attribute__((always_inli
 
 /**
  * Inline function to get monotonic time
+ * Legacy split time, the FSM and idle code use cmTimeNow() of
+ * CommonClock.h
  * @param: tv - output timestamp
  * @return: None
  */
 INLINE void SGetMonotonicTime(TIMESTAMP *tv)
 {
     struct timespec ts;
-    int retval = FAILURE;
-  
-    memset(tv,0,sizeof(TIMESTAMP));
 
-    retval = clock_gettime(CLOCK_MONOTONIC, &ts);
-    if(retval < 0)
-    {
-        retval = errno;
-        SLOGERR("Failed to call clock_gettime (%s)",strerror(retval));
-        return;
-     }
-
-     tv->uiSeconds      = ts.tv_sec;
-     tv->uiMicroseconds = ts.tv_nsec / 1000;
-     return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tv->uiSeconds      = ts.tv_sec;
+    tv->uiMicroseconds = ts.tv_nsec / 1000;
 }
 
 /**
@@ -198,15 +189,16 @@ INLINE U32 SCompareTimeStamp(TIMESTAMP *tsNow, TIMESTAMP *tsCmp)
 }
 
 /**
- * Inline function to add micro seconds onto the time stamp
+ * Inline function to add milliseconds onto the time stamp
  * @param: ts - the target time stamp
- * @param: ms - the micro seconds to add
- * @return: SUCCESS
+ * @param: ms - the milliseconds to add
+ * @return: None
  */
 INLINE void SAddMsToTimeStamp(TIMESTAMP *ts, U32 ms)
 {
-    ts->uiSeconds += ((ms + 500) / 1000);    
-    ts->uiMicroseconds +=  ms % 1000;
+    ts->uiMicroseconds += (ms % 1000) * 1000;
+    ts->uiSeconds      += ms / 1000 + ts->uiMicroseconds / 1000000;
+    ts->uiMicroseconds %= 1000000;
     return;
 }
 
@@ -218,7 +210,9 @@ INLINE void SAddMsToTimeStamp(TIMESTAMP *ts, U32 ms)
  */
 INLINE void dumpTimeStamp(TIMESTAMP *ts)
 {
-    SLOGINFO("TS DATA: %d %d", ts->uiSeconds, ts->uiMicroseconds);
+    /* No SLOGxxx call site here, its static descriptor can not be inline */
+    sl_LogSysMsg(LOG_INFO, LOG_TYPE_INFO, __FILE__, __FUNCTION__, __LINE__,
+                 "TS DATA: %d %d", ts->uiSeconds, ts->uiMicroseconds);
 }
 /**
  * Inline function to check if the char in list
@@ -0,0 +1,148 @@
+/*
+ * \file Name: CommonShard.h
+ *
+ * \brief Shared-nothing per-core shards
+ *
+ * \details
+ * A shard group runs one pinned thread per shard. Each shard owns its
+ * sessions, its FSM control point (instances and state timers) and its
+ * idle context; nothing of it is touched by the other threads. Shards
+ * only talk through messages carried by single producer single consumer
+ * rings, one ring per (source, destination) pair, so posting from a
+ * shard needs no lock and no atomic read-modify-write. The threads
+ * outside the shards share one external ring per destination, their
+ * pushes are serialized by a lock of that shard. Sessions are placed on
+ * a shard by key, see CM_SHARD_OF_KEY().
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_SHARD_H
+#define _COMMON_SHARD_H
+
+#include <pthread.h>
+#include "CommonInc.h"
+#include "CommonFsm.h"
+#include "CommonIdle.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_SHARD_MAX           (64)
+#define CM_SHARD_RING_DEFAULT  (1024)   /* Messages per ring, power of 2 */
+#define CM_SHARD_EXTERNAL      (-1)     /* cmShardSelf() off the shard threads */
+
+/* Home shard of a session key */
+#define CM_SHARD_OF_KEY(grp, key)  ((U32)(key) % (grp)->numShards)
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+struct cmShard;
+struct cmShardGrp;
+
+typedef struct cmShardMsg
+{
+    U16   msgId;      /* Application message id         */
+    U16   srcShard;   /* Sender, numShards for external */
+    U32   key;        /* Session key                    */
+    void  *payload;
+} CmShardMsg;
+
+/* Producer and consumer indexes live on their own cache lines */
+typedef struct cmSpscRing
+{
+    volatile U32 tail __attribute__((aligned(64)));  /* Written by the producer */
+    U32          headCache;                          /* Producer view of head   */
+    volatile U32 head __attribute__((aligned(64)));  /* Written by the consumer */
+    U32          tailCache;                          /* Consumer view of tail   */
+    U32          mask __attribute__((aligned(64)));
+    CmShardMsg   *slots;
+} CmSpscRing;
+
+/* Runs on the shard thread: create the shard's sessions and FSM CP */
+typedef S16  (*CmShardInitFn)(struct cmShard *shard);
+typedef void (*CmShardMsgFn)(struct cmShard *shard, CmShardMsg *msg);
+typedef void (*CmShardDeinitFn)(struct cmShard *shard);
+
+typedef struct cmShard
+{
+    U32                id;
+    S32                cpu;         /* Pinned core, -1 if pinning failed */
+    pthread_t          tid;
+    struct cmShardGrp  *grp;
+    CmFsmCp            fsmCp;       /* Instances and timers of the shard */
+    void               *userData;   /* Shard sessions, set by the init hook */
+    CmIdleCtx          idle;
+    S32                evFd;        /* eventfd waking the idle shard */
+    pthread_mutex_t    extLock;     /* Producers of the external ring */
+    volatile U32       sleeping;    /* Shard about to block in idle  */
+    U64                msgCnt;      /* Messages handled              */
+    U64                dropCnt;     /* Messages to this shard dropped on full rings */
+    U64                wakeCnt;     /* Wake-ups signalled to this shard */
+} __attribute__((aligned(64))) CmShard;
+
+typedef struct cmShardGrp
+{
+    U32                numShards;
+    U32                numStarted;  /* Shard threads to be joined */
+    CmShard            *shards;
+    CmSpscRing         *rings;      /* [dst][src], src numShards is external */
+    CM_IDLE_STRATEGY_t idleStrategy;
+    CmShardInitFn      initFn;
+    CmShardMsgFn       msgFn;
+    CmShardDeinitFn    deinitFn;
+    volatile bool      quit;
+    volatile U32       numReady;    /* Shards done with their init hook */
+    volatile S32       initRet;     /* FAILURE if any init hook failed  */
+} CmShardGrp;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+S16 cmSpscInit( CmSpscRing *ring, U32 size );
+void cmSpscDeinit( CmSpscRing *ring );
+S16 cmSpscPush( CmSpscRing *ring, CmShardMsg *msg );
+S16 cmSpscPop( CmSpscRing *ring, CmShardMsg *msg );
+
+S16 cmShardGrpInit(
+    CmShardGrp         *grp,        /* shard group */
+    U32                numShards,   /* 1 to CM_SHARD_MAX */
+    U32                ringLen,     /* messages per ring, power of 2 */
+    CM_IDLE_STRATEGY_t idleStrategy,
+    CmShardInitFn      initFn,      /* per shard init, on the shard thread */
+    CmShardMsgFn       msgFn,       /* message handler */
+    CmShardDeinitFn    deinitFn     /* per shard cleanup, may be NULL */
+);
+
+S16 cmShardPost(
+    CmShardGrp *grp,       /* shard group */
+    U32        dstShard,   /* destination shard */
+    U16        msgId,      /* message id */
+    U32        key,        /* session key */
+    void       *payload    /* message payload */
+);
+
+S32  cmShardSelf( void );
+void cmShardDumpStats( CmShardGrp *grp );
+void cmShardGrpDeinit( CmShardGrp *grp );
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * \file Name: CommonSlab.h
+ *
+ * \brief Fixed size object slab for FSM instance contexts
+ *
+ * \details
+ * One slab is a single mapping cut into equal objects, each rounded up
+ * to CM_SLAB_ALIGN so two sessions never share a cache line. Objects are
+ * handed out from a free list first, then from the untouched tail of the
+ * mapping, both O(1). The mapping can be backed by huge pages and the
+ * whole slab can be reset at once, without walking the live objects.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_SLAB_H
+#define _COMMON_SLAB_H
+
+#include "CommonInc.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_SLAB_ALIGN       (64)            /* Object alignment, cache line */
+#define CM_SLAB_HUGE_SIZE   (2 * 1024 * 1024)
+
+/* cmSlabInit() flags */
+#define CM_SLAB_FLAG_HUGE   0x01  /* Back the slab with huge pages if possible */
+#define CM_SLAB_FLAG_ZERO   0x02  /* Zero the objects on allocation            */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* Link of a free object, kept in its first bytes */
+typedef struct cmSlabFreeObj
+{
+    struct cmSlabFreeObj *next;
+} CmSlabFreeObj;
+
+typedef struct cmSlab
+{
+    U8             *base;      /* Object i at base + i * stride      */
+    size_t         len;        /* Mapping length                      */
+    U32            objSize;    /* Requested object size               */
+    U32            stride;     /* objSize rounded up to CM_SLAB_ALIGN */
+    U32            numObj;     /* Slab capacity                       */
+    U32            numUsed;    /* Objects handed out                  */
+    U32            numFresh;   /* Objects never handed out start here */
+    U32            maxUsed;    /* High watermark of numUsed           */
+    U32            flags;      /* CM_SLAB_FLAG_xxx                    */
+    bool           hugeTlb;    /* Mapped from the huge page pool      */
+    CmSlabFreeObj  *freeList;  /* Objects given back                  */
+} CmSlab;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+S16 cmSlabInit(
+    CmSlab  *slab,      /* slab */
+    U32     objSize,    /* object size, rounded up to CM_SLAB_ALIGN */
+    U32     numObj,     /* slab capacity */
+    U32     flags       /* CM_SLAB_FLAG_xxx */
+);
+
+void *cmSlabAlloc( CmSlab *slab );
+S16  cmSlabFree( CmSlab *slab, void *obj );
+void cmSlabReset( CmSlab *slab );
+void cmSlabDeinit( CmSlab *slab );
+void cmSlabDumpStats( CmSlab *slab );
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * \file Name: CommonTmrWheel.h
+ *
+ * \brief Hierarchical timing wheel
+ *
+ * \details
+ * Timers are intrusive nodes hashed into CM_TMR_WHEEL_LEVELS wheels of
+ * CM_TMR_WHEEL_SIZE slots. Start and stop are O(1), expiry walks one
+ * level 0 slot per tick and cascades the higher levels when level 0
+ * wraps. Time is counted in ticks of CM_TMR_TICK_MS milliseconds.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _COMMON_TMR_WHEEL_H
+#define _COMMON_TMR_WHEEL_H
+
+#include <stddef.h>
+#include "CommonInc.h"
+#include "CommonClock.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define CM_TMR_TICK_MS       (1)   /* Tick length in milliseconds */
+#define CM_TMR_WHEEL_BITS    (6)
+#define CM_TMR_WHEEL_SIZE    (1 << CM_TMR_WHEEL_BITS)
+#define CM_TMR_WHEEL_MASK    (CM_TMR_WHEEL_SIZE - 1)
+#define CM_TMR_WHEEL_LEVELS  (4)   /* 2^24 ticks, about 4.6 hours at 1ms */
+#define CM_TMR_MAX_DELTA     ((1ULL << (CM_TMR_WHEEL_BITS * CM_TMR_WHEEL_LEVELS)) - 1)
+
+#define CM_TMR_IS_ARMED(node)  ((node)->next != NULL)
+#define CM_TMR_NODE_ENTRY(node, type, member) \
+    ((type *)((U8 *)(node) - offsetof(type, member)))
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+typedef struct cmTmrNode
+{
+    struct cmTmrNode *next;     /* Slot list links, NULL when not armed */
+    struct cmTmrNode *prev;
+    U64              expires;   /* Absolute expiry tick */
+} CmTmrNode;
+
+typedef void (*CmTmrCb)(CmTmrNode *node, void *arg);
+
+typedef struct cmTmrWheel
+{
+    U64        curTick;   /* Next tick to be processed */
+    U32        numTmr;    /* Armed timers              */
+    CmTmrNode  slots[CM_TMR_WHEEL_LEVELS][CM_TMR_WHEEL_SIZE]; /* Slot list heads */
+} CmTmrWheel;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+void cmTmrWheelInit( CmTmrWheel *wheel, U64 nowTick );
+
+void cmTmrStart(
+    CmTmrWheel *wheel,    /* timing wheel */
+    CmTmrNode  *node,     /* timer node   */
+    U64        expires    /* absolute expiry tick */
+);
+
+void cmTmrStop( CmTmrWheel *wheel, CmTmrNode *node );
+
+U32 cmTmrExpire(
+    CmTmrWheel *wheel,    /* timing wheel */
+    U64        nowTick,   /* current tick */
+    CmTmrCb    cb,        /* called for every expired timer */
+    void       *arg       /* callback argument */
+);
+
+S16 cmTmrNextExpiry( CmTmrWheel *wheel, U64 *tick );
+
+U64      cmTmrNsToTick( CmTimeNs ts );
+CmTimeNs cmTmrTickToNs( U64 tick );
+
+#endif
@@ -41,6 +41,9 @@
 #define NB_ENABLE   1   /* Non-Blocking Mode Enabled  */
 #define NB_DISABLE  0   /* Non-Blocking Mode Disabled */
 #define UI_TIMEOUT  10  /* Maximum user input timeout */
+#define UI_KEY_NONE 1   /* clPollUserInputChar(): no key pressed yet */
+#define UI_KEY_CLOSED 2 /* clPollUserInputChar(): input closed, no key will come */
+#define MAIN_FSM_MAX_INST  1  /* Game sessions driven by the main FSM CP */
 
 /**
 ************************************************************
@@ -55,7 +58,7 @@ int generateRandSeq(
 
 S32 keyHit();
 void setSysNonBlockMode(U8 state);
-S16 clReadUserInputChar(S8 *allowedStr,U32 timeout,S8 *outputChr);
+S16 clPollUserInputChar(S8 *allowedStr,S8 *outputChr);
 static S32 clInstallSignalHandler(void);
 static void clSignalHandler (int sig, siginfo_t * siginf, void *ptr);
 
@@ -63,6 +66,7 @@ static void clSignalHandler (int sig, siginfo_t * siginf, void *ptr);
 static S16 clGenerateRandomSeq(PROC_INFO_t *context);
 static S16 clCollectUserInputStart(PROC_INFO_t *context);
 static S16 clCollectUserInput(PROC_INFO_t *context);
+static S16 clWaitNextRound(PROC_INFO_t *context);
 static S16 clGeneralTimeoutHdl(PROC_INFO_t *context);
 static S16 clFsmQuit(PROC_INFO_t *context);
 S16 clMainFsmDr(void *outputFn, void *context);
@@ -36,6 +36,14 @@
 */
 #define MAX_BTN_CNT 3
 
+/* Session fields the subscribers are notified of */
+#define MD_PROC_DIRTY_LED    (1U << 0)   /* ledStat                  */
+#define MD_PROC_DIRTY_INPUT  (1U << 1)   /* btnUserInput, inputIndex */
+#define MD_PROC_DIRTY_SEQ    (1U << 2)   /* btnSeq                   */
+#define MD_PROC_DIRTY_ALL    (MD_PROC_DIRTY_LED | MD_PROC_DIRTY_INPUT | MD_PROC_DIRTY_SEQ)
+
+#define MD_PROC_SUBS_MAX     4           /* Subscribers per shard    */
+
 /**
 ************************************************************
 *  Type Definitions
@@ -46,6 +54,7 @@ typedef enum PROC_STAT_TAG
     MAIN_ST_INIT = 0,    /* Init State                       */
     MAIN_ST_START,       /* FSM started                      */
     MAIN_ST_INPUT,       /* Wait User Input and set the LED  */
+    MAIN_ST_RESULT,      /* Round over, wait for enter       */
     MAIN_ST_QUIT,        /* Quit the application             */
     MAIN_ST_MAX=MAIN_ST_QUIT /* Maximum FSM               */
 } PROC_STAT_t;
@@ -58,9 +67,13 @@ typedef struct PROC_INFO_TAG
     S32         inputIndex;                  /* Current Input index            */
     PROC_STAT_t procStat;                    /* Save the current process state */
     time_t      procStatTimeOut;             /* State Time out                 */
+    CmTimeNs    inputGate;                   /* Deadline of the pending key    */
     CmFsmEntity fsmEnt;                      /* FSM Control Point              */
 } PROC_INFO_t;
 
+/* Called on the owner thread after an update changed watched fields */
+typedef void (*MD_PROC_NOTIFY_f)(U32 dirty, void *arg);
+
 /**
 ************************************************************
 *  Function prototype
@@ -68,7 +81,19 @@ typedef struct PROC_INFO_TAG
 */
 
 S16 setProcInfo(PROC_INFO_t *proc);
-S16 getProcInfo(PROC_INFO_t *proc);
+S16 getProcInfo(S32 shard, PROC_INFO_t *proc);
+
+/* Owner updates the published session in place */
+void writeProcInfoBegin();
+void writeProcInfoEnd();
+
+/* Lock free readers of any thread, the session named by its owner shard,
+ * loop until readProcInfoRetry() returns FALSE */
+U32  readProcInfoBegin(S32 shard, const PROC_INFO_t **proc);
+bool readProcInfoRetry(S32 shard, U32 version);
+
+/* Notified of the changes of the published session */
+S16  subscribeProcInfo(U32 fields, MD_PROC_NOTIFY_f notify, void *arg);
 void dumpProcInfo();
 
 #endif
@@ -0,0 +1,148 @@
+/*
+ * \file Name: SysLogBin.h
+ *
+ * \brief Deferred binary logging
+ *
+ * \details
+ *   In binary mode the SLOGxxx call sites are not formatted at all. A
+ * record only holds the call site id, a timestamp, the thread id and
+ * the raw bytes of the arguments, appended to a ring in a memory mapped
+ * file. Each call site is described once in the file: source location,
+ * format string and argument types parsed from it. The LogDecode tool
+ * formats the records offline.
+ *
+ *   File layout: SlBinHdr, the call site area, then the record ring.
+ * Writers reserve ring space with one atomic add and write the record
+ * position last, so a reader can tell complete records from overwritten
+ * or unfinished ones. Records wrapping at the ring end are replaced by
+ * padding records.
+ *   The flight recorder is the same ring in anonymous memory, written
+ * to a file only when asked to or on a fatal signal.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _SYS_LOG_BIN_H
+#define _SYS_LOG_BIN_H
+#include <stdarg.h>
+#include "SysLogging.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define SL_BIN_MAGIC       (0x4E424C53)   /* "SLBN" */
+#define SL_BIN_VERSION     (1)
+#define SL_BIN_ALIGN       (16)           /* Record and site entry alignment   */
+#define SL_BIN_SIZE_MB     (64)           /* Default record ring size          */
+#define SL_BIN_SITE_AREA   (256 * 1024)   /* Call site descriptions            */
+#define SL_BIN_STR_MAX     (256)          /* String argument bytes kept        */
+#define SL_BIN_TEXT_MAX    (1024)         /* Text of a preformatted call site  */
+#define SL_BIN_SITE_PAD    (0)            /* siteId of a padding record        */
+
+/* What the binary log is used for */
+#define SL_BIN_MODE_OFF    0
+#define SL_BIN_MODE_FILE   1   /* sl_BinLogStart(), replaces the text log   */
+#define SL_BIN_MODE_REC    2   /* sl_FlightRecStart(), next to the text log */
+
+#define SL_FLIGHT_SIZE_MB  (4)            /* Default flight recorder ring      */
+
+/* Call site flags */
+#define SL_BIN_SITE_TEXT   0x01  /* Format not supported, records hold the text */
+
+/* Argument types, in the record after the header */
+enum
+{
+    SL_ARG_END = 0,
+    SL_ARG_I32,         /* 4 bytes: int and smaller, long, size_t, ptr on 32-bit */
+    SL_ARG_I64,         /* 8 bytes: long long, long, size_t, ptr on 64-bit */
+    SL_ARG_DBL,         /* double, 8 bytes                */
+    SL_ARG_LDBL,        /* long double, sizeof(long double) */
+    SL_ARG_STR          /* U16 length then the bytes, no NUL */
+};
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* File header */
+typedef struct slBinHdr
+{
+    unsigned int       magic;      /* SL_BIN_MAGIC                        */
+    unsigned int       version;    /* SL_BIN_VERSION                      */
+    unsigned int       pid;
+    unsigned int       numSites;   /* Call sites described                */
+    unsigned long long siteOff;    /* Call site area                      */
+    unsigned long long siteSize;
+    unsigned long long sitePos;    /* Used part of the call site area     */
+    unsigned long long dataOff;    /* Record ring                         */
+    unsigned long long dataSize;   /* Power of two                        */
+    unsigned long long head;       /* Ring position of the next record    */
+    unsigned long long dropped;    /* Call sites left out, area full      */
+    char               procName[MAX_NAME_LEN];
+} __attribute__((aligned(64))) SlBinHdr;
+
+/* Call site description, file, function and format strings follow */
+typedef struct slBinSite
+{
+    unsigned int   len;        /* Entry length, SL_BIN_ALIGN aligned */
+    unsigned int   id;         /* siteId of its records, from 1      */
+    int            level;
+    int            type;
+    int            line;
+    unsigned short flags;      /* SL_BIN_SITE_xxx                    */
+    unsigned short numArgs;
+    unsigned char  argTypes[SL_SITE_MAX_ARGS];
+    unsigned short fileLen;    /* String lengths with the NUL        */
+    unsigned short funcLen;
+    unsigned short fmtLen;
+    unsigned short reserved;
+} SlBinSite;
+
+/* Record header, the arguments follow */
+typedef struct slBinRec
+{
+    unsigned long long pos;     /* Ring position, written last      */
+    unsigned int       len;     /* Record length, SL_BIN_ALIGN aligned */
+    unsigned int       siteId;  /* SL_BIN_SITE_PAD for padding       */
+    unsigned long long tsNs;    /* CLOCK_REALTIME                    */
+    unsigned int       tid;
+    unsigned int       reserved;
+} SlBinRec;
+
+/* One conversion of a format string */
+typedef struct slBinSpec
+{
+    int            len;        /* Characters from the '%'            */
+    int            numStars;   /* '*' width/precision arguments      */
+    unsigned char  argType;    /* SL_ARG_xxx, SL_ARG_END for "%%"    */
+} SlBinSpec;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+int  sl_BinLogStart( const char *path, unsigned int sizeMb );
+void sl_BinLogStop( void );
+int  sl_BinLogWrite( SlSite *site, va_list ap );
+int  sl_BinParseSpec( const char *spec, SlBinSpec *out );
+int  sl_BinLogMode( void );
+int  sl_FlightRecStart( const char *dumpPath, unsigned int sizeMb );
+int  sl_FlightRecDump( const char *path );
+
+#endif
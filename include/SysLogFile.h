@@ -0,0 +1,82 @@
+/*
+ * \file Name: SysLogFile.h
+ *
+ * \brief Group commit file sink of the system logging
+ *
+ * \details
+ *   With LOG_OUT_FILE the formatted records are appended to large
+ * memory buffers. A flusher thread writes the filled buffers with one
+ * writev() when one fills up, or the partly filled one when it is older
+ * than the flush interval: that interval is how long a record may stay
+ * in memory. The flusher also rotates the file by size or age, so the
+ * logging threads never wait for the disk, only for a free buffer when
+ * all of them are waiting to be written.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _SYS_LOG_FILE_H
+#define _SYS_LOG_FILE_H
+#include "SysLogging.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define SL_FILE_BUF_SIZE    (1024 * 1024)  /* One group commit buffer         */
+#define SL_FILE_NUM_BUFS    (4)            /* Buffers, at most one being filled */
+#define SL_FILE_FLUSH_MS    (100)          /* Default durability window       */
+#define SL_FILE_MAX_SIZE    (64ULL << 20)  /* Default rotation size           */
+#define SL_FILE_KEEP        (4)            /* Default rotated files kept      */
+#define SL_FILE_KEEP_MAX    (99)
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* File sink settings, 0 in a field selects its default or turns it off */
+typedef struct slFileCfg
+{
+    unsigned int       flushMs;    /* Longest time a record stays in memory  */
+    unsigned long long maxSize;    /* Rotate at this size, default SL_FILE_MAX_SIZE */
+    unsigned int       rotateSec;  /* Rotate at this age, 0 never            */
+    unsigned int       keep;       /* Rotated files path.1 ... path.keep     */
+    int                sync;       /* fdatasync() after every group commit   */
+} SlFileCfg;
+
+/* File sink counters */
+typedef struct slFileStats
+{
+    unsigned long long records;    /* Records appended                       */
+    unsigned long long bytes;      /* Bytes written                          */
+    unsigned long long commits;    /* writev() calls                         */
+    unsigned long long stalls;     /* Times a writer waited for a buffer     */
+    unsigned long long rotations;
+    unsigned long long errors;     /* Failed writes, records lost            */
+} SlFileStats;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+int  sl_FileLogStart( const char *path, const SlFileCfg *cfg );
+void sl_FileLogStop( void );
+void sl_FileLogStats( SlFileStats *stats );
+int  sl_FileLogPut( const char *text, int len );
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * \file Name: SysLogSock.h
+ *
+ * \brief Direct syslog socket sink of the system logging
+ *
+ * \details
+ *   With LOG_OUT_SYSLOG and the sink started, the records do not go
+ * through syslog(), one send per message. The logging threads only
+ * append the record and its timestamp to a buffer. A flusher thread
+ * builds the RFC 5424 frames and sends them on its own datagram socket
+ * to /dev/log, up to SL_SOCK_BATCH of them per sendmmsg() call. Like
+ * syslog() the sink is lossy: records are dropped, and counted, when
+ * the daemon can not keep up and both buffers are full.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _SYS_LOG_SOCK_H
+#define _SYS_LOG_SOCK_H
+#include "SysLogging.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define SL_SOCK_PATH        "/dev/log"
+#define SL_SOCK_BUF_SIZE    (256 * 1024)  /* Records waiting, two buffers     */
+#define SL_SOCK_BATCH       (64)          /* Frames per sendmmsg()            */
+#define SL_SOCK_FLUSH_MS    (10)          /* Longest wait before a send       */
+#define SL_SOCK_HDR_MAX     (384)         /* RFC 5424 header of one frame     */
+#define SL_SOCK_APP_MAX     (48)          /* RFC 5424 APP-NAME length         */
+#define SL_SOCK_HOST_MAX    (255)         /* RFC 5424 HOSTNAME length         */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* Socket sink counters */
+typedef struct slSockStats
+{
+    unsigned long long records;    /* Records appended                  */
+    unsigned long long frames;     /* Frames sent                       */
+    unsigned long long batches;    /* sendmmsg() calls                  */
+    unsigned long long dropped;    /* Records lost, both buffers full   */
+    unsigned long long errors;     /* Frames the socket refused         */
+} SlSockStats;
+
+/**
+************************************************************
+*  Function prototype
+************************************************************
+*/
+int  sl_SockLogStart( const char *path );
+void sl_SockLogStop( void );
+void sl_SockLogStats( SlSockStats *stats );
+int  sl_SockLogPut( int iLevel, const char *text, int len );
+
+#endif
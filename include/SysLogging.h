@@ -9,6 +9,11 @@
  *   System common logging functions contains all the logging
  * related functions. All the output will go to common system
  * log of Linux system.
+ *   In asynchronous mode the callers only copy the formatted record
+ * into a ring of their own thread, a background thread writes them.
+ * In binary mode, see SysLogBin.h, the records are not even formatted.
+ *   Each SLOGxxx call site can be disabled at runtime, is rate limited
+ * by a token bucket and counts its hits, see sl_LogSiteDump().
  */
 
 /* 
@@ -28,10 +33,12 @@
 #ifndef _SYS_LOGGING_H
 #define _SYS_LOGGING_H
 #include <sys/syslog.h>
+#include <pthread.h>
 
 /* System Log Output Target */
 #define LOG_OUT_SYSLOG  0
 #define LOG_OUT_STDOUT  1
+#define LOG_OUT_FILE    2   /* Set by sl_FileLogStart(), see SysLogFile.h */
 
 /* System Log Types       */
 #define LOG_TYPE_MIN     0
@@ -48,11 +55,66 @@
 
 #define VALID_LOGTYPE(x) (((x) > LOG_TYPE_MIN ) && ((x) < LOG_TYPE_MAX))
 
-#define SLOGCRI(...)     sl_LogSysMsg(LOG_CRIT,  LOG_TYPE_COMMON,  __FILE__,__FUNCTION__,__LINE__,__VA_ARGS__ );
-#define SLOGERR(...)     sl_LogSysMsg(LOG_ERR,  LOG_TYPE_ERROR,  __FILE__,__FUNCTION__,__LINE__,__VA_ARGS__ );
-#define SLOGWARN(...)    sl_LogSysMsg(LOG_WARN, LOG_TYPE_WARN,   __FILE__,__FUNCTION__,__LINE__,__VA_ARGS__ );
-#define SLOGNOTE(...)    sl_LogSysMsg(LOG_NOTICE,  LOG_TYPE_COMMON, __FILE__,__FUNCTION__,__LINE__,__VA_ARGS__ );
-#define SLOGINFO(...)    sl_LogSysMsg(LOG_INFO, LOG_TYPE_INFO,   __FILE__,__FUNCTION__,__LINE__,__VA_ARGS__ );
+/* Asynchronous logging */
+#define SL_ASYNC_RING_SIZE   (256 * 1024)  /* Default ring of each logging thread */
+#define SL_ASYNC_RING_MIN    (4 * SYS_LOG_BUFFER_SIZE)
+#define SL_ASYNC_POLL_US     (1000)        /* Writer sleep with all rings empty   */
+#define SL_ASYNC_POLL_MAX    (10)          /* Empty polls before the writer blocks */
+
+#define SL_SITE_MAX_ARGS     16   /* Arguments of a call site logged in binary */
+#define SL_SITE_RULES_MAX    32   /* sl_LogSiteEnable() rules kept for new sites */
+#define SL_SITE_RATE_DEFAULT  (100)  /* Messages per second of one call site    */
+#define SL_SITE_BURST_DEFAULT (500)  /* Messages a call site may log at once    */
+
+/*
+ * Every SLOGxxx expansion owns a static call site descriptor. A disabled
+ * site costs one branch, its arguments are not evaluated.
+ */
+#define SL_LOG_SITE(lvl, typ, fmt, ...)                                     \
+    do {                                                                \
+        static SlSite _slSite = { (lvl), (typ), __LINE__, __FILE__,     \
+                                  __FUNCTION__, (fmt) };                \
+        if (__builtin_expect(!__atomic_load_n(&_slSite.off, __ATOMIC_RELAXED), 1)) \
+            sl_LogSite(&_slSite, ##__VA_ARGS__);                        \
+    } while (0)
+
+#define SLOGCRI(...)     SL_LOG_SITE(LOG_CRIT,  LOG_TYPE_COMMON,  __VA_ARGS__ );
+#define SLOGERR(...)     SL_LOG_SITE(LOG_ERR,  LOG_TYPE_ERROR,  __VA_ARGS__ );
+#define SLOGWARN(...)    SL_LOG_SITE(LOG_WARNING, LOG_TYPE_WARN, __VA_ARGS__ );
+#define SLOGNOTE(...)    SL_LOG_SITE(LOG_NOTICE,  LOG_TYPE_COMMON, __VA_ARGS__ );
+#define SLOGINFO(...)    SL_LOG_SITE(LOG_INFO, LOG_TYPE_INFO,   __VA_ARGS__ );
+
+/* Call site of a SLOGxxx macro */
+typedef struct slSite
+{
+    int           level;
+    int           type;
+    int           line;
+    const char    *file;
+    const char    *func;
+    const char    *fmt;
+    int           off;        /* Disabled, checked before the call          */
+    int           reg;        /* In the call site list                      */
+    struct slSite *next;      /* Call sites that logged at least once       */
+    unsigned long long hits;        /* Calls, filtered ones included        */
+    unsigned long long suppressed;  /* Calls dropped by the rate limit      */
+    unsigned long long rateTat;     /* Time the rate bucket is full again   */
+    unsigned int  suppPend;   /* Suppressed since the last message logged   */
+    unsigned int  binGen;     /* Binary log the site is described in, 0 for none */
+    unsigned int  binId;      /* Site id in that binary log                 */
+    unsigned int  binFlags;   /* SL_BIN_SITE_xxx                            */
+    unsigned int  binNumArgs;
+    unsigned char binArgs[SL_SITE_MAX_ARGS]; /* SL_ARG_xxx of each argument */
+} SlSite;
+
+/* Asynchronous logging counters */
+typedef struct slAsyncStats
+{
+    unsigned long long written;    /* Records written by the writer thread */
+    unsigned long long dropped;    /* Records lost on full rings           */
+    unsigned long long overflows;  /* Times a ring filled up               */
+    unsigned int       rings;      /* Rings of the logging threads         */
+} SlAsyncStats;
 
 void InitSystemLogging(
     const char *logProcName,     /* process name    */
@@ -71,4 +133,18 @@ void sl_LogSysMsg
     ...
 );
 
+void sl_LogSite( SlSite *site, ... );
+const char *sl_LogTypeStr( int iType );
+const char *sl_LogProcName( void );
+int  sl_LogSetOutput( int iOutput );
+int  sl_LogSiteEnable( const char *match, int enable );
+void sl_LogRateLimit( unsigned int perSec, unsigned int burst );
+void sl_LogSiteDump( unsigned int top );
+
+int  sl_AsyncLogStart( unsigned int ringSize );
+void sl_AsyncLogStop( void );
+void sl_AsyncLogStats( SlAsyncStats *stats );
+
+int  sl_ThreadCreate( pthread_t *tid, void *(*start)(void *), void *arg );
+
 #endif
@@ -0,0 +1,278 @@
+/*
+ * \file Name: CommonClock.c
+ *
+ * \brief 64-bit nanosecond monotonic time and its clock sources
+ *
+ * \details
+ * The TSC source is calibrated once against CLOCK_MONOTONIC and then
+ * converted with a fixed point multiplier, it is only offered when the
+ * CPU reports an invariant TSC. The virtual time may be read by worker
+ * threads while the driver advances it, so it is only accessed
+ * atomically.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "CommonClock.h"
+#ifdef CM_CLOCK_HAS_TSC
+ #include <cpuid.h>
+#endif
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+CmClock g_cmClock;   /* CM_CLOCK_MONOTONIC until told otherwise */
+
+static const S8 *CM_CLOCK_STR[CM_CLOCK_MAX] = { "monotonic", "coarse", "tsc", "virtual" };
+
+/**
+ * Read CLOCK_MONOTONIC in nanoseconds, whatever the selected source
+ *
+ * @param: None
+ * @return: monotonic time in nanoseconds
+ */
+PRIVATE CmTimeNs cmClockMonoNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (CmTimeNs)ts.tv_sec * CM_TIME_NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Calibrate the TSC against CLOCK_MONOTONIC
+ *
+ * @param: None
+ * @return: SUCCESS  TSC usable as clock source
+ *          FAILURE  no invariant TSC
+ */
+PRIVATE S16 cmClockTscCalibrate(void)
+{
+#ifdef CM_CLOCK_HAS_TSC
+    struct timespec slp;
+    U32       eax, ebx, ecx, edx;
+    U64       tsc0, tsc1, mult;
+    CmTimeNs  ns0, ns1;
+
+    /* CPUID.80000007H:EDX[8], the TSC rate survives P/C-states */
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+    {
+        SLOGINFO("No invariant TSC on this CPU");
+        return FAILURE;
+    }
+
+    slp.tv_sec  = 0;
+    slp.tv_nsec = CM_CLOCK_TSC_CAL_MS * CM_TIME_NS_PER_MS;
+
+    ns0  = cmClockMonoNs();
+    tsc0 = __rdtsc();
+    nanosleep(&slp, NULL);
+    ns1  = cmClockMonoNs();
+    tsc1 = __rdtsc();
+
+    if (tsc1 <= tsc0 || ns1 <= ns0)
+    {
+        SLOGERR("TSC calibration failed");
+        return FAILURE;
+    }
+
+    mult = ((ns1 - ns0) << CM_CLOCK_TSC_SHIFT) / (tsc1 - tsc0);
+    if (mult == 0 || mult > 0xFFFFFFFFULL)
+    {
+        SLOGERR("TSC rate out of range, %llu cycles in %llu ns",
+                tsc1 - tsc0, ns1 - ns0);
+        return FAILURE;
+    }
+
+    g_cmClock.tscBase   = tsc1;
+    g_cmClock.tscNsBase = ns1;
+    g_cmClock.tscMult   = (U32)mult;
+    SLOGINFO("TSC calibrated, %llu kHz",
+             (tsc1 - tsc0) * CM_TIME_NS_PER_MS / (ns1 - ns0));
+    return SUCCESS;
+#else
+    SLOGINFO("No TSC on this architecture");
+    return FAILURE;
+#endif
+}
+
+/**
+ * Select the clock source read by cmTimeNow()
+ * While the virtual clock runs the source is only taken for the
+ * return to real time.
+ *
+ * @param: source  CM_CLOCK_xxx
+ * @return: SUCCESS  source selected
+ *          FAILURE  source not available, the current one is kept
+ */
+S16 cmClockSetSource( CM_CLOCK_SOURCE_t source )
+{
+    if (source >= CM_CLOCK_MAX)
+    {
+        SLOGERR("Invalid clock source:%d", source);
+        return FAILURE;
+    }
+
+    if (source == CM_CLOCK_VIRTUAL)
+        return cmClockIsVirtual() ? SUCCESS : cmClockVirtStart(0);
+
+    if (source == CM_CLOCK_TSC && !g_cmClock.tscMult &&
+        cmClockTscCalibrate() != SUCCESS)
+        return FAILURE;
+
+    g_cmClock.realSource = source;
+    if (!cmClockIsVirtual())
+        g_cmClock.source = source;
+
+    return SUCCESS;
+}
+
+/**
+ * Parse a clock source name
+ *
+ * @param: str     "monotonic", "coarse", "tsc" or "virtual"
+ * @param: source  output source
+ * @return: SUCCESS  known name
+ *          FAILURE  unknown name
+ */
+S16 cmClockStrToSource( const S8 *str, CM_CLOCK_SOURCE_t *source )
+{
+    U32 i;
+
+    for (i = 0; str && i < CM_CLOCK_MAX; i++)
+    {
+        if (strcmp(str, CM_CLOCK_STR[i]) == 0)
+        {
+            *source = i;
+            return SUCCESS;
+        }
+    }
+    return FAILURE;
+}
+
+/**
+ * Name of a clock source
+ *
+ * @param: source  CM_CLOCK_xxx
+ * @return: name
+ */
+const S8 *cmClockSourceStr( CM_CLOCK_SOURCE_t source )
+{
+    return source < CM_CLOCK_MAX ? CM_CLOCK_STR[source] : "unknown";
+}
+
+/**
+ * Switch cmTimeNow() to virtual time
+ *
+ * @param: start  initial virtual time, 0 for the current time
+ * @return: SUCCESS  virtual clock running
+ *          FAILURE  already started
+ */
+S16 cmClockVirtStart( CmTimeNs start )
+{
+    if (cmClockIsVirtual())
+    {
+        SLOGERR("Virtual clock already started");
+        return FAILURE;
+    }
+
+    if (start == 0)
+        start = cmTimeNow();
+
+    g_cmClock.realSource = g_cmClock.source;
+    g_cmClock.virtStart  = start;
+    g_cmClock.virtJumps  = 0;
+    __atomic_store_n(&g_cmClock.virtNs, start, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_cmClock.source, CM_CLOCK_VIRTUAL, __ATOMIC_RELEASE);
+
+    return SUCCESS;
+}
+
+/**
+ * Switch back to the real clock source
+ * The real time is usually behind the virtual one, the timers armed in
+ * virtual time keep their deadlines.
+ *
+ * @param: None
+ * @return: None
+ */
+void cmClockVirtStop( void )
+{
+    if (cmClockIsVirtual())
+        __atomic_store_n(&g_cmClock.source, g_cmClock.realSource, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check if the virtual clock is running
+ *
+ * @param: None
+ * @return: TRUE if cmTimeNow() returns virtual time
+ */
+bool cmClockIsVirtual( void )
+{
+    return g_cmClock.source == CM_CLOCK_VIRTUAL;
+}
+
+/**
+ * Move the virtual time forward, no operation if ts is not ahead
+ *
+ * @param: ts  new virtual time
+ * @return: None
+ */
+void cmClockVirtAdvanceTo( CmTimeNs ts )
+{
+    CmTimeNs cur = __atomic_load_n(&g_cmClock.virtNs, __ATOMIC_RELAXED);
+
+    while (ts > cur)
+    {
+        if (__atomic_compare_exchange_n(&g_cmClock.virtNs, &cur, ts, FALSE,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            __atomic_add_fetch(&g_cmClock.virtJumps, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+/**
+ * Move the virtual time forward by a duration
+ *
+ * @param: ms  milliseconds
+ * @return: None
+ */
+void cmClockVirtAdvanceMs( U32 ms )
+{
+    if (ms == 0) return;
+
+    __atomic_add_fetch(&g_cmClock.virtNs, CM_TIME_FROM_MS(ms), __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_cmClock.virtJumps, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Log how far the virtual time went
+ *
+ * @param: None
+ * @return: None
+ */
+void cmClockVirtDumpStats( void )
+{
+    CmTimeNs ns;
+
+    if (!cmClockIsVirtual()) return;
+
+    ns = __atomic_load_n(&g_cmClock.virtNs, __ATOMIC_ACQUIRE) - g_cmClock.virtStart;
+    SLOGNOTE("Virtual clock advanced %llu.%06llu s in %llu jumps",
+             ns / CM_TIME_NS_PER_SEC, CM_TIME_TO_US(ns % CM_TIME_NS_PER_SEC),
+             g_cmClock.virtJumps);
+}
@@ -7,7 +7,8 @@
  * 
  * \details
  * This module provide one simple FSM implementation.
- * It is not an event triggerred FSM, state was modified in application logic.
+ * In polling mode the state was modified in application logic, in event
+ * mode only posted events and expired state timers run an instance.
  */
 
 /* 
@@ -24,10 +25,25 @@
  * Had you not received a copy of the GNU General Public License yet, write
  * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libgen.h>
 #include "CommonFsm.h"
+#include "CommonFsmSparse.h"
+#include "CommonTmrWheel.h"
+#include "CommonFsmTrace.h"
 #include "SysLogging.h"
 #include "CommonInc.h"
 
+/* Arguments of one driver pass given to the timer expiry callback */
+typedef struct cmFsmDrvPass
+{
+    CmFsmCp   *fsmCp;
+    CmTimeNs  tsNow;
+    bool      deferred;   /* Only flag timed out instances, run them later */
+} CmFsmDrvPass;
+
 /**
  * Initialize a common FSM Control Point
  *
@@ -37,7 +53,8 @@
  * @param: offset    Context Offset of CmFsmEntity in the FSM instance context
  * @param: numStates Maximum States of the FSM
  * @param: states    States Definitions
- * @param: fsmMt     FSM state matrix
+ * @param: fsmMt     FSM state matrix, NULL when a compressed table is
+ *                   set with cmFsmCpSetSparse()
  * @return: SUCCESS      success
  *          FAILURE  failed
  *
@@ -52,13 +69,16 @@ S16 cmFsmCpInit (
     CmFsmEntry     *fsmMt    /* FSM state matrix */
 )
 {
-    if (!fsmCp || !fsmMt || !fsmStr || !numStates)
+    CmTimeNs  tsNow;
+
+    if (!fsmCp || !fsmStr || !numStates || numStates >= CM_FSM_STATE_NONE)
     {
         SLOGERR("Invalid parameters, fsmCp:%p, fsmMt:%p, numStates:%d",
                 fsmCp, fsmMt, numStates);
         return FAILURE;
     }
 
+    memset(fsmCp, 0, sizeof(CmFsmCp));
     strncpy(fsmCp->fsmStr, fsmStr, CM_FSM_ID_STR_LEN);
     fsmCp->fsmStr[CM_FSM_ID_STR_LEN - 1] = '\0';
 
@@ -67,130 +87,1695 @@ S16 cmFsmCpInit (
     fsmCp->states       = states;
     fsmCp->fsmMt        = fsmMt;
     fsmCp->fsmFp        = fsmFp;
+    fsmCp->mode         = CM_FSM_MODE_POLL;
+    fsmCp->numCols      = CM_FSM_CTRL_MAX;
+
+    tsNow = cmTimeNow();
+    cmTmrWheelInit(&fsmCp->tmrWheel, cmTmrNsToTick(tsNow));
 
     return (SUCCESS);
 }
 
+/**
+ * Switch a FSM Control Point to event driven mode
+ * Must be called before any instance is initialized. The state matrix
+ * given to cmFsmCpInit() then has numCols columns per state:
+ * CM_FSM_CTRL_NORMAL, CM_FSM_CTRL_TIMEOUT, then the application events
+ * starting from CM_FSM_EVT_USER.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: numCols   Number of matrix columns
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCpEvtInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    U16      numCols      /* matrix columns, NORMAL, TIMEOUT then user events */
+)
+{
+    if (!fsmCp || numCols < CM_FSM_CTRL_MAX || fsmCp->numActive ||
+        (fsmCp->sparse && numCols > fsmCp->sparse->numCols))
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p, numCols:%d",
+                fsmCp, numCols);
+        return FAILURE;
+    }
+
+    fsmCp->mode    = CM_FSM_MODE_EVENT;
+    fsmCp->numCols = numCols;
+    return SUCCESS;
+}
+
+/**
+ * Look up the transitions in a compressed table instead of fsmMt
+ * Must be called before any instance is initialized. The table needs a
+ * row per state, including the final one, and at least the columns of
+ * the control point. It is not copied and must outlive the control
+ * point.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: sparse    Compressed table, NULL to go back to fsmMt
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCpSetSparse(
+    CmFsmCp            *fsmCp,   /* FSM control point */
+    const CmFsmSparse  *sparse   /* compressed table, NULL for fsmMt */
+)
+{
+    if (!fsmCp || fsmCp->numActive || (!sparse && !fsmCp->fsmMt) ||
+        (sparse && (sparse->numRows <= fsmCp->numStates ||
+                    sparse->numCols < fsmCp->numCols)))
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p, sparse:%p", fsmCp, sparse);
+        return FAILURE;
+    }
+
+    fsmCp->sparse = sparse;
+    return SUCCESS;
+}
+
+/**
+ * Output function and next state of one matrix cell
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: row       Matrix row
+ * @param: col       Matrix column
+ * @param: cell      Output cell
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmGetCell(CmFsmCp *fsmCp, U16 row, U16 col, CmFsmEntry *cell)
+{
+    const CmFsmSparseCell *spCell;
+
+    if (fsmCp->sparse)
+    {
+        spCell = cmFsmSparseGet(fsmCp->sparse, row, col);
+        cell->outputFn  = fsmCp->sparse->fnTab[spCell->fnIdx];
+        cell->nextState = spCell->nextState;
+    }
+    else
+    {
+        *cell = fsmCp->fsmMt[row * fsmCp->numCols + col];
+    }
+}
+
+/**
+ * Run the output functions through a generated typed dispatcher
+ * The state matrix still gives the transitions and tells which cells
+ * have an output function, the dispatcher replaces the fsmFp call.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: dispFn    Dispatcher, NULL to go back to fsmFp
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCpSetDispatch(
+    CmFsmCp      *fsmCp,    /* FSM control point */
+    CmFsmDispFn  dispFn     /* generated dispatcher, NULL for fsmFp */
+)
+{
+    if (!fsmCp)
+    {
+        SLOGERR("Invalid fsmCp:%p ", fsmCp);
+        return FAILURE;
+    }
+
+    fsmCp->dispFn = dispFn;
+    return SUCCESS;
+}
+
+/**
+ * Attach an instance pool to the FSM Control Point
+ * All instances initialized afterwards are registered in the pool
+ * and advanced together by cmFsmDriverAll()
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: maxInst   Maximum instances driven by this control point
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCpPoolInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    U32      maxInst      /* maximum instances driven by this CP */
+)
+{
+    if (!fsmCp || !maxInst || fsmCp->entPool)
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p, maxInst:%u",
+                fsmCp, maxInst);
+        return FAILURE;
+    }
+
+    fsmCp->entPool = calloc(maxInst, sizeof(CmFsmEntity *));
+    if (!fsmCp->entPool)
+    {
+        SLOGERR("Failed to allocate pool for %u instances", maxInst);
+        return FAILURE;
+    }
+
+    fsmCp->maxInst = maxInst;
+    fsmCp->numInst = 0;
+    return SUCCESS;
+}
+
+/**
+ * Mirror the state of a pooled instance into the batch state array
+ * Batch passes group the instances from this array, without touching
+ * the instances that do not run.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmBatchSync(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt)
+{
+    if (!fsmCp->batchState)
+        return;
+
+    fsmCp->batchState[fsmEnt->poolIdx] =
+        (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE) ? fsmEnt->state : CM_FSM_BATCH_IDLE;
+}
+
+/**
+ * Switch a pooled FSM Control Point to batch execution
+ * Each driver pass then groups the runnable instances by their current
+ * state and runs the groups one after the other, so the same output
+ * function runs back to back over its whole group. Within a group the
+ * instances keep their pool order. Must be called after
+ * cmFsmCpPoolInit(); output functions may only remove their own
+ * instance during a pass.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCpBatchInit( CmFsmCp *fsmCp )
+{
+    U32 i;
+
+    if (!fsmCp || !fsmCp->entPool || fsmCp->batchEnts || fsmCp->edf)
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p", fsmCp);
+        return FAILURE;
+    }
+
+    /* One extra group for instances restored past the last state */
+    fsmCp->batchState = malloc(fsmCp->maxInst * sizeof(U16));
+    fsmCp->batchEnts  = calloc(CM_FSM_BATCH_CHUNK, sizeof(CmFsmEntity *));
+    fsmCp->batchEnd   = calloc(fsmCp->numStates + 1, sizeof(U32));
+    if (!fsmCp->batchState || !fsmCp->batchEnts || !fsmCp->batchEnd)
+    {
+        SLOGERR("Failed to allocate batch of %u instances", fsmCp->maxInst);
+        free(fsmCp->batchState);
+        free(fsmCp->batchEnts);
+        free(fsmCp->batchEnd);
+        fsmCp->batchState = NULL;
+        fsmCp->batchEnts  = NULL;
+        fsmCp->batchEnd   = NULL;
+        return FAILURE;
+    }
+
+    for (i = 0; i < fsmCp->numInst; i++)
+        cmFsmBatchSync(fsmCp, fsmCp->entPool[i]);
+
+    return SUCCESS;
+}
+
+/**
+ * Switch a pooled FSM Control Point to earliest deadline first runs
+ * Each driver pass then runs the runnable instances, the whole pool in
+ * polling mode or the ready list in event mode, by increasing state
+ * deadline. Instances without state timeout come last, the least
+ * recently run first. Timed out states are queued on their deadline
+ * like any other instance instead of running in the timer expiry.
+ * Once the pass used up its budget the rest is deferred to the next
+ * pass: event mode instances keep their pending events, polling mode
+ * instances skip the pass. Must be called after cmFsmCpPoolInit() and
+ * not together with cmFsmCpBatchInit(); output functions may only
+ * remove their own instance during a pass.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: budgetUs  Run time of one driver pass, 0 for unlimited
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCpEdfInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    U32      budgetUs     /* run time of one driver pass, 0 for unlimited */
+)
+{
+    CmFsmEdf *edf;
+
+    if (!fsmCp || !fsmCp->entPool || fsmCp->batchEnts || fsmCp->edf)
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p", fsmCp);
+        return FAILURE;
+    }
+
+    edf = calloc(1, sizeof(CmFsmEdf));
+    if (edf)
+    {
+        edf->heap    = malloc(fsmCp->maxInst * sizeof(CmFsmEdfNode));
+        edf->lastRun = calloc(fsmCp->maxInst, sizeof(U64));
+    }
+    if (!edf || !edf->heap || !edf->lastRun)
+    {
+        SLOGERR("Failed to allocate EDF queue of %u instances", fsmCp->maxInst);
+        if (edf)
+        {
+            free(edf->heap);
+            free(edf->lastRun);
+            free(edf);
+        }
+        return FAILURE;
+    }
+
+    edf->budget = (CmTimeNs)budgetUs * CM_TIME_NS_PER_US;
+    fsmCp->edf  = edf;
+    return SUCCESS;
+}
+
+/**
+ * Log the EDF run queue counters of a control point
+ *
+ * @param: fsmCp     FSM Control Point
+ * @return: None
+ *
+ */
+void cmFsmEdfDumpStats( CmFsmCp *fsmCp )
+{
+    CmFsmEdf *edf;
+
+    if (!fsmCp || !fsmCp->edf) return;
+
+    edf = fsmCp->edf;
+    SLOGNOTE("FSM %s EDF: %llu passes, %llu runs, %llu deferred in %llu "
+             "overloaded passes, %llu missed deadlines, worst lateness %llu us",
+             fsmCp->fsmStr, edf->passCnt, edf->runCnt, edf->deferCnt,
+             edf->overCnt, edf->missCnt, CM_TIME_TO_US(edf->lateMax));
+}
+
+/**
+ * Release the resources owned by the FSM Control Point
+ * The instance contexts are owned by the caller and not freed here
+ *
+ * @param: fsmCp     FSM Control Point
+ * @return: None
+ *
+ */
+void cmFsmCpDeinit( CmFsmCp *fsmCp )
+{
+    if (!fsmCp) return;
+
+    free(fsmCp->entPool);
+    free(fsmCp->batchState);
+    free(fsmCp->batchEnts);
+    free(fsmCp->batchEnd);
+    if (fsmCp->edf)
+    {
+        free(fsmCp->edf->heap);
+        free(fsmCp->edf->lastRun);
+        free(fsmCp->edf);
+    }
+    fsmCp->edf        = NULL;
+    fsmCp->entPool    = NULL;
+    fsmCp->batchState = NULL;
+    fsmCp->batchEnts  = NULL;
+    fsmCp->batchEnd   = NULL;
+    fsmCp->maxInst   = 0;
+    fsmCp->numInst   = 0;
+    fsmCp->numActive = 0;
+    fsmCp->numWaiting = 0;
+    fsmCp->fsmEnt    = NULL;
+    fsmCp->readyHead = NULL;
+    fsmCp->readyTail = NULL;
+    cmTmrWheelInit(&fsmCp->tmrWheel, fsmCp->tmrWheel.curTick);
+}
+
+/**
+ * Start the timeout of the instance current state
+ * The state timer is kept in the control point timing wheel, so the
+ * drivers never look at instances without a pending timeout.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmArmTmr(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt, CmTimeNs tsNow)
+{
+    fsmEnt->timestamp = tsNow + CM_TIME_FROM_MS(fsmEnt->timeout);
+
+    CM_FSM_CP_LOCK(fsmCp);
+    fsmCp->chgCnt++;
+    fsmEnt->flags &= ~(CM_FSM_ENT_FLAG_TMO | CM_FSM_ENT_FLAG_WAKE);
+    if (fsmEnt->timeout == 0 || !(fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+    {
+        cmTmrStop(&fsmCp->tmrWheel, &fsmEnt->tmrNode);
+    }
+    else
+    {
+        /* Tick rounded up like the waits, the TIMEOUT column never runs early */
+        cmTmrStart(&fsmCp->tmrWheel, &fsmEnt->tmrNode,
+                   cmTmrNsToTick(fsmEnt->timestamp) + 1);
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
+}
+
+/**
+ * Put the state timer back to the state deadline after a wait deadline
+ * Called with the control point lock held
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmRearmStateTmr(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt)
+{
+    fsmEnt->flags &= ~CM_FSM_ENT_FLAG_WAKE;
+    if (fsmEnt->timeout == 0)
+        cmTmrStop(&fsmCp->tmrWheel, &fsmEnt->tmrNode);
+    else
+        cmTmrStart(&fsmCp->tmrWheel, &fsmEnt->tmrNode,
+                   cmTmrNsToTick(fsmEnt->timestamp) + 1);
+}
+
+/**
+ * End the suspended output function of an instance, if any
+ * Called with the control point lock held
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmEndWait(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt)
+{
+    fsmEnt->coPt = 0;
+    if (!(fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT))
+        return;
+
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_WAKE)
+        cmFsmRearmStateTmr(fsmCp, fsmEnt);
+    fsmEnt->flags &= ~CM_FSM_ENT_FLAG_WAIT;
+    fsmCp->numWaiting--;
+}
+
+/**
+ * Stop an instance, it will not be run by the drivers anymore
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmInstStop(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt)
+{
+    CM_FSM_CP_LOCK(fsmCp);
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE)
+    {
+        cmFsmEndWait(fsmCp, fsmEnt);
+        cmTmrStop(&fsmCp->tmrWheel, &fsmEnt->tmrNode);
+        fsmEnt->flags &= ~(CM_FSM_ENT_FLAG_ACTIVE | CM_FSM_ENT_FLAG_TMO |
+                           CM_FSM_ENT_FLAG_WAKE);
+        fsmEnt->evtCnt = 0;
+        fsmCp->numActive--;
+        fsmCp->chgCnt++;
+        cmFsmBatchSync(fsmCp, fsmEnt);
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
+}
+
 /**
  * Initialize a common FSM Instance
+ * May run while other threads drive or post to the control point. The
+ * context must not hold an instance still running in it.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: context   context User context for FSM instance
+ * @param: instaName FSM instance name
+ * @return: SUCCESS      success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmInstInit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    void     *context,    /* user context for FSM instance */
+    S8       *instName,   /* instance name */
+    U16      initState)
+{
+    CmFsmEntity *fsmEnt;
+    CmTimeNs    tsNow;
+
+    if (!fsmCp || !context)
+    {
+        SLOGERR("Invalid Parameter, fsmCp:%p, context:%p\n",
+                fsmCp, context);
+        return (FAILURE);
+    }
+
+    if (!fsmCp->fsmMt && !fsmCp->sparse)
+    {
+        SLOGERR("FSM %s has no transition table", fsmCp->fsmStr);
+        return (FAILURE);
+    }
+
+    fsmEnt=GET_FSM_ENT_FROM_CONTEXT(fsmCp, context);
+
+    /* Its timer and list links are still in use, see cmFsmInstDeinit() */
+    if (fsmEnt->fsmCp == fsmCp && (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+    {
+        SLOGERR("FSM %s already running", fsmEnt->instName);
+        return (FAILURE);
+    }
+
+    /* Set Init State */
+    if (initState >= fsmCp->numStates)
+    {
+        SLOGERR("Invalid Initial State:%d, Max States:%d\n",
+                 initState, fsmCp->numStates);
+        return (FAILURE);
+    }
+
+    /* Built before it is published, the drivers only see it in the pool */
+    memset((U8 *)fsmEnt, 0, sizeof(CmFsmEntity));
+    fsmEnt->fsmCp = fsmCp;
+    fsmEnt->state = initState;
+    snprintf(fsmEnt->instName, CM_FSM_INST_STR_LEN,
+             "%s-%s", fsmCp->fsmStr, instName);
+    fsmEnt->instName[CM_FSM_INST_STR_LEN-1] = 0;
+    fsmEnt->timeout = fsmCp->states[initState].timeout;
+    SLOGINFO("Adding %d ms to current time",  fsmEnt->timeout);
+    tsNow = cmTimeNow();
+    fsmEnt->enterUs = CM_TIME_TO_US(tsNow);
+
+    /* Register the instance in the pool */
+    CM_FSM_CP_LOCK(fsmCp);
+    if (fsmCp->entPool)
+    {
+        if (fsmCp->numInst >= fsmCp->maxInst)
+        {
+            CM_FSM_CP_UNLOCK(fsmCp);
+            SLOGERR("FSM %s pool full, Max Instances:%u",
+                    fsmCp->fsmStr, fsmCp->maxInst);
+            return (FAILURE);
+        }
+        fsmEnt->poolIdx = fsmCp->numInst;
+        fsmCp->entPool[fsmCp->numInst++] = fsmEnt;
+        if (fsmCp->edf)
+            fsmCp->edf->lastRun[fsmEnt->poolIdx] = fsmCp->edf->passCnt;
+    }
+    fsmCp->fsmEnt  = fsmEnt;
+    fsmEnt->flags  = CM_FSM_ENT_FLAG_ACTIVE;
+    fsmCp->numActive++;
+    if (fsmCp->entPool)
+        cmFsmBatchSync(fsmCp, fsmEnt);
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    cmFsmArmTmr(fsmCp, fsmEnt, tsNow);
+
+    return SUCCESS;
+}
+
+/**
+ * Remove a FSM Instance from its control point pool
+ * The last pool slot is moved into the freed one. May run while other
+ * threads drive or post to the control point, but the context is only
+ * released once no output function of the instance runs any more.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: context   User context for FSM instance
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmInstDeinit(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    void     *context     /* user context for FSM instance */
+)
+{
+    CmFsmEntity *fsmEnt, *lastEnt, **link;
+
+    if (!fsmCp || !context)
+    {
+        SLOGERR("Invalid Parameter, fsmCp:%p, context:%p",
+                fsmCp, context);
+        return (FAILURE);
+    }
+
+    fsmEnt = GET_FSM_ENT_FROM_CONTEXT(fsmCp, context);
+    cmFsmInstStop(fsmCp, fsmEnt);
+
+    CM_FSM_CP_LOCK(fsmCp);
+
+    /* The context may be released by the caller, unlink it from the ready list */
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_READY)
+    {
+        lastEnt = NULL;
+        for (link = &fsmCp->readyHead; *link; link = &(*link)->readyNext)
+        {
+            if (*link == fsmEnt)
+            {
+                *link = fsmEnt->readyNext;
+                if (fsmCp->readyTail == fsmEnt)
+                    fsmCp->readyTail = lastEnt;
+                break;
+            }
+            lastEnt = *link;
+        }
+        fsmEnt->readyNext = NULL;
+        fsmEnt->flags &= ~CM_FSM_ENT_FLAG_READY;
+    }
+
+    if (fsmCp->entPool)
+    {
+        if (fsmEnt->poolIdx >= fsmCp->numInst ||
+            fsmCp->entPool[fsmEnt->poolIdx] != fsmEnt)
+        {
+            CM_FSM_CP_UNLOCK(fsmCp);
+            SLOGERR("FSM %s not found in pool", fsmEnt->instName);
+            return (FAILURE);
+        }
+        lastEnt = fsmCp->entPool[--fsmCp->numInst];
+        lastEnt->poolIdx = fsmEnt->poolIdx;
+        fsmCp->entPool[fsmEnt->poolIdx] = lastEnt;
+        fsmCp->entPool[fsmCp->numInst]  = NULL;
+        cmFsmBatchSync(fsmCp, lastEnt);
+        if (fsmCp->edf)
+            fsmCp->edf->lastRun[lastEnt->poolIdx] = fsmCp->edf->lastRun[fsmCp->numInst];
+    }
+
+    if (fsmCp->fsmEnt == fsmEnt)
+        fsmCp->fsmEnt = NULL;
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    return SUCCESS;
+}
+
+/**
+ * Allocate a zeroed context from a slab and start a FSM instance in it
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: slab      Context slab, objects large enough for the CP offset
+ * @param: instName  Instance name
+ * @param: initState Initial state
+ * @return: context, NULL if failed
+ *
+ */
+void *cmFsmInstAlloc(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    CmSlab   *slab,       /* context slab */
+    S8       *instName,   /* instance name */
+    U16      initState    /* initial state for this FSM instance */
+)
+{
+    void *context;
+
+    if (!fsmCp || !slab ||
+        slab->objSize < fsmCp->offset + sizeof(CmFsmEntity))
+    {
+        SLOGERR("Invalid Parameter, fsmCp:%p, slab:%p", fsmCp, slab);
+        return NULL;
+    }
+
+    context = cmSlabAlloc(slab);
+    if (!context)
+        return NULL;
+
+    if (!(slab->flags & CM_SLAB_FLAG_ZERO))
+        memset(context, 0, slab->objSize);
+
+    if (cmFsmInstInit(fsmCp, context, instName, initState) != SUCCESS)
+    {
+        cmSlabFree(slab, context);
+        return NULL;
+    }
+
+    return context;
+}
+
+/**
+ * Remove a FSM instance and give its context back to the slab
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: slab      Context slab
+ * @param: context   Context from cmFsmInstAlloc()
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmInstFree(
+    CmFsmCp  *fsmCp,      /* FSM control point */
+    CmSlab   *slab,       /* context slab */
+    void     *context     /* context from cmFsmInstAlloc() */
+)
+{
+    if (cmFsmInstDeinit(fsmCp, context) != SUCCESS)
+        return (FAILURE);
+
+    return cmSlabFree(slab, context);
+}
+
+/**
+ * Call the output function of a matrix cell
+ * A suspended output function keeps the cell for its resumption, any
+ * other return ends the wait.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @param: row       Matrix row, the state the cell belongs to
+ * @param: col       Matrix column
+ * @param: cell      The cell if already looked up, NULL otherwise
+ * @return: output function return, CM_FSM_SUSPEND reported as SUCCESS
+ *
+ */
+PRIVATE S16 cmFsmCallOutput(
+    CmFsmCp          *fsmCp,
+    CmFsmEntity      *fsmEnt,
+    U16              row,
+    U16              col,
+    const CmFsmEntry *cell
+)
+{
+    S16        ret;
+    CmFsmEntry lookup;
+    void       *context = CM_FSM_GET_CONTEXT(fsmEnt);
+
+    if (fsmCp->dispFn)
+    {
+        ret = fsmCp->dispFn(context, row, col);
+    }
+    else
+    {
+        if (!cell)
+        {
+            cmFsmGetCell(fsmCp, row, col, &lookup);
+            cell = &lookup;
+        }
+        ret = fsmCp->fsmFp(cell->outputFn, context);
+    }
+
+    CM_FSM_CP_LOCK(fsmCp);
+    if (ret == CM_FSM_SUSPEND)
+    {
+        if (!(fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT))
+        {
+            fsmEnt->flags |= CM_FSM_ENT_FLAG_WAIT;
+            fsmEnt->coRow  = row;
+            fsmEnt->coCol  = col;
+            fsmCp->numWaiting++;
+        }
+        ret = SUCCESS;
+    }
+    else
+    {
+        /* Ran to its end, the context may have changed */
+        fsmCp->chgCnt++;
+        cmFsmEndWait(fsmCp, fsmEnt);
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    return ret;
+}
+
+/**
+ * Resume the suspended output function of an instance
+ * No transition is taken, the output function sets the state itself.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance, CM_FSM_ENT_FLAG_WAIT set
+ * @return: SUCCESS  success
+ *          FAILURE  failed, the instance is no more runnable
+ *
+ */
+PRIVATE S16 cmFsmResumeInst(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt)
+{
+    fsmEnt->fsmCnt++;
+    if (cmFsmCallOutput(fsmCp, fsmEnt, fsmEnt->coRow, fsmEnt->coCol, NULL) != SUCCESS)
+    {
+        SLOGERR("Output Function in FSM return failure");
+    }
+
+    if (fsmEnt->state >= fsmCp->numStates)
+    {
+        SLOGERR(" Max States:%d reached!", fsmCp->numStates);
+        return (FAILURE);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Run one step of a FSM instance
+ * A suspended output function of the instance is abandoned.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @param: col       Matrix column, see CM_FSM_EVT_COL()
+ * @param: tsNow     Current time, read once by the caller
+ * @return: SUCCESS  success
+ *          FAILURE  failed, the instance is no more runnable
+ *
+ */
+PRIVATE S16 cmFsmRunInst(
+    CmFsmCp     *fsmCp,
+    CmFsmEntity *fsmEnt,
+    U16         col,
+    CmTimeNs    tsNow
+)
+{
+    S16 ret = FAILURE;
+    CmFsmEntry fsmRow;
+    U16 row = fsmEnt->state;
+
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT)
+    {
+        CM_FSM_CP_LOCK(fsmCp);
+        cmFsmEndWait(fsmCp, fsmEnt);
+        CM_FSM_CP_UNLOCK(fsmCp);
+    }
+
+    cmFsmGetCell(fsmCp, row, col, &fsmRow);
+
+    if ( fsmRow.nextState <= fsmCp->numStates )
+    {
+        fsmEnt->lastState = fsmEnt->state;
+        fsmEnt->state    = fsmRow.nextState;
+        fsmEnt->timeout = fsmCp->states[fsmRow.nextState].timeout;
+        if (fsmEnt->lastState != fsmEnt->state)
+        {
+            cmFsmBatchSync(fsmCp, fsmEnt);
+            cmFsmArmTmr(fsmCp, fsmEnt, tsNow);
+            cmFsmTraceRecord(fsmEnt, fsmEnt->lastState, fsmEnt->state, col, tsNow);
+        }
+        SLOGINFO("FSM %s, STAT %s-->%s timeout %d", fsmEnt->instName, 
+                 fsmCp->states[fsmEnt->lastState].stateStr, 
+                 fsmCp->states[fsmEnt->state].stateStr, fsmEnt->timeout);
+    }
+    else
+    {
+        /* the output function will set the new state if required */
+        SLOGINFO("FSM %s, STAT %s\n", fsmEnt->instName,
+                 fsmCp->states[fsmEnt->state].stateStr);
+    }
+
+    fsmEnt->fsmCnt++;
+    if (fsmRow.outputFn)
+    {
+        ret = cmFsmCallOutput(fsmCp, fsmEnt, row, col, &fsmRow);
+        if (ret != SUCCESS)
+        {
+            SLOGERR("Output Function in FSM return failure");
+        }
+    }
+    else if (fsmCp->mode != CM_FSM_MODE_EVENT)
+    {
+       SLOGERR("CM_FSM:fsmRow does not have an output func");
+       ABORT_DEBUG;
+    }
+
+    if (fsmEnt->state >= fsmCp->numStates)
+    {
+        SLOGERR(" Max States:%d reached!", fsmCp->numStates);
+        return (FAILURE);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Run one polling step of a FSM instance
+ * The TIMEOUT column is used once the state timer expired
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @param: tsNow     Current time
+ * @return: SUCCESS  success
+ *          FAILURE  failed, the instance is no more runnable
+ *
+ */
+PRIVATE S16 cmFsmPollInst(
+    CmFsmCp     *fsmCp,
+    CmFsmEntity *fsmEnt,
+    CmTimeNs    tsNow
+)
+{
+    U16 col = CM_FSM_EVT_COL(CM_FSM_CTRL_NORMAL);
+
+    /* State timer expired in the wheel */
+    CM_FSM_CP_LOCK(fsmCp);
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_TMO)
+    {
+        /* FSM State Timed out */
+        fsmEnt->flags &= ~CM_FSM_ENT_FLAG_TMO;
+        col = CM_FSM_EVT_COL(CM_FSM_CTRL_TIMEOUT);
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    /* A suspended output function resumes until it is done or times out */
+    if ((fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT) &&
+        col == CM_FSM_EVT_COL(CM_FSM_CTRL_NORMAL))
+    {
+        return cmFsmResumeInst(fsmCp, fsmEnt);
+    }
+
+    fsmEnt->curEvt.eventId = col + CM_FSM_CTRL_NORMAL;
+    fsmEnt->curEvt.payload = NULL;
+    return cmFsmRunInst(fsmCp, fsmEnt, col, tsNow);
+}
+
+/**
+ * Add an instance at the tail of the ready list
+ * Called with the control point lock held
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmMakeReady(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt)
+{
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_READY)
+        return;
+
+    fsmEnt->flags |= CM_FSM_ENT_FLAG_READY;
+    fsmEnt->readyNext = NULL;
+    if (fsmCp->readyTail)
+        fsmCp->readyTail->readyNext = fsmEnt;
+    else
+        fsmCp->readyHead = fsmEnt;
+    fsmCp->readyTail = fsmEnt;
+}
+
+/**
+ * Timing wheel callback for an expired state timer
+ * Event mode runs the TIMEOUT column right away, polling mode and
+ * deferred passes flag the instance so that its next step uses the
+ * TIMEOUT column. A flag cleared by a state change in between drops
+ * the stale timeout. A timer armed to the wait deadline of a suspended
+ * output function only wakes the instance up.
+ *
+ * @param: node      State timer of the instance
+ * @param: arg       Driver pass arguments
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmTmrExpiryCb(CmTmrNode *node, void *arg)
+{
+    CmFsmDrvPass *pass   = arg;
+    CmFsmCp      *fsmCp  = pass->fsmCp;
+    CmFsmEntity  *fsmEnt = CM_TMR_NODE_ENTRY(node, CmFsmEntity, tmrNode);
+
+    /* Wait deadline of a suspended output function, the state timer goes on */
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_WAKE)
+    {
+        cmFsmRearmStateTmr(fsmCp, fsmEnt);
+        if (fsmCp->mode == CM_FSM_MODE_EVENT)
+            cmFsmMakeReady(fsmCp, fsmEnt);
+        return;
+    }
+
+    if (fsmCp->mode != CM_FSM_MODE_EVENT || pass->deferred)
+    {
+        fsmEnt->flags |= CM_FSM_ENT_FLAG_TMO;
+        if (fsmCp->mode == CM_FSM_MODE_EVENT)
+            cmFsmMakeReady(fsmCp, fsmEnt);
+        return;
+    }
+
+    fsmCp->fsmEnt = fsmEnt;
+    fsmEnt->curEvt.eventId = CM_FSM_CTRL_TIMEOUT;
+    fsmEnt->curEvt.payload = NULL;
+    if (cmFsmRunInst(fsmCp, fsmEnt, CM_FSM_EVT_COL(CM_FSM_CTRL_TIMEOUT),
+                     pass->tsNow) != SUCCESS)
+    {
+        cmFsmInstStop(fsmCp, fsmEnt);
+    }
+}
+
+/**
+ * Expire the state timers due at the current time
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmExpireTmrs( CmFsmCp *fsmCp, CmTimeNs tsNow )
+{
+    CmFsmDrvPass pass;
+
+    pass.fsmCp    = fsmCp;
+    pass.tsNow    = tsNow;
+    pass.deferred = FALSE;
+    cmTmrExpire(&fsmCp->tmrWheel, cmTmrNsToTick(tsNow), cmFsmTmrExpiryCb, &pass);
+}
+
+/**
+ * Expire the state timers due at the current time without running them
+ * Timed out instances are flagged and, in event mode, made ready. Their
+ * TIMEOUT column runs in their next cmFsmInstStep().
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+void cmFsmCollectTmrs( CmFsmCp *fsmCp, CmTimeNs tsNow )
+{
+    CmFsmDrvPass pass;
+
+    pass.fsmCp    = fsmCp;
+    pass.tsNow    = tsNow;
+    pass.deferred = TRUE;
+    CM_FSM_CP_LOCK(fsmCp);
+    cmTmrExpire(&fsmCp->tmrWheel, cmTmrNsToTick(tsNow), cmFsmTmrExpiryCb, &pass);
+    CM_FSM_CP_UNLOCK(fsmCp);
+}
+
+/**
+ * Detach instances from the head of the ready list
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: ents      Output instance array
+ * @param: maxEnts   Capacity of ents
+ * @return: number of instances returned
+ *
+ */
+U32 cmFsmTakeReady( CmFsmCp *fsmCp, CmFsmEntity **ents, U32 maxEnts )
+{
+    CmFsmEntity *fsmEnt;
+    U32         num = 0;
+
+    CM_FSM_CP_LOCK(fsmCp);
+    while (num < maxEnts && (fsmEnt = fsmCp->readyHead) != NULL)
+    {
+        fsmCp->readyHead = fsmEnt->readyNext;
+        fsmEnt->readyNext = NULL;
+        fsmEnt->flags &= ~CM_FSM_ENT_FLAG_READY;
+        ents[num++] = fsmEnt;
+    }
+    if (!fsmCp->readyHead)
+        fsmCp->readyTail = NULL;
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    return num;
+}
+
+/**
+ * Run the events pending on an event mode instance
+ * A timed out state runs its TIMEOUT column first, otherwise a
+ * suspended output function resumes first and holds the pending events
+ * until it is done. Events posted while running put the instance back
+ * on the ready list for the next pass.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmEvtInst(
+    CmFsmCp     *fsmCp,
+    CmFsmEntity *fsmEnt,
+    CmTimeNs    tsNow
+)
+{
+    CmFsmEvt evt;
+    U8       numEvt;
+    bool     timedOut;
+
+    CM_FSM_CP_LOCK(fsmCp);
+    timedOut = (fsmEnt->flags & CM_FSM_ENT_FLAG_TMO) != 0;
+    fsmEnt->flags &= ~CM_FSM_ENT_FLAG_TMO;
+    numEvt = fsmEnt->evtCnt;
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    if (timedOut)
+    {
+        fsmEnt->curEvt.eventId = CM_FSM_CTRL_TIMEOUT;
+        fsmEnt->curEvt.payload = NULL;
+        if (cmFsmRunInst(fsmCp, fsmEnt, CM_FSM_EVT_COL(CM_FSM_CTRL_TIMEOUT),
+                         tsNow) != SUCCESS)
+        {
+            cmFsmInstStop(fsmCp, fsmEnt);
+        }
+    }
+    else if (fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT)
+    {
+        if (cmFsmResumeInst(fsmCp, fsmEnt) != SUCCESS)
+            cmFsmInstStop(fsmCp, fsmEnt);
+    }
+
+    /* Pending events wait for the suspended output function to be done */
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT)
+        return;
+
+    for (; numEvt && (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE); numEvt--)
+    {
+        CM_FSM_CP_LOCK(fsmCp);
+        if (!fsmEnt->evtCnt)
+        {
+            CM_FSM_CP_UNLOCK(fsmCp);
+            break;
+        }
+        evt = fsmEnt->evtQ[fsmEnt->evtHead];
+        fsmEnt->evtHead = (fsmEnt->evtHead + 1) % CM_FSM_EVT_QUEUE_LEN;
+        fsmEnt->evtCnt--;
+        CM_FSM_CP_UNLOCK(fsmCp);
+
+        fsmEnt->curEvt = evt;
+        if (cmFsmRunInst(fsmCp, fsmEnt, CM_FSM_EVT_COL(evt.eventId),
+                         tsNow) != SUCCESS)
+        {
+            cmFsmInstStop(fsmCp, fsmEnt);
+        }
+    }
+
+    CM_FSM_CP_LOCK(fsmCp);
+    if (fsmEnt->evtCnt && (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+        cmFsmMakeReady(fsmCp, fsmEnt);
+    CM_FSM_CP_UNLOCK(fsmCp);
+}
+
+/**
+ * Run one scheduling step of a FSM instance
+ * Polling mode runs one NORMAL or TIMEOUT step, event mode runs the
+ * pending timeout and events. An instance must only be stepped by one
+ * thread at a time.
+ *
+ * @param: fsmEnt    FSM instance
+ * @param: tsNow     Current time
+ * @return: SUCCESS  instance still runnable
+ *          FAILURE  instance stopped
+ *
+ */
+S16 cmFsmInstStep( CmFsmEntity *fsmEnt, CmTimeNs tsNow )
+{
+    CmFsmCp *fsmCp = fsmEnt->fsmCp;
+
+    if (!(fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+        return (FAILURE);
+
+    if (fsmCp->mode == CM_FSM_MODE_EVENT)
+        cmFsmEvtInst(fsmCp, fsmEnt, tsNow);
+    else if (cmFsmPollInst(fsmCp, fsmEnt, tsNow) != SUCCESS)
+        cmFsmInstStop(fsmCp, fsmEnt);
+
+    return (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE) ? SUCCESS : FAILURE;
+}
+
+/**
+ * Event mode driver pass
+ * Every instance on the ready list consumes the events pending when it
+ * is picked up. Events posted during the pass are run by the next pass.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmDriverEvt( CmFsmCp *fsmCp, CmTimeNs tsNow )
+{
+    CmFsmEntity *fsmEnt, *nextEnt;
+
+    /* Detach the ready list, events posted from now on run next pass */
+    CM_FSM_CP_LOCK(fsmCp);
+    fsmEnt = fsmCp->readyHead;
+    fsmCp->readyHead = fsmCp->readyTail = NULL;
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    while (fsmEnt)
+    {
+        /* Posters test the flag under the lock to queue the instance again */
+        CM_FSM_CP_LOCK(fsmCp);
+        nextEnt = fsmEnt->readyNext;
+        fsmEnt->readyNext = NULL;
+        fsmEnt->flags &= ~CM_FSM_ENT_FLAG_READY;
+        CM_FSM_CP_UNLOCK(fsmCp);
+
+        fsmCp->fsmEnt = fsmEnt;
+        cmFsmEvtInst(fsmCp, fsmEnt, tsNow);
+
+        fsmEnt = nextEnt;
+    }
+}
+
+/**
+ * Post an event to a FSM instance of an event mode control point
+ * The event is queued and run by the next cmFsmDriverAll() pass
+ *
+ * @param: fsmEnt    FSM instance
+ * @param: eventId   CM_FSM_CTRL_NORMAL or application event
+ * @param: payload   Event data, must stay valid until it is processed
+ * @return: SUCCESS  success
+ *          FAILURE  invalid event, stopped instance or queue full
+ *
+ */
+S16 cmFsmPostEvent(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    U16         eventId,  /* CM_FSM_CTRL_NORMAL or application event */
+    void        *payload  /* event data */
+)
+{
+    CmFsmCp  *fsmCp;
+    CmFsmEvt *evt;
+
+    if (!fsmEnt || !fsmEnt->fsmCp)
+    {
+        SLOGERR("Invalid fsmEnt:%p ",fsmEnt);
+        return (FAILURE);
+    }
+
+    fsmCp = fsmEnt->fsmCp;
+    if (fsmCp->mode != CM_FSM_MODE_EVENT ||
+        eventId < CM_FSM_CTRL_NORMAL ||
+        CM_FSM_EVT_COL(eventId) >= fsmCp->numCols)
+    {
+        SLOGERR("FSM %s invalid event:%d, numCols:%d",
+                fsmEnt->instName, eventId, fsmCp->numCols);
+        return (FAILURE);
+    }
+
+    CM_FSM_CP_LOCK(fsmCp);
+    if (!(fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+    {
+        CM_FSM_CP_UNLOCK(fsmCp);
+        return (FAILURE);
+    }
+
+    if (fsmEnt->evtCnt >= CM_FSM_EVT_QUEUE_LEN)
+    {
+        fsmCp->evtDropCnt++;
+        CM_FSM_CP_UNLOCK(fsmCp);
+        SLOGERR("FSM %s event queue full, event:%d dropped",
+                fsmEnt->instName, eventId);
+        return (FAILURE);
+    }
+
+    evt = &fsmEnt->evtQ[(fsmEnt->evtHead + fsmEnt->evtCnt) % CM_FSM_EVT_QUEUE_LEN];
+    evt->eventId = eventId;
+    evt->payload = payload;
+    fsmEnt->evtCnt++;
+
+    cmFsmMakeReady(fsmCp, fsmEnt);
+    CM_FSM_CP_UNLOCK(fsmCp);
+    return SUCCESS;
+}
+
+/**
+ * Returns the event being processed by a FSM instance
+ * Called from the output functions
+ *
+ * @param: fsmEnt    FSM instance
+ * @param: eventId   Event to be returned
+ * @param: payload   Event data to be returned
+ * @return: SUCCESS  successful
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmGetEvent(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    U16         *eventId, /* event being processed */
+    void        **payload /* event data */
+)
+{
+    if (!fsmEnt)
+    {
+        SLOGERR("Invalid fsmEnt:%p ",fsmEnt);
+        return (FAILURE);
+    }
+
+    if (eventId) *eventId = fsmEnt->curEvt.eventId;
+    if (payload) *payload = fsmEnt->curEvt.payload;
+    return SUCCESS;
+}
+
+/**
+ * Wait from a suspended output function, see CM_FSM_CO_WAIT_UNTIL()
+ * The state timer is armed to the wait deadline when it comes first,
+ * its expiry then only wakes the instance up.
+ *
+ * @param: fsmEnt    FSM instance
+ * @param: deadline  Monotonic wake-up deadline, NULL for none
+ * @return: CM_FSM_SUSPEND  suspend the output function
+ *          SUCCESS         deadline passed, go on
+ *          FAILURE         invalid instance
+ *
+ */
+S16 cmFsmInstWait(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    CmTimeNs    *deadline /* monotonic wake-up deadline, NULL for none */
+)
+{
+    CmFsmCp   *fsmCp;
+
+    if (!fsmEnt || !fsmEnt->fsmCp)
+    {
+        SLOGERR("Invalid fsmEnt:%p ",fsmEnt);
+        return (FAILURE);
+    }
+
+    if (!deadline)
+        return CM_FSM_SUSPEND;
+
+    if (cmTimeNow() >= *deadline)
+        return SUCCESS;
+
+    fsmCp = fsmEnt->fsmCp;
+    CM_FSM_CP_LOCK(fsmCp);
+    if (fsmEnt->timeout == 0 ||
+        *deadline < fsmEnt->timestamp)
+    {
+        /* Tick rounded up, the wake-up never comes before the deadline */
+        cmTmrStart(&fsmCp->tmrWheel, &fsmEnt->tmrNode, cmTmrNsToTick(*deadline) + 1);
+        fsmEnt->flags |= CM_FSM_ENT_FLAG_WAKE;
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    return CM_FSM_SUSPEND;
+}
+
+/**
+ * Wake up the suspended output function of an event mode instance
+ * Polling mode resumes suspended output functions on every pass.
+ *
+ * @param: fsmEnt    FSM instance
+ * @return: SUCCESS  success
+ *          FAILURE  invalid or stopped instance
+ *
+ */
+S16 cmFsmInstWake( CmFsmEntity *fsmEnt )
+{
+    CmFsmCp *fsmCp;
+
+    if (!fsmEnt || !fsmEnt->fsmCp)
+    {
+        SLOGERR("Invalid fsmEnt:%p ",fsmEnt);
+        return (FAILURE);
+    }
+
+    fsmCp = fsmEnt->fsmCp;
+    CM_FSM_CP_LOCK(fsmCp);
+    if (!(fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+    {
+        CM_FSM_CP_UNLOCK(fsmCp);
+        return (FAILURE);
+    }
+    if (fsmCp->mode == CM_FSM_MODE_EVENT && (fsmEnt->flags & CM_FSM_ENT_FLAG_WAIT))
+        cmFsmMakeReady(fsmCp, fsmEnt);
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    return SUCCESS;
+}
+
+/**
+ * FSM Driver to run a FSM instance
+ *
+ * @param: fsmCp     FSM Control Point
+ * @return: SUCCESS      success
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmDriver( CmFsmCp *fsmCp )
+{
+    CmTimeNs  tsNow;
+
+    tsNow = cmTimeNow();
+    cmFsmExpireTmrs(fsmCp, tsNow);
+    return cmFsmPollInst(fsmCp, fsmCp->fsmEnt, tsNow);
+}
+
+/**
+ * Group a chunk of instances by state and run the groups
+ * The instances are counting sorted into batchEnts, keeping their
+ * order within a group.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: ents      Instances of the chunk
+ * @param: states    State of each instance, CM_FSM_BATCH_IDLE to skip
+ * @param: numEnts   Instances in the chunk, up to CM_FSM_BATCH_CHUNK
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmRunChunk(
+    CmFsmCp     *fsmCp,
+    CmFsmEntity **ents,
+    U16         *states,
+    U32         numEnts,
+    CmTimeNs    tsNow
+)
+{
+    CmFsmEntity *fsmEnt;
+    U32         *batchEnd = fsmCp->batchEnd;
+    U32         numGrp = fsmCp->numStates + 1;
+    U32         i, state, sum, cnt;
+    U8          *line;
+
+    memset(batchEnd, 0, numGrp * sizeof(U32));
+    for (i = 0; i < numEnts; i++)
+    {
+        if (states[i] != CM_FSM_BATCH_IDLE)
+            batchEnd[states[i]]++;
+    }
+
+    /* Group starts, then scatter; batchEnd ends up at the group ends */
+    for (state = 0, sum = 0; state < numGrp; state++)
+    {
+        cnt = batchEnd[state];
+        batchEnd[state] = sum;
+        sum += cnt;
+    }
+    /* Fetch the chunk in memory order, the groups then run from cache */
+    for (i = 0; i < numEnts; i++)
+    {
+        if (states[i] != CM_FSM_BATCH_IDLE)
+        {
+            fsmEnt = ents[i];
+            for (line = CM_FSM_GET_CONTEXT(fsmEnt); line < (U8 *)(fsmEnt + 1); line += 64)
+                __builtin_prefetch(line, 1);
+            fsmCp->batchEnts[batchEnd[states[i]]++] = fsmEnt;
+        }
+    }
+
+    for (i = 0; i < sum; i++)
+    {
+        fsmEnt = fsmCp->batchEnts[i];
+        fsmCp->fsmEnt = fsmEnt;
+        if (fsmCp->mode == CM_FSM_MODE_EVENT)
+            cmFsmEvtInst(fsmCp, fsmEnt, tsNow);
+        else if (cmFsmPollInst(fsmCp, fsmEnt, tsNow) != SUCCESS)
+            cmFsmInstStop(fsmCp, fsmEnt);
+    }
+}
+
+/**
+ * Batch mode driver pass
+ * The runnable instances, the whole pool in polling mode or the ready
+ * list in event mode, run in chunks of CM_FSM_BATCH_CHUNK grouped by
+ * state. A chunk stays cache resident while its groups run, the chunks
+ * themselves walk the memory in order. Polling mode groups from the
+ * batchState array, without touching the instances. Instances added
+ * during the pass run in the next one.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: tsNow     Current time
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmDriverBatch( CmFsmCp *fsmCp, CmTimeNs tsNow )
+{
+    CmFsmEntity *fsmEnt, *readyList;
+    CmFsmEntity *ents[CM_FSM_BATCH_CHUNK];
+    U16         states[CM_FSM_BATCH_CHUNK];
+    U32         i, num, numInst;
+
+    if (fsmCp->mode != CM_FSM_MODE_EVENT)
+    {
+        numInst = fsmCp->numInst;
+        for (i = 0; i < numInst; i += num)
+        {
+            num = numInst - i;
+            if (num > CM_FSM_BATCH_CHUNK)
+                num = CM_FSM_BATCH_CHUNK;
+            cmFsmRunChunk(fsmCp, &fsmCp->entPool[i], &fsmCp->batchState[i],
+                          num, tsNow);
+        }
+        return;
+    }
+
+    CM_FSM_CP_LOCK(fsmCp);
+    readyList = fsmCp->readyHead;
+    fsmCp->readyHead = fsmCp->readyTail = NULL;
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    while (readyList)
+    {
+        CM_FSM_CP_LOCK(fsmCp);
+        for (num = 0; readyList && num < CM_FSM_BATCH_CHUNK; num++)
+        {
+            fsmEnt = readyList;
+            readyList = fsmEnt->readyNext;
+            fsmEnt->readyNext = NULL;
+            fsmEnt->flags &= ~CM_FSM_ENT_FLAG_READY;
+            ents[num]   = fsmEnt;
+            states[num] = fsmEnt->state;
+        }
+        CM_FSM_CP_UNLOCK(fsmCp);
+        cmFsmRunChunk(fsmCp, ents, states, num, tsNow);
+    }
+}
+
+/**
+ * Restore the heap order below one EDF heap slot
+ *
+ * @param: heap      EDF heap
+ * @param: num       Nodes in the heap
+ * @param: i         Slot to sift down
+ * @return: None
+ *
+ */
+PRIVATE void cmFsmEdfSiftDown(CmFsmEdfNode *heap, U32 num, U32 i)
+{
+    CmFsmEdfNode node = heap[i];
+    U32          child;
+
+    while ((child = 2 * i + 1) < num)
+    {
+        if (child + 1 < num && heap[child + 1].key < heap[child].key)
+            child++;
+        if (node.key <= heap[child].key)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = node;
+}
+
+/**
+ * EDF mode driver pass
+ * The runnable instances are heaped on their deadline and run earliest
+ * first until the budget of the pass is used up. The clock is read again
+ * every CM_FSM_EDF_CHECK instances, to check the budget and to measure
+ * how late the instances run.
  *
  * @param: fsmCp     FSM Control Point
- * @param: context   context User context for FSM instance
- * @param: instaName FSM instance name
- * @return: SUCCESS      success
- *          FAILURE  failed
+ * @param: tsNow     Current time
+ * @return: None
  *
  */
-S16 cmFsmInstInit(
-    CmFsmCp  *fsmCp,      /* FSM control point */
-    void     *context,    /* user context for FSM instance */
-    S8       *instName,   /* instance name */
-    U16      initState)
+PRIVATE void cmFsmDriverEdf( CmFsmCp *fsmCp, CmTimeNs tsNow )
 {
-    CmFsmEntity *fsmEnt;
+    CmFsmEdf     *edf  = fsmCp->edf;
+    CmFsmEdfNode *heap = edf->heap;
+    CmFsmEntity  *fsmEnt, *readyList;
+    CmTimeNs     tsRun = tsNow, late;
+    U32          i, num = 0, ran;
 
-    if (!fsmCp || !context)
+    if (fsmCp->mode == CM_FSM_MODE_EVENT)
     {
-        SLOGERR("Invalid Parameter, fsmCp:%p, context:%p\n",
-                fsmCp, context);
-        return (FAILURE);
+        CM_FSM_CP_LOCK(fsmCp);
+        readyList = fsmCp->readyHead;
+        fsmCp->readyHead = fsmCp->readyTail = NULL;
+        for (; readyList; readyList = fsmEnt->readyNext)
+        {
+            fsmEnt = readyList;
+            fsmEnt->flags &= ~CM_FSM_ENT_FLAG_READY;
+            heap[num++].fsmEnt = fsmEnt;
+        }
+        CM_FSM_CP_UNLOCK(fsmCp);
+    }
+    else
+    {
+        for (i = 0; i < fsmCp->numInst; i++)
+        {
+            if (fsmCp->entPool[i]->flags & CM_FSM_ENT_FLAG_ACTIVE)
+                heap[num++].fsmEnt = fsmCp->entPool[i];
+        }
     }
 
-    fsmEnt=GET_FSM_ENT_FROM_CONTEXT(fsmCp, context);
+    for (i = 0; i < num; i++)
+    {
+        fsmEnt = heap[i].fsmEnt;
+        fsmEnt->readyNext = NULL;
+        heap[i].key = fsmEnt->timeout ? fsmEnt->timestamp :
+                      CM_FSM_EDF_NO_DEADLINE + edf->lastRun[fsmEnt->poolIdx];
+    }
+    for (i = num / 2; i-- > 0; )
+        cmFsmEdfSiftDown(heap, num, i);
 
-    memset((U8 *)fsmEnt, 0, sizeof(CmFsmEntity));
+    edf->passCnt++;
+    for (ran = 0; num; ran++)
+    {
+        if (ran && ran % CM_FSM_EDF_CHECK == 0)
+        {
+            tsRun = cmTimeNow();
+            if (edf->budget && tsRun - tsNow >= edf->budget)
+                break;
+        }
 
-    fsmEnt->fsmCp  = fsmCp;
-    fsmCp->fsmEnt  = fsmEnt;
+        fsmEnt = heap[0].fsmEnt;
+        if (heap[0].key < CM_FSM_EDF_NO_DEADLINE && tsRun > heap[0].key)
+        {
+            late = tsRun - heap[0].key;
+            if (late > edf->lateMax)
+                edf->lateMax = late;
+            if (late > CM_FSM_EDF_SLACK)
+                edf->missCnt++;
+        }
+        heap[0] = heap[--num];
+        cmFsmEdfSiftDown(heap, num, 0);
 
-    /* Set Init State */
-    if (initState >= fsmCp->numStates)
-    {
-        SLOGERR("Invalid Initial State:%d, Max States:%d\n",
-                 initState, fsmCp->numStates);
-        return (FAILURE);
+        edf->lastRun[fsmEnt->poolIdx] = edf->passCnt;
+        fsmCp->fsmEnt = fsmEnt;
+        if (fsmCp->mode == CM_FSM_MODE_EVENT)
+            cmFsmEvtInst(fsmCp, fsmEnt, tsRun);
+        else if (cmFsmPollInst(fsmCp, fsmEnt, tsRun) != SUCCESS)
+            cmFsmInstStop(fsmCp, fsmEnt);
     }
+    edf->runCnt += ran;
 
-    fsmEnt->state = initState;
-    snprintf(fsmEnt->instName, CM_FSM_INST_STR_LEN,
-             "%s-%s", fsmCp->fsmStr, instName);
-    fsmEnt->instName[CM_FSM_INST_STR_LEN-1] = 0;
-    fsmEnt->timeout = fsmCp->states[initState].timeout;
-    SLOGINFO("Adding %d ms to current time",  fsmEnt->timeout);
-    SGetMonotonicTime(&fsmEnt->timestamp);
-    SAddMsToTimeStamp(&fsmEnt->timestamp, fsmEnt->timeout);
+    if (!num)
+        return;
 
-    return SUCCESS;
+    /* Overload, the latest deadlines wait for the next pass */
+    edf->overCnt++;
+    edf->deferCnt += num;
+    if (fsmCp->mode != CM_FSM_MODE_EVENT)
+        return;
+
+    CM_FSM_CP_LOCK(fsmCp);
+    for (i = 0; i < num; i++)
+    {
+        if (heap[i].fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE)
+            cmFsmMakeReady(fsmCp, heap[i].fsmEnt);
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
 }
 
 /**
- * FSM Driver to run a FSM instance
+ * FSM Driver to run all the runnable instances of a control point
+ * The clock is read once for the whole pass and the state timers due
+ * are expired in bulk first. Instances failing to run are deactivated
+ * and skipped by the following passes.
+ * In event mode only instances with pending events or expired
+ * state timers are run. Batch mode control points run them grouped
+ * by state, see cmFsmCpBatchInit(), EDF mode control points by
+ * deadline within a time budget, see cmFsmCpEdfInit().
  *
  * @param: fsmCp     FSM Control Point
- * @return: SUCCESS      success
- *          FAILURE  failed
+ * @return: number of instances still runnable
+ *          FAILURE  invalid control point
  *
  */
-S16 cmFsmDriver( CmFsmCp *fsmCp )
+S32 cmFsmDriverAll( CmFsmCp *fsmCp )
 {
-    S16 ret = FAILURE;
-    CmFsmEntry *fsmRow;
-    void *context;
-    CmFsmEntity *fsmEnt = fsmCp->fsmEnt;
-    
-    fsmRow = fsmCp->fsmMt + fsmEnt->state*CM_FSM_CTRL_MAX;
+    CmTimeNs    tsNow;
+    CmFsmEntity *fsmEnt;
+    U32         i;
 
-    /* Check if the instance FSM instance timeout */
-    ret = cmFsmCheckTmr(fsmCp);
-    if (ret != TIME_NOT_EXPIRED)
+    if (!fsmCp)
     {
-        /* FSM State Timed out */
-        fsmRow ++; // point to next timeout control function point
+        SLOGERR("Invalid fsmCp:%p ",fsmCp);
+        return (FAILURE);
     }
 
-    if ( fsmRow->nextState <= fsmCp->numStates )
+    tsNow = cmTimeNow();
+
+    /* Timed out instances take their turn in the EDF order */
+    if (fsmCp->edf)
     {
-        fsmEnt->lastState = fsmEnt->state;
-        fsmEnt->state    = fsmRow->nextState;
-        fsmEnt->timeout = fsmCp->states[fsmRow->nextState].timeout;
-        if (fsmEnt->lastState != fsmEnt->state)
-        {
-            SGetMonotonicTime(&fsmEnt->timestamp);
-            SAddMsToTimeStamp(&fsmEnt->timestamp, fsmEnt->timeout);
-        }
-        SLOGINFO("FSM %s, STAT %s-->%s timeout %d", fsmEnt->instName, 
-                 fsmCp->states[fsmEnt->lastState].stateStr, 
-                 fsmCp->states[fsmEnt->state].stateStr, fsmEnt->timeout);
+        cmFsmCollectTmrs(fsmCp, tsNow);
+        cmFsmDriverEdf(fsmCp, tsNow);
+        return fsmCp->numActive;
     }
-    else
+
+    cmFsmExpireTmrs(fsmCp, tsNow);
+
+    if (fsmCp->batchEnts)
     {
-        /* the output function will set the new state if required */
-        SLOGINFO("FSM %s, STAT %s\n", fsmEnt->instName,
-                 fsmCp->states[fsmEnt->state].stateStr);
+        cmFsmDriverBatch(fsmCp, tsNow);
+        return fsmCp->numActive;
     }
 
-    if (fsmRow->outputFn)
+    if (fsmCp->mode == CM_FSM_MODE_EVENT)
     {
-        context = CM_FSM_GET_CONTEXT(fsmEnt);
-        ret = fsmCp->fsmFp(fsmRow->outputFn, context);
-        if (ret != SUCCESS)
+        cmFsmDriverEvt(fsmCp, tsNow);
+        return fsmCp->numActive;
+    }
+
+    /* Single instance control point */
+    if (!fsmCp->entPool)
+    {
+        fsmEnt = fsmCp->fsmEnt;
+        if (fsmEnt && (fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE) &&
+            cmFsmPollInst(fsmCp, fsmEnt, tsNow) != SUCCESS)
         {
-            SLOGERR("Output Function in FSM return failure");
+            cmFsmInstStop(fsmCp, fsmEnt);
         }
+        return fsmCp->numActive;
     }
-    else
+
+    /* numInst re-read on purpose: output functions may add instances */
+    for (i = 0; i < fsmCp->numInst; i++)
     {
-       SLOGERR("CM_FSM:fsmRow does not have an output func");
-       ABORT_DEBUG;
+        fsmEnt = fsmCp->entPool[i];
+        if (!(fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+            continue;
+
+        fsmCp->fsmEnt = fsmEnt;
+        if (cmFsmPollInst(fsmCp, fsmEnt, tsNow) != SUCCESS)
+        {
+            cmFsmInstStop(fsmCp, fsmEnt);
+        }
     }
 
-    if (fsmEnt->state >= fsmCp->numStates)
-    {
-        SLOGERR(" Max States:%d reached!", fsmCp->numStates);
+    return fsmCp->numActive;
+}
+
+/**
+ * Returns the time the control point next needs a driver pass
+ * Polling mode and pending events need a pass right away, unless all
+ * the instances wait in suspended output functions. Otherwise the
+ * earliest armed state or wait timer gives the deadline.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: deadline  Monotonic deadline to be returned
+ * @return: SUCCESS  deadline returned
+ *          FAILURE  nothing scheduled, only a new event can wake it up
+ *
+ */
+S16 cmFsmNextDeadline( CmFsmCp *fsmCp, CmTimeNs *deadline )
+{
+    U64 tick;
+
+    if (!fsmCp || !deadline || !fsmCp->numActive)
         return (FAILURE);
+
+    if ((fsmCp->mode != CM_FSM_MODE_EVENT && fsmCp->numWaiting < fsmCp->numActive) ||
+        fsmCp->readyHead)
+    {
+        *deadline = cmTimeNow();
+        return (SUCCESS);
     }
 
-    return SUCCESS;
+    if (cmTmrNextExpiry(&fsmCp->tmrWheel, &tick) != SUCCESS)
+        return (FAILURE);
+
+    *deadline = cmTmrTickToNs(tick);
+    return (SUCCESS);
 }
 
 /**
@@ -202,14 +1787,29 @@ S16 cmFsmDriver( CmFsmCp *fsmCp )
  *
  */
 U32 cmFsmCheckTmr( CmFsmCp *fsmCp )
+{
+    if (fsmCp->states[fsmCp->fsmEnt->state].timeout == 0)
+        return TIME_NOT_EXPIRED;
+
+    return cmFsmInstCheckTmr(fsmCp->fsmEnt, cmTimeNow());
+}
+
+/**
+ * Check if the state of one instance timed out against a given time
+ *
+ * @param: fsmEnt    FSM instance
+ * @param: tsNow     Current time
+ * @return: TIME_EXPIRED  state timed out
+ *          others        state not timed out
+ *
+ */
+U32 cmFsmInstCheckTmr( CmFsmEntity *fsmEnt, CmTimeNs tsNow )
 {
     U32 ret = TIME_NOT_EXPIRED;
-    TIMESTAMP ts;
 
-    if (fsmCp->states[fsmCp->fsmEnt->state].timeout > 0)
+    if (fsmEnt->fsmCp->states[fsmEnt->state].timeout > 0)
     {
-        SGetMonotonicTime(&ts);
-        ret = SCompareTimeStamp(&ts, &(fsmCp->fsmEnt->timestamp));
+        ret = cmTimeCompare(tsNow, fsmEnt->timestamp);
     }
     return ret;
 }
@@ -228,15 +1828,39 @@ S16 cmFsmSetState(
     U16      state        /* new state */
 )
 {
-    CmFsmEntity *fsmEnt;
-
     if (!fsmCp )
     {
         SLOGERR("Invalid fsmCp:%p ",fsmCp);
         return (FAILURE);
     }
-    
-    fsmEnt = fsmCp->fsmEnt;
+
+    return cmFsmInstSetState(fsmCp->fsmEnt, state);
+} /* cmFsmSetState() */
+
+/**
+ * Set state for a given FSM instance
+ *
+ * @param: fsmEnt    FSM instance
+ * @param: state     New state
+ * @return: SUCCESS      successful
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmInstSetState(
+    CmFsmEntity *fsmEnt,  /* FSM instance */
+    U16         state     /* new state */
+)
+{
+    CmFsmCp   *fsmCp;
+    CmTimeNs  tsNow;
+
+    if (!fsmEnt || !fsmEnt->fsmCp)
+    {
+        SLOGERR("Invalid fsmEnt:%p ",fsmEnt);
+        return (FAILURE);
+    }
+
+    fsmCp = fsmEnt->fsmCp;
 
     if (state > fsmCp->numStates)
     {
@@ -248,8 +1872,15 @@ S16 cmFsmSetState(
     fsmEnt->timeout   = fsmCp->states[state].timeout;
     fsmEnt->lastState = fsmEnt->state;
     fsmEnt->state     = state;
-    SGetMonotonicTime(&fsmEnt->timestamp);
-    SAddMsToTimeStamp(&fsmEnt->timestamp, fsmEnt->timeout);
+    if (fsmCp->entPool)
+        cmFsmBatchSync(fsmCp, fsmEnt);
+    tsNow = cmTimeNow();
+    cmFsmArmTmr(fsmCp, fsmEnt, tsNow);
+    if (fsmEnt->lastState != state)
+    {
+        cmFsmTraceRecord(fsmEnt, fsmEnt->lastState, state,
+                         CM_FSM_TRACE_COL_SET, tsNow);
+    }
 
     SLOGINFO("%s:SetState:%s-->%s, timeout: %d\n",
              fsmEnt->instName, 
@@ -258,7 +1889,7 @@ S16 cmFsmSetState(
              fsmCp->states[state].timeout);
     
     return (SUCCESS);
-} /* cmFsmSetState() */
+} /* cmFsmInstSetState() */
 
 
 /**
@@ -288,8 +1919,342 @@ S16 cmFsmGetState(
         return (FAILURE);
     }
     
-    fsmEnt = fsmCp->fsmEnt;    
+    fsmEnt = GET_FSM_ENT_FROM_CONTEXT(fsmCp, context);
     *state     = fsmEnt->state;
     *lastState = fsmEnt->lastState;
     return (SUCCESS);
 } /* cmFsmGetState() */
+
+/**
+ * Returns the state timer left for an instance
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: fsmEnt    FSM instance
+ * @param: nowTick   Current wheel tick
+ * @return: milliseconds left, CM_FSM_CKPT_NO_TMR for no timer
+ *
+ */
+PRIVATE U32 cmFsmRemainMs(CmFsmCp *fsmCp, CmFsmEntity *fsmEnt, U64 nowTick)
+{
+    U64 expires;
+
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_TMO)
+        return 0;
+    if (!CM_TMR_IS_ARMED(&fsmEnt->tmrNode))
+        return CM_FSM_CKPT_NO_TMR;
+
+    /* Armed to a wait deadline, the state deadline is the one to keep */
+    expires = fsmEnt->tmrNode.expires;
+    if (fsmEnt->flags & CM_FSM_ENT_FLAG_WAKE)
+    {
+        if (fsmEnt->timeout == 0)
+            return CM_FSM_CKPT_NO_TMR;
+        expires = cmTmrNsToTick(fsmEnt->timestamp) + 1;
+    }
+
+    if (expires <= nowTick)
+        return 0;
+    return (expires - nowTick) * CM_TMR_TICK_MS;
+}
+
+/**
+ * Flush the directory entry of a file, so that a rename survives a crash
+ *
+ * @param: path  file
+ * @return: SUCCESS/FAILURE
+ *
+ */
+PRIVATE S16 cmFsmSyncDir(const S8 *path)
+{
+    S8  dirPath[PATH_MAX];
+    S32 fd, ret;
+
+    snprintf(dirPath, sizeof(dirPath), "%s", path);
+    fd = open(dirname(dirPath), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return FAILURE;
+    ret = fsync(fd);
+    close(fd);
+    return ret < 0 ? FAILURE : SUCCESS;
+}
+
+/**
+ * Write all the active instances of a control point into an image file
+ * The contexts are copied as is, they must not hold pointers. Pending
+ * events are not saved. The image is written aside and renamed over
+ * path, a crash never leaves a partial image behind, and the directory
+ * is flushed so that the new image is the one found after a crash.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: path      Image file
+ * @param: ctxSize   Size of the instance contexts
+ * @return: SUCCESS  image written
+ *          FAILURE  failed
+ *
+ */
+S16 cmFsmCheckpoint(
+    CmFsmCp    *fsmCp,    /* FSM control point */
+    const S8   *path,     /* image file */
+    U32        ctxSize    /* instance context size */
+)
+{
+    CmFsmCkptHdr *hdr;
+    CmFsmCkptRec *rec;
+    CmFsmEntity  *fsmEnt;
+    CmTimeNs     tsNow;
+    S8           tmpPath[PATH_MAX];
+    U8           *base;
+    size_t       len;
+    U64          nowTick, chgCnt;
+    U32          i, numInst, stride;
+    S32          fd;
+
+    if (!fsmCp || !path || ctxSize < fsmCp->offset + sizeof(CmFsmEntity))
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p, path:%p, ctxSize:%u",
+                fsmCp, path, ctxSize);
+        return FAILURE;
+    }
+
+    numInst = fsmCp->entPool ? fsmCp->numInst : (fsmCp->fsmEnt ? 1 : 0);
+    stride  = (sizeof(CmFsmCkptRec) + ctxSize + CM_FSM_CKPT_ALIGN - 1) &
+              ~(CM_FSM_CKPT_ALIGN - 1);
+    len     = sizeof(CmFsmCkptHdr) + (size_t)numInst * stride;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, len) < 0)
+    {
+        SLOGERR("Failed to create %s (%s)", tmpPath, strerror(errno));
+        if (fd >= 0) close(fd);
+        return FAILURE;
+    }
+
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        SLOGERR("Failed to map %s (%s)", tmpPath, strerror(errno));
+        unlink(tmpPath);
+        return FAILURE;
+    }
+
+    tsNow = cmTimeNow();
+    nowTick = cmTmrNsToTick(tsNow);
+
+    CM_FSM_CP_LOCK(fsmCp);
+    chgCnt = fsmCp->chgCnt;
+    for (i = 0, numInst = 0; i < (fsmCp->entPool ? fsmCp->numInst : 1); i++)
+    {
+        fsmEnt = fsmCp->entPool ? fsmCp->entPool[i] : fsmCp->fsmEnt;
+        if (!fsmEnt || !(fsmEnt->flags & CM_FSM_ENT_FLAG_ACTIVE))
+            continue;
+
+        rec = (CmFsmCkptRec *)(base + sizeof(CmFsmCkptHdr) + (size_t)numInst * stride);
+        rec->remainMs = cmFsmRemainMs(fsmCp, fsmEnt, nowTick);
+        memcpy(rec + 1, CM_FSM_GET_CONTEXT(fsmEnt), ctxSize);
+        numInst++;
+    }
+    CM_FSM_CP_UNLOCK(fsmCp);
+
+    hdr = (CmFsmCkptHdr *)base;
+    hdr->magic     = CM_FSM_CKPT_MAGIC;
+    hdr->version   = CM_FSM_CKPT_VERSION;
+    hdr->numStates = fsmCp->numStates;
+    hdr->ctxSize   = ctxSize;
+    hdr->offset    = fsmCp->offset;
+    hdr->stride    = stride;
+    hdr->numInst   = numInst;
+    hdr->entSize   = sizeof(CmFsmEntity);
+    strncpy(hdr->fsmStr, fsmCp->fsmStr, CM_FSM_ID_STR_LEN);
+
+    if (msync(base, len, MS_SYNC) < 0 || rename(tmpPath, path) < 0)
+    {
+        SLOGERR("Failed to write %s (%s)", path, strerror(errno));
+        munmap(base, len);
+        unlink(tmpPath);
+        return FAILURE;
+    }
+
+    munmap(base, len);
+    if (cmFsmSyncDir(path) != SUCCESS)
+    {
+        SLOGERR("Failed to sync the directory of %s (%s)", path, strerror(errno));
+        return FAILURE;
+    }
+
+    fsmCp->ckptChgCnt = chgCnt;
+    fsmCp->ckptTs     = tsNow;
+    return SUCCESS;
+}
+
+/**
+ * Check whether the image of a control point should be saved again
+ * It is out of date once a state was entered, an output function ran
+ * to its end or an instance stopped since the last cmFsmCheckpoint(),
+ * and anyway every CM_FSM_CKPT_PERIOD for the remaining state times.
+ *
+ * @param: fsmCp     FSM Control Point
+ * @param: tsNow     Current time
+ * @return: TRUE     cmFsmCheckpoint() due
+ *          FALSE    the last image is still up to date
+ *
+ */
+bool cmFsmCheckpointDue( CmFsmCp *fsmCp, CmTimeNs tsNow )
+{
+    bool due;
+
+    CM_FSM_CP_LOCK(fsmCp);
+    due = fsmCp->chgCnt != fsmCp->ckptChgCnt || !fsmCp->ckptTs ||
+          tsNow - fsmCp->ckptTs >= CM_FSM_CKPT_PERIOD;
+    CM_FSM_CP_UNLOCK(fsmCp);
+    return due;
+}
+
+/**
+ * Map an image file and attach its instances to a control point
+ * The contexts stay in the private mapping, only the CmFsmEntity
+ * pointers are fixed up and the state timers re-armed with the time
+ * they had left. The downtime is not counted and suspended output
+ * functions restart from their beginning. The image must be kept
+ * until the instances are removed, see cmFsmImageRelease().
+ *
+ * @param: fsmCp     FSM Control Point, no instance initialized yet
+ * @param: path      Image file
+ * @param: ctxSize   Size of the instance contexts
+ * @param: image     Mapped image to be returned
+ * @return: SUCCESS  instances restored
+ *          FAILURE  no usable image, nothing restored
+ *
+ */
+S16 cmFsmRestore(
+    CmFsmCp    *fsmCp,    /* FSM control point, no instance yet */
+    const S8   *path,     /* image file */
+    U32        ctxSize    /* instance context size */,
+    CmFsmImage *image     /* mapped image, contexts in place */
+)
+{
+    CmFsmCkptHdr *hdr;
+    CmFsmCkptRec *rec;
+    CmFsmEntity  *fsmEnt;
+    CmTimeNs     tsNow;
+    struct stat  st;
+    U64          nowTick;
+    U32          i;
+    S32          fd;
+
+    if (!fsmCp || !path || !image || fsmCp->numInst || fsmCp->numActive)
+    {
+        SLOGERR("Invalid parameters, fsmCp:%p, path:%p, image:%p",
+                fsmCp, path, image);
+        return FAILURE;
+    }
+
+    memset(image, 0, sizeof(CmFsmImage));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return FAILURE;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CmFsmCkptHdr))
+    {
+        SLOGERR("Invalid image %s", path);
+        close(fd);
+        return FAILURE;
+    }
+
+    image->len  = st.st_size;
+    image->base = mmap(NULL, image->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image->base == MAP_FAILED)
+    {
+        SLOGERR("Failed to map %s (%s)", path, strerror(errno));
+        image->base = NULL;
+        return FAILURE;
+    }
+
+    hdr = (CmFsmCkptHdr *)image->base;
+    if (hdr->magic != CM_FSM_CKPT_MAGIC || hdr->version != CM_FSM_CKPT_VERSION ||
+        hdr->numStates != fsmCp->numStates || hdr->ctxSize != ctxSize ||
+        hdr->offset != fsmCp->offset || hdr->entSize != sizeof(CmFsmEntity) ||
+        hdr->stride < sizeof(CmFsmCkptRec) + ctxSize ||
+        hdr->stride % CM_FSM_CKPT_ALIGN ||
+        image->len < sizeof(CmFsmCkptHdr) + (size_t)hdr->numInst * hdr->stride ||
+        hdr->numInst > (fsmCp->entPool ? fsmCp->maxInst : 1))
+    {
+        SLOGERR("Image %s does not match FSM %s", path, fsmCp->fsmStr);
+        cmFsmImageRelease(image);
+        return FAILURE;
+    }
+    image->stride  = hdr->stride;
+    image->numInst = hdr->numInst;
+
+    /* Nothing attached before all the records are known to be valid */
+    for (i = 0; i < image->numInst; i++)
+    {
+        fsmEnt = GET_FSM_ENT_FROM_CONTEXT(fsmCp, CM_FSM_IMAGE_CTX(image, i));
+        if (fsmEnt->state > fsmCp->numStates)
+        {
+            SLOGERR("Image %s record %u has invalid state %u", path, i, fsmEnt->state);
+            cmFsmImageRelease(image);
+            return FAILURE;
+        }
+    }
+
+    tsNow = cmTimeNow();
+    nowTick = cmTmrNsToTick(tsNow);
+
+    for (i = 0; i < image->numInst; i++)
+    {
+        rec    = (CmFsmCkptRec *)CM_FSM_IMAGE_CTX(image, i) - 1;
+        fsmEnt = GET_FSM_ENT_FROM_CONTEXT(fsmCp, CM_FSM_IMAGE_CTX(image, i));
+
+        /* Process pointers and pending events do not survive a restart */
+        fsmEnt->fsmCp          = fsmCp;
+        fsmEnt->readyNext      = NULL;
+        fsmEnt->tmrNode.next   = fsmEnt->tmrNode.prev = NULL;
+        fsmEnt->flags          = CM_FSM_ENT_FLAG_ACTIVE;
+        fsmEnt->evtCnt         = 0;
+        fsmEnt->coPt           = 0;
+        fsmEnt->curEvt.payload = NULL;
+        fsmEnt->timestamp      = tsNow;
+        fsmEnt->enterUs        = CM_TIME_TO_US(tsNow);
+
+        if (fsmCp->entPool)
+        {
+            fsmEnt->poolIdx = fsmCp->numInst;
+            fsmCp->entPool[fsmCp->numInst++] = fsmEnt;
+            cmFsmBatchSync(fsmCp, fsmEnt);
+        }
+        fsmCp->fsmEnt = fsmEnt;
+        fsmCp->numActive++;
+
+        if (rec->remainMs != CM_FSM_CKPT_NO_TMR)
+        {
+            fsmEnt->timestamp += CM_TIME_FROM_MS(rec->remainMs);
+            cmTmrStart(&fsmCp->tmrWheel, &fsmEnt->tmrNode,
+                       nowTick + rec->remainMs / CM_TMR_TICK_MS);
+        }
+    }
+
+    SLOGNOTE("FSM %s restored %u instances from %s",
+             fsmCp->fsmStr, image->numInst, path);
+    return SUCCESS;
+}
+
+/**
+ * Unmap a restored image
+ * The instances living in it must have been removed from their
+ * control point first.
+ *
+ * @param: image     Image returned by cmFsmRestore()
+ * @return: None
+ *
+ */
+void cmFsmImageRelease( CmFsmImage *image )
+{
+    if (!image || !image->base)
+        return;
+
+    munmap(image->base, image->len);
+    memset(image, 0, sizeof(CmFsmImage));
+}
@@ -0,0 +1,349 @@
+/*
+ * \file Name: CommonFsmExec.c
+ *
+ * \brief Multi-threaded executor for FSM instance pools
+ *
+ * \details
+ * Each pass the caller collects the expired state timers, deals the
+ * runnable instances out to the worker deques in contiguous chunks and
+ * sleeps until the last worker is done. The deques follow Chase-Lev:
+ * nothing is pushed once a pass started, so the owner only pops at the
+ * bottom and thieves CAS the top. Instances must not be added to or
+ * removed from the pool while a pass runs.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "CommonFsmExec.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+/**
+ * Pop a task from the bottom of the own deque
+ *
+ * @param: worker  owner of the deque
+ * @return: instance, NULL when the deque is empty
+ */
+PRIVATE CmFsmEntity *cmFsmExecPop(CmFsmExecWorker *worker)
+{
+    CmFsmEntity *fsmEnt = NULL;
+    S64         b, t;
+
+    b = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&worker->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+
+    if (t <= b)
+    {
+        fsmEnt = worker->tasks[b];
+        if (t == b)
+        {
+            /* Last task, race the thieves for it */
+            if (!__atomic_compare_exchange_n(&worker->top, &t, t + 1, FALSE,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            {
+                fsmEnt = NULL;
+            }
+            __atomic_store_n(&worker->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+        return fsmEnt;
+    }
+
+    __atomic_store_n(&worker->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Steal a task from the top of the other workers' deques
+ *
+ * @param: worker  thief
+ * @return: instance, NULL when all the deques are empty
+ */
+PRIVATE CmFsmEntity *cmFsmExecSteal(CmFsmExecWorker *worker)
+{
+    CmFsmExec       *exec = worker->exec;
+    CmFsmExecWorker *victim;
+    CmFsmEntity     *fsmEnt;
+    S64             b, t;
+    U32             i;
+
+    for (i = 1; i < exec->numWorkers; i++)
+    {
+        victim = &exec->workers[(worker->id + i) % exec->numWorkers];
+
+        while (true)
+        {
+            t = __atomic_load_n(&victim->top, __ATOMIC_ACQUIRE);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            b = __atomic_load_n(&victim->bottom, __ATOMIC_ACQUIRE);
+            if (t >= b)
+                break;
+
+            fsmEnt = victim->tasks[t];
+            if (__atomic_compare_exchange_n(&victim->top, &t, t + 1, FALSE,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            {
+                worker->stealCnt++;
+                return fsmEnt;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Worker thread, runs one pass per start signal until asked to quit
+ *
+ * @param: arg  worker
+ * @return: NULL
+ */
+PRIVATE void *cmFsmExecWorkerMain(void *arg)
+{
+    CmFsmExecWorker *worker = (CmFsmExecWorker *)arg;
+    CmFsmExec       *exec = worker->exec;
+    CmFsmEntity     *fsmEnt;
+    CmTimeNs        tsStart;
+    U64             seenPass = 0;
+
+    while (true)
+    {
+        pthread_mutex_lock(&exec->mutex);
+        while (!exec->quit && exec->passId == seenPass)
+            pthread_cond_wait(&exec->startCond, &exec->mutex);
+        if (exec->quit)
+        {
+            pthread_mutex_unlock(&exec->mutex);
+            break;
+        }
+        seenPass = exec->passId;
+        pthread_mutex_unlock(&exec->mutex);
+
+        tsStart = cmTimeNow();
+        while ((fsmEnt = cmFsmExecPop(worker)) != NULL ||
+               (fsmEnt = cmFsmExecSteal(worker)) != NULL)
+        {
+            cmFsmInstStep(fsmEnt, exec->tsNow);
+            worker->runCnt++;
+        }
+        worker->busyUs += CM_TIME_TO_US(cmTimeNow() - tsStart);
+
+        pthread_mutex_lock(&exec->mutex);
+        if (--exec->numRunning == 0)
+            pthread_cond_signal(&exec->doneCond);
+        pthread_mutex_unlock(&exec->mutex);
+    }
+
+    return NULL;
+}
+
+/**
+ * Initialize an executor and start its worker threads
+ * The control point is switched to its thread safe paths for good.
+ *
+ * @param: exec        executor
+ * @param: fsmCp       control point, initialized with cmFsmCpPoolInit()
+ * @param: numWorkers  worker threads, 1 to CM_FSM_EXEC_MAX_WORKERS
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ */
+S16 cmFsmExecInit(
+    CmFsmExec  *exec,        /* executor */
+    CmFsmCp    *fsmCp,       /* control point with an instance pool */
+    U32        numWorkers    /* worker threads */
+)
+{
+    CmFsmExecWorker *worker;
+    U32             i;
+
+    if (!exec || !fsmCp || !fsmCp->entPool ||
+        numWorkers == 0 || numWorkers > CM_FSM_EXEC_MAX_WORKERS)
+    {
+        SLOGERR("Invalid parameters, exec:%p, fsmCp:%p, numWorkers:%u",
+                exec, fsmCp, numWorkers);
+        return FAILURE;
+    }
+
+    memset(exec, 0, sizeof(CmFsmExec));
+    exec->fsmCp = fsmCp;
+    exec->ready = calloc(fsmCp->maxInst, sizeof(CmFsmEntity *));
+    if (posix_memalign((void **)&exec->workers, 64,
+                       numWorkers * sizeof(CmFsmExecWorker)) != 0)
+    {
+        exec->workers = NULL;
+    }
+    if (!exec->ready || !exec->workers)
+    {
+        SLOGERR("Failed to allocate %u workers", numWorkers);
+        free(exec->ready);
+        free(exec->workers);
+        return FAILURE;
+    }
+    memset(exec->workers, 0, numWorkers * sizeof(CmFsmExecWorker));
+
+    pthread_mutex_init(&exec->mutex, NULL);
+    pthread_cond_init(&exec->startCond, NULL);
+    pthread_cond_init(&exec->doneCond, NULL);
+    exec->tsStart = cmTimeNow();
+    fsmCp->mtSafe = TRUE;
+
+    for (i = 0; i < numWorkers; i++)
+    {
+        worker = &exec->workers[i];
+        worker->id    = i;
+        worker->exec  = exec;
+        worker->tasks = calloc(fsmCp->maxInst, sizeof(CmFsmEntity *));
+        if (!worker->tasks ||
+            sl_ThreadCreate(&worker->tid, cmFsmExecWorkerMain, worker) != 0)
+        {
+            SLOGERR("Failed to start FSM worker %u", i);
+            free(worker->tasks);
+            cmFsmExecDeinit(exec);
+            return FAILURE;
+        }
+        exec->numWorkers++;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Run all the runnable instances of the control point on the workers
+ * Same semantics as cmFsmDriverAll(), but the TIMEOUT columns run in the
+ * instance steps instead of from the timer expiry.
+ *
+ * @param: exec  executor
+ * @return: number of instances still runnable
+ *          FAILURE  invalid executor
+ */
+S32 cmFsmExecDriverAll( CmFsmExec *exec )
+{
+    CmFsmCp         *fsmCp;
+    CmFsmEntity     **tasks = exec ? exec->ready : NULL;
+    CmFsmExecWorker *worker;
+    U32             i, numTask = 0, chunk, pos;
+
+    if (!exec || !exec->numWorkers)
+    {
+        SLOGERR("Invalid executor:%p", exec);
+        return (FAILURE);
+    }
+
+    fsmCp = exec->fsmCp;
+    exec->tsNow = cmTimeNow();
+    cmFsmCollectTmrs(fsmCp, exec->tsNow);
+
+    if (fsmCp->mode == CM_FSM_MODE_EVENT)
+    {
+        numTask = cmFsmTakeReady(fsmCp, tasks, fsmCp->maxInst);
+    }
+    else
+    {
+        /* Instances may be added or removed by other threads meanwhile */
+        CM_FSM_CP_LOCK(fsmCp);
+        for (i = 0; i < fsmCp->numInst; i++)
+        {
+            if (fsmCp->entPool[i]->flags & CM_FSM_ENT_FLAG_ACTIVE)
+                tasks[numTask++] = fsmCp->entPool[i];
+        }
+        CM_FSM_CP_UNLOCK(fsmCp);
+    }
+
+    if (numTask == 0)
+        return fsmCp->numActive;
+
+    /* Contiguous chunks keep neighbouring instances on one core */
+    chunk = (numTask + exec->numWorkers - 1) / exec->numWorkers;
+    for (i = 0, pos = 0; i < exec->numWorkers; i++)
+    {
+        worker = &exec->workers[i];
+        worker->top = 0;
+        worker->bottom = 0;
+        for (; pos < numTask && worker->bottom < chunk; worker->bottom++)
+            worker->tasks[worker->bottom] = tasks[pos++];
+    }
+
+    pthread_mutex_lock(&exec->mutex);
+    exec->numRunning = exec->numWorkers;
+    exec->passId++;
+    pthread_cond_broadcast(&exec->startCond);
+    while (exec->numRunning)
+        pthread_cond_wait(&exec->doneCond, &exec->mutex);
+    pthread_mutex_unlock(&exec->mutex);
+
+    return fsmCp->numActive;
+}
+
+/**
+ * Log the per-worker run, steal and busy ratio counters
+ *
+ * @param: exec  executor
+ * @return: None
+ */
+void cmFsmExecDumpStats( CmFsmExec *exec )
+{
+    CmFsmExecWorker *worker;
+    U64             elapsedUs;
+    U32             i;
+
+    if (!exec) return;
+
+    elapsedUs = CM_TIME_TO_US(cmTimeNow() - exec->tsStart);
+    if (elapsedUs == 0)
+        elapsedUs = 1;
+
+    for (i = 0; i < exec->numWorkers; i++)
+    {
+        worker = &exec->workers[i];
+        SLOGNOTE("FSM %s worker %u: %llu runs, %llu steals, busy %llu%%",
+                 exec->fsmCp->fsmStr, i, worker->runCnt, worker->stealCnt,
+                 worker->busyUs * 100 / elapsedUs);
+    }
+}
+
+/**
+ * Stop the worker threads and release the executor
+ * The control point stays in its thread safe mode.
+ *
+ * @param: exec  executor
+ * @return: None
+ */
+void cmFsmExecDeinit( CmFsmExec *exec )
+{
+    U32 i;
+
+    if (!exec || !exec->workers) return;
+
+    pthread_mutex_lock(&exec->mutex);
+    exec->quit = TRUE;
+    pthread_cond_broadcast(&exec->startCond);
+    pthread_mutex_unlock(&exec->mutex);
+
+    for (i = 0; i < exec->numWorkers; i++)
+    {
+        pthread_join(exec->workers[i].tid, NULL);
+        free(exec->workers[i].tasks);
+    }
+
+    pthread_cond_destroy(&exec->doneCond);
+    pthread_cond_destroy(&exec->startCond);
+    pthread_mutex_destroy(&exec->mutex);
+    free(exec->workers);
+    free(exec->ready);
+    exec->workers = NULL;
+    exec->ready = NULL;
+    exec->numWorkers = 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * \file Name: CommonFsmSparse.c
+ *
+ * \brief Compressed transition table for large FSMs
+ *
+ * \details
+ * The table is built in two walks over the rows, the first one picks
+ * the row defaults and counts the exceptions, the second one fills the
+ * single allocation sized from that count.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdlib.h>
+#include "CommonFsmSparse.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+#define CM_FSM_SPARSE_CELL_EQ(a, b) \
+    ((a).fnIdx == (b).fnIdx && (a).nextState == (b).nextState)
+
+/**
+ * qsort() order of the listed transitions, by state then column
+ *
+ * @param: a  transition
+ * @param: b  transition
+ * @return: <0, 0, >0
+ */
+PRIVATE int cmFsmSparseTransCmp(const void *a, const void *b)
+{
+    const CmFsmTrans *ta = a, *tb = b;
+
+    if (ta->state != tb->state)
+        return (int)ta->state - (int)tb->state;
+    return (int)ta->col - (int)tb->col;
+}
+
+/**
+ * Pick the default cell of one row, the most frequent one
+ * Columns not listed count as cells without output nor transition.
+ *
+ * @param: cells    listed cells of the row
+ * @param: num      number of listed cells
+ * @param: numCols  columns of the row
+ * @param: def      output default cell
+ * @return: number of cells equal to the default
+ */
+PRIVATE U32 cmFsmSparsePickDefault(
+    const CmFsmSparseCell *cells,
+    U32                   num,
+    U16                   numCols,
+    CmFsmSparseCell       *def
+)
+{
+    CmFsmSparseCell empty = { CM_FSM_SPARSE_NO_FN, CM_FSM_STATE_NONE };
+    U32             i, j, cnt, best;
+
+    *def = empty;
+    best = numCols - num;
+    for (i = 0; i < num; i++)
+    {
+        if (CM_FSM_SPARSE_CELL_EQ(cells[i], empty))
+            best++;
+    }
+
+    for (i = 0; i < num; i++)
+    {
+        for (cnt = 0, j = 0; j < num; j++)
+        {
+            if (CM_FSM_SPARSE_CELL_EQ(cells[i], cells[j]))
+                cnt++;
+        }
+        if (cnt > best)
+        {
+            best = cnt;
+            *def = cells[i];
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Build a compressed table from a transition list
+ * The cells not listed have no output function and no transition.
+ *
+ * @param: sp        table to build
+ * @param: numRows   states, including the final one
+ * @param: numCols   columns, NORMAL, TIMEOUT then user events
+ * @param: trans     listed transitions, any order
+ * @param: numTrans  number of listed transitions
+ * @return: SUCCESS  success
+ *          FAILURE  invalid or duplicated transition, out of memory
+ */
+S16 cmFsmSparseInit(
+    CmFsmSparse       *sp,       /* table to build */
+    U16               numRows,   /* states, including the final one */
+    U16               numCols,   /* columns, NORMAL, TIMEOUT then user events */
+    const CmFsmTrans  *trans,    /* listed transitions */
+    U32               numTrans   /* number of listed transitions */
+)
+{
+    CmFsmTrans       *sorted = NULL;
+    CmFsmSparseCell  *cells = NULL, empty = { CM_FSM_SPARSE_NO_FN, CM_FSM_STATE_NONE };
+    void             **fns = NULL;
+    U8               *mem;
+    U32              i, f, row, col, first, last, numExc = 0;
+    S16              ret = FAILURE;
+
+    if (!sp || !numRows || numCols < CM_FSM_CTRL_MAX || (!trans && numTrans))
+    {
+        SLOGERR("Invalid parameters, sp:%p, numRows:%d, numCols:%d, trans:%p",
+                sp, numRows, numCols, trans);
+        return FAILURE;
+    }
+
+    memset(sp, 0, sizeof(CmFsmSparse));
+    sorted = malloc((numTrans + 1) * sizeof(CmFsmTrans));
+    cells  = malloc((numTrans + 1) * sizeof(CmFsmSparseCell));
+    fns    = malloc((numTrans + 1) * sizeof(void *));
+    if (!sorted || !cells || !fns)
+    {
+        SLOGERR("Failed to allocate %u transitions", numTrans);
+        goto done;
+    }
+
+    memcpy(sorted, trans, numTrans * sizeof(CmFsmTrans));
+    qsort(sorted, numTrans, sizeof(CmFsmTrans), cmFsmSparseTransCmp);
+
+    /* Check the transitions and intern the output functions */
+    fns[0] = NULL;
+    sp->numFn = 1;
+    for (i = 0; i < numTrans; i++)
+    {
+        if (sorted[i].state >= numRows || sorted[i].col >= numCols ||
+            (sorted[i].nextState != CM_FSM_STATE_NONE && sorted[i].nextState >= numRows))
+        {
+            SLOGERR("Invalid transition state:%d col:%d next:%d",
+                    sorted[i].state, sorted[i].col, sorted[i].nextState);
+            goto done;
+        }
+        if (i && !cmFsmSparseTransCmp(&sorted[i - 1], &sorted[i]))
+        {
+            SLOGERR("Duplicated transition state:%d col:%d",
+                    sorted[i].state, sorted[i].col);
+            goto done;
+        }
+
+        for (f = 0; f < sp->numFn && fns[f] != sorted[i].outputFn; f++)
+            ;
+        if (f == sp->numFn)
+        {
+            if (f >= CM_FSM_SPARSE_MAX_FN)
+            {
+                SLOGERR("More than %u output functions", CM_FSM_SPARSE_MAX_FN);
+                goto done;
+            }
+            fns[sp->numFn++] = sorted[i].outputFn;
+        }
+        cells[i].fnIdx     = f;
+        cells[i].nextState = sorted[i].nextState;
+    }
+
+    /* First walk, the row defaults and the exception count */
+    sp->numRows = numRows;
+    sp->numCols = numCols;
+    sp->rowDef  = malloc(numRows * sizeof(CmFsmSparseCell));
+    if (!sp->rowDef)
+    {
+        SLOGERR("Failed to allocate %u rows", numRows);
+        goto done;
+    }
+    for (row = 0, first = 0; row < numRows; row++, first = last)
+    {
+        for (last = first; last < numTrans && sorted[last].state == row; last++)
+            ;
+        numExc += numCols - cmFsmSparsePickDefault(&cells[first], last - first,
+                                                   numCols, &sp->rowDef[row]);
+    }
+
+    /* One block: fnTab, rowStart, rowDef, excCell then excCol */
+    sp->numExc = numExc;
+    sp->memLen = sp->numFn * sizeof(void *) +
+                 (numRows + 1) * sizeof(U32) +
+                 (numRows + numExc) * sizeof(CmFsmSparseCell) +
+                 numExc * sizeof(U16);
+    sp->mem = mem = malloc(sp->memLen);
+    if (!mem)
+    {
+        SLOGERR("Failed to allocate %zu bytes of FSM table", sp->memLen);
+        goto done;
+    }
+    sp->fnTab    = (void **)mem;            mem += sp->numFn * sizeof(void *);
+    sp->rowStart = (U32 *)mem;              mem += (numRows + 1) * sizeof(U32);
+    memcpy(mem, sp->rowDef, numRows * sizeof(CmFsmSparseCell));
+    free(sp->rowDef);
+    sp->rowDef   = (CmFsmSparseCell *)mem;  mem += numRows * sizeof(CmFsmSparseCell);
+    sp->excCell  = (CmFsmSparseCell *)mem;  mem += numExc * sizeof(CmFsmSparseCell);
+    sp->excCol   = (U16 *)mem;
+    memcpy(sp->fnTab, fns, sp->numFn * sizeof(void *));
+
+    /* Second walk, every column differing from the row default */
+    numExc = 0;
+    for (row = 0, i = 0; row < numRows; row++)
+    {
+        sp->rowStart[row] = numExc;
+        for (col = 0; col < numCols; col++)
+        {
+            CmFsmSparseCell cell = empty;
+
+            if (i < numTrans && sorted[i].state == row && sorted[i].col == col)
+                cell = cells[i++];
+            if (CM_FSM_SPARSE_CELL_EQ(cell, sp->rowDef[row]))
+                continue;
+
+            sp->excCol[numExc]  = col;
+            sp->excCell[numExc] = cell;
+            numExc++;
+        }
+    }
+    sp->rowStart[numRows] = numExc;
+    ret = SUCCESS;
+
+done:
+    if (ret != SUCCESS && sp)
+    {
+        if (!sp->mem)
+            free(sp->rowDef);
+        cmFsmSparseDeinit(sp);
+    }
+    free(sorted);
+    free(cells);
+    free(fns);
+    return ret;
+}
+
+/**
+ * Build a compressed table from a dense matrix
+ *
+ * @param: sp       table to build
+ * @param: fsmMt    dense matrix, numRows x numCols
+ * @param: numRows  matrix rows
+ * @param: numCols  matrix columns
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ */
+S16 cmFsmSparseFromDense(
+    CmFsmSparse       *sp,       /* table to build */
+    const CmFsmEntry  *fsmMt,    /* dense matrix, numRows x numCols */
+    U16               numRows,
+    U16               numCols
+)
+{
+    CmFsmTrans *trans;
+    U32        row, col, num = 0;
+    S16        ret;
+
+    if (!fsmMt)
+    {
+        SLOGERR("Invalid matrix");
+        return FAILURE;
+    }
+
+    trans = malloc(((U32)numRows * numCols + 1) * sizeof(CmFsmTrans));
+    if (!trans)
+    {
+        SLOGERR("Failed to allocate %u x %u transitions", numRows, numCols);
+        return FAILURE;
+    }
+
+    for (row = 0; row < numRows; row++)
+    {
+        for (col = 0; col < numCols; col++)
+        {
+            const CmFsmEntry *cell = &fsmMt[row * numCols + col];
+
+            if (!cell->outputFn && cell->nextState == CM_FSM_STATE_NONE)
+                continue;
+            trans[num].state     = row;
+            trans[num].col       = col;
+            trans[num].outputFn  = cell->outputFn;
+            trans[num].nextState = cell->nextState;
+            num++;
+        }
+    }
+
+    ret = cmFsmSparseInit(sp, numRows, numCols, trans, num);
+    free(trans);
+    return ret;
+}
+
+/**
+ * Release a compressed table
+ *
+ * @param: sp  table
+ * @return: None
+ */
+void cmFsmSparseDeinit( CmFsmSparse *sp )
+{
+    if (!sp) return;
+
+    free(sp->mem);
+    memset(sp, 0, sizeof(CmFsmSparse));
+}
+
+/**
+ * Log the size of a compressed table against the dense matrix
+ *
+ * @param: sp  table
+ * @return: None
+ */
+void cmFsmSparseDumpStats( CmFsmSparse *sp )
+{
+    if (!sp || !sp->mem) return;
+
+    SLOGNOTE("FSM table %u x %u: %u exceptions, %u output functions, "
+             "%zu bytes, dense %zu bytes",
+             sp->numRows, sp->numCols, sp->numExc, sp->numFn - 1, sp->memLen,
+             (size_t)sp->numRows * sp->numCols * sizeof(CmFsmEntry));
+}
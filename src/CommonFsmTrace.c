@@ -0,0 +1,379 @@
+/*
+ * \file Name: CommonFsmTrace.c
+ *
+ * \brief Binary FSM transition trace
+ *
+ * \details
+ * A thread registers its ring on its first record. Each ring has one
+ * producer, the recording thread, and one consumer, the aggregator, so
+ * head and tail are plain acquire/release indexes. The statistics are
+ * only touched under cm_traceMutex by the aggregator and the dump.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <pthread.h>
+#include "CommonFsmTrace.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+static volatile bool     cm_traceOn;
+static volatile bool     cm_traceQuit;
+static pthread_t         cm_traceTid;
+static pthread_mutex_t   cm_traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    cm_traceCond  = PTHREAD_COND_INITIALIZER;
+static CmFsmTraceRing    *cm_traceRings;            /* Registered rings */
+static U32               cm_traceGen;               /* Bumped when the rings are freed */
+static __thread CmFsmTraceRing *cm_traceMyRing;     /* Ring of the calling thread */
+static __thread U32      cm_traceMyGen;
+static CmFsmTraceCpStat  cm_traceCp[CM_FSM_TRACE_MAX_CP];
+static U64               cm_traceUnknown;           /* Records of CPs or states not aggregated */
+
+/**
+ * Allocate and register the ring of the calling thread
+ *
+ * @param: None
+ * @return: ring, NULL if out of memory
+ */
+PRIVATE CmFsmTraceRing *cmFsmTraceRegister(void)
+{
+    CmFsmTraceRing *ring;
+
+    if (posix_memalign((void **)&ring, 64, sizeof(CmFsmTraceRing)) != 0)
+        return NULL;
+    memset(ring, 0, sizeof(CmFsmTraceRing));
+
+    ring->next = __atomic_load_n(&cm_traceRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&cm_traceRings, &ring->next, ring, FALSE,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    cm_traceMyRing = ring;
+    cm_traceMyGen  = cm_traceGen;
+    return ring;
+}
+
+/**
+ * Record one state change of an instance
+ * Also restarts the dwell time of the instance, traced or not.
+ *
+ * @param: fsmEnt  FSM instance
+ * @param: from    left state
+ * @param: to      entered state
+ * @param: col     matrix column or CM_FSM_TRACE_COL_SET
+ * @param: tsNow   transition time
+ * @return: None
+ */
+void cmFsmTraceRecord(
+    CmFsmEntity *fsmEnt,   /* FSM instance */
+    U16         from,      /* left state */
+    U16         to,        /* entered state */
+    U16         col,       /* matrix column or CM_FSM_TRACE_COL_SET */
+    CmTimeNs    tsNow      /* transition time */
+)
+{
+    CmFsmTraceRing *ring = cm_traceMyRing;
+    CmFsmTraceRec  *rec;
+    U64            nowUs = CM_TIME_TO_US(tsNow);
+    U32            tail;
+
+    if (!cm_traceOn)
+    {
+        fsmEnt->enterUs = nowUs;
+        return;
+    }
+
+    if ((!ring || cm_traceMyGen != cm_traceGen) && !(ring = cmFsmTraceRegister()))
+    {
+        fsmEnt->enterUs = nowUs;
+        return;
+    }
+
+    tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= CM_FSM_TRACE_RING_LEN)
+    {
+        ring->dropCnt++;
+        fsmEnt->enterUs = nowUs;
+        return;
+    }
+
+    rec = &ring->recs[tail & (CM_FSM_TRACE_RING_LEN - 1)];
+    rec->tsUs    = nowUs;
+    rec->dwellUs = nowUs > fsmEnt->enterUs ? nowUs - fsmEnt->enterUs : 0;
+    rec->fsmCp   = fsmEnt->fsmCp;
+    rec->from    = from;
+    rec->to      = to;
+    rec->col     = col;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    fsmEnt->enterUs = nowUs;
+}
+
+/**
+ * Find or add the statistics of a control point
+ *
+ * @param: fsmCp  control point
+ * @return: statistics, NULL if the table is full
+ */
+PRIVATE CmFsmTraceCpStat *cmFsmTraceCpStat(CmFsmCp *fsmCp)
+{
+    U32 i;
+
+    for (i = 0; i < CM_FSM_TRACE_MAX_CP; i++)
+    {
+        if (cm_traceCp[i].fsmCp == fsmCp)
+            return &cm_traceCp[i];
+        if (!cm_traceCp[i].fsmCp)
+        {
+            cm_traceCp[i].fsmCp = fsmCp;
+            return &cm_traceCp[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns the dwell histogram bucket of a duration
+ *
+ * @param: us  duration in microseconds
+ * @return: bucket, 0 for less than 1us
+ */
+PRIVATE U32 cmFsmTraceBucket(U64 us)
+{
+    U32 bkt = us ? 64 - __builtin_clzll(us) : 0;
+
+    return bkt < CM_FSM_TRACE_HIST_BKTS ? bkt : CM_FSM_TRACE_HIST_BKTS - 1;
+}
+
+/**
+ * Drain all the rings into the statistics
+ * Called with cm_traceMutex held
+ *
+ * @param: periodUs  time since the previous drain, 0 to skip the rate
+ * @return: None
+ */
+PRIVATE void cmFsmTraceDrain(U64 periodUs)
+{
+    CmFsmTraceRing   *ring;
+    CmFsmTraceRec    *rec;
+    CmFsmTraceCpStat *cpStat;
+    U64              rate;
+    U32              head, tail, i;
+    U32              cnt[CM_FSM_TRACE_MAX_CP];
+
+    memset(cnt, 0, sizeof(cnt));
+    for (ring = __atomic_load_n(&cm_traceRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        head = ring->head;
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            rec = &ring->recs[head & (CM_FSM_TRACE_RING_LEN - 1)];
+            cpStat = cmFsmTraceCpStat(rec->fsmCp);
+            if (!cpStat || rec->from >= CM_FSM_TRACE_MAX_STATES ||
+                rec->to >= CM_FSM_TRACE_MAX_STATES)
+            {
+                cm_traceUnknown++;
+                continue;
+            }
+
+            if (!cpStat->firstUs)
+                cpStat->firstUs = rec->tsUs;
+            cpStat->lastUs = rec->tsUs;
+            cpStat->states[rec->from].exitCnt++;
+            cpStat->states[rec->from].dwellSumUs += rec->dwellUs;
+            if (rec->dwellUs > cpStat->states[rec->from].dwellMaxUs)
+                cpStat->states[rec->from].dwellMaxUs = rec->dwellUs;
+            cpStat->states[rec->from].hist[cmFsmTraceBucket(rec->dwellUs)]++;
+            cpStat->states[rec->to].enterCnt++;
+            cpStat->trans[rec->from][rec->to]++;
+            cnt[cpStat - cm_traceCp]++;
+        }
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+
+    for (i = 0; periodUs && i < CM_FSM_TRACE_MAX_CP; i++)
+    {
+        rate = (U64)cnt[i] * 1000000 / periodUs;
+        if (rate > cm_traceCp[i].peakRate)
+            cm_traceCp[i].peakRate = rate;
+    }
+}
+
+/**
+ * Aggregator thread, drains the rings every CM_FSM_TRACE_AGG_MS
+ *
+ * @param: arg  unused
+ * @return: NULL
+ */
+PRIVATE void *cmFsmTraceMain(void *arg)
+{
+    struct timespec wake;
+    CmTimeNs        tsLast, tsNow;
+
+    tsLast = cmTimeNow();
+    pthread_mutex_lock(&cm_traceMutex);
+    while (!cm_traceQuit)
+    {
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += CM_FSM_TRACE_AGG_MS * 1000000L;
+        if (wake.tv_nsec >= 1000000000L)
+        {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&cm_traceCond, &cm_traceMutex, &wake);
+
+        tsNow = cmTimeNow();
+        /* Back from virtual time the clock may be behind the last drain */
+        cmFsmTraceDrain(tsNow > tsLast ? CM_TIME_TO_US(tsNow - tsLast) : 0);
+        tsLast = tsNow;
+    }
+    pthread_mutex_unlock(&cm_traceMutex);
+
+    return NULL;
+}
+
+/**
+ * Start tracing and the aggregator thread
+ *
+ * @param: None
+ * @return: SUCCESS  tracing
+ *          FAILURE  failed to start the aggregator
+ */
+S16 cmFsmTraceInit( void )
+{
+    if (cm_traceOn)
+        return SUCCESS;
+
+    cm_traceQuit = FALSE;
+    if (sl_ThreadCreate(&cm_traceTid, cmFsmTraceMain, NULL) != 0)
+    {
+        SLOGERR("Failed to start FSM trace aggregator");
+        return FAILURE;
+    }
+
+    cm_traceOn = TRUE;
+    return SUCCESS;
+}
+
+/**
+ * Log the dwell histograms and transition counts aggregated so far
+ * The traced control points must still be alive.
+ *
+ * @param: None
+ * @return: None
+ */
+void cmFsmTraceDump( void )
+{
+    CmFsmTraceCpStat    *cpStat;
+    CmFsmTraceStateStat *st;
+    CmFsmTraceRing      *ring;
+    S8                  hist[CM_FSM_TRACE_HIST_BKTS * 24];
+    U64                 drops = 0, spanUs;
+    U32                 i, s, t, b, len, numStates;
+
+    pthread_mutex_lock(&cm_traceMutex);
+    cmFsmTraceDrain(0);
+
+    for (ring = cm_traceRings; ring; ring = ring->next)
+        drops += ring->dropCnt;
+    SLOGNOTE("FSM trace: %llu records dropped, %llu not aggregated",
+             drops, cm_traceUnknown);
+
+    for (i = 0; i < CM_FSM_TRACE_MAX_CP && cm_traceCp[i].fsmCp; i++)
+    {
+        cpStat = &cm_traceCp[i];
+        numStates = cpStat->fsmCp->numStates + 1;
+        if (numStates > CM_FSM_TRACE_MAX_STATES)
+            numStates = CM_FSM_TRACE_MAX_STATES;
+        spanUs = cpStat->lastUs - cpStat->firstUs;
+
+        for (s = 0; s < numStates; s++)
+        {
+            st = &cpStat->states[s];
+            if (!st->enterCnt && !st->exitCnt)
+                continue;
+
+            SLOGNOTE("FSM %s %s: in %llu out %llu, dwell avg %llu us max %llu us",
+                     cpStat->fsmCp->fsmStr, cpStat->fsmCp->states[s].stateStr,
+                     st->enterCnt, st->exitCnt,
+                     st->exitCnt ? st->dwellSumUs / st->exitCnt : 0,
+                     st->dwellMaxUs);
+
+            /* Non empty buckets as <upper bound us>:count */
+            for (b = 0, len = 0, hist[0] = '\0'; b < CM_FSM_TRACE_HIST_BKTS; b++)
+            {
+                if (st->hist[b] && len < sizeof(hist))
+                    len += snprintf(hist + len, sizeof(hist) - len, " <%llu:%llu",
+                                    1ULL << b, st->hist[b]);
+            }
+            if (len)
+                SLOGNOTE("FSM %s %s dwell us:%s", cpStat->fsmCp->fsmStr,
+                         cpStat->fsmCp->states[s].stateStr, hist);
+        }
+
+        for (s = 0; s < numStates; s++)
+        {
+            for (t = 0; t < numStates; t++)
+            {
+                if (!cpStat->trans[s][t])
+                    continue;
+                SLOGNOTE("FSM %s %s-->%s: %llu, %llu/s avg",
+                         cpStat->fsmCp->fsmStr,
+                         cpStat->fsmCp->states[s].stateStr,
+                         cpStat->fsmCp->states[t].stateStr,
+                         cpStat->trans[s][t],
+                         spanUs ? cpStat->trans[s][t] * 1000000 / spanUs : 0);
+            }
+        }
+        SLOGNOTE("FSM %s peak %llu transitions/s", cpStat->fsmCp->fsmStr,
+                 cpStat->peakRate);
+    }
+
+    pthread_mutex_unlock(&cm_traceMutex);
+}
+
+/**
+ * Stop tracing and release the rings
+ * The FSMs must not run while the rings are released.
+ *
+ * @param: None
+ * @return: None
+ */
+void cmFsmTraceDeinit( void )
+{
+    CmFsmTraceRing *ring;
+
+    if (!cm_traceOn)
+        return;
+
+    cm_traceOn = FALSE;
+    pthread_mutex_lock(&cm_traceMutex);
+    cm_traceQuit = TRUE;
+    pthread_cond_signal(&cm_traceCond);
+    pthread_mutex_unlock(&cm_traceMutex);
+    pthread_join(cm_traceTid, NULL);
+
+    while ((ring = cm_traceRings) != NULL)
+    {
+        cm_traceRings = ring->next;
+        free(ring);
+    }
+    cm_traceGen++;
+    cm_traceMyRing = NULL;
+    memset(cm_traceCp, 0, sizeof(cm_traceCp));
+    cm_traceUnknown = 0;
+}
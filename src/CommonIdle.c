@@ -0,0 +1,381 @@
+/*
+ * \file Name: CommonIdle.c
+ *
+ * \brief Idle strategies for the driver loops
+ *
+ * \details
+ * CM_IDLE_SPIN and CM_IDLE_YIELD poll the watched descriptor and the
+ * clock in a loop, CM_IDLE_BLOCK sleeps in epoll_wait() on the watched
+ * descriptor and a timerfd armed with the time left to the deadline on
+ * the selected clock source. CM_IDLE_SIM advances the virtual clock to
+ * the deadline, it only blocks on the watched descriptor when there is
+ * no deadline at all.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <sched.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "CommonIdle.h"
+#include "CommonClock.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+static const S8 *CM_IDLE_STR[CM_IDLE_MAX] = { "spin", "yield", "block", "sim" };
+
+/**
+ * Account one deadline wake-up
+ *
+ * @param: idle      idle context
+ * @param: deadline  deadline that was waited for
+ * @return: None
+ */
+PRIVATE void cmIdleRecordWake(CmIdleCtx *idle, CmTimeNs *deadline)
+{
+    CmTimeNs tsNow = cmTimeNow();
+    U64      latUs = 0;
+
+    if (tsNow > *deadline)
+        latUs = CM_TIME_TO_US(tsNow - *deadline);
+
+    idle->wakeCnt++;
+    idle->latSumUs += latUs;
+    if (latUs > idle->latMaxUs)
+        idle->latMaxUs = latUs;
+}
+
+/**
+ * Check if the watched descriptor is readable, without waiting
+ *
+ * @param: idle  idle context
+ * @return: TRUE if readable
+ */
+PRIVATE bool cmIdleFdReady(CmIdleCtx *idle)
+{
+    struct pollfd pfd;
+
+    if (idle->watchFd < 0)
+        return FALSE;
+    if (idle->watchPoll)
+        return TRUE;
+
+    pfd.fd      = idle->watchFd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    return (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLIN | POLLHUP)));
+}
+
+/**
+ * Initialize an idle context
+ *
+ * @param: idle      idle context
+ * @param: strategy  CM_IDLE_SPIN/CM_IDLE_YIELD/CM_IDLE_BLOCK/CM_IDLE_SIM
+ * @param: watchFd   descriptor to wait for, -1 for none
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ */
+S16 cmIdleInit(
+    CmIdleCtx          *idle,     /* idle context */
+    CM_IDLE_STRATEGY_t strategy,  /* CM_IDLE_xxx  */
+    S32                watchFd    /* descriptor to wait for, -1 for none */
+)
+{
+    struct epoll_event ev;
+
+    if (!idle || strategy >= CM_IDLE_MAX)
+    {
+        SLOGERR("Invalid parameters, idle:%p, strategy:%d", idle, strategy);
+        return FAILURE;
+    }
+
+    memset(idle, 0, sizeof(CmIdleCtx));
+    idle->strategy = strategy;
+    idle->spinCnt  = CM_IDLE_SPIN_DEFAULT;
+    idle->watchFd  = watchFd;
+    idle->epFd     = -1;
+    idle->tmrFd    = -1;
+
+    /* Simulation runs on the virtual clock, start it from now */
+    if (strategy == CM_IDLE_SIM && !cmClockIsVirtual() &&
+        cmClockVirtStart(0) != SUCCESS)
+        return FAILURE;
+
+    if (strategy != CM_IDLE_BLOCK)
+        return SUCCESS;
+
+    idle->epFd  = epoll_create1(EPOLL_CLOEXEC);
+    idle->tmrFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (idle->epFd < 0 || idle->tmrFd < 0)
+    {
+        SLOGERR("Failed to create epoll/timerfd (%s)", strerror(errno));
+        cmIdleDeinit(idle);
+        return FAILURE;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = idle->tmrFd;
+    if (epoll_ctl(idle->epFd, EPOLL_CTL_ADD, idle->tmrFd, &ev) < 0)
+    {
+        SLOGERR("Failed to watch timerfd (%s)", strerror(errno));
+        cmIdleDeinit(idle);
+        return FAILURE;
+    }
+
+    if (watchFd >= 0)
+    {
+        ev.data.fd = watchFd;
+        if (epoll_ctl(idle->epFd, EPOLL_CTL_ADD, watchFd, &ev) < 0)
+        {
+            /* Regular files can not be polled and are always readable */
+            if (errno != EPERM)
+            {
+                SLOGERR("Failed to watch fd %d (%s)", watchFd, strerror(errno));
+                cmIdleDeinit(idle);
+                return FAILURE;
+            }
+            idle->watchPoll = TRUE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Release the descriptors of an idle context
+ *
+ * @param: idle  idle context
+ * @return: None
+ */
+void cmIdleDeinit( CmIdleCtx *idle )
+{
+    if (!idle) return;
+
+    if (idle->tmrFd >= 0) close(idle->tmrFd);
+    if (idle->epFd  >= 0) close(idle->epFd);
+    idle->tmrFd = idle->epFd = -1;
+}
+
+/**
+ * Busy wait until the watched descriptor is readable or the deadline
+ *
+ * @param: idle      idle context
+ * @param: deadline  monotonic deadline, NULL for none
+ * @return: CM_IDLE_WAKE_FD/CM_IDLE_WAKE_TMR
+ */
+PRIVATE S32 cmIdleSpin(CmIdleCtx *idle, CmTimeNs *deadline)
+{
+    U32 spins = 0;
+
+    while (true)
+    {
+        if (cmIdleFdReady(idle))
+            return CM_IDLE_WAKE_FD;
+
+        if (deadline)
+        {
+            if (cmTimeNow() >= *deadline)
+            {
+                cmIdleRecordWake(idle, deadline);
+                return CM_IDLE_WAKE_TMR;
+            }
+        }
+
+        if (idle->strategy == CM_IDLE_YIELD && ++spins >= idle->spinCnt)
+        {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Block until the watched descriptor is readable or the deadline
+ *
+ * @param: idle      idle context
+ * @param: deadline  monotonic deadline, NULL for none
+ * @return: CM_IDLE_WAKE_FD/CM_IDLE_WAKE_TMR
+ *          FAILURE  failed
+ */
+PRIVATE S32 cmIdleBlock(CmIdleCtx *idle, CmTimeNs *deadline)
+{
+    struct itimerspec  its;
+    struct epoll_event evs[2];
+    CmTimeNs           tsNow, left = 1;
+    U64                expCnt;
+    S32                i, num;
+    bool               tmrFired = FALSE;
+
+    /* Relative to the selected source, whatever the clock behind it */
+    memset(&its, 0, sizeof(its));
+    if (deadline)
+    {
+        /* A zero it_value disarms the timer, a due deadline sleeps 1 ns */
+        tsNow = cmTimeNow();
+        if (*deadline > tsNow)
+            left = *deadline - tsNow;
+        its.it_value.tv_sec  = left / CM_TIME_NS_PER_SEC;
+        its.it_value.tv_nsec = left % CM_TIME_NS_PER_SEC;
+    }
+
+    if (timerfd_settime(idle->tmrFd, 0, &its, NULL) < 0)
+    {
+        SLOGERR("Failed to arm timerfd (%s)", strerror(errno));
+        return FAILURE;
+    }
+
+    while (true)
+    {
+        num = epoll_wait(idle->epFd, evs, 2, -1);
+        if (num < 0)
+        {
+            if (errno == EINTR) continue;
+            SLOGERR("epoll_wait failed (%s)", strerror(errno));
+            return FAILURE;
+        }
+
+        for (i = 0; i < num; i++)
+        {
+            if (evs[i].data.fd == idle->tmrFd)
+            {
+                if (read(idle->tmrFd, &expCnt, sizeof(expCnt)) == sizeof(expCnt))
+                    tmrFired = TRUE;
+            }
+            else
+            {
+                return CM_IDLE_WAKE_FD;
+            }
+        }
+
+        if (tmrFired)
+        {
+            cmIdleRecordWake(idle, deadline);
+            return CM_IDLE_WAKE_TMR;
+        }
+    }
+}
+
+/**
+ * Jump the virtual clock to the deadline, or block on the watched
+ * descriptor when there is no deadline
+ *
+ * @param: idle      idle context
+ * @param: deadline  monotonic deadline, NULL for none
+ * @return: CM_IDLE_WAKE_FD/CM_IDLE_WAKE_TMR
+ *          FAILURE  failed
+ */
+PRIVATE S32 cmIdleSim(CmIdleCtx *idle, CmTimeNs *deadline)
+{
+    struct pollfd pfd;
+
+    if (deadline)
+    {
+        cmClockVirtAdvanceTo(*deadline);
+        cmIdleRecordWake(idle, deadline);
+        return CM_IDLE_WAKE_TMR;
+    }
+
+    pfd.fd     = idle->watchFd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, -1) < 0)
+    {
+        if (errno == EINTR) continue;
+        SLOGERR("poll failed (%s)", strerror(errno));
+        return FAILURE;
+    }
+    return CM_IDLE_WAKE_FD;
+}
+
+/**
+ * Wait until the watched descriptor is readable or the deadline
+ * A readable descriptor wins over a deadline reached at the same time.
+ *
+ * @param: idle      idle context
+ * @param: deadline  monotonic deadline, NULL for none
+ * @return: CM_IDLE_WAKE_FD  descriptor readable
+ *          CM_IDLE_WAKE_TMR deadline reached
+ *          FAILURE          nothing to wait for or error
+ */
+S32 cmIdleWait(
+    CmIdleCtx  *idle,     /* idle context */
+    CmTimeNs   *deadline  /* monotonic deadline, NULL for none */
+)
+{
+
+    if (!idle || (!deadline && idle->watchFd < 0))
+    {
+        SLOGERR("Nothing to wait for, idle:%p", idle);
+        return FAILURE;
+    }
+
+    if (cmIdleFdReady(idle))
+        return CM_IDLE_WAKE_FD;
+
+    /* Deadline already passed, no need to sleep */
+    if (deadline)
+    {
+        if (cmTimeNow() >= *deadline)
+            return CM_IDLE_WAKE_TMR;
+    }
+
+    if (idle->strategy == CM_IDLE_BLOCK)
+        return cmIdleBlock(idle, deadline);
+
+    if (idle->strategy == CM_IDLE_SIM)
+        return cmIdleSim(idle, deadline);
+
+    return cmIdleSpin(idle, deadline);
+}
+
+/**
+ * Parse an idle strategy name
+ *
+ * @param: str       "spin", "yield", "block" or "sim"
+ * @param: strategy  output strategy
+ * @return: SUCCESS  known name
+ *          FAILURE  unknown name
+ */
+S16 cmIdleStrToStrategy( const S8 *str, CM_IDLE_STRATEGY_t *strategy )
+{
+    U32 i;
+
+    for (i = 0; str && i < CM_IDLE_MAX; i++)
+    {
+        if (strcmp(str, CM_IDLE_STR[i]) == 0)
+        {
+            *strategy = i;
+            return SUCCESS;
+        }
+    }
+    return FAILURE;
+}
+
+/**
+ * Log the measured deadline wake-up latency
+ *
+ * @param: idle  idle context
+ * @return: None
+ */
+void cmIdleDumpStats( CmIdleCtx *idle )
+{
+    if (!idle || idle->strategy >= CM_IDLE_MAX) return;
+
+    SLOGNOTE("Idle %s: %llu deadline wake-ups, latency avg %llu us, max %llu us",
+             CM_IDLE_STR[idle->strategy], idle->wakeCnt,
+             idle->wakeCnt ? idle->latSumUs / idle->wakeCnt : 0,
+             idle->latMaxUs);
+}
@@ -0,0 +1,522 @@
+/*
+ * \file Name: CommonShard.c
+ *
+ * \brief Shared-nothing per-core shards
+ *
+ * \details
+ * Each shard thread drains its inbound rings, runs its FSM control
+ * point and then idles until its next state timer or until a sender
+ * signals its eventfd. Senders only write the eventfd when the shard
+ * announced it is going to sleep, so busy shards cost no system call.
+ * Any number of threads outside the shards may post messages, they take
+ * turns on the external ring of the destination.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "CommonShard.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+/* Shard owning the calling thread */
+static __thread S32 cm_shardSelf = CM_SHARD_EXTERNAL;
+
+/**
+ * Initialize an empty SPSC ring
+ *
+ * @param: ring  ring
+ * @param: size  number of slots, power of 2
+ * @return: SUCCESS  success
+ *          FAILURE  invalid size or no memory
+ */
+S16 cmSpscInit( CmSpscRing *ring, U32 size )
+{
+    if (!ring || size < 2 || (size & (size - 1)))
+    {
+        SLOGERR("Invalid parameters, ring:%p, size:%u", ring, size);
+        return FAILURE;
+    }
+
+    memset(ring, 0, sizeof(CmSpscRing));
+    ring->slots = calloc(size, sizeof(CmShardMsg));
+    if (!ring->slots)
+    {
+        SLOGERR("Failed to allocate %u ring slots", size);
+        return FAILURE;
+    }
+    ring->mask = size - 1;
+    return SUCCESS;
+}
+
+/**
+ * Release the slots of a SPSC ring
+ *
+ * @param: ring  ring
+ * @return: None
+ */
+void cmSpscDeinit( CmSpscRing *ring )
+{
+    if (!ring) return;
+
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * Push one message, producer side only
+ * The consumer index is only re-read when the cached one says full.
+ *
+ * @param: ring  ring
+ * @param: msg   message copied into the ring
+ * @return: SUCCESS  pushed
+ *          FAILURE  ring full
+ */
+S16 cmSpscPush( CmSpscRing *ring, CmShardMsg *msg )
+{
+    U32 tail = ring->tail;
+
+    if (tail - ring->headCache > ring->mask)
+    {
+        ring->headCache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->headCache > ring->mask)
+            return FAILURE;
+    }
+
+    ring->slots[tail & ring->mask] = *msg;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+/**
+ * Pop one message, consumer side only
+ *
+ * @param: ring  ring
+ * @param: msg   output message
+ * @return: SUCCESS  popped
+ *          FAILURE  ring empty
+ */
+S16 cmSpscPop( CmSpscRing *ring, CmShardMsg *msg )
+{
+    U32 head = ring->head;
+
+    if (head == ring->tailCache)
+    {
+        ring->tailCache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->tailCache)
+            return FAILURE;
+    }
+
+    *msg = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+/**
+ * Returns the inbound ring of a shard for one sender
+ *
+ * @param: grp  shard group
+ * @param: dst  destination shard
+ * @param: src  source shard, numShards for external
+ * @return: ring
+ */
+PRIVATE CmSpscRing *cmShardRing(CmShardGrp *grp, U32 dst, U32 src)
+{
+    return &grp->rings[dst * (grp->numShards + 1) + src];
+}
+
+/**
+ * Handle all the messages pending on the inbound rings of a shard
+ *
+ * @param: shard  shard
+ * @return: number of messages handled
+ */
+PRIVATE U32 cmShardDrain(CmShard *shard)
+{
+    CmShardGrp *grp = shard->grp;
+    CmShardMsg msg;
+    U32        src, num = 0;
+
+    for (src = 0; src <= grp->numShards; src++)
+    {
+        while (cmSpscPop(cmShardRing(grp, shard->id, src), &msg) == SUCCESS)
+        {
+            grp->msgFn(shard, &msg);
+            num++;
+        }
+    }
+
+    shard->msgCnt += num;
+    return num;
+}
+
+/**
+ * Check if any inbound ring of a shard holds a message
+ *
+ * @param: shard  shard
+ * @return: TRUE if a message is pending
+ */
+PRIVATE bool cmShardPending(CmShard *shard)
+{
+    CmShardGrp *grp = shard->grp;
+    CmSpscRing *ring;
+    U32        src;
+
+    for (src = 0; src <= grp->numShards; src++)
+    {
+        ring = cmShardRing(grp, shard->id, src);
+        if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Pin the calling thread to one core
+ *
+ * @param: shard  shard, cpu set to the core or -1
+ * @return: None
+ */
+PRIVATE void cmShardPin(CmShard *shard)
+{
+    cpu_set_t cpus;
+    S32       numCpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    shard->cpu = -1;
+    if (numCpu <= 0)
+        return;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->id % numCpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        SLOGERR("Failed to pin shard %u on cpu %u", shard->id, shard->id % numCpu);
+        return;
+    }
+    shard->cpu = shard->id % numCpu;
+}
+
+/**
+ * Idle a shard until a timer, a message or the group quits
+ * The sleeping flag is raised before the last ring check, a sender
+ * pushing after that check sees it and signals the eventfd.
+ *
+ * @param: shard  shard
+ * @return: None
+ */
+PRIVATE void cmShardIdle(CmShard *shard)
+{
+    CmTimeNs tsDeadline;
+    CmTimeNs *deadline = NULL;
+    U64      cnt;
+
+    if (shard->fsmCp.numStates &&
+        cmFsmNextDeadline(&shard->fsmCp, &tsDeadline) == SUCCESS)
+    {
+        deadline = &tsDeadline;
+    }
+
+    __atomic_store_n(&shard->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!cmShardPending(shard) && !shard->grp->quit)
+    {
+        if (cmIdleWait(&shard->idle, deadline) == CM_IDLE_WAKE_FD)
+            (void)!read(shard->evFd, &cnt, sizeof(cnt));
+    }
+    __atomic_store_n(&shard->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Shard thread
+ *
+ * @param: arg  shard
+ * @return: NULL
+ */
+PRIVATE void *cmShardMain(void *arg)
+{
+    CmShard    *shard = (CmShard *)arg;
+    CmShardGrp *grp = shard->grp;
+    S32        active = 0;
+    U32        numMsg;
+
+    cm_shardSelf = shard->id;
+    cmShardPin(shard);
+
+    /* Sessions are allocated on the shard thread, close to its core */
+    if (cmIdleInit(&shard->idle, grp->idleStrategy, shard->evFd) != SUCCESS ||
+        grp->initFn(shard) != SUCCESS)
+    {
+        SLOGERR("Failed to init shard %u", shard->id);
+        grp->initRet = FAILURE;
+        __atomic_add_fetch(&grp->numReady, 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    __atomic_add_fetch(&grp->numReady, 1, __ATOMIC_RELEASE);
+
+    while (!grp->quit)
+    {
+        numMsg = cmShardDrain(shard);
+        if (shard->fsmCp.numStates)
+            active = cmFsmDriverAll(&shard->fsmCp);
+
+        /* Polling mode instances need every pass */
+        if (numMsg == 0 &&
+            (active <= 0 || shard->fsmCp.mode == CM_FSM_MODE_EVENT))
+        {
+            cmShardIdle(shard);
+        }
+    }
+
+    if (grp->deinitFn)
+        grp->deinitFn(shard);
+    cmIdleDeinit(&shard->idle);
+    return NULL;
+}
+
+/**
+ * Initialize a shard group and start one pinned thread per shard
+ * Returns once every shard ran its init hook.
+ *
+ * @param: grp           shard group
+ * @param: numShards     1 to CM_SHARD_MAX
+ * @param: ringLen       messages per ring, power of 2
+ * @param: idleStrategy  idle strategy of the shard threads
+ * @param: initFn        per shard init, on the shard thread
+ * @param: msgFn         message handler
+ * @param: deinitFn      per shard cleanup, may be NULL
+ * @return: SUCCESS  all the shards running
+ *          FAILURE  failed, nothing left running
+ */
+S16 cmShardGrpInit(
+    CmShardGrp         *grp,        /* shard group */
+    U32                numShards,   /* 1 to CM_SHARD_MAX */
+    U32                ringLen,     /* messages per ring, power of 2 */
+    CM_IDLE_STRATEGY_t idleStrategy,
+    CmShardInitFn      initFn,      /* per shard init, on the shard thread */
+    CmShardMsgFn       msgFn,       /* message handler */
+    CmShardDeinitFn    deinitFn     /* per shard cleanup, may be NULL */
+)
+{
+    CmShard *shard;
+    U32     i, numRings;
+
+    if (!grp || numShards == 0 || numShards > CM_SHARD_MAX || !initFn || !msgFn)
+    {
+        SLOGERR("Invalid parameters, grp:%p, numShards:%u", grp, numShards);
+        return FAILURE;
+    }
+
+    memset(grp, 0, sizeof(CmShardGrp));
+    grp->numShards    = numShards;
+    grp->idleStrategy = idleStrategy;
+    grp->initFn       = initFn;
+    grp->msgFn        = msgFn;
+    grp->deinitFn     = deinitFn;
+    grp->initRet      = SUCCESS;
+
+    numRings = numShards * (numShards + 1);
+    if (posix_memalign((void **)&grp->shards, 64, numShards * sizeof(CmShard)) != 0 ||
+        posix_memalign((void **)&grp->rings, 64, numRings * sizeof(CmSpscRing)) != 0)
+    {
+        SLOGERR("Failed to allocate %u shards", numShards);
+        free(grp->shards);
+        return FAILURE;
+    }
+    memset(grp->shards, 0, numShards * sizeof(CmShard));
+    memset(grp->rings, 0, numRings * sizeof(CmSpscRing));
+    for (i = 0; i < numShards; i++)
+    {
+        grp->shards[i].evFd = -1;
+        pthread_mutex_init(&grp->shards[i].extLock, NULL);
+    }
+
+    for (i = 0; i < numRings; i++)
+    {
+        if (cmSpscInit(&grp->rings[i], ringLen) != SUCCESS)
+            goto fail;
+    }
+
+    for (i = 0; i < numShards; i++)
+    {
+        shard = &grp->shards[i];
+        shard->id   = i;
+        shard->grp  = grp;
+        shard->evFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->evFd < 0)
+        {
+            SLOGERR("Failed to create eventfd (%s)", strerror(errno));
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < numShards; i++, grp->numStarted++)
+    {
+        if (sl_ThreadCreate(&grp->shards[i].tid, cmShardMain,
+                            &grp->shards[i]) != 0)
+        {
+            SLOGERR("Failed to start shard %u", i);
+            grp->initRet = FAILURE;
+            break;
+        }
+    }
+
+    while (__atomic_load_n(&grp->numReady, __ATOMIC_ACQUIRE) < grp->numStarted)
+        sched_yield();
+
+    if (grp->initRet == SUCCESS)
+        return SUCCESS;
+
+fail:
+    cmShardGrpDeinit(grp);
+    return FAILURE;
+}
+
+/**
+ * Post a message to a shard
+ * From a shard thread it goes through the ring of that shard, from any
+ * other thread through the external ring, under the lock of the
+ * destination since the ring has a single producer.
+ *
+ * @param: grp       shard group
+ * @param: dstShard  destination shard
+ * @param: msgId     message id
+ * @param: key       session key
+ * @param: payload   message payload
+ * @return: SUCCESS  queued
+ *          FAILURE  invalid shard or ring full
+ */
+S16 cmShardPost(
+    CmShardGrp *grp,       /* shard group */
+    U32        dstShard,   /* destination shard */
+    U16        msgId,      /* message id */
+    U32        key,        /* session key */
+    void       *payload    /* message payload */
+)
+{
+    CmShard    *dst;
+    CmShardMsg msg;
+    U64        one = 1;
+    U32        src;
+    S16        ret;
+
+    if (!grp || dstShard >= grp->numShards)
+    {
+        SLOGERR("Invalid parameters, grp:%p, dstShard:%u", grp, dstShard);
+        return FAILURE;
+    }
+
+    src = (cm_shardSelf == CM_SHARD_EXTERNAL) ? grp->numShards : (U32)cm_shardSelf;
+    dst = &grp->shards[dstShard];
+
+    msg.msgId    = msgId;
+    msg.srcShard = src;
+    msg.key      = key;
+    msg.payload  = payload;
+    if (src == grp->numShards)
+    {
+        pthread_mutex_lock(&dst->extLock);
+        ret = cmSpscPush(cmShardRing(grp, dstShard, src), &msg);
+        pthread_mutex_unlock(&dst->extLock);
+    }
+    else
+        ret = cmSpscPush(cmShardRing(grp, dstShard, src), &msg);
+    if (ret != SUCCESS)
+    {
+        __atomic_add_fetch(&dst->dropCnt, 1, __ATOMIC_RELAXED);
+        return FAILURE;
+    }
+
+    /* Pairs with the sleeping flag raised in cmShardIdle() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&dst->sleeping, __ATOMIC_RELAXED))
+    {
+        __atomic_add_fetch(&dst->wakeCnt, 1, __ATOMIC_RELAXED);
+        (void)!write(dst->evFd, &one, sizeof(one));
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Returns the shard running the calling thread
+ *
+ * @param: None
+ * @return: shard id, CM_SHARD_EXTERNAL off the shard threads
+ */
+S32 cmShardSelf( void )
+{
+    return cm_shardSelf;
+}
+
+/**
+ * Log the per-shard counters
+ *
+ * @param: grp  shard group
+ * @return: None
+ */
+void cmShardDumpStats( CmShardGrp *grp )
+{
+    CmShard *shard;
+    U32     i;
+
+    if (!grp || !grp->shards) return;
+
+    for (i = 0; i < grp->numShards; i++)
+    {
+        shard = &grp->shards[i];
+        SLOGNOTE("Shard %u cpu %d: %llu msgs, %llu dropped, %llu wake-ups, %u active",
+                 i, shard->cpu, shard->msgCnt, shard->dropCnt, shard->wakeCnt,
+                 shard->fsmCp.numActive);
+    }
+}
+
+/**
+ * Stop the shard threads and release the group
+ *
+ * @param: grp  shard group
+ * @return: None
+ */
+void cmShardGrpDeinit( CmShardGrp *grp )
+{
+    CmShard *shard;
+    U64     one = 1;
+    U32     i;
+
+    if (!grp || !grp->shards) return;
+
+    grp->quit = TRUE;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < grp->numStarted; i++)
+    {
+        shard = &grp->shards[i];
+        (void)!write(shard->evFd, &one, sizeof(one));
+        pthread_join(shard->tid, NULL);
+    }
+
+    for (i = 0; i < grp->numShards; i++)
+    {
+        if (grp->shards[i].evFd >= 0)
+            close(grp->shards[i].evFd);
+        pthread_mutex_destroy(&grp->shards[i].extLock);
+    }
+    for (i = 0; grp->rings && i < grp->numShards * (grp->numShards + 1); i++)
+        cmSpscDeinit(&grp->rings[i]);
+
+    free(grp->rings);
+    free(grp->shards);
+    grp->rings  = NULL;
+    grp->shards = NULL;
+}
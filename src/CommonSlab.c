@@ -0,0 +1,197 @@
+/*
+ * \file Name: CommonSlab.c
+ *
+ * \brief Fixed size object slab for FSM instance contexts
+ *
+ * \details
+ * The slab is one anonymous mapping, tried from the huge page pool first
+ * when asked for, then as normal pages with transparent huge pages
+ * advised. Free objects are chained through their first bytes.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <sys/mman.h>
+#include "CommonSlab.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+/**
+ * Initialize a slab
+ *
+ * @param: slab     slab
+ * @param: objSize  object size, rounded up to CM_SLAB_ALIGN
+ * @param: numObj   slab capacity
+ * @param: flags    CM_SLAB_FLAG_xxx
+ * @return: SUCCESS  success
+ *          FAILURE  failed
+ */
+S16 cmSlabInit(
+    CmSlab  *slab,      /* slab */
+    U32     objSize,    /* object size, rounded up to CM_SLAB_ALIGN */
+    U32     numObj,     /* slab capacity */
+    U32     flags       /* CM_SLAB_FLAG_xxx */
+)
+{
+    if (!slab || objSize == 0 || numObj == 0)
+    {
+        SLOGERR("Invalid parameters, slab:%p, objSize:%u, numObj:%u",
+                slab, objSize, numObj);
+        return FAILURE;
+    }
+
+    memset(slab, 0, sizeof(CmSlab));
+    slab->objSize = objSize;
+    slab->stride  = (objSize + CM_SLAB_ALIGN - 1) & ~(CM_SLAB_ALIGN - 1);
+    slab->numObj  = numObj;
+    slab->flags   = flags;
+    slab->len     = (size_t)slab->stride * numObj;
+
+    if (flags & CM_SLAB_FLAG_HUGE)
+    {
+        slab->len = (slab->len + CM_SLAB_HUGE_SIZE - 1) & ~((size_t)CM_SLAB_HUGE_SIZE - 1);
+        slab->base = mmap(NULL, slab->len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab->base != MAP_FAILED)
+            slab->hugeTlb = TRUE;
+        else
+            SLOGINFO("No huge page pool for %zu bytes (%s), using THP",
+                     slab->len, strerror(errno));
+    }
+
+    if (!slab->hugeTlb)
+    {
+        slab->base = mmap(NULL, slab->len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab->base == MAP_FAILED)
+        {
+            SLOGERR("Failed to map slab of %zu bytes (%s)",
+                    slab->len, strerror(errno));
+            slab->base = NULL;
+            return FAILURE;
+        }
+        if (flags & CM_SLAB_FLAG_HUGE)
+            madvise(slab->base, slab->len, MADV_HUGEPAGE);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Take one object from the slab
+ *
+ * @param: slab  slab
+ * @return: object, NULL if the slab is exhausted
+ */
+void *cmSlabAlloc( CmSlab *slab )
+{
+    void *obj;
+
+    if (slab->freeList)
+    {
+        obj = slab->freeList;
+        slab->freeList = slab->freeList->next;
+    }
+    else if (slab->numFresh < slab->numObj)
+    {
+        obj = slab->base + (size_t)slab->numFresh++ * slab->stride;
+    }
+    else
+    {
+        SLOGERR("Slab of %u objects exhausted", slab->numObj);
+        return NULL;
+    }
+
+    if (slab->flags & CM_SLAB_FLAG_ZERO)
+        memset(obj, 0, slab->objSize);
+
+    if (++slab->numUsed > slab->maxUsed)
+        slab->maxUsed = slab->numUsed;
+
+    return obj;
+}
+
+/**
+ * Give one object back to the slab
+ *
+ * @param: slab  slab
+ * @param: obj   object from cmSlabAlloc()
+ * @return: SUCCESS  success
+ *          FAILURE  not an object of this slab
+ */
+S16 cmSlabFree( CmSlab *slab, void *obj )
+{
+    size_t off;
+
+    off = (U8 *)obj - slab->base;
+    if ((U8 *)obj < slab->base ||
+        off >= (size_t)slab->numFresh * slab->stride ||
+        off % slab->stride)
+    {
+        SLOGERR("Object %p not from slab %p", obj, slab->base);
+        return FAILURE;
+    }
+
+    ((CmSlabFreeObj *)obj)->next = slab->freeList;
+    slab->freeList = obj;
+    slab->numUsed--;
+
+    return SUCCESS;
+}
+
+/**
+ * Give all the objects back at once, the mapping stays
+ *
+ * @param: slab  slab
+ * @return: None
+ */
+void cmSlabReset( CmSlab *slab )
+{
+    slab->freeList = NULL;
+    slab->numFresh = 0;
+    slab->numUsed  = 0;
+}
+
+/**
+ * Unmap a slab, all the objects are released
+ *
+ * @param: slab  slab
+ * @return: None
+ */
+void cmSlabDeinit( CmSlab *slab )
+{
+    if (!slab || !slab->base) return;
+
+    munmap(slab->base, slab->len);
+    slab->base = NULL;
+    slab->numObj = slab->numUsed = slab->numFresh = 0;
+    slab->freeList = NULL;
+}
+
+/**
+ * Log the slab usage
+ *
+ * @param: slab  slab
+ * @return: None
+ */
+void cmSlabDumpStats( CmSlab *slab )
+{
+    if (!slab || !slab->base) return;
+
+    SLOGNOTE("Slab %u x %u bytes (%s): %u in use, peak %u",
+             slab->numObj, slab->stride,
+             slab->hugeTlb ? "hugetlb" : "4k/thp",
+             slab->numUsed, slab->maxUsed);
+}
@@ -0,0 +1,308 @@
+/*
+ * \file Name: CommonTmrWheel.c
+ *
+ * \brief Hierarchical timing wheel
+ *
+ * \details
+ * Level N slot i holds the timers expiring in the i-th span of
+ * CM_TMR_WHEEL_SIZE^N ticks. When level 0 wraps, the due slot of the
+ * next level is re-hashed into the lower levels (cascade).
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "CommonTmrWheel.h"
+#include "SysLogging.h"
+#include "CommonInc.h"
+
+/**
+ * Initialize an empty slot list
+ *
+ * @param: head  slot list head
+ * @return: None
+ */
+PRIVATE void cmTmrListInit(CmTmrNode *head)
+{
+    head->next = head->prev = head;
+}
+
+/**
+ * Move all the nodes of a slot list into another empty list head
+ *
+ * @param: from  slot list head, empty on return
+ * @param: to    destination list head
+ * @return: None
+ */
+PRIVATE void cmTmrListMove(CmTmrNode *from, CmTmrNode *to)
+{
+    if (from->next == from)
+    {
+        cmTmrListInit(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    cmTmrListInit(from);
+}
+
+/**
+ * Hash an armed node into the slot matching its expiry tick
+ *
+ * @param: wheel  timing wheel
+ * @param: node   timer node, expires already set
+ * @return: None
+ */
+PRIVATE void cmTmrInsert(CmTmrWheel *wheel, CmTmrNode *node)
+{
+    CmTmrNode *head;
+    U64       delta;
+    U32       level = 0;
+
+    /* Already due timers fire on the next processed tick */
+    if (node->expires < wheel->curTick)
+        node->expires = wheel->curTick;
+
+    delta = node->expires - wheel->curTick;
+    if (delta > CM_TMR_MAX_DELTA)
+    {
+        delta = CM_TMR_MAX_DELTA;
+        node->expires = wheel->curTick + delta;
+    }
+
+    while (level < CM_TMR_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (CM_TMR_WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    head = &wheel->slots[level]
+        [(node->expires >> (CM_TMR_WHEEL_BITS * level)) & CM_TMR_WHEEL_MASK];
+
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+/**
+ * Initialize a timing wheel
+ *
+ * @param: wheel    timing wheel
+ * @param: nowTick  current tick, see cmTmrNsToTick()
+ * @return: None
+ */
+void cmTmrWheelInit( CmTmrWheel *wheel, U64 nowTick )
+{
+    U32 level, slot;
+
+    for (level = 0; level < CM_TMR_WHEEL_LEVELS; level++)
+    {
+        for (slot = 0; slot < CM_TMR_WHEEL_SIZE; slot++)
+            cmTmrListInit(&wheel->slots[level][slot]);
+    }
+
+    wheel->curTick = nowTick;
+    wheel->numTmr  = 0;
+}
+
+/**
+ * Start or restart a timer
+ *
+ * @param: wheel    timing wheel
+ * @param: node     timer node
+ * @param: expires  absolute expiry tick
+ * @return: None
+ */
+void cmTmrStart(
+    CmTmrWheel *wheel,    /* timing wheel */
+    CmTmrNode  *node,     /* timer node   */
+    U64        expires    /* absolute expiry tick */
+)
+{
+    cmTmrStop(wheel, node);
+
+    node->expires = expires;
+    cmTmrInsert(wheel, node);
+    wheel->numTmr++;
+}
+
+/**
+ * Stop a timer, no operation if it is not armed
+ *
+ * @param: wheel    timing wheel
+ * @param: node     timer node
+ * @return: None
+ */
+void cmTmrStop( CmTmrWheel *wheel, CmTmrNode *node )
+{
+    if (!CM_TMR_IS_ARMED(node))
+        return;
+
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+    wheel->numTmr--;
+}
+
+/**
+ * Re-hash the due slot of the upper levels when level 0 wraps
+ *
+ * @param: wheel  timing wheel
+ * @return: None
+ */
+PRIVATE void cmTmrCascade(CmTmrWheel *wheel)
+{
+    CmTmrNode list, *node;
+    U32       level, idx;
+
+    for (level = 1; level < CM_TMR_WHEEL_LEVELS; level++)
+    {
+        idx = (wheel->curTick >> (CM_TMR_WHEEL_BITS * level)) & CM_TMR_WHEEL_MASK;
+
+        cmTmrListMove(&wheel->slots[level][idx], &list);
+        while ((node = list.next) != &list)
+        {
+            list.next = node->next;
+            node->next->prev = &list;
+            cmTmrInsert(wheel, node);
+        }
+
+        /* Upper level only due when this one wraps as well */
+        if (idx != 0)
+            break;
+    }
+}
+
+/**
+ * Advance the wheel up to the current tick and fire the expired timers
+ * The callback may start or stop any timer, including the fired one.
+ *
+ * @param: wheel    timing wheel
+ * @param: nowTick  current tick
+ * @param: cb       called for every expired timer, already stopped
+ * @param: arg      callback argument
+ * @return: number of expired timers
+ */
+U32 cmTmrExpire(
+    CmTmrWheel *wheel,    /* timing wheel */
+    U64        nowTick,   /* current tick */
+    CmTmrCb    cb,        /* called for every expired timer */
+    void       *arg       /* callback argument */
+)
+{
+    CmTmrNode list, *node;
+    U32       idx, numExp = 0;
+
+    while (wheel->curTick <= nowTick)
+    {
+        /* Nothing armed, no need to walk the empty slots */
+        if (wheel->numTmr == 0)
+        {
+            wheel->curTick = nowTick + 1;
+            break;
+        }
+
+        idx = wheel->curTick & CM_TMR_WHEEL_MASK;
+        if (idx == 0)
+            cmTmrCascade(wheel);
+
+        cmTmrListMove(&wheel->slots[0][idx], &list);
+        wheel->curTick++;
+
+        /* Pop one by one, the callback may stop the following nodes */
+        while ((node = list.next) != &list)
+        {
+            list.next = node->next;
+            node->next->prev = &list;
+            node->next = node->prev = NULL;
+            wheel->numTmr--;
+            numExp++;
+            cb(node, arg);
+        }
+    }
+
+    return numExp;
+}
+
+/**
+ * Find the earliest armed expiry tick
+ * In every level only the first non-empty slot from the current index
+ * is walked, the later slots of the same level expire after it. The
+ * current slot of an upper level is only due when its cascade is still
+ * pending, i.e. all the lower index bits of curTick are zero.
+ *
+ * @param: wheel  timing wheel
+ * @param: tick   earliest expiry tick to be returned
+ * @return: SUCCESS  at least one timer armed
+ *          FAILURE  no timer armed
+ */
+S16 cmTmrNextExpiry( CmTmrWheel *wheel, U64 *tick )
+{
+    CmTmrNode *head, *node;
+    U64       minTick = ~0ULL;
+    U32       level, i, idx;
+    U64       lowMask;
+
+    if (wheel->numTmr == 0)
+        return FAILURE;
+
+    for (level = 0; level < CM_TMR_WHEEL_LEVELS; level++)
+    {
+        idx = (wheel->curTick >> (CM_TMR_WHEEL_BITS * level)) & CM_TMR_WHEEL_MASK;
+        lowMask = (1ULL << (CM_TMR_WHEEL_BITS * level)) - 1;
+
+        for (i = (wheel->curTick & lowMask) ? 1 : 0; i <= CM_TMR_WHEEL_SIZE; i++)
+        {
+            head = &wheel->slots[level][(idx + i) & CM_TMR_WHEEL_MASK];
+            if (head->next == head)
+                continue;
+
+            for (node = head->next; node != head; node = node->next)
+            {
+                if (node->expires < minTick)
+                    minTick = node->expires;
+            }
+            break;
+        }
+    }
+
+    *tick = minTick;
+    return SUCCESS;
+}
+
+/**
+ * Convert a monotonic time into wheel ticks
+ *
+ * @param: ts  monotonic time
+ * @return: ticks
+ */
+U64 cmTmrNsToTick( CmTimeNs ts )
+{
+    return ts / (CM_TMR_TICK_MS * CM_TIME_NS_PER_MS);
+}
+
+/**
+ * Convert wheel ticks into a monotonic time
+ *
+ * @param: tick  ticks
+ * @return: monotonic time
+ */
+CmTimeNs cmTmrTickToNs( U64 tick )
+{
+    return tick * CM_TMR_TICK_MS * CM_TIME_NS_PER_MS;
+}
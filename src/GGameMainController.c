@@ -37,49 +37,55 @@
 #include <stddef.h>
 #include <signal.h>
 #include "SysLogging.h"
+#include "SysLogBin.h"
+#include "SysLogFile.h"
+#include "SysLogSock.h"
+#include "CommonIdle.h"
+#include "CommonClock.h"
+#include "CommonFsmGen.h"
+#include "CommonFsmTrace.h"
 #include "GGameMainController.h"
 
-/* FSM State and timeout definitions*/
-CmFsmStatDesc mainFsmDesc[] =
-{
-    {"MAIN_ST_INIT",  0      },
-    {"MAIN_ST_START", 0      },
-    {"MAIN_ST_INPUT", 30000  },
-    {"MAIN_ST_QUIT",  0      },
-};
-
-/* FSM Matrix */
-CmFsmEntry mainCtrlFsmMt[MAIN_ST_MAX+1][CM_FSM_CTRL_MAX] =
-{
-    /* MAIN_ST_INIT */
-    {
-        {clGenerateRandomSeq,     MAIN_ST_START},   /* CM_FSM_CTRL_NORMAL */
-        {clGeneralTimeoutHdl,     MAIN_ST_QUIT },   /* CM_FSM_CTRL_TIMEOUT */
-    },
-    /* MAIN_ST_START */
-    {
-        {clCollectUserInputStart, MAIN_ST_INPUT},   /* CM_FSM_CTRL_NORMAL */
-        {clGeneralTimeoutHdl,     MAIN_ST_QUIT },   /* CM_FSM_CTRL_TIMEOUT */
-    },
-    /* MAIN_ST_INPUT */
-    {
-        {clCollectUserInput,      MAIN_ST_INPUT},   /* CM_FSM_CTRL_NORMAL */
-        {clGeneralTimeoutHdl,     MAIN_ST_QUIT },   /* CM_FSM_CTRL_TIMEOUT */
-    },
-    /* MAIN_ST_QUIT */
-    {
-        {clFsmQuit,               MAIN_ST_QUIT },   /* CM_FSM_CTRL_NORMAL */
-        {clGeneralTimeoutHdl,     MAIN_ST_QUIT },   /* CM_FSM_CTRL_TIMEOUT */
-    }
-};
+/* FSM States: state, timeout (ms) */
+#define MAIN_FSM_STATES(S)                \
+    S(MAIN_ST_INIT,  0      )             \
+    S(MAIN_ST_START, 0      )             \
+    S(MAIN_ST_INPUT, 30000  )             \
+    S(MAIN_ST_RESULT, 0     )             \
+    S(MAIN_ST_QUIT,  0      )
+
+/* FSM Transitions: state, event, output function, next state */
+#define MAIN_FSM_TRANS(T)                                                          \
+    T(MAIN_ST_INIT,  CM_FSM_CTRL_NORMAL,  clGenerateRandomSeq,     MAIN_ST_START)   \
+    T(MAIN_ST_INIT,  CM_FSM_CTRL_TIMEOUT, clGeneralTimeoutHdl,     MAIN_ST_QUIT )   \
+    T(MAIN_ST_START, CM_FSM_CTRL_NORMAL,  clCollectUserInputStart, MAIN_ST_INPUT)   \
+    T(MAIN_ST_START, CM_FSM_CTRL_TIMEOUT, clGeneralTimeoutHdl,     MAIN_ST_QUIT )   \
+    T(MAIN_ST_INPUT, CM_FSM_CTRL_NORMAL,  clCollectUserInput,      MAIN_ST_INPUT)   \
+    T(MAIN_ST_INPUT, CM_FSM_CTRL_TIMEOUT, clGeneralTimeoutHdl,     MAIN_ST_QUIT )   \
+    T(MAIN_ST_RESULT, CM_FSM_CTRL_NORMAL, clWaitNextRound,         MAIN_ST_RESULT)  \
+    T(MAIN_ST_RESULT, CM_FSM_CTRL_TIMEOUT, clGeneralTimeoutHdl,    MAIN_ST_QUIT )   \
+    T(MAIN_ST_QUIT,  CM_FSM_CTRL_NORMAL,  clFsmQuit,               MAIN_ST_QUIT )   \
+    T(MAIN_ST_QUIT,  CM_FSM_CTRL_TIMEOUT, clGeneralTimeoutHdl,     MAIN_ST_QUIT )
+
+/* mainCtrlFsmDesc, mainCtrlFsmMt, mainCtrlFsmMtInit() and mainCtrlFsmDisp() */
+CM_FSM_GEN_DEFINE(mainCtrlFsm, PROC_INFO_t, MAIN_ST_MAX, CM_FSM_CTRL_MAX,
+                  MAIN_FSM_STATES, MAIN_FSM_TRANS)
 
 static char *BTN_ALLLOWED="abc";
-static PROC_INFO_t g_procInfo;
+static CmIdleCtx   g_idleCtx;   /* Idle strategy while waiting for input or deadlines */
+static CmSlab      g_ctxSlab;   /* Session contexts, one cache line aligned each */
+static volatile sig_atomic_t g_traceDumpReq; /* SIGUSR1 received, dump the FSM trace */
+static bool        g_randFixed; /* Seeded with -s, sequences are reproducible */
 /**
  * Application Main Entrance
  * see system logs for detail logs
  *
- * @param: not supported yet
+ * @param: -i spin|yield|block|sim  idle strategy, block by default, sim runs
+ *                                  on a virtual clock jumping to the deadlines
+ * @param: -c file                  checkpoint image, the session resumes from it
+ * @param: -s seed                  fixed seed of the random sequences
+ * @param: -t monotonic|coarse|tsc  clock source of the timers, monotonic
+ *                                  by default
  * @return: SUCCESS/FAILURE
  *
  */
@@ -87,9 +93,55 @@ int main (int argc, char *argv[])
 {
     
     CmFsmCp     mainFsmCp;
+    PROC_INFO_t *procInfo = NULL;   /* Session owned by the main thread */
+    CmFsmImage  ckptImage;
+    S8          *ckptPath = NULL;
+    S8          *binLogPath = NULL;
+    S8          *fileLogPath = NULL;
+    S8          *flightPath = NULL;
     S16         ret = FAILURE;
+    S32         opt;
+    S32         numRun;
+    CmTimeNs    tsDeadline;
+    CM_IDLE_STRATEGY_t idleStrategy = CM_IDLE_BLOCK;
+    CM_CLOCK_SOURCE_t  clockSource  = CM_CLOCK_MONOTONIC;
+    bool        badOpt = FALSE;
+    SlAsyncStats logStats;
 
-    memset(&g_procInfo,0,sizeof(g_procInfo));
+    memset(&ckptImage,0,sizeof(ckptImage));
+
+    while ((opt = getopt(argc, argv, "i:c:s:t:l:q:f:r:")) != -1)
+    {
+        if (opt == 'c')
+            ckptPath = optarg;
+        else if (opt == 'l')
+            binLogPath = optarg;
+        else if (opt == 'f')
+            fileLogPath = optarg;
+        else if (opt == 'r')
+            flightPath = optarg;
+        else if (opt == 'q')
+            badOpt = sl_LogSiteEnable(optarg, 0) < 0;
+        else if (opt == 's')
+        {
+            srandom((U32)strtoul(optarg, NULL, 0));
+            g_randFixed = TRUE;
+        }
+        else if (opt == 't')
+            badOpt = cmClockStrToSource(optarg, &clockSource) != SUCCESS;
+        else if (opt == 'i')
+            badOpt = cmIdleStrToStrategy(optarg, &idleStrategy) != SUCCESS;
+        else
+            badOpt = TRUE;
+
+        if (badOpt)
+        {
+            printf("Usage: %s [-i spin|yield|block|sim] [-c checkpoint] [-s seed]"
+                   " [-t monotonic|coarse|tsc] [-l binlog] [-f logfile]"
+                   " [-r dumpfile] [-q file[:line]|function]\n", argv[0]);
+            return FAILURE;
+        }
+    }
 
     /* Install necessary signal handler */
     ret = clInstallSignalHandler();
@@ -97,34 +149,94 @@ int main (int argc, char *argv[])
 
     SLOGINFO("Initialize Logging .. ");
     InitSystemLogging(argv[0], LOG_INFO, LOG_OUT_SYSLOG);
-    getProcInfo(&g_procInfo);
+
+    /* The FSM logs every step, only queue the records on this thread */
+    if (sl_AsyncLogStart(0) != 0)
+        SLOGERR("Asynchronous logging not available");
+
+    /* Frames sent to /dev/log in batches, syslog() if there is no socket */
+    sl_SockLogStart(NULL);
+
+    /* Written in the background, flushed at exit */
+    if (fileLogPath && sl_FileLogStart(fileLogPath, NULL) != 0)
+        SLOGERR("Log file %s not available (%s)", fileLogPath, strerror(errno));
+
+    /* Records stay in the mapped file when the game dies, never stopped */
+    if (binLogPath && sl_BinLogStart(binLogPath, 0) != 0)
+        SLOGERR("Binary log %s not available (%s)", binLogPath, strerror(errno));
+
+    /* Every level kept in memory, dumped on a crash, a quit or SIGUSR1 */
+    if (flightPath && sl_FlightRecStart(flightPath, 0) != 0)
+        SLOGERR("Flight recorder not available%s",
+                binLogPath ? ", the binary log is on" : "");
+
+    /* Timers and deadlines all read this clock, select it first */
+    if (cmClockSetSource(clockSource) != SUCCESS)
+        SLOGERR("Clock source %s not available, using %s",
+                cmClockSourceStr(clockSource), cmClockSourceStr(g_cmClock.source));
 
     SLOGINFO("Initialize FSM Control BLock ..");
+    mainCtrlFsmMtInit();
     ret = cmFsmCpInit(&mainFsmCp,
                       "G-FSM",
                       clMainFsmDr,
                       (U16)offsetof(PROC_INFO_t, fsmEnt),
                       MAIN_ST_MAX,
-                      mainFsmDesc,
+                      mainCtrlFsmDesc,
                       &mainCtrlFsmMt[0][0] /* FSM matrix */
                      );
+    if (ret == SUCCESS)
+        ret = cmFsmCpSetDispatch(&mainFsmCp, mainCtrlFsmDisp);
     if (ret != SUCCESS)
     {
         SLOGERR("Failed to init FSM Control Point");
         return FAILURE;
     }
 
-    SLOGINFO("Initialize FSM Instance ..");
-    ret = cmFsmInstInit(&mainFsmCp,
-                        &g_procInfo,
-                        "MAIN",
-                        MAIN_ST_INIT);
+    /* Transitions are traced in binary, dumped on SIGUSR1 and on exit */
+    if (cmFsmTraceInit() != SUCCESS)
+        SLOGERR("FSM transition trace not available");
+
+    ret = cmFsmCpPoolInit(&mainFsmCp, MAIN_FSM_MAX_INST);
+    if (ret == SUCCESS)
+        ret = cmSlabInit(&g_ctxSlab, sizeof(PROC_INFO_t), MAIN_FSM_MAX_INST, 0);
+    if (ret != SUCCESS)
+    {
+        SLOGERR("Failed to init FSM instance pool");
+        return FAILURE;
+    }
+
+    /* Resume the session saved by a previous run */
+    if (ckptPath &&
+        cmFsmRestore(&mainFsmCp, ckptPath, sizeof(PROC_INFO_t), &ckptImage) == SUCCESS &&
+        ckptImage.numInst)
+    {
+        SLOGINFO("Resuming FSM Instance from %s ..", ckptPath);
+        procInfo = CM_FSM_IMAGE_CTX(&ckptImage, 0);
+        ret = SUCCESS;
+    }
+    else
+    {
+        SLOGINFO("Initialize FSM Instance ..");
+        procInfo = cmFsmInstAlloc(&mainFsmCp,
+                                  &g_ctxSlab,
+                                  "MAIN",
+                                  MAIN_ST_INIT);
+        ret = procInfo ? SUCCESS : FAILURE;
+    }
     if (ret != SUCCESS)
     {
         SLOGERR("Failed to init FSM Instance");
         return FAILURE;
     }
 
+    ret = cmIdleInit(&g_idleCtx, idleStrategy, STDIN_FILENO);
+    if (ret != SUCCESS)
+    {
+        SLOGERR("Failed to init idle strategy");
+        return FAILURE;
+    }
+
     /* Init the LED data */
     SLOGINFO("Intitialize LED ..");
     ret = VLED_Init(LED_POS_X_DEFAULT,
@@ -136,33 +248,65 @@ int main (int argc, char *argv[])
         return FAILURE;
     }
 
-    /* Run FSM and update LED View */
-    VLED_UpdateView();
+    /* Published once, the FSM updates it in place, the view is drawn */
+    setProcInfo(procInfo);
+
+    /* Run FSM, the LED View follows the model changes */
     SLOGINFO("FSM Intance started and running ..");
     while(true)
     {
-        usleep(1);
-
-        ret = cmFsmDriver(&mainFsmCp);
-        if (ret == FAILURE)
-        {
+        /* Update Model Data, readers see it before or after the step,
+         * the LED View is redrawn if the LEDs changed */
+        writeProcInfoBegin();
+        numRun = cmFsmDriverAll(&mainFsmCp);
+        if (numRun <= 0)
             /* Clear and quit */
-            memset(g_procInfo.ledStat, 0, sizeof(g_procInfo.ledStat));
+            memset(procInfo->ledStat, 0, sizeof(procInfo->ledStat));
+        writeProcInfoEnd();
+        if (numRun <= 0)
+        {
+            ret = FAILURE;
             break;
         }
-                
-        /* Update Model Data */
-        setProcInfo(&g_procInfo);
-        /* Update LED View  */
-        VLED_UpdateView();
+
+        /* Save the session when it changed, a restart resumes from here */
+        if (ckptPath && cmFsmCheckpointDue(&mainFsmCp, cmTimeNow()))
+            cmFsmCheckpoint(&mainFsmCp, ckptPath, sizeof(PROC_INFO_t));
+
+        if (g_traceDumpReq)
+        {
+            g_traceDumpReq = 0;
+            cmFsmTraceDump();
+        }
+
+        /* Idle until the FSM needs to run again or a key is pressed */
+        if (cmFsmNextDeadline(&mainFsmCp, &tsDeadline) == SUCCESS)
+            cmIdleWait(&g_idleCtx, &tsDeadline);
+        else
+            cmIdleWait(&g_idleCtx, NULL);
     }
 
-    /* Update Model Data */
-    setProcInfo(&g_procInfo);
-    /* Update LED View  */
-    VLED_UpdateView();
     VLED_clearScreen();
+    /* The session goes away with the pool */
+    setProcInfo(NULL);
+    cmFsmTraceDump();
+    cmFsmTraceDeinit();
+    cmFsmCpDeinit(&mainFsmCp);
+    cmFsmImageRelease(&ckptImage);
+    cmSlabDeinit(&g_ctxSlab);
+    /* The game ended, nothing to resume */
+    if (ckptPath)
+        unlink(ckptPath);
+    cmIdleDumpStats(&g_idleCtx);
+    cmIdleDeinit(&g_idleCtx);
+    cmClockVirtDumpStats();
     SLOGINFO("Guessing Game System Quit");
+    sl_LogSiteDump(10);
+    sl_AsyncLogStop();
+    sl_AsyncLogStats(&logStats);
+    SLOGNOTE("Async log: %llu records written, %llu dropped in %llu overflows",
+             logStats.written, logStats.dropped, logStats.overflows);
+    sl_FlightRecDump(NULL);
 
     return ret;
 }
@@ -195,6 +339,10 @@ int generateRandSeq(
         return FAILURE;
     }
 
+    /* Seeded once from the command line, keep the sequence reproducible */
+    if (g_randFixed)
+        goto generate;
+
     /**
      * Seed random number generator with system rand
      * to avoid getting same sequence
@@ -208,7 +356,9 @@ int generateRandSeq(
     /* Seed the random */
     fread(&randSeed, sizeof(randSeed), 1, fdSysRandom);
     srandom (randSeed);
+    fclose(fdSysRandom);
 
+generate:
     /* Generate the random sequence */
     maxIdx  = strlen(inArray);
     for (i = 0; i < number; i++) {
@@ -279,13 +429,13 @@ S32 keyHit()
  *
  * @param: outputFn   - Function Pointer
  * @param: context    - Data Exchange Context
- * @return: None
+ * @return: output function return
  *
  */
 S16 clMainFsmDr(void *outputFn, void *context)
 {
-    ((S16 (*)(PROC_INFO_t *context))(outputFn))(context);
-    return (SUCCESS);
+    /* CM_FSM_SUSPEND has to reach the FSM driver */
+    return ((S16 (*)(PROC_INFO_t *context))(outputFn))(context);
 }
 
 /**
@@ -329,61 +479,93 @@ static S16 clCollectUserInputStart(PROC_INFO_t *context)
     return SUCCESS;
 }
 
+/**
+ * Check that all the LEDs of the round are green
+ *
+ * @param: procInfo - Data Exchange Context during FSM running
+ * @return: TRUE if the sequence was guessed
+ *
+ */
+static bool clAllGreen(PROC_INFO_t *procInfo)
+{
+    S32 i;
+
+    for(i=0; i<MAX_BTN_CNT; i++)
+    {
+        if( procInfo->ledStat[i] != LED_GREEN) return FALSE;
+    }
+    return TRUE;
+}
+
 /**
  * Collecting user input
+ * Suspends while waiting for a key, the driver keeps running meanwhile.
+ * Locals do not survive a suspension, see CM_FSM_CO_WAIT_UNTIL().
  *
  * @param: context - Data Exchange Context during FSM running
  * @return: SUCCESS - executed successfully
+ *          CM_FSM_SUSPEND - waiting for a key
  *          FAILURE - errors happen
  *
  */
 static S16 clCollectUserInput(PROC_INFO_t *context)
 {
     PROC_INFO_t *procInfo=context;
+    CmFsmEntity *fsmEnt=&procInfo->fsmEnt;
     U32 idx  = 0;
     S32 i = 0;
-    S32 ret  = FAILURE;
+    S16 ret  = FAILURE;
     S8  chrSeq = 0, chrUserInput = 0;
-    
-    idx = procInfo->inputIndex;
+
+    CM_FSM_CO_BEGIN(fsmEnt);
 
     /**
      * Shift the items in the arrays
      * Array[MAX_BTN_CNT-1] will always save the latest input
      */
-    if(idx > MAX_BTN_CNT-1)
+    if(procInfo->inputIndex > MAX_BTN_CNT-1)
     {
         /* Max loop exceeded, check if it is all green or not */
-        ret = FAILURE;
-        for(i=0; i<MAX_BTN_CNT; i++)
-        {
-            if( procInfo->ledStat[i] != LED_GREEN) break;
-        }
-
-        /* All GREEN will trigger new random sequence generation */
-        if (i == MAX_BTN_CNT)
+        if (clAllGreen(procInfo))
         {
             SLOGINFO("All GREEN, FSM one batch done");
             printf("Your guessing is correct! (key:%s)\n",procInfo->btnSeq);
             printf("Press enter to start a new one or Ctrl+C to quit\n");
-            getchar();
-            cmFsmSetState(procInfo->fsmEnt.fsmCp,  MAIN_ST_INIT);
         }
         else
         {
             SLOGINFO("Game not passed, retry....");
             printf("You failed! Press enter to retry or Ctrl+C to quit\n");
-            getchar();
-            cmFsmSetState(procInfo->fsmEnt.fsmCp,  MAIN_ST_START);
         }
+
+        /* Wait for enter in a state without timeout, as long as it takes */
+        cmFsmInstSetState(fsmEnt, MAIN_ST_RESULT);
         return SUCCESS;
     }
-   
-    /* Read one user input with 20 seconds timeout */
-    ret = clReadUserInputChar(BTN_ALLLOWED,UI_TIMEOUT,
-                              &(procInfo->btnUserInput[MAX_BTN_CNT-1]));
-    if (ret == SUCCESS)
+
+    /* Read one user input with UI_TIMEOUT seconds timeout */
+    procInfo->inputGate = cmTimeNow() + CM_TIME_FROM_SEC(UI_TIMEOUT);
+    setSysNonBlockMode(NB_ENABLE);
+
+    CM_FSM_CO_WAIT_UNTIL(fsmEnt,
+        (ret = clPollUserInputChar(BTN_ALLLOWED,
+                                   &(procInfo->btnUserInput[MAX_BTN_CNT-1]))) != UI_KEY_NONE,
+        &procInfo->inputGate);
+
+    setSysNonBlockMode(NB_DISABLE);
+    if (ret == UI_KEY_CLOSED)
+    {
+        /* Nobody left to play, a scripted run ends with its input */
+        cmFsmInstSetState(fsmEnt, MAIN_ST_QUIT);
+    }
+    else if (ret == UI_KEY_NONE)
+    {
+        /* Maximum waiting time expired */
+        SLOGERR("Timed out to wait user input ");
+    }
+    else if (ret == SUCCESS)
     {
+        idx = procInfo->inputIndex;
         chrUserInput = procInfo->btnUserInput[MAX_BTN_CNT-1];
 
         /* Shift the value after user input */
@@ -425,65 +607,85 @@ static S16 clCollectUserInput(PROC_INFO_t *context)
         procInfo->inputIndex++;
     }
 
+    CM_FSM_CO_END(fsmEnt);
     return SUCCESS;
 }
 
 /**
- * Collecting user input with timeout
+ * Wait for enter after the result of a round
+ * The state has no timeout, the player may take any time to read it.
+ *
+ * @param: context - Data Exchange Context during FSM running
+ * @return: SUCCESS - enter pressed, next round
+ *          CM_FSM_SUSPEND - waiting for enter
+ *
+ */
+static S16 clWaitNextRound(PROC_INFO_t *context)
+{
+    PROC_INFO_t *procInfo = context;
+    CmFsmEntity *fsmEnt = &procInfo->fsmEnt;
+    S16 ret = FAILURE;
+    S8  chrUserInput = 0;
+
+    CM_FSM_CO_BEGIN(fsmEnt);
+
+    CM_FSM_CO_WAIT_UNTIL(fsmEnt,
+        (ret = clPollUserInputChar("\n", &chrUserInput)) != UI_KEY_NONE, NULL);
+
+    CM_FSM_CO_END(fsmEnt);
+
+    /* All GREEN will trigger new random sequence generation */
+    if (ret == UI_KEY_CLOSED)
+        cmFsmInstSetState(fsmEnt, MAIN_ST_QUIT);
+    else
+        cmFsmInstSetState(fsmEnt, clAllGreen(procInfo) ? MAIN_ST_INIT : MAIN_ST_START);
+    return SUCCESS;
+}
+
+/**
+ * Read the pending user input without waiting
+ * Keys not in allowedStr are consumed and skipped.
  *
  * @param: allowedStr  allowed user input
- * @param: timeout     the maximum waiting time (seconds)
  * @param: outputChr   output user input if success
  * @return: SUCCESS - Got one user input
- *          FAILURE - error happen or time out
+ *          UI_KEY_NONE - no allowed key pressed yet
+ *          UI_KEY_CLOSED - end of input or read error, stop waiting for keys
  *
  */
-S16 clReadUserInputChar(
+S16 clPollUserInputChar(
     S8 *allowedStr,
-    U32 timeout,
     S8 *outputChr
 )
 {
-    S32 keyCnt = 0, ret = FAILURE;
-    S8  outChr;
-    TIMESTAMP tsGate, tsNow;
-
-    SGetMonotonicTime(&tsGate);
-    tsGate.uiSeconds += timeout;
+    S8      outChr;
+    ssize_t ret;
 
-    setSysNonBlockMode(NB_ENABLE);
-    while(!keyCnt)
+    while (keyHit())
     {
-        usleep(1);
-        keyCnt=keyHit();
-        if (keyCnt != 0)
+        /* Read user input, bypass stdio buffering so that poll stays exact */
+        ret = read(STDIN_FILENO, &outChr, 1);
+        if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (ret == 0)
         {
-            /* Read user input */
-            outChr = fgetc(stdin);
-            if (SCharIncluded(outChr,allowedStr) == SUCCESS)
-                keyCnt = 1;
-            else
-                keyCnt = 0;
+            /* Readable for ever from now on, not a key */
+            SLOGNOTE("End of user input");
+            return UI_KEY_CLOSED;
         }
-
-        /* Check if the time expired */
-        SGetMonotonicTime(&tsNow);
-        ret = SCompareTimeStamp(&tsNow, &tsGate);
-        if (ret != TIME_NOT_EXPIRED)
+        if (ret != 1)
         {
-            /* Maximum waiting time expired */
-            SLOGERR("Timed out to wait user input ");
-            keyCnt = 0xF;
+            SLOGERR("Failed to read user input (%s)", strerror(errno));
+            return UI_KEY_CLOSED;
+        }
+        if (SCharIncluded(outChr,allowedStr) == SUCCESS)
+        {
+            *outputChr=outChr;
+            return SUCCESS;
         }
     }
-    setSysNonBlockMode(NB_DISABLE);
 
-    if(keyCnt == 1)
-    {
-        *outputChr=outChr;
-        return SUCCESS;
-    }
-    return FAILURE;
+    return UI_KEY_NONE;
 }
 /**
  * General Timeout handler
@@ -495,7 +697,7 @@ S16 clReadUserInputChar(
 static S16 clGeneralTimeoutHdl(PROC_INFO_t *context)
 {
     SLOGERR("General timeout handler triggered");
-    cmFsmSetState(context->fsmEnt.fsmCp,  MAIN_ST_QUIT);
+    cmFsmInstSetState(&context->fsmEnt, MAIN_ST_QUIT);
     return SUCCESS;
 }
 
@@ -541,6 +743,12 @@ static S32 clInstallSignalHandler(void)
         return FAILURE;
     }
 
+    if((ret = sigaction(SIGUSR1,&act,NULL)) < 0)
+    {
+        SLOGERR("Install SIGUSR1 signal handler failed (%s)",strerror(errno));
+        return FAILURE;
+    }
+
     return SUCCESS;
 }
 
@@ -562,6 +770,7 @@ static void clSignalHandler (int sig, siginfo_t * siginf, void *ptr)
     case SIGINT:
         {
             SLOGERR("SIGTERM or SIGINT signal received!");
+            sl_FlightRecDump(NULL);
             /**
              * It is a bad behavior to run system call directly
              * this is just a temp solution to reset terminial
@@ -571,6 +780,14 @@ static void clSignalHandler (int sig, siginfo_t * siginf, void *ptr)
             exit(sig);
             break;
         }
+    case SIGUSR1:
+        {
+            /* Dumped from the main loop, logging is not signal safe */
+            g_traceDumpReq = 1;
+            /* The flight recorder dump is */
+            sl_FlightRecDump(NULL);
+            break;
+        }
     default:
         {
             SLOGERR("Unknown signal received!");
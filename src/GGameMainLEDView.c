@@ -35,6 +35,7 @@
 #include "SysLogging.h"
 #include "GGameMainLEDView.h"
 #include "GGameMainModel.h"
+#include "CommonShard.h"
 
 /**
  * Static member variables with initial value
@@ -69,16 +70,26 @@ void VLED_ResetLedAll()
 
 /**
  * Read data from model and display
- * @param: x - LED x position
- * @param: y - LED y position
+ * Only the LED states are taken from the session, in place: the
+ * terminal output can not be retried, so they are kept until drawn.
  * @return: None
  */
 void VLED_UpdateView()
 {
-    PROC_INFO_t data;
-    memset(&data,0,sizeof(data));
-    getProcInfo(&data);
-    VLED_BatchSetLedColor(data.ledStat);
+    const PROC_INFO_t *proc;
+    LED_COLOR_t ledStat[MAX_BTN_CNT+1];
+    S32 shard = cmShardSelf();   /* The view runs with the session owner */
+    U32 ver;
+
+    do
+    {
+        ver = readProcInfoBegin(shard, &proc);
+        if (proc)
+            memcpy(ledStat, proc->ledStat, sizeof(ledStat));
+        else
+            memset(ledStat, 0, sizeof(ledStat));
+    } while (readProcInfoRetry(shard, ver));
+    VLED_BatchSetLedColor(ledStat);
     printHelp();
 }
 
@@ -150,6 +161,17 @@ S16 VLED_CheckLedDriver()
     return SUCCESS;
 }
 
+/**
+ * Model change notification, redraws when the LEDs changed
+ * @param: dirty - MD_PROC_DIRTY_xxx changed
+ * @param: arg - unused
+ * @return: None
+ */
+static void VLED_ModelChanged(U32 dirty, void *arg)
+{
+    VLED_UpdateView();
+}
+
 /**
  * VLED Layer Init Part
  * @param: x - LED x position
@@ -164,6 +186,10 @@ S16  VLED_Init(U16 x, U16 y, U16 intVal)
     VLED_Y=y;
     VLED_INTERVAL=intVal;
 
+    /* Drawn again only when the model says the LEDs changed */
+    if (subscribeProcInfo(MD_PROC_DIRTY_LED, VLED_ModelChanged, NULL) != SUCCESS)
+        return FAILURE;
+
     return VLED_CheckLedDriver();
 }
 
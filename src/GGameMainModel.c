@@ -8,6 +8,18 @@
  * \details
  * This is the main medel layer of the GGame System
  * This layer will provide main data/state storage.
+ * Every shard thread keeps its own slot, slot 0 belongs to the threads
+ * outside the shards, so the model is never written by two cores. The
+ * writer side always works on the slot of the calling thread, readers
+ * name the shard owning the session, see cmShardSelf().
+ * The slot does not hold a copy of the session: the owner publishes it
+ * once and updates it in place between writeProcInfoBegin() and
+ * writeProcInfoEnd(). The sequence count of the slot lets the readers
+ * read the fields they need straight from the session without a lock,
+ * and retry when the owner changed it meanwhile (seqlock).
+ * At the end of an update the fields the view shows are compared with
+ * their values at the previous one, and the subscribers watching the
+ * changed ones are called, so nothing is redrawn while nothing changes.
  */
 
 /* 
@@ -24,33 +36,247 @@
  * Had you not received a copy of the GNU General Public License yet, write
  * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#include <sched.h>
 #include "CommonInc.h"
 #include "SysLogging.h"
 #include "GGameMainModel.h"
+#include "CommonShard.h"
 
-static PROC_INFO_t md_ProcInfo; /* model data, proc information */
+/* Subscriber of the session changes */
+typedef struct MD_PROC_SUB_TAG
+{
+    U32              fields;    /* MD_PROC_DIRTY_xxx watched */
+    MD_PROC_NOTIFY_f notify;
+    void             *arg;
+} MD_PROC_SUB_t;
+
+/* Per-shard model slot, cache line aligned against false sharing */
+typedef struct MD_PROC_SLOT_TAG
+{
+    U32         seq;        /* Odd while the owner updates the session  */
+    PROC_INFO_t *procInfo;  /* Published session, NULL when none        */
+    U32         dirty;      /* Fields to notify at the end of the update */
+
+    /* Watched fields as of the previous update */
+    LED_COLOR_t ledStat[MAX_BTN_CNT+1];
+    S8          btnUserInput[MAX_BTN_CNT+1];
+    S32         inputIndex;
+    S8          btnSeq[MAX_BTN_CNT+1];
+
+    U32           numSubs;
+    MD_PROC_SUB_t subs[MD_PROC_SUBS_MAX];
+} __attribute__((aligned(64))) MD_PROC_SLOT_t;
+
+static MD_PROC_SLOT_t md_ProcSlot[CM_SHARD_MAX+1]; /* model data, proc information */
 
+/* Model slot of the calling thread's shard, writer side */
+#define md_ProcSelf (&md_ProcSlot[cmShardSelf() + 1])
+
+/**
+ * Returns the model slot of a shard, reader side
+ *
+ * @param: shard  shard id, CM_SHARD_EXTERNAL for the threads outside
+ * @return: slot, NULL if the shard id is out of range
+ */
+static MD_PROC_SLOT_t *mdProcSlotOf(S32 shard)
+{
+    if (shard < CM_SHARD_EXTERNAL || shard >= CM_SHARD_MAX)
+        return NULL;
+    return &md_ProcSlot[shard + 1];
+}
+
+/**
+ * Publish the session of the calling thread's shard
+ * The session is not copied, it must stay valid until it is replaced
+ * or withdrawn with NULL, and be changed only between
+ * writeProcInfoBegin() and writeProcInfoEnd().
+ *
+ * @param: proc  session, NULL to withdraw it
+ * @return: SUCCESS
+ */
 S16 setProcInfo(PROC_INFO_t *proc)
 {
-    if(proc)
-        md_ProcInfo = *proc;
+    MD_PROC_SLOT_t *slot = md_ProcSelf;
+
+    writeProcInfoBegin();
+    slot->procInfo = proc;
+    /* A new session is drawn whole */
+    slot->dirty = proc ? MD_PROC_DIRTY_ALL : 0;
+    writeProcInfoEnd();
+    return SUCCESS;
+}
+
+/**
+ * Subscribe to the changes of the calling thread's shard session
+ * The subscriber is called on the owner thread, after the update, and
+ * may read the session there.
+ *
+ * @param: fields  MD_PROC_DIRTY_xxx to be notified of
+ * @param: notify  called with the changed fields among them
+ * @param: arg     given back to notify
+ * @return: SUCCESS, FAILURE if no room is left
+ */
+S16 subscribeProcInfo(U32 fields, MD_PROC_NOTIFY_f notify, void *arg)
+{
+    MD_PROC_SLOT_t *slot = md_ProcSelf;
+    MD_PROC_SUB_t  *sub;
+
+    if (!notify || !fields || slot->numSubs >= MD_PROC_SUBS_MAX)
+        return FAILURE;
+    sub = &slot->subs[slot->numSubs++];
+    sub->fields = fields;
+    sub->notify = notify;
+    sub->arg    = arg;
     return SUCCESS;
 }
 
-S16 getProcInfo(PROC_INFO_t *proc)
+/**
+ * Compare the watched fields of the session with the previous update
+ *
+ * @param: slot  model slot, its session published
+ * @return: MD_PROC_DIRTY_xxx changed
+ */
+static U32 mdProcDiff(MD_PROC_SLOT_t *slot)
+{
+    const PROC_INFO_t *proc = slot->procInfo;
+    U32               dirty = 0;
+
+    if (memcmp(slot->ledStat, proc->ledStat, sizeof(slot->ledStat)))
+    {
+        memcpy(slot->ledStat, proc->ledStat, sizeof(slot->ledStat));
+        dirty |= MD_PROC_DIRTY_LED;
+    }
+    if (slot->inputIndex != proc->inputIndex ||
+        memcmp(slot->btnUserInput, proc->btnUserInput, sizeof(slot->btnUserInput)))
+    {
+        memcpy(slot->btnUserInput, proc->btnUserInput, sizeof(slot->btnUserInput));
+        slot->inputIndex = proc->inputIndex;
+        dirty |= MD_PROC_DIRTY_INPUT;
+    }
+    if (memcmp(slot->btnSeq, proc->btnSeq, sizeof(slot->btnSeq)))
+    {
+        memcpy(slot->btnSeq, proc->btnSeq, sizeof(slot->btnSeq));
+        dirty |= MD_PROC_DIRTY_SEQ;
+    }
+    return dirty;
+}
+
+/**
+ * Copy a consistent snapshot of the session a shard published
+ * For the readers keeping it, readProcInfoBegin() reads in place.
+ *
+ * @param: shard  owner shard, CM_SHARD_EXTERNAL for the threads outside
+ * @param: proc   snapshot
+ * @return: SUCCESS, FAILURE if no session is published
+ */
+S16 getProcInfo(S32 shard, PROC_INFO_t *proc)
 {
-    if(proc)
-        *proc = md_ProcInfo;
+    const PROC_INFO_t *cur;
+    U32               ver;
+
+    if(!proc)
+        return FAILURE;
+    do
+    {
+        ver = readProcInfoBegin(shard, &cur);
+        if (!cur)
+            return FAILURE;
+        *proc = *cur;
+    } while (readProcInfoRetry(shard, ver));
     return SUCCESS;
 }
 
+/**
+ * Start updating the published session, readers retry until the end
+ * Owner thread only, does not nest.
+ *
+ * @return: None
+ */
+void writeProcInfoBegin()
+{
+    MD_PROC_SLOT_t *slot = md_ProcSelf;
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * End updating the published session, a new version is visible
+ * The subscribers of the fields that changed are then called.
+ *
+ * @return: None
+ */
+void writeProcInfoEnd()
+{
+    MD_PROC_SLOT_t *slot = md_ProcSelf;
+    U32            dirty = slot->dirty;
+    U32            i;
+
+    if (slot->procInfo)
+        dirty |= mdProcDiff(slot);
+    slot->dirty = 0;
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+    for (i = 0; dirty && i < slot->numSubs; i++)
+    {
+        if (slot->subs[i].fields & dirty)
+            slot->subs[i].notify(slot->subs[i].fields & dirty, slot->subs[i].arg);
+    }
+}
+
+/**
+ * Start reading the session a shard published, in place
+ * Any thread may read, without lock. The fields read are consistent only
+ * once readProcInfoRetry() returned FALSE: read them in a loop, and act
+ * on them after it. Not from the owner between writeProcInfoBegin() and
+ * writeProcInfoEnd().
+ *
+ * @param: shard  owner shard, CM_SHARD_EXTERNAL for the threads outside
+ * @param: proc   published session, NULL when none
+ * @return: version of the session, to give to readProcInfoRetry()
+ */
+U32 readProcInfoBegin(S32 shard, const PROC_INFO_t **proc)
+{
+    MD_PROC_SLOT_t *slot = mdProcSlotOf(shard);
+    U32            seq;
+
+    *proc = NULL;
+    if (!slot)
+        return 0;
+    while ((seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+    *proc = __atomic_load_n(&slot->procInfo, __ATOMIC_RELAXED);
+    return seq >> 1;
+}
+
+/**
+ * Check the session read since readProcInfoBegin() did not change
+ *
+ * @param: shard    owner shard given to readProcInfoBegin()
+ * @param: version  returned by readProcInfoBegin()
+ * @return: TRUE if it changed and must be read again, FALSE otherwise
+ */
+bool readProcInfoRetry(S32 shard, U32 version)
+{
+    MD_PROC_SLOT_t *slot = mdProcSlotOf(shard);
+
+    if (!slot)
+        return FALSE;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) >> 1) != version;
+}
+
 void dumpProcInfo()
 {
-    SLOGINFO("md_ProcInfo.btnSeq=%s",md_ProcInfo.btnSeq);
-    SLOGINFO("md_ProcInfo.btnUserInput=%s",md_ProcInfo.btnUserInput);
+    const PROC_INFO_t *proc = md_ProcSelf->procInfo;
+
+    if (!proc)
+        return;
+    SLOGINFO("md_ProcInfo.btnSeq=%s",proc->btnSeq);
+    SLOGINFO("md_ProcInfo.btnUserInput=%s",proc->btnUserInput);
     SLOGINFO("md_ProcInfo.ledStat=%d %d %d",
-             md_ProcInfo.ledStat[0],md_ProcInfo.ledStat[1],md_ProcInfo.ledStat[2]);
-    SLOGINFO("md_ProcInfo.inputIndex=%d",md_ProcInfo.inputIndex);
-    SLOGINFO("md_ProcInfo.procStat=%d",md_ProcInfo.procStat);
-    SLOGINFO("md_ProcInfo.fsmEnt=%p",&md_ProcInfo.fsmEnt);
+             proc->ledStat[0],proc->ledStat[1],proc->ledStat[2]);
+    SLOGINFO("md_ProcInfo.inputIndex=%d",proc->inputIndex);
+    SLOGINFO("md_ProcInfo.procStat=%d",proc->procStat);
+    SLOGINFO("md_ProcInfo.fsmEnt=%p",&proc->fsmEnt);
 }
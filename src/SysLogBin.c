@@ -0,0 +1,579 @@
+/*
+ * \file Name: SysLogBin.c
+ *
+ * \brief Deferred binary logging
+ *
+ * \details
+ *   The arguments of a call site are copied as raw bytes, using the
+ * argument types parsed once from its format string. Strings are copied
+ * up to SL_BIN_STR_MAX bytes. A format this parser can not follow, like
+ * "%n" or "%m", makes the call site fall back to recording its formatted
+ * text. Call sites are described under a mutex the first time they log,
+ * records themselves are written without any lock.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "SysLogging.h"
+#include "SysLogBin.h"
+
+/* Largest record: header, arguments, string lengths and bytes */
+#define SL_BIN_REC_MAX  (sizeof(SlBinRec) + SL_SITE_MAX_ARGS * (2 + SL_BIN_STR_MAX) + \
+                         SL_BIN_TEXT_MAX + SL_BIN_ALIGN)
+
+static SlBinHdr         *sl_pBinHdr  = NULL;  /* Mapped log, NULL when off     */
+static size_t           sl_lBinLen   = 0;
+static unsigned int     sl_iBinGen   = 0;     /* Incremented by every start    */
+static pthread_mutex_t  sl_binLock   = PTHREAD_MUTEX_INITIALIZER;
+static __thread unsigned int sl_iBinTid = 0;  /* Kernel thread id, cached      */
+static int              sl_iBinMode  = SL_BIN_MODE_OFF;
+
+/* Flight recorder */
+static const int        SL_FLIGHT_SIGS[] = { SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+#define SL_FLIGHT_NUM_SIGS  ((int)(sizeof(SL_FLIGHT_SIGS) / sizeof(SL_FLIGHT_SIGS[0])))
+static struct sigaction sl_flightOldAct[SL_FLIGHT_NUM_SIGS];
+static char             sl_flightPath[PATH_MAX];
+
+/**
+ * Parse one conversion of a format string
+ *
+ * @param: spec  conversion, starting at its '%'
+ * @param: out   length, '*' arguments and argument type
+ * @return: 0 on success, -1 if not supported
+ *
+ */
+int sl_BinParseSpec( const char *spec, SlBinSpec *out )
+{
+    const char *p = spec + 1;
+    int        numLong = 0, isLdbl = 0;
+    size_t     argSize = sizeof(int);
+
+    out->numStars = 0;
+    if (*p == '%')
+    {
+        out->len     = 2;
+        out->argType = SL_ARG_END;
+        return 0;
+    }
+
+    while (*p && strchr("-+ #0'I", *p))
+        p++;
+    if (*p == '*')
+    {
+        out->numStars++;
+        p++;
+    }
+    else
+        while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            out->numStars++;
+            p++;
+        }
+        else
+            while (*p >= '0' && *p <= '9') p++;
+    }
+
+    /* Integer sizes as passed by this build, 4 bytes for long, size_t
+     * and pointers on 32-bit targets */
+    for (; *p && strchr("hlLqjzt", *p); p++)
+    {
+        switch (*p)
+        {
+        case 'L': isLdbl = 1; break;
+        case 'l': argSize = numLong++ ? sizeof(long long) : sizeof(long); break;
+        case 'q': numLong++; argSize = sizeof(long long); break;
+        case 'j': numLong++; argSize = sizeof(intmax_t); break;
+        case 'z': numLong++; argSize = sizeof(size_t); break;
+        case 't': numLong++; argSize = sizeof(ptrdiff_t); break;
+        default: break;
+        }
+    }
+
+    switch (*p)
+    {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        out->argType = argSize > 4 ? SL_ARG_I64 : SL_ARG_I32;
+        break;
+    case 'c':
+        out->argType = SL_ARG_I32;
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        out->argType = isLdbl ? SL_ARG_LDBL : SL_ARG_DBL;
+        break;
+    case 's':
+        if (numLong)
+            return -1;
+        out->argType = SL_ARG_STR;
+        break;
+    case 'p':
+        out->argType = sizeof(void *) > 4 ? SL_ARG_I64 : SL_ARG_I32;
+        break;
+    default:
+        return -1;
+    }
+
+    out->len = p + 1 - spec;
+    return 0;
+}
+
+/**
+ * Parse the argument types of a call site from its format string
+ *
+ * @param: site  call site
+ * @return: None, sites not supported get SL_BIN_SITE_TEXT
+ *
+ */
+static void sl_BinParseSite(SlSite *site)
+{
+    const char   *p;
+    SlBinSpec    spec;
+    unsigned int num = 0;
+
+    site->binFlags = 0;
+    for (p = site->fmt; *p; )
+    {
+        if (*p != '%')
+        {
+            p++;
+            continue;
+        }
+        if (sl_BinParseSpec(p, &spec) != 0 ||
+            num + spec.numStars + 1 > SL_SITE_MAX_ARGS)
+        {
+            site->binFlags   = SL_BIN_SITE_TEXT;
+            site->binNumArgs = 1;
+            site->binArgs[0] = SL_ARG_STR;
+            return;
+        }
+        for (; spec.numStars; spec.numStars--)
+            site->binArgs[num++] = SL_ARG_I32;
+        if (spec.argType != SL_ARG_END)
+            site->binArgs[num++] = spec.argType;
+        p += spec.len;
+    }
+    site->binNumArgs = num;
+}
+
+/**
+ * Describe a call site in the binary log, once per log
+ *
+ * @param: site  call site
+ * @return: 0 on success, -1 if the call site area is full
+ *
+ */
+static int sl_BinSiteAdd(SlSite *site)
+{
+    SlBinHdr   *hdr;
+    SlBinSite  *ent;
+    const char *fmt;
+    size_t     fileLen, funcLen, fmtLen, len;
+    int        ret = -1;
+
+    pthread_mutex_lock(&sl_binLock);
+    hdr = sl_pBinHdr;
+    if (!hdr || site->binGen == sl_iBinGen)
+    {
+        ret = hdr ? 0 : -1;
+        goto unlock;
+    }
+
+    sl_BinParseSite(site);
+    fmt     = (site->binFlags & SL_BIN_SITE_TEXT) ? "%s" : site->fmt;
+    fileLen = strlen(site->file) + 1;
+    funcLen = strlen(site->func) + 1;
+    fmtLen  = strlen(fmt) + 1;
+    len     = (sizeof(SlBinSite) + fileLen + funcLen + fmtLen + SL_BIN_ALIGN - 1) &
+              ~(size_t)(SL_BIN_ALIGN - 1);
+    if (hdr->sitePos + len > hdr->siteSize || fmtLen > 0xFFFF)
+    {
+        hdr->dropped++;
+        goto unlock;
+    }
+
+    ent = (SlBinSite *)((char *)hdr + hdr->siteOff + hdr->sitePos);
+    memset(ent, 0, sizeof(SlBinSite));
+    ent->id      = hdr->numSites + 1;
+    ent->level   = site->level;
+    ent->type    = site->type;
+    ent->line    = site->line;
+    ent->flags   = site->binFlags;
+    ent->numArgs = site->binNumArgs;
+    ent->fileLen = fileLen;
+    ent->funcLen = funcLen;
+    ent->fmtLen  = fmtLen;
+    memcpy(ent->argTypes, site->binArgs, SL_SITE_MAX_ARGS);
+    memcpy((char *)(ent + 1), site->file, fileLen);
+    memcpy((char *)(ent + 1) + fileLen, site->func, funcLen);
+    memcpy((char *)(ent + 1) + fileLen + funcLen, fmt, fmtLen);
+    ent->len = len;
+
+    hdr->numSites++;
+    __atomic_store_n(&hdr->sitePos, hdr->sitePos + len, __ATOMIC_RELEASE);
+    site->binId = ent->id;
+    __atomic_store_n(&site->binGen, sl_iBinGen, __ATOMIC_RELEASE);
+    ret = 0;
+
+unlock:
+    pthread_mutex_unlock(&sl_binLock);
+    return ret;
+}
+
+/**
+ * Write a padding record over a part of the ring
+ *
+ * @param: hdr  binary log
+ * @param: pos  ring position of the part
+ * @param: len  part length
+ * @return: None
+ *
+ */
+static void sl_BinPad(SlBinHdr *hdr, unsigned long long pos, unsigned int len)
+{
+    SlBinRec *rec;
+
+    rec = (SlBinRec *)((char *)hdr + hdr->dataOff + (pos & (hdr->dataSize - 1)));
+    rec->len    = len;
+    rec->siteId = SL_BIN_SITE_PAD;
+    __atomic_store_n(&rec->pos, pos, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record one message of a call site in the binary log
+ * The record is built on the stack, then copied into ring space
+ * reserved with one atomic add. A reservation crossing the ring end is
+ * padded out and reserved again.
+ *
+ * @param: site  call site
+ * @param: ap    arguments of the call site format
+ * @return: 0 when recorded, -1 if binary logging is off or the call
+ *          site could not be described, ap is then left untouched
+ *
+ */
+int sl_BinLogWrite( SlSite *site, va_list ap )
+{
+    SlBinHdr           *hdr = __atomic_load_n(&sl_pBinHdr, __ATOMIC_ACQUIRE);
+    unsigned char      buf[SL_BIN_REC_MAX] __attribute__((aligned(16)));
+    SlBinRec           *rec = (SlBinRec *)buf;
+    unsigned char      *arg = buf + sizeof(SlBinRec);
+    unsigned long long pos, off;
+    struct timespec    ts;
+    const char         *str;
+    unsigned int       i, len, first;
+    unsigned short     strLen;
+    int                i32;
+    long long          i64;
+    double             dbl;
+    long double        ldbl;
+
+    if (!hdr)
+        return -1;
+    if (__atomic_load_n(&site->binGen, __ATOMIC_ACQUIRE) != sl_iBinGen &&
+        sl_BinSiteAdd(site) != 0)
+        return -1;
+
+    if (!sl_iBinTid)
+        sl_iBinTid = syscall(SYS_gettid);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->tsNs     = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->tid      = sl_iBinTid;
+    rec->siteId   = site->binId;
+    rec->reserved = 0;
+
+    if (site->binFlags & SL_BIN_SITE_TEXT)
+    {
+        i32 = vsnprintf((char *)arg + 2, SL_BIN_TEXT_MAX, site->fmt, ap);
+        strLen = (i32 < 0) ? 0 : (i32 >= SL_BIN_TEXT_MAX) ? SL_BIN_TEXT_MAX - 1 : i32;
+        memcpy(arg, &strLen, 2);
+        arg += 2 + strLen;
+    }
+    else for (i = 0; i < site->binNumArgs; i++)
+    {
+        switch (site->binArgs[i])
+        {
+        case SL_ARG_I32:
+            i32 = va_arg(ap, int);
+            memcpy(arg, &i32, 4);
+            arg += 4;
+            break;
+        case SL_ARG_I64:
+            i64 = va_arg(ap, long long);
+            memcpy(arg, &i64, 8);
+            arg += 8;
+            break;
+        case SL_ARG_DBL:
+            dbl = va_arg(ap, double);
+            memcpy(arg, &dbl, 8);
+            arg += 8;
+            break;
+        case SL_ARG_LDBL:
+            ldbl = va_arg(ap, long double);
+            memcpy(arg, &ldbl, sizeof(ldbl));
+            arg += sizeof(ldbl);
+            break;
+        case SL_ARG_STR:
+            str = va_arg(ap, const char *);
+            if (!str)
+                str = "(null)";
+            strLen = strnlen(str, SL_BIN_STR_MAX);
+            memcpy(arg, &strLen, 2);
+            memcpy(arg + 2, str, strLen);
+            arg += 2 + strLen;
+            break;
+        }
+    }
+
+    len = ((arg - buf) + SL_BIN_ALIGN - 1) & ~(SL_BIN_ALIGN - 1);
+    rec->len = len;
+
+    while (1)
+    {
+        pos = __atomic_fetch_add(&hdr->head, len, __ATOMIC_RELAXED);
+        off = pos & (hdr->dataSize - 1);
+        if (off + len <= hdr->dataSize)
+            break;
+        first = hdr->dataSize - off;
+        sl_BinPad(hdr, pos, first);
+        sl_BinPad(hdr, pos + first, len - first);
+    }
+
+    memcpy((char *)hdr + hdr->dataOff + off + sizeof(rec->pos),
+           buf + sizeof(rec->pos), len - sizeof(rec->pos));
+    __atomic_store_n((unsigned long long *)((char *)hdr + hdr->dataOff + off), pos,
+                     __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Map and initialize a binary log, file backed or anonymous
+ *
+ * @param: fd      log file, -1 for anonymous memory
+ * @param: sizeMb  record ring size in MB, rounded up to a power of two,
+ *                 0 for SL_BIN_SIZE_MB
+ * @param: mode    SL_BIN_MODE_FILE/SL_BIN_MODE_REC
+ * @return: 0 on success, -1 on failure
+ *
+ */
+static int sl_BinMap(int fd, unsigned int sizeMb, int mode)
+{
+    SlBinHdr           *hdr;
+    unsigned long long dataSize = 1ULL << 20;
+    size_t             len;
+
+    if (sizeMb == 0)
+        sizeMb = SL_BIN_SIZE_MB;
+    while (dataSize < (unsigned long long)sizeMb << 20)
+        dataSize <<= 1;
+    len = sizeof(SlBinHdr) + SL_BIN_SITE_AREA + dataSize;
+
+    if (fd >= 0)
+    {
+        if (ftruncate(fd, len) != 0)
+            return -1;
+        hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    else
+        hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (hdr == MAP_FAILED)
+        return -1;
+
+    hdr->magic    = SL_BIN_MAGIC;
+    hdr->version  = SL_BIN_VERSION;
+    hdr->pid      = getpid();
+    hdr->siteOff  = sizeof(SlBinHdr);
+    hdr->siteSize = SL_BIN_SITE_AREA;
+    hdr->dataOff  = sizeof(SlBinHdr) + SL_BIN_SITE_AREA;
+    hdr->dataSize = dataSize;
+    strncpy(hdr->procName, sl_LogProcName(), MAX_NAME_LEN - 1);
+
+    pthread_mutex_lock(&sl_binLock);
+    if (sl_pBinHdr)
+    {
+        pthread_mutex_unlock(&sl_binLock);
+        munmap(hdr, len);
+        return -1;
+    }
+    sl_iBinGen++;
+    sl_lBinLen  = len;
+    sl_iBinMode = mode;
+    __atomic_store_n(&sl_pBinHdr, hdr, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sl_binLock);
+    return 0;
+}
+
+/**
+ * Start recording the SLOGxxx call sites in a binary log file
+ * The file is created or truncated. Records stay in the page cache
+ * when the process dies, nothing needs to be flushed.
+ *
+ * @param: path    log file
+ * @param: sizeMb  record ring size in MB, rounded up to a power of two,
+ *                 0 for SL_BIN_SIZE_MB
+ * @return: 0 on success, -1 on failure
+ *
+ */
+int sl_BinLogStart( const char *path, unsigned int sizeMb )
+{
+    int fd, ret;
+
+    if (sl_pBinHdr || !path)
+        return -1;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    ret = sl_BinMap(fd, sizeMb, SL_BIN_MODE_FILE);
+    close(fd);
+    return ret;
+}
+
+/**
+ * Stop binary logging or the flight recorder, the SLOGxxx call sites
+ * are formatted again
+ * Must not race with other threads still logging.
+ *
+ * @return: None
+ *
+ */
+void sl_BinLogStop( void )
+{
+    SlBinHdr *hdr;
+
+    pthread_mutex_lock(&sl_binLock);
+    hdr = sl_pBinHdr;
+    __atomic_store_n(&sl_pBinHdr, NULL, __ATOMIC_RELEASE);
+    sl_iBinMode = SL_BIN_MODE_OFF;
+    pthread_mutex_unlock(&sl_binLock);
+
+    if (hdr)
+        munmap(hdr, sl_lBinLen);
+}
+
+/**
+ * Returns what the binary log is used for
+ *
+ * @return: SL_BIN_MODE_OFF/SL_BIN_MODE_FILE/SL_BIN_MODE_REC
+ *
+ */
+int sl_BinLogMode( void )
+{
+    return __atomic_load_n(&sl_iBinMode, __ATOMIC_RELAXED);
+}
+
+/**
+ * Fatal signal handler of the flight recorder: dump, then let the
+ * previous handler, or the default action, take the signal again
+ *
+ * @param: sig  signal
+ * @return: None
+ *
+ */
+static void sl_FlightRecSignal(int sig)
+{
+    int i;
+
+    sl_FlightRecDump(NULL);
+    for (i = 0; i < SL_FLIGHT_NUM_SIGS; i++)
+        if (SL_FLIGHT_SIGS[i] == sig)
+            sigaction(sig, &sl_flightOldAct[i], NULL);
+    raise(sig);
+}
+
+/**
+ * Start the flight recorder
+ * Every SLOGxxx call site not disabled is recorded in binary, in an
+ * anonymous memory ring, whatever the verbosity: the last records are
+ * there when something goes wrong. The ring is written to the dump file
+ * on SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL, or by sl_FlightRecDump().
+ * Excludes sl_BinLogStart(), the messages passing the verbosity are
+ * still formatted as usual.
+ *
+ * @param: dumpPath  dump file, decoded by LogDecode
+ * @param: sizeMb    record ring size in MB, 0 for SL_FLIGHT_SIZE_MB
+ * @return: 0 on success, -1 on failure
+ *
+ */
+int sl_FlightRecStart( const char *dumpPath, unsigned int sizeMb )
+{
+    struct sigaction act;
+    int              i;
+
+    if (sl_pBinHdr || !dumpPath || strlen(dumpPath) >= sizeof(sl_flightPath))
+        return -1;
+
+    strcpy(sl_flightPath, dumpPath);
+    if (sl_BinMap(-1, sizeMb ? sizeMb : SL_FLIGHT_SIZE_MB, SL_BIN_MODE_REC) != 0)
+        return -1;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sl_FlightRecSignal;
+    act.sa_flags   = SA_RESETHAND | SA_NODEFER;
+    sigemptyset(&act.sa_mask);
+    for (i = 0; i < SL_FLIGHT_NUM_SIGS; i++)
+        sigaction(SL_FLIGHT_SIGS[i], &act, &sl_flightOldAct[i]);
+    return 0;
+}
+
+/**
+ * Write the flight recorder ring to a file
+ * Async-signal-safe, may be called from a signal handler. Records being
+ * written meanwhile are skipped by the decoder.
+ *
+ * @param: path  dump file, NULL for the one given to sl_FlightRecStart()
+ * @return: 0 on success, -1 on failure or when the recorder is off
+ *
+ */
+int sl_FlightRecDump( const char *path )
+{
+    SlBinHdr *hdr = __atomic_load_n(&sl_pBinHdr, __ATOMIC_ACQUIRE);
+    size_t   done = 0;
+    ssize_t  ret;
+    int      fd;
+
+    if (!hdr || sl_iBinMode != SL_BIN_MODE_REC)
+        return -1;
+
+    fd = open(path ? path : sl_flightPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    while (done < sl_lBinLen)
+    {
+        ret = write(fd, (char *)hdr + done, sl_lBinLen - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    close(fd);
+    return done == sl_lBinLen ? 0 : -1;
+}
@@ -0,0 +1,421 @@
+/*
+ * \file Name: SysLogFile.c
+ *
+ * \brief Group commit file sink of the system logging
+ *
+ * \details
+ *   The buffers are used in turn, as a ring: the logging threads append
+ * to the buffer at head under a mutex, the flusher thread writes every
+ * buffer from tail up to head with one writev(), then hands them back.
+ * The file descriptor is only touched by the flusher, which is how the
+ * file can be rotated while the logging threads keep appending.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include "SysLogging.h"
+#include "SysLogFile.h"
+
+/* One group commit buffer */
+typedef struct slFileBuf
+{
+    char         *data;
+    unsigned int len;
+} SlFileBuf;
+
+static int                sl_iFileOn    = 0;    /* Records go to the buffers   */
+static int                sl_iFileStop  = 0;    /* Flusher to write all and quit */
+static int                sl_iFileFailed = 0;   /* Rotation failed, records refused */
+static int                sl_iFilePrev  = LOG_OUT_STDOUT;  /* Output before the sink */
+static int                sl_fileFd     = -1;   /* Flusher only                */
+static char               sl_filePath[PATH_MAX];
+static SlFileCfg          sl_fileCfg;
+static SlFileBuf          sl_fileBufs[SL_FILE_NUM_BUFS];
+static unsigned long long sl_lFileHead  = 0;    /* Buffer being filled         */
+static unsigned long long sl_lFileTail  = 0;    /* Oldest buffer not written   */
+static unsigned long long sl_lFileSize  = 0;    /* Flusher: current file size  */
+static time_t             sl_tFileOpen  = 0;    /* Flusher: current file start */
+static SlFileStats        sl_fileStats;
+static pthread_mutex_t    sl_fileLock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     sl_fileWake;          /* Flusher: buffers to write   */
+static pthread_cond_t     sl_fileSpace;         /* Writers: buffers written    */
+static pthread_t          sl_fileFlusher;
+static pthread_once_t     sl_fileOnce   = PTHREAD_ONCE_INIT;
+
+/**
+ * Append one record to the buffer being filled
+ * Waits for the flusher only when every buffer is full.
+ *
+ * @param: text  formatted record
+ * @param: len   record length, without the newline
+ * @return: 0 on success, -1 if the file sink is not running
+ *
+ */
+int sl_FileLogPut( const char *text, int len )
+{
+    SlFileBuf *buf;
+
+    if (!__atomic_load_n(&sl_iFileOn, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&sl_iFileFailed, __ATOMIC_ACQUIRE))
+        return -1;
+    if (len > SYS_LOG_BUFFER_SIZE - 1)
+        len = SYS_LOG_BUFFER_SIZE - 1;
+
+    pthread_mutex_lock(&sl_fileLock);
+    if (!sl_iFileOn || sl_iFileFailed)
+    {
+        pthread_mutex_unlock(&sl_fileLock);
+        return -1;
+    }
+
+    buf = &sl_fileBufs[sl_lFileHead % SL_FILE_NUM_BUFS];
+    if (buf->len + len + 1 > SL_FILE_BUF_SIZE)
+    {
+        /* Size trigger: hand the full buffer over, take the next one */
+        sl_lFileHead++;
+        pthread_cond_signal(&sl_fileWake);
+    }
+    /* The buffer at head is the oldest one, being written, when all are queued */
+    if (sl_lFileHead - sl_lFileTail >= SL_FILE_NUM_BUFS)
+        sl_fileStats.stalls++;
+    while (sl_lFileHead - sl_lFileTail >= SL_FILE_NUM_BUFS)
+        pthread_cond_wait(&sl_fileSpace, &sl_fileLock);
+    buf = &sl_fileBufs[sl_lFileHead % SL_FILE_NUM_BUFS];
+
+    memcpy(buf->data + buf->len, text, len);
+    buf->data[buf->len + len] = '\n';
+    buf->len += len + 1;
+    sl_fileStats.records++;
+    pthread_mutex_unlock(&sl_fileLock);
+    return 0;
+}
+
+/**
+ * Open the log file, appending to an existing one
+ *
+ * @param: flags  extra open() flags
+ * @return: 0 on success, -1 on failure
+ *
+ */
+static int sl_FileOpen(int flags)
+{
+    struct stat st;
+
+    sl_fileFd = open(sl_filePath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | flags, 0644);
+    if (sl_fileFd < 0)
+        return -1;
+    sl_lFileSize = (fstat(sl_fileFd, &st) == 0) ? st.st_size : 0;
+    sl_tFileOpen = time(NULL);
+    return 0;
+}
+
+/**
+ * Rotate the log file when it is too large or too old
+ * path.N-1 becomes path.N and so on, the oldest file is overwritten.
+ * When the new file can not be created the old one keeps its name and
+ * takes what is already queued, the records to come go to the output
+ * used before the sink. This runs on the flusher: the error is reported
+ * with syslog(), a log call could wait on the flusher itself.
+ *
+ * @return: 1 if rotated, 0 otherwise
+ *
+ */
+static int sl_FileRotate(void)
+{
+    char         from[PATH_MAX + 12], to[PATH_MAX + 12];
+    unsigned int i;
+    int          fd, err;
+
+    if (sl_iFileFailed || !sl_lFileSize ||
+        (sl_lFileSize < sl_fileCfg.maxSize &&
+         (!sl_fileCfg.rotateSec || time(NULL) - sl_tFileOpen < sl_fileCfg.rotateSec)))
+        return 0;
+
+    for (i = sl_fileCfg.keep; i > 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%u", sl_filePath, i - 1);
+        snprintf(to, sizeof(to), "%s.%u", sl_filePath, i);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", sl_filePath);
+    rename(sl_filePath, to);
+
+    fd = sl_fileFd;
+    if (sl_FileOpen(O_TRUNC) != 0)
+    {
+        err = errno;
+        rename(to, sl_filePath);
+        sl_fileFd = fd;
+        sl_LogSetOutput(sl_iFilePrev);
+        __atomic_store_n(&sl_iFileFailed, 1, __ATOMIC_RELEASE);
+        syslog(LOG_USER | LOG_ERR, "Can not reopen %s after rotation (%s), "
+               "logging to the previous output", sl_filePath, strerror(err));
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+/**
+ * Write a group of buffers with as few writev() calls as possible
+ *
+ * @param: iov  buffers
+ * @param: num  buffers
+ * @return: bytes written
+ *
+ */
+static unsigned long long sl_FileWrite(struct iovec *iov, int num)
+{
+    unsigned long long total = 0;
+    ssize_t            ret;
+
+    while (num > 0 && sl_fileFd >= 0)
+    {
+        ret = writev(sl_fileFd, iov, num);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        total += ret;
+        while (num > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            num--;
+        }
+        if (num > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return total;
+}
+
+/**
+ * Flusher thread: write the filled buffers, and the one being filled
+ * once per flush interval
+ *
+ * @param: arg  unused
+ * @return: NULL
+ *
+ */
+static void *sl_FileFlusher(void *arg)
+{
+    struct iovec       iov[SL_FILE_NUM_BUFS];
+    struct timespec    ts;
+    unsigned long long tail, bytes, pending;
+    unsigned int       i, num;
+    int                rotated;
+
+    pthread_mutex_lock(&sl_fileLock);
+    while (1)
+    {
+        if (sl_lFileHead == sl_lFileTail && !sl_iFileStop)
+        {
+            /* Latency trigger: wait one flush interval at most */
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec  += sl_fileCfg.flushMs / 1000;
+            ts.tv_nsec += (sl_fileCfg.flushMs % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&sl_fileWake, &sl_fileLock, &ts);
+        }
+
+        /* The buffer being filled joins the group, if that leaves one free
+         * for the writers: the next one after it is the oldest otherwise */
+        if (sl_fileBufs[sl_lFileHead % SL_FILE_NUM_BUFS].len &&
+            sl_lFileHead - sl_lFileTail < SL_FILE_NUM_BUFS - 1)
+            sl_lFileHead++;
+
+        num = sl_lFileHead - sl_lFileTail;
+        if (!num)
+        {
+            if (sl_iFileStop)
+                break;
+            continue;
+        }
+        tail = sl_lFileTail;
+        for (i = 0, pending = 0; i < num; i++)
+        {
+            iov[i].iov_base = sl_fileBufs[(tail + i) % SL_FILE_NUM_BUFS].data;
+            iov[i].iov_len  = sl_fileBufs[(tail + i) % SL_FILE_NUM_BUFS].len;
+            pending += iov[i].iov_len;
+        }
+        pthread_mutex_unlock(&sl_fileLock);
+
+        bytes = sl_FileWrite(iov, num);
+        if (sl_fileCfg.sync && sl_fileFd >= 0)
+            fdatasync(sl_fileFd);
+        sl_lFileSize += bytes;
+        rotated = sl_FileRotate();
+
+        pthread_mutex_lock(&sl_fileLock);
+        for (i = 0; i < num; i++)
+            sl_fileBufs[(tail + i) % SL_FILE_NUM_BUFS].len = 0;
+        sl_lFileTail += num;
+        sl_fileStats.bytes += bytes;
+        sl_fileStats.commits++;
+        sl_fileStats.rotations += rotated;
+        sl_fileStats.errors += (bytes < pending);
+        pthread_cond_broadcast(&sl_fileSpace);
+    }
+    pthread_mutex_unlock(&sl_fileLock);
+    return NULL;
+}
+
+/**
+ * Make the exit stop the file sink, once per process
+ *
+ * @return: None
+ *
+ */
+static void sl_FileOnce(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sl_fileWake, &attr);
+    pthread_cond_init(&sl_fileSpace, NULL);
+    pthread_condattr_destroy(&attr);
+    atexit(sl_FileLogStop);
+}
+
+/**
+ * Start writing the log to a file, the output becomes LOG_OUT_FILE
+ *
+ * @param: path  log file, appended to
+ * @param: cfg   settings, NULL for the defaults
+ * @return: 0 on success, -1 on failure
+ *
+ */
+int sl_FileLogStart( const char *path, const SlFileCfg *cfg )
+{
+    unsigned int i;
+
+    if (sl_iFileOn || !path || strlen(path) >= PATH_MAX)
+        return -1;
+    pthread_once(&sl_fileOnce, sl_FileOnce);
+
+    memset(&sl_fileCfg, 0, sizeof(sl_fileCfg));
+    if (cfg)
+        sl_fileCfg = *cfg;
+    if (!sl_fileCfg.flushMs)
+        sl_fileCfg.flushMs = SL_FILE_FLUSH_MS;
+    if (!sl_fileCfg.maxSize)
+        sl_fileCfg.maxSize = SL_FILE_MAX_SIZE;
+    if (!sl_fileCfg.keep)
+        sl_fileCfg.keep = SL_FILE_KEEP;
+    if (sl_fileCfg.keep > SL_FILE_KEEP_MAX)
+        sl_fileCfg.keep = SL_FILE_KEEP_MAX;
+
+    strcpy(sl_filePath, path);
+    if (sl_FileOpen(0) != 0)
+        return -1;
+
+    for (i = 0; i < SL_FILE_NUM_BUFS; i++)
+    {
+        sl_fileBufs[i].len  = 0;
+        sl_fileBufs[i].data = malloc(SL_FILE_BUF_SIZE);
+        if (!sl_fileBufs[i].data)
+            goto fail;
+    }
+
+    memset(&sl_fileStats, 0, sizeof(sl_fileStats));
+    sl_lFileHead = sl_lFileTail = 0;
+    sl_iFileStop = 0;
+    sl_iFileFailed = 0;
+    if (sl_ThreadCreate(&sl_fileFlusher, sl_FileFlusher, NULL) != 0)
+        goto fail;
+
+    __atomic_store_n(&sl_iFileOn, 1, __ATOMIC_RELEASE);
+    sl_iFilePrev = sl_LogSetOutput(LOG_OUT_FILE);
+    return 0;
+
+fail:
+    for (i = 0; i < SL_FILE_NUM_BUFS; i++)
+    {
+        free(sl_fileBufs[i].data);
+        sl_fileBufs[i].data = NULL;
+    }
+    close(sl_fileFd);
+    sl_fileFd = -1;
+    return -1;
+}
+
+/**
+ * Write everything buffered and stop the file sink
+ * Asynchronous logging is stopped first, so the records still queued in
+ * its rings reach the file. The output goes back to the one before.
+ *
+ * @return: None
+ *
+ */
+void sl_FileLogStop( void )
+{
+    unsigned int i;
+
+    if (!__atomic_load_n(&sl_iFileOn, __ATOMIC_ACQUIRE))
+        return;
+    sl_AsyncLogStop();
+
+    pthread_mutex_lock(&sl_fileLock);
+    __atomic_store_n(&sl_iFileOn, 0, __ATOMIC_RELEASE);
+    sl_iFileStop = 1;
+    pthread_cond_signal(&sl_fileWake);
+    pthread_mutex_unlock(&sl_fileLock);
+    pthread_join(sl_fileFlusher, NULL);
+
+    sl_LogSetOutput(sl_iFilePrev);
+    close(sl_fileFd);
+    sl_fileFd = -1;
+    for (i = 0; i < SL_FILE_NUM_BUFS; i++)
+    {
+        free(sl_fileBufs[i].data);
+        sl_fileBufs[i].data = NULL;
+    }
+}
+
+/**
+ * Returns the file sink counters
+ *
+ * @param: stats  output counters
+ * @return: None
+ *
+ */
+void sl_FileLogStats( SlFileStats *stats )
+{
+    pthread_mutex_lock(&sl_fileLock);
+    *stats = sl_fileStats;
+    pthread_mutex_unlock(&sl_fileLock);
+}
@@ -0,0 +1,434 @@
+/*
+ * \file Name: SysLogSock.c
+ *
+ * \brief Direct syslog socket sink of the system logging
+ *
+ * \details
+ *   Two buffers: the logging threads append to the active one under a
+ * mutex, the flusher swaps them and sends the records of the other one
+ * out of the lock. A frame is the RFC 5424 header, built by the flusher
+ * from the record timestamp, and the record text, sent as two iovecs.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "SysLogging.h"
+#include "SysLogSock.h"
+
+#define SL_SOCK_ALIGN  8   /* Record alignment in the buffers */
+
+/* Record header, the text follows */
+typedef struct slSockRec
+{
+    unsigned long long tsNs;     /* CLOCK_REALTIME when logged */
+    unsigned short     len;      /* Text length                */
+    unsigned short     level;
+    unsigned int       reserved;
+} SlSockRec;
+
+/* Records waiting to be sent */
+typedef struct slSockBuf
+{
+    char         *data;
+    unsigned int len;
+} SlSockBuf;
+
+static int                sl_iSockOn    = 0;    /* Records go to the buffers   */
+static int                sl_iSockStop  = 0;    /* Flusher to send all and quit */
+static int                sl_sockFd     = -1;   /* Flusher only                */
+static struct sockaddr_un sl_sockAddr;
+static char               sl_sockHost[SL_SOCK_HOST_MAX + 1];
+static char               sl_sockApp[SL_SOCK_APP_MAX + 1];
+static SlSockBuf          sl_sockBufs[2];
+static unsigned int       sl_iSockActive = 0;   /* Buffer the writers fill     */
+static SlSockStats        sl_sockStats;
+static pthread_mutex_t    sl_sockLock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     sl_sockWake;
+static pthread_t          sl_sockFlusher;
+static pthread_once_t     sl_sockOnce   = PTHREAD_ONCE_INIT;
+
+/**
+ * Append one record to the active buffer
+ * Never waits: a record that does not fit is dropped.
+ *
+ * @param: iLevel  print level of the record
+ * @param: text    formatted record
+ * @param: len     record length
+ * @return: 0 if taken or dropped, -1 if the socket sink is not running
+ *
+ */
+int sl_SockLogPut( int iLevel, const char *text, int len )
+{
+    struct timespec ts;
+    SlSockBuf       *buf;
+    SlSockRec       *rec;
+    unsigned int    need;
+
+    if (!__atomic_load_n(&sl_iSockOn, __ATOMIC_ACQUIRE))
+        return -1;
+    if (len > SYS_LOG_BUFFER_SIZE - 1)
+        len = SYS_LOG_BUFFER_SIZE - 1;
+    need = (sizeof(SlSockRec) + len + SL_SOCK_ALIGN - 1) & ~(SL_SOCK_ALIGN - 1);
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    pthread_mutex_lock(&sl_sockLock);
+    if (!sl_iSockOn)
+    {
+        pthread_mutex_unlock(&sl_sockLock);
+        return -1;
+    }
+
+    buf = &sl_sockBufs[sl_iSockActive];
+    if (buf->len + need > SL_SOCK_BUF_SIZE)
+    {
+        sl_sockStats.dropped++;
+        pthread_cond_signal(&sl_sockWake);
+        pthread_mutex_unlock(&sl_sockLock);
+        return 0;
+    }
+
+    rec = (SlSockRec *)(buf->data + buf->len);
+    rec->tsNs  = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->len   = len;
+    rec->level = iLevel;
+    memcpy(rec + 1, text, len);
+    buf->len += need;
+    sl_sockStats.records++;
+
+    /* First record: start the flush interval. Half full: send now
+     * rather than at the end of it */
+    if (buf->len == need ||
+        (buf->len - need < SL_SOCK_BUF_SIZE / 2 && buf->len >= SL_SOCK_BUF_SIZE / 2))
+        pthread_cond_signal(&sl_sockWake);
+    pthread_mutex_unlock(&sl_sockLock);
+    return 0;
+}
+
+/**
+ * Open the datagram socket and connect it to the syslog socket
+ *
+ * @return: 0 on success, -1 on failure
+ *
+ */
+static int sl_SockConnect(void)
+{
+    if (sl_sockFd >= 0)
+        close(sl_sockFd);
+    sl_sockFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sl_sockFd < 0)
+        return -1;
+    if (connect(sl_sockFd, (struct sockaddr *)&sl_sockAddr, sizeof(sl_sockAddr)) != 0)
+    {
+        close(sl_sockFd);
+        sl_sockFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send a batch of frames, reconnecting once if the daemon went away
+ *
+ * @param: msgs     frames
+ * @param: num      frames
+ * @param: batches  output, sendmmsg() calls added
+ * @return: frames the socket refused
+ *
+ */
+static unsigned int sl_SockSend(struct mmsghdr *msgs, unsigned int num, unsigned int *batches)
+{
+    unsigned int sent = 0, failed = 0;
+    int          ret, retried = 0;
+
+    while (sent < num)
+    {
+        ret = (sl_sockFd >= 0) ? sendmmsg(sl_sockFd, msgs + sent, num - sent, 0) : -1;
+        (*batches)++;
+        if (ret > 0)
+        {
+            sent += ret;
+            continue;
+        }
+        if (ret < 0 && errno == EINTR)
+            continue;
+        /* Daemon restarted: reconnect once */
+        if (!retried && (sl_sockFd < 0 || errno == ECONNREFUSED || errno == ENOTCONN))
+        {
+            retried = 1;
+            sl_SockConnect();
+            continue;
+        }
+        /* No socket left, the whole rest is lost */
+        if (sl_sockFd < 0)
+            return failed + num - sent;
+        /* A frame it will not take: skip it, send the others */
+        failed++;
+        sent++;
+    }
+    return failed;
+}
+
+/**
+ * Build the frames of one buffer and send them in batches
+ *
+ * @param: buf  records
+ * @return: None
+ *
+ */
+static void sl_SockSendBuf(SlSockBuf *buf)
+{
+    static time_t  lastSec = -1;   /* Flusher only */
+    static char    date[32];
+    struct mmsghdr msgs[SL_SOCK_BATCH];
+    struct iovec   iov[SL_SOCK_BATCH][2];
+    char           hdr[SL_SOCK_BATCH][SL_SOCK_HDR_MAX];
+    SlSockRec      *rec;
+    struct tm      tm;
+    time_t         sec;
+    unsigned int   pos = 0, num = 0, pid = getpid();
+    unsigned int   failed = 0, frames = 0, batches = 0;
+    int            hdrLen;
+
+    memset(msgs, 0, sizeof(msgs));
+    while (pos < buf->len)
+    {
+        rec = (SlSockRec *)(buf->data + pos);
+        pos += (sizeof(SlSockRec) + rec->len + SL_SOCK_ALIGN - 1) & ~(SL_SOCK_ALIGN - 1);
+
+        sec = rec->tsNs / 1000000000ULL;
+        if (sec != lastSec)
+        {
+            gmtime_r(&sec, &tm);
+            strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+            lastSec = sec;
+        }
+        /* <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG */
+        hdrLen = snprintf(hdr[num], SL_SOCK_HDR_MAX, "<%u>1 %s.%06uZ %s %s %u - - ",
+                          LOG_USER | rec->level, date,
+                          (unsigned int)(rec->tsNs % 1000000000ULL / 1000),
+                          sl_sockHost, sl_sockApp, pid);
+        if (hdrLen >= SL_SOCK_HDR_MAX)
+            hdrLen = SL_SOCK_HDR_MAX - 1;
+
+        iov[num][0].iov_base = hdr[num];
+        iov[num][0].iov_len  = hdrLen;
+        iov[num][1].iov_base = rec + 1;
+        iov[num][1].iov_len  = rec->len;
+        msgs[num].msg_hdr.msg_iov    = iov[num];
+        msgs[num].msg_hdr.msg_iovlen = 2;
+
+        if (++num == SL_SOCK_BATCH || pos >= buf->len)
+        {
+            failed += sl_SockSend(msgs, num, &batches);
+            frames += num;
+            num = 0;
+        }
+    }
+
+    pthread_mutex_lock(&sl_sockLock);
+    sl_sockStats.frames += frames - failed;
+    sl_sockStats.errors += failed;
+    sl_sockStats.batches += batches;
+    pthread_mutex_unlock(&sl_sockLock);
+}
+
+/**
+ * Flusher thread: send the active buffer when half full, or at the
+ * latest SL_SOCK_FLUSH_MS after its first record. It sleeps without a
+ * timeout while the active buffer is empty.
+ *
+ * @param: arg  unused
+ * @return: NULL
+ *
+ */
+static void *sl_SockFlusher(void *arg)
+{
+    struct timespec ts;
+    SlSockBuf       *buf;
+
+    (void)arg;
+    pthread_mutex_lock(&sl_sockLock);
+    while (1)
+    {
+        /* Nothing to send: the first record wakes us up */
+        if (!sl_iSockStop && !sl_sockBufs[sl_iSockActive].len)
+        {
+            pthread_cond_wait(&sl_sockWake, &sl_sockLock);
+            continue;
+        }
+        if (!sl_iSockStop && sl_sockBufs[sl_iSockActive].len < SL_SOCK_BUF_SIZE / 2)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += SL_SOCK_FLUSH_MS * 1000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&sl_sockWake, &sl_sockLock, &ts);
+        }
+
+        buf = &sl_sockBufs[sl_iSockActive];
+        if (!buf->len)
+        {
+            if (sl_iSockStop)
+                break;
+            continue;
+        }
+
+        /* The other buffer was emptied by the previous round */
+        sl_iSockActive ^= 1;
+        pthread_mutex_unlock(&sl_sockLock);
+        sl_SockSendBuf(buf);
+        pthread_mutex_lock(&sl_sockLock);
+        buf->len = 0;
+    }
+    pthread_mutex_unlock(&sl_sockLock);
+    return NULL;
+}
+
+/**
+ * Initialize the flusher wake-up and make the exit stop the socket
+ * sink, once per process
+ *
+ * @return: None
+ *
+ */
+static void sl_SockOnce(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sl_sockWake, &attr);
+    pthread_condattr_destroy(&attr);
+    atexit(sl_SockLogStop);
+}
+
+/**
+ * Send the syslog output straight to the syslog socket
+ * Nothing changes when the socket is not there, syslog() is used.
+ *
+ * @param: path  syslog socket, NULL for SL_SOCK_PATH
+ * @return: 0 on success, -1 on failure
+ *
+ */
+int sl_SockLogStart( const char *path )
+{
+    unsigned int i;
+
+    if (sl_iSockOn)
+        return -1;
+    if (!path)
+        path = SL_SOCK_PATH;
+    if (strlen(path) >= sizeof(sl_sockAddr.sun_path))
+        return -1;
+    pthread_once(&sl_sockOnce, sl_SockOnce);
+
+    memset(&sl_sockAddr, 0, sizeof(sl_sockAddr));
+    sl_sockAddr.sun_family = AF_UNIX;
+    strcpy(sl_sockAddr.sun_path, path);
+    if (sl_SockConnect() != 0)
+        return -1;
+
+    if (gethostname(sl_sockHost, sizeof(sl_sockHost)) != 0 || !sl_sockHost[0])
+        strcpy(sl_sockHost, "-");
+    sl_sockHost[SL_SOCK_HOST_MAX] = '\0';
+    snprintf(sl_sockApp, sizeof(sl_sockApp), "%s",
+             *sl_LogProcName() ? sl_LogProcName() : "-");
+
+    for (i = 0; i < 2; i++)
+    {
+        sl_sockBufs[i].len  = 0;
+        sl_sockBufs[i].data = malloc(SL_SOCK_BUF_SIZE);
+        if (!sl_sockBufs[i].data)
+            goto fail;
+    }
+
+    memset(&sl_sockStats, 0, sizeof(sl_sockStats));
+    sl_iSockActive = 0;
+    sl_iSockStop   = 0;
+    if (sl_ThreadCreate(&sl_sockFlusher, sl_SockFlusher, NULL) != 0)
+        goto fail;
+
+    __atomic_store_n(&sl_iSockOn, 1, __ATOMIC_RELEASE);
+    return 0;
+
+fail:
+    for (i = 0; i < 2; i++)
+    {
+        free(sl_sockBufs[i].data);
+        sl_sockBufs[i].data = NULL;
+    }
+    close(sl_sockFd);
+    sl_sockFd = -1;
+    return -1;
+}
+
+/**
+ * Send everything buffered and go back to syslog()
+ * Asynchronous logging is stopped first, so the records still queued in
+ * its rings are sent.
+ *
+ * @return: None
+ *
+ */
+void sl_SockLogStop( void )
+{
+    unsigned int i;
+
+    if (!__atomic_load_n(&sl_iSockOn, __ATOMIC_ACQUIRE))
+        return;
+    sl_AsyncLogStop();
+
+    pthread_mutex_lock(&sl_sockLock);
+    __atomic_store_n(&sl_iSockOn, 0, __ATOMIC_RELEASE);
+    sl_iSockStop = 1;
+    pthread_cond_signal(&sl_sockWake);
+    pthread_mutex_unlock(&sl_sockLock);
+    pthread_join(sl_sockFlusher, NULL);
+
+    close(sl_sockFd);
+    sl_sockFd = -1;
+    for (i = 0; i < 2; i++)
+    {
+        free(sl_sockBufs[i].data);
+        sl_sockBufs[i].data = NULL;
+    }
+}
+
+/**
+ * Returns the socket sink counters
+ *
+ * @param: stats  output counters
+ * @return: None
+ *
+ */
+void sl_SockLogStats( SlSockStats *stats )
+{
+    pthread_mutex_lock(&sl_sockLock);
+    *stats = sl_sockStats;
+    pthread_mutex_unlock(&sl_sockLock);
+}
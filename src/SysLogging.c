@@ -9,6 +9,11 @@
  *   System common logging functions contains all the logging
  * related functions. All the output will go to common system
  * log of Linux system.
+ *   Asynchronous mode gives every logging thread a single producer,
+ * single consumer ring. Records are copied in without any lock or
+ * system call, one writer thread drains all the rings to the output.
+ * A full ring drops the record and counts it, the writer reports the
+ * drops in the log.
  */
 
 /*
@@ -29,6 +34,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
@@ -37,13 +43,108 @@
 #include <libgen.h>
 #include <stdarg.h>
 #include "SysLogging.h"
+#include "SysLogBin.h"
+#include "SysLogFile.h"
+#include "SysLogSock.h"
+
+#define SL_REC_ALIGN  8   /* Ring record alignment */
+
+/* Ring record header, the NUL terminated text follows */
+typedef struct slRec
+{
+    unsigned int   len;      /* Record length, SL_REC_ALIGN aligned, 0 pads to the ring end */
+    unsigned short level;
+    unsigned short textLen;  /* Without the NUL */
+} SlRec;
+
+/* Ring of one logging thread, the thread produces, the writer consumes */
+typedef struct slRing
+{
+    struct slRing      *next;      /* Registered rings, kept until exit  */
+    char               *buf;
+    unsigned int       size;       /* Power of two                       */
+    int                owned;      /* A live thread logs into it         */
+    int                full;       /* Producer: last record was dropped  */
+    unsigned long long dropped;    /* Producer: records lost, ring full  */
+    unsigned long long overflows;  /* Producer: times the ring filled up */
+    unsigned long long head __attribute__((aligned(64)));  /* Producer position */
+    unsigned long long tail __attribute__((aligned(64)));  /* Consumer position */
+    unsigned long long dropSeen;   /* Consumer: drops already reported   */
+} SlRing;
 
 static char sl_ProcName[MAX_NAME_LEN] = {0};  /* System Logging Process Name */
 static int  sl_iVerbosity             = 0  ;  /* System Verbosity Level      */
 static int  sl_iOutput                = LOG_OUT_STDOUT;
 
+/* Asynchronous mode */
+static int                sl_iAsync    = 0;     /* Records go to the rings     */
+static int                sl_iStop     = 0;     /* Writer thread to quit       */
+static int                sl_iIdle     = 0;     /* Writer waits on sl_wakeCond */
+static unsigned int       sl_iRingSize = 0;
+static SlRing             *sl_pRings   = NULL;  /* All the registered rings    */
+static unsigned long long sl_lWritten  = 0;     /* Records written by the writer */
+static pthread_t          sl_writer;
+static pthread_mutex_t    sl_wakeLock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     sl_wakeCond  = PTHREAD_COND_INITIALIZER;
+static pthread_key_t      sl_ringKey;
+static pthread_once_t     sl_asyncOnce = PTHREAD_ONCE_INIT;
+static __thread SlRing    *sl_pRing    = NULL;  /* Ring of the calling thread  */
+
+/* Message prefix parts kept by each thread */
+typedef struct slPrefix
+{
+    unsigned int gen;         /* sl_iPrefixGen the parts were built for  */
+    time_t       sec;         /* Second of the time part, -1 for none    */
+    int          timeLen;
+    int          idLen;
+    char         time[MAX_NAME_LEN + 32];  /* "[d/m/y h:m:s] proc "       */
+    char         id[32];                   /* "pid(thread) "              */
+} SlPrefix;
+
+static unsigned int       sl_iPrefixGen = 1;    /* Bumped on init and fork     */
+static pthread_once_t     sl_initOnce  = PTHREAD_ONCE_INIT;
+static __thread SlPrefix  sl_prefix;
+
+/* sl_LogSiteEnable() rule, also applied to sites that log later */
+typedef struct slSiteRule
+{
+    char match[MAX_NAME_LEN];
+    int  enable;
+} SlSiteRule;
+
+/* Call sites */
+static SlSite             *sl_pSites    = NULL;  /* Sites that logged once      */
+static SlSiteRule         sl_rules[SL_SITE_RULES_MAX];
+static unsigned int       sl_iNumRules  = 0;
+static pthread_mutex_t    sl_siteLock   = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long sl_lRateIntv  = 1000000000ULL / SL_SITE_RATE_DEFAULT; /* ns, 0 unlimited */
+static unsigned long long sl_lRateBurst = (SL_SITE_BURST_DEFAULT - 1) *
+                                          (1000000000ULL / SL_SITE_RATE_DEFAULT);
+
 void slogf(int severity, const char * fmt, ... );
 
+/**
+ * Invalidate the cached prefixes in a forked child, its pid changed
+ *
+ * @return: None
+ *
+ */
+static void sl_AtForkChild(void)
+{
+    sl_iPrefixGen++;
+}
+
+/**
+ * Register the fork handler, once per process
+ *
+ * @return: None
+ *
+ */
+static void sl_InitOnce(void)
+{
+    pthread_atfork(NULL, NULL, sl_AtForkChild);
+}
+
 /**
  * This function initialize the gloabal system logging
  * @param: verbosity system verbosity level, comply with linux system setting
@@ -83,6 +184,618 @@ void InitSystemLogging(
 
     /* Default output to system log */
     sl_iOutput = (iOutput == LOG_OUT_STDOUT)?LOG_OUT_STDOUT:LOG_OUT_SYSLOG;
+
+    /* Cached prefixes hold the process name and pid */
+    pthread_once(&sl_initOnce, sl_InitOnce);
+    __atomic_fetch_add(&sl_iPrefixGen, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Write one formatted record to the log output
+ *
+ * @param: iLevel  print level of the record
+ * @param: text    formatted record, NUL terminated
+ * @param: len     record length
+ * @return: None
+ *
+ */
+static void sl_Output(int iLevel, const char *text, int len)
+{
+    if (sl_iOutput == LOG_OUT_FILE && sl_FileLogPut(text, len) == 0)
+        return;
+
+    if (sl_iOutput != LOG_OUT_SYSLOG)
+    {
+        flockfile(stdout);
+        fwrite_unlocked(text, 1, len, stdout);
+        fputc_unlocked('\n', stdout);
+        funlockfile(stdout);
+    }
+    else if (sl_SockLogPut(iLevel, text, len) != 0)
+        syslog(LOG_USER|iLevel, "%.*s", len, text);
+}
+
+/**
+ * Mark the ring of an exiting thread free for the next new thread
+ *
+ * @param: arg  ring of the thread
+ * @return: None
+ *
+ */
+static void sl_RingRelease(void *arg)
+{
+    SlRing *ring = arg;
+
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create the thread key releasing the rings, once per process
+ *
+ * @return: None
+ *
+ */
+static void sl_AsyncOnce(void)
+{
+    pthread_key_create(&sl_ringKey, sl_RingRelease);
+    atexit(sl_AsyncLogStop);
+}
+
+/**
+ * Returns the ring of the calling thread
+ * A drained ring left by an exited thread is reused first, otherwise a
+ * new ring is registered. Only the first record of a thread gets here.
+ *
+ * @return: ring, NULL if out of memory
+ *
+ */
+static SlRing *sl_RingGet(void)
+{
+    SlRing *ring;
+    int    unowned;
+
+    if (sl_pRing)
+        return sl_pRing;
+
+    for (ring = __atomic_load_n(&sl_pRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        unowned = 0;
+        if (ring->size == sl_iRingSize &&
+            __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head &&
+            __atomic_compare_exchange_n(&ring->owned, &unowned, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!ring)
+    {
+        if (posix_memalign((void **)&ring, 64, sizeof(SlRing)) != 0)
+            return NULL;
+        memset(ring, 0, sizeof(SlRing));
+        ring->size  = sl_iRingSize;
+        ring->owned = 1;
+        ring->buf   = malloc(ring->size);
+        if (!ring->buf)
+        {
+            free(ring);
+            return NULL;
+        }
+        ring->next = __atomic_load_n(&sl_pRings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&sl_pRings, &ring->next, ring, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    pthread_setspecific(sl_ringKey, ring);
+    sl_pRing = ring;
+    return ring;
+}
+
+/**
+ * Wake the writer thread up
+ *
+ * @return: None
+ *
+ */
+static void sl_AsyncWake(void)
+{
+    pthread_mutex_lock(&sl_wakeLock);
+    pthread_cond_signal(&sl_wakeCond);
+    pthread_mutex_unlock(&sl_wakeLock);
+}
+
+/**
+ * Check that all the rings are drained
+ *
+ * @return: 1 if no record is queued, 0 otherwise
+ *
+ */
+static int sl_RingsEmpty(void)
+{
+    SlRing *ring;
+
+    for (ring = __atomic_load_n(&sl_pRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Copy one formatted record into the ring of the calling thread
+ * A record that does not fit in the ring end is put at its start,
+ * after a padding record.
+ *
+ * @param: iLevel  print level of the record
+ * @param: text    formatted record
+ * @param: len     record length
+ * @return: 0      queued or dropped on a full ring
+ *          -1     no ring, the caller writes it itself
+ *
+ */
+static int sl_RingPut(int iLevel, const char *text, int len)
+{
+    SlRing             *ring = sl_RingGet();
+    SlRec              *rec;
+    unsigned long long head, tail;
+    unsigned int       off, need, pad;
+
+    if (!ring)
+        return -1;
+
+    need = (sizeof(SlRec) + len + 1 + SL_REC_ALIGN - 1) & ~(SL_REC_ALIGN - 1);
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    off  = head & (ring->size - 1);
+    pad  = (ring->size - off < need) ? ring->size - off : 0;
+
+    if (head + pad + need - tail > ring->size)
+    {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        if (!ring->full)
+            __atomic_store_n(&ring->overflows, ring->overflows + 1, __ATOMIC_RELAXED);
+        ring->full = 1;
+        return 0;
+    }
+    ring->full = 0;
+
+    if (pad)
+    {
+        ((SlRec *)(ring->buf + off))->len = 0;
+        head += pad;
+        off = 0;
+    }
+
+    rec = (SlRec *)(ring->buf + off);
+    rec->len     = need;
+    rec->level   = iLevel;
+    rec->textLen = len;
+    memcpy(rec + 1, text, len);
+    ((char *)(rec + 1))[len] = 0;
+
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+
+    /* First record of a drained ring, wake the writer if it waits. The
+     * writer flags itself idle before checking the rings, see
+     * sl_AsyncWriter(), one of both sees the other. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sl_iIdle, __ATOMIC_RELAXED) &&
+        __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == ring->head - need - pad)
+        sl_AsyncWake();
+    return 0;
+}
+
+/**
+ * Write the records queued in one ring
+ *
+ * @param: ring  ring to drain
+ * @return: number of records written
+ *
+ */
+static unsigned int sl_RingDrain(SlRing *ring)
+{
+    SlRec              *rec;
+    unsigned long long head, tail, dropped;
+    unsigned int       off, num = 0;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = ring->tail;
+    while (tail != head)
+    {
+        off = tail & (ring->size - 1);
+        rec = (SlRec *)(ring->buf + off);
+        if (rec->len == 0)
+        {
+            tail += ring->size - off;
+            continue;
+        }
+        sl_Output(rec->level, (char *)(rec + 1), rec->textLen);
+        tail += rec->len;
+        num++;
+        /* Room for the producer as soon as possible */
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped != ring->dropSeen)
+    {
+        SLOGNOTE("%llu log records dropped, ring of %u bytes full",
+                 dropped - ring->dropSeen, ring->size);
+        ring->dropSeen = dropped;
+    }
+
+    return num;
+}
+
+/**
+ * Write the records queued in all the rings
+ *
+ * @return: number of records written
+ *
+ */
+static unsigned int sl_RingDrainAll(void)
+{
+    SlRing       *ring;
+    unsigned int num = 0;
+
+    for (ring = __atomic_load_n(&sl_pRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+        num += sl_RingDrain(ring);
+
+    __atomic_store_n(&sl_lWritten, sl_lWritten + num, __ATOMIC_RELAXED);
+    return num;
+}
+
+/**
+ * Writer thread, drains the rings until asked to stop
+ * Its own records, the drop reports, go to its own ring and are
+ * written by the next round. Once the rings stayed empty for
+ * SL_ASYNC_POLL_MAX polls it blocks until a producer queues into a
+ * drained ring, an idle process keeps it off the CPU.
+ *
+ * @param: arg  not used
+ * @return: NULL
+ *
+ */
+static void *sl_AsyncWriter(void *arg)
+{
+    struct timespec ts = { 0, SL_ASYNC_POLL_US * 1000 };
+    unsigned int    idleCnt = 0;
+
+    (void)arg;
+    while (!__atomic_load_n(&sl_iStop, __ATOMIC_ACQUIRE))
+    {
+        if (sl_RingDrainAll())
+        {
+            idleCnt = 0;
+            continue;
+        }
+
+        if (sl_iOutput == LOG_OUT_STDOUT)
+            fflush(stdout);
+
+        /* Keep polling for a while, a busy producer does not pay a
+         * wake-up for every record */
+        if (idleCnt++ < SL_ASYNC_POLL_MAX)
+        {
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        /* Idle first, then check: a record queued meanwhile is seen
+         * here or its producer sees the flag and signals */
+        pthread_mutex_lock(&sl_wakeLock);
+        __atomic_store_n(&sl_iIdle, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (sl_RingsEmpty() && !__atomic_load_n(&sl_iStop, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&sl_wakeCond, &sl_wakeLock);
+        __atomic_store_n(&sl_iIdle, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&sl_wakeLock);
+    }
+
+    /* Twice, the first round may report drops */
+    sl_RingDrainAll();
+    sl_RingDrainAll();
+    if (sl_iOutput == LOG_OUT_STDOUT)
+        fflush(stdout);
+    return NULL;
+}
+
+/**
+ * Switch the logging to asynchronous mode
+ * From now on the callers only copy their formatted records into a
+ * ring of their thread and a writer thread outputs them. The queued
+ * records are flushed by sl_AsyncLogStop(), also run at exit.
+ *
+ * @param: ringSize  ring size of each logging thread in bytes, rounded
+ *                   up to a power of two, 0 for SL_ASYNC_RING_SIZE
+ * @return: 0 on success, -1 on failure
+ *
+ */
+int sl_AsyncLogStart( unsigned int ringSize )
+{
+    unsigned int size = SL_ASYNC_RING_MIN;
+
+    if (sl_iAsync)
+        return -1;
+
+    if (ringSize == 0)
+        ringSize = SL_ASYNC_RING_SIZE;
+    while (size < ringSize && size < (1U << 30))
+        size <<= 1;
+
+    pthread_once(&sl_asyncOnce, sl_AsyncOnce);
+    sl_iRingSize = size;
+    sl_iStop     = 0;
+    if (sl_ThreadCreate(&sl_writer, sl_AsyncWriter, NULL) != 0)
+        return -1;
+
+    __atomic_store_n(&sl_iAsync, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Flush the queued records and go back to synchronous logging
+ * The rings stay registered for a later restart. A record queued by
+ * another thread while the writer exits may be lost.
+ *
+ * @return: None
+ *
+ */
+void sl_AsyncLogStop( void )
+{
+    if (!__atomic_load_n(&sl_iAsync, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n(&sl_iAsync, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&sl_iStop, 1, __ATOMIC_RELEASE);
+    sl_AsyncWake();
+    pthread_join(sl_writer, NULL);
+}
+
+/**
+ * Returns the asynchronous logging counters
+ *
+ * @param: stats  counters to be returned
+ * @return: None
+ *
+ */
+void sl_AsyncLogStats( SlAsyncStats *stats )
+{
+    SlRing *ring;
+
+    memset(stats, 0, sizeof(SlAsyncStats));
+    stats->written = __atomic_load_n(&sl_lWritten, __ATOMIC_RELAXED);
+    for (ring = __atomic_load_n(&sl_pRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        stats->dropped   += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        stats->overflows += __atomic_load_n(&ring->overflows, __ATOMIC_RELAXED);
+        stats->rings++;
+    }
+}
+
+/**
+ * Start a background thread with all signals blocked
+ * The signal handlers of the application, exit() included, then always
+ * run on its own threads, never on a thread that its atexit handlers
+ * join or that holds a lock they take. The faults raised by the thread
+ * itself stay deliverable, the flight recorder dumps on them.
+ *
+ * @param: tid    thread id to be returned
+ * @param: start  thread function
+ * @param: arg    thread function argument
+ * @return: 0 on success, an error number as pthread_create() otherwise
+ *
+ */
+int sl_ThreadCreate( pthread_t *tid, void *(*start)(void *), void *arg )
+{
+    sigset_t all, prev;
+    int      ret;
+
+    sigfillset(&all);
+    sigdelset(&all, SIGSEGV);
+    sigdelset(&all, SIGBUS);
+    sigdelset(&all, SIGFPE);
+    sigdelset(&all, SIGILL);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    ret = pthread_create(tid, NULL, start, arg);
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    return ret;
+}
+
+/**
+ * Returns the tag of a log type, as put in front of the message
+ *
+ * @param: iType  message type, defined in LOG_TYPE_...
+ * @return: tag, empty for LOG_TYPE_COMMON
+ *
+ */
+const char *sl_LogTypeStr( int iType )
+{
+    switch (iType)
+    {
+    case LOG_TYPE_ERROR:
+        return "ERR ";
+    case LOG_TYPE_USR:
+        return "USR ";
+    case LOG_TYPE_WARN:
+        return "WARN ";
+    case LOG_TYPE_INFO:
+        return "INFO ";
+    case LOG_TYPE_COMMON:
+    default:
+        return "";
+    }
+}
+
+/**
+ * Switch the log output, for the sinks started at runtime
+ *
+ * @param: iOutput  LOG_OUT_SYSLOG/LOG_OUT_STDOUT/LOG_OUT_FILE
+ * @return: previous output
+ *
+ */
+int sl_LogSetOutput( int iOutput )
+{
+    int prev = sl_iOutput;
+
+    sl_iOutput = iOutput;
+    return prev;
+}
+
+/**
+ * Returns the process name given to InitSystemLogging()
+ *
+ * @return: process name
+ *
+ */
+const char *sl_LogProcName( void )
+{
+    return sl_ProcName;
+}
+
+/**
+ * Append a string to a message
+ *
+ * @param: buf  message
+ * @param: pos  message length
+ * @param: str  string, at most SYS_LOG_BUFFER_SIZE / 4 characters taken
+ * @return: new message length
+ *
+ */
+static inline int sl_Append(char *buf, int pos, const char *str)
+{
+    size_t len = strnlen(str, SYS_LOG_BUFFER_SIZE / 4);
+
+    memcpy(buf + pos, str, len);
+    return pos + len;
+}
+
+/**
+ * Append a decimal number to a message
+ *
+ * @param: buf  message
+ * @param: pos  message length
+ * @param: val  number
+ * @return: new message length
+ *
+ */
+static inline int sl_AppendInt(char *buf, int pos, int val)
+{
+    char         digits[12];
+    int          i = sizeof(digits);
+    unsigned int u = val < 0 ? -(unsigned int)val : (unsigned int)val;
+
+    do {
+        digits[--i] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (val < 0)
+        digits[--i] = '-';
+    memcpy(buf + pos, digits + i, sizeof(digits) - i);
+    return pos + sizeof(digits) - i;
+}
+
+/**
+ * Returns the prefix parts of the calling thread, rebuilt when stale
+ * The time part is only formatted again when the second changes.
+ *
+ * @param: withTime  the time part is needed
+ * @return: prefix parts
+ *
+ */
+static SlPrefix *sl_PrefixGet(int withTime)
+{
+    SlPrefix  *prefix = &sl_prefix;
+    time_t    ltime;
+    struct tm Tm;
+
+    if (prefix->gen != __atomic_load_n(&sl_iPrefixGen, __ATOMIC_ACQUIRE))
+    {
+        prefix->gen   = sl_iPrefixGen;
+        prefix->sec   = -1;
+        prefix->idLen = snprintf(prefix->id, sizeof(prefix->id), "%u(%u) ",
+                                 (unsigned int)getpid(), (unsigned int)pthread_self());
+    }
+
+    if (withTime && (ltime = time(NULL)) != prefix->sec)
+    {
+        localtime_r(&ltime, &Tm);
+        prefix->timeLen = snprintf(prefix->time, sizeof(prefix->time),
+                                   "[%d/%d/%d %d:%d:%d] %s ",
+                                   Tm.tm_mday, Tm.tm_mon+1, Tm.tm_year+1900,
+                                   Tm.tm_hour, Tm.tm_min, Tm.tm_sec, sl_ProcName);
+        if (prefix->timeLen >= (int)sizeof(prefix->time))
+            prefix->timeLen = sizeof(prefix->time) - 1;
+        prefix->sec = ltime;
+    }
+    return prefix;
+}
+
+/**
+ * Format one message and write it, or queue it in asynchronous mode
+ * The prefix is copied from the thread cache, only the message itself
+ * goes through vsnprintf(). The buffer is not cleared, every path
+ * leaves it NUL terminated.
+ *
+ * @param: iLevel  print level of this message, already checked
+ * @param: iType   message type, defined in LOG_TYPE_...
+ * @param: strFile File name
+ * @param: strFunc Function name
+ * @param: iLine   File Line Number
+ * @param: format  Message format
+ * @param: ap      Arguments for format
+ * @return: None
+ *
+ */
+static void sl_LogVa
+(
+    int         iLevel,
+    int         iType,
+    const char* strFile,
+    const char* strFunc,
+    int         iLine,
+    const char  *format,
+    va_list     ap
+)
+{
+    char     szFoo[ SYS_LOG_BUFFER_SIZE ] ;
+    int      iLoc = 0, iLen ;
+    SlPrefix *prefix = sl_PrefixGet(sl_iOutput != LOG_OUT_SYSLOG);
+
+    /* At most 1/4 of the buffer per string, the prefix always fits */
+    if (sl_iOutput != LOG_OUT_SYSLOG)
+    {
+        memcpy(szFoo, prefix->time, prefix->timeLen);
+        iLoc = prefix->timeLen;
+    }
+    memcpy(szFoo + iLoc, prefix->id, prefix->idLen);
+    iLoc += prefix->idLen;
+    iLoc = sl_Append(szFoo, iLoc, sl_LogTypeStr(iType));
+    szFoo[iLoc++] = '[';
+    iLoc = sl_Append(szFoo, iLoc, strFile);
+    szFoo[iLoc++] = ':';
+    iLoc = sl_Append(szFoo, iLoc, strFunc);
+    szFoo[iLoc++] = ':';
+    iLoc = sl_AppendInt(szFoo, iLoc, iLine);
+    szFoo[iLoc++] = ']';
+    szFoo[iLoc++] = ' ';
+
+    iLen = vsnprintf ( szFoo+iLoc, SYS_LOG_BUFFER_SIZE-iLoc , format, ap ) ;
+    if (iLen < 0)
+    {
+        szFoo[iLoc] = '\0';
+        iLen = 0;
+    }
+    iLen += iLoc;
+    if (iLen > SYS_LOG_BUFFER_SIZE - 1)
+        iLen = SYS_LOG_BUFFER_SIZE - 1;
+
+    if (__atomic_load_n(&sl_iAsync, __ATOMIC_ACQUIRE) && sl_RingPut(iLevel, szFoo, iLen) == 0)
+        return;
+
+    sl_Output(iLevel, szFoo, iLen);
 }
 
 /**
@@ -110,9 +823,6 @@ void sl_LogSysMsg
 )
 {
     va_list ap;
-    char    szFoo[ SYS_LOG_BUFFER_SIZE ] ;
-    char    logType[MAX_NAME_LEN];
-    int     iLoc ;
 
     /* Check input log level before print into syslog */
     if ( iLevel < LOG_CRIT )
@@ -122,56 +832,253 @@ void sl_LogSysMsg
 
     if (iLevel > sl_iVerbosity) return;
 
-    /* Based on the input type, add log identity */
-    memset(logType,0,sizeof(logType));
-    switch (iType)
+    va_start ( ap, format ) ;
+    sl_LogVa(iLevel, iType, strFile, strFunc, iLine, format, ap);
+    va_end ( ap ) ;
+}
+
+/**
+ * Check if a call site matches a sl_LogSiteEnable() pattern
+ *
+ * @param: site   call site
+ * @param: match  "file:line", "file" or function name, file with or
+ *                without its directory
+ * @return: 1 if matched, 0 otherwise
+ *
+ */
+static int sl_SiteMatch(const SlSite *site, const char *match)
+{
+    const char *base = strrchr(site->file, '/');
+    const char *colon = strrchr(match, ':');
+    size_t     len = colon ? (size_t)(colon - match) : strlen(match);
+
+    base = base ? base + 1 : site->file;
+    if (colon && atoi(colon + 1) != site->line)
+        return 0;
+    if ((strncmp(site->file, match, len) == 0 && site->file[len] == '\0') ||
+        (strncmp(base, match, len) == 0 && base[len] == '\0'))
+        return 1;
+    return !colon && strcmp(site->func, match) == 0;
+}
+
+/**
+ * Add a call site to the site list on its first call
+ * The rules given so far decide if it starts disabled.
+ *
+ * @param: site  call site
+ * @return: None
+ *
+ */
+static void sl_SiteRegister(SlSite *site)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&sl_siteLock);
+    if (!site->reg)
     {
-    case LOG_TYPE_ERROR:
-        strcpy(logType,"ERR ");
-        break;
-    case LOG_TYPE_USR:
-        strcpy(logType,"USR ");
-        break;
-    case LOG_TYPE_WARN:
-        strcpy(logType,"WARN ");
-        break;
-    case LOG_TYPE_INFO:
-        strcpy(logType,"INFO ");
-        break;
-    case LOG_TYPE_COMMON:
-    default:
-        break;
+        for (i = 0; i < sl_iNumRules; i++)
+            if (sl_SiteMatch(site, sl_rules[i].match))
+                __atomic_store_n(&site->off, !sl_rules[i].enable, __ATOMIC_RELAXED);
+        site->next = sl_pSites;
+        sl_pSites  = site;
+        __atomic_store_n(&site->reg, 1, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&sl_siteLock);
+}
 
-    /* Print input message into system log */
-    memset(szFoo,0 , SYS_LOG_BUFFER_SIZE);
-    iLoc = snprintf ( szFoo, SYS_LOG_BUFFER_SIZE-1, "%u(%u) %s[%s:%s:%d] ",
-                      (unsigned int)getpid(),(unsigned int)pthread_self(),
-                      logType, strFile, strFunc, iLine ) ;
-    va_start ( ap, format ) ;
-    vsnprintf ( szFoo+iLoc, SYS_LOG_BUFFER_SIZE-iLoc , format, ap ) ;
+/**
+ * Take a token from the rate bucket of a call site
+ * The bucket is kept as the time it is full again: each message pushes
+ * it one interval further, a message is allowed while it is less than
+ * a burst ahead. Concurrent callers may let a few extra messages pass.
+ *
+ * @param: site  call site
+ * @return: 1 if the message may be logged, 0 if suppressed
+ *
+ */
+static int sl_SiteRateOk(SlSite *site)
+{
+    struct timespec    ts;
+    unsigned long long tsNow, tat, intv = sl_lRateIntv;
+
+    if (!intv)
+        return 1;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    tsNow = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    tat   = __atomic_load_n(&site->rateTat, __ATOMIC_RELAXED);
+    if (tat > tsNow + sl_lRateBurst)
+    {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&site->suppPend, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_store_n(&site->rateTat, (tat > tsNow ? tat : tsNow) + intv, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Log one message of a SLOGxxx call site
+ * Binary mode records the raw arguments, otherwise the message is
+ * formatted like sl_LogSysMsg() does. The flight recorder takes every
+ * message, before the verbosity and the rate limit. The messages a site
+ * lost to its rate limit are reported before its next message.
+ *
+ * @param: site   call site descriptor
+ * @param: ...    Arguments for the site format
+ * @return: None
+ *
+ */
+void sl_LogSite( SlSite *site, ... )
+{
+    va_list      ap, apRec;
+    int          iLevel = site->level;
+    int          binMode = sl_BinLogMode();
+    unsigned int supp;
+
+    if (!__atomic_load_n(&site->reg, __ATOMIC_ACQUIRE))
+    {
+        sl_SiteRegister(site);
+        if (site->off)
+            return;
+    }
+    __atomic_fetch_add(&site->hits, 1, __ATOMIC_RELAXED);
+
+    if ( iLevel < LOG_CRIT )
+        iLevel = LOG_CRIT;
+    if ( iLevel > LOG_DEBUG )
+        iLevel = LOG_DEBUG ;
+
+    if (binMode == SL_BIN_MODE_REC)
+    {
+        va_start ( apRec, site ) ;
+        sl_BinLogWrite(site, apRec);
+        va_end ( apRec ) ;
+    }
+
+    if (iLevel > sl_iVerbosity) return;
+    if (!sl_SiteRateOk(site)) return;
+
+    if (site->suppPend && (supp = __atomic_exchange_n(&site->suppPend, 0, __ATOMIC_RELAXED)))
+        sl_LogSysMsg(iLevel, site->type, site->file, site->func, site->line,
+                     "%u messages suppressed by the rate limit", supp);
+
+    va_start ( ap, site ) ;
+    if (binMode != SL_BIN_MODE_FILE || sl_BinLogWrite(site, ap) != 0)
+        sl_LogVa(iLevel, site->type, site->file, site->func, site->line, site->fmt, ap);
     va_end ( ap ) ;
+}
 
+/**
+ * Enable or disable call sites at runtime
+ * The rule is also kept for the sites that have not logged yet, they
+ * take it on their first call, their arguments are evaluated once.
+ *
+ * @param: match   "file:line", "file" or function name, file with or
+ *                 without its directory
+ * @param: enable  1 to enable, 0 to disable
+ * @return: number of sites changed, -1 if no room for the rule
+ *
+ */
+int sl_LogSiteEnable( const char *match, int enable )
+{
+    SlSite *site;
+    int    num = 0;
 
-    if (sl_iOutput == LOG_OUT_STDOUT)
+    if (!match || !*match)
+        return -1;
+
+    pthread_mutex_lock(&sl_siteLock);
+    if (sl_iNumRules >= SL_SITE_RULES_MAX)
     {
-        time_t ltime;
-        struct tm *Tm;
-        ltime=time(NULL);
-        Tm=localtime(&ltime);
-        printf("[%d/%d/%d %d:%d:%d] %s %s\n",
-               Tm->tm_mday,
-               Tm->tm_mon+1,
-               Tm->tm_year+1900,
-               Tm->tm_hour,
-               Tm->tm_min,
-               Tm->tm_sec,
-               sl_ProcName,
-               szFoo);
+        pthread_mutex_unlock(&sl_siteLock);
+        return -1;
     }
-    else
-        slogf(iLevel,"%s",szFoo);
+    strncpy(sl_rules[sl_iNumRules].match, match, MAX_NAME_LEN - 1);
+    sl_rules[sl_iNumRules].enable = enable;
+    sl_iNumRules++;
+
+    for (site = sl_pSites; site; site = site->next)
+    {
+        if (sl_SiteMatch(site, match))
+        {
+            __atomic_store_n(&site->off, !enable, __ATOMIC_RELAXED);
+            num++;
+        }
+    }
+    pthread_mutex_unlock(&sl_siteLock);
+    return num;
+}
+
+/**
+ * Set the rate limit of every call site
+ *
+ * @param: perSec  messages per second, 0 for no limit
+ * @param: burst   messages logged at once before the limit applies
+ * @return: None
+ *
+ */
+void sl_LogRateLimit( unsigned int perSec, unsigned int burst )
+{
+    unsigned long long intv = perSec ? 1000000000ULL / perSec : 0;
+
+    if (intv && !burst)
+        burst = 1;
+    sl_lRateBurst = intv ? (burst - 1) * intv : 0;
+    sl_lRateIntv  = intv;
+}
+
+/**
+ * Compare the hits of two call sites, most hits first
+ *
+ * @param: a  call site
+ * @param: b  call site
+ * @return: qsort() order
+ *
+ */
+static int sl_SiteCmpHits(const void *a, const void *b)
+{
+    unsigned long long ha = (*(SlSite * const *)a)->hits, hb = (*(SlSite * const *)b)->hits;
+
+    return ha < hb ? 1 : ha > hb ? -1 : 0;
+}
 
+/**
+ * Log the call sites with the most hits
+ *
+ * @param: top  sites to log, 0 for all
+ * @return: None
+ *
+ */
+void sl_LogSiteDump( unsigned int top )
+{
+    SlSite       *site, **sites;
+    unsigned int i, num = 0;
+
+    /* Sorted out of the lock, logging may register the dump sites */
+    pthread_mutex_lock(&sl_siteLock);
+    for (site = sl_pSites; site; site = site->next)
+        num++;
+    sites = malloc(num * sizeof(SlSite *) + 1);
+    for (i = 0, site = sl_pSites; sites && site; site = site->next)
+        sites[i++] = site;
+    pthread_mutex_unlock(&sl_siteLock);
+
+    if (!sites)
+        return;
+    qsort(sites, num, sizeof(SlSite *), sl_SiteCmpHits);
+
+    if (!top || top > num)
+        top = num;
+    SLOGNOTE("Log call sites: %u, %u noisiest", num, top);
+    for (i = 0; i < top; i++)
+    {
+        SLOGNOTE("  %10llu hits %10llu suppressed %s[%s:%s:%d]%s",
+                 sites[i]->hits, sites[i]->suppressed, sl_LogTypeStr(sites[i]->type),
+                 sites[i]->file, sites[i]->func, sites[i]->line,
+                 sites[i]->off ? " disabled" : "");
+    }
+    free(sites);
 }
 
 /**
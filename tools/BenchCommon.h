@@ -0,0 +1,124 @@
+/*
+ * \file Name: BenchCommon.h
+ *
+ * \brief Scaffolding shared by the FSM benchmarks
+ *
+ * \details
+ * Each benchmark defines its own session context, struct BENCH_CTX_TAG,
+ * with a CmFsmEntity member and its own matrix of output functions
+ * taking that context. The control point setup, the output function
+ * call and the clock are the same for all of them and live here.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _BENCH_COMMON_H
+#define _BENCH_COMMON_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "CommonInc.h"
+#include "CommonFsm.h"
+#include "CommonSlab.h"
+#include "SysLogging.h"
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+typedef struct BENCH_CTX_TAG BENCH_CTX_t;
+
+typedef S16 (*BENCH_FN_t)(BENCH_CTX_t *ctx);
+
+/**
+ * Call an output function of the bench matrix
+ *
+ * @param: outputFn  output function
+ * @param: context   instance context
+ * @return: output function result
+ */
+PRIVATE inline S16 benchFsmDr(void *outputFn, void *context)
+{
+    return ((BENCH_FN_t)outputFn)(context);
+}
+
+/**
+ * Returns the monotonic time in microseconds
+ *
+ * @return: microseconds
+ */
+PRIVATE inline U64 benchNowUs(void)
+{
+    return CM_TIME_TO_US(cmTimeNow());
+}
+
+/**
+ * Set up a bench control point with its pool and the slab of the sessions
+ * Run queue modes are switched on by the caller, before the sessions are
+ * allocated.
+ *
+ * @param: fsmCp      control point
+ * @param: slab       slab of the session contexts
+ * @param: ctxSize    sizeof(BENCH_CTX_t)
+ * @param: entOffset  offsetof(BENCH_CTX_t, fsmEnt)
+ * @param: numStates  states
+ * @param: desc       state descriptions
+ * @param: fsmMt      matrix
+ * @param: numCols    matrix columns for event mode, 0 for polling mode
+ * @param: numInst    sessions
+ * @param: slabFlags  cmSlabInit() flags
+ * @return: SUCCESS/FAILURE, nothing left allocated on failure
+ */
+PRIVATE inline S16 benchCpInit(
+    CmFsmCp        *fsmCp,
+    CmSlab         *slab,
+    U32            ctxSize,
+    U16            entOffset,
+    U16            numStates,
+    CmFsmStatDesc  *desc,
+    CmFsmEntry     *fsmMt,
+    U16            numCols,
+    U32            numInst,
+    U32            slabFlags
+)
+{
+    if (cmFsmCpInit(fsmCp, "BENCH", benchFsmDr, entOffset, numStates, desc, fsmMt) != SUCCESS)
+        return FAILURE;
+
+    if ((numCols && cmFsmCpEvtInit(fsmCp, numCols) != SUCCESS) ||
+        cmFsmCpPoolInit(fsmCp, numInst) != SUCCESS ||
+        cmSlabInit(slab, ctxSize, numInst, slabFlags) != SUCCESS)
+    {
+        cmFsmCpDeinit(fsmCp);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Release a control point set up by benchCpInit() and its sessions
+ *
+ * @param: fsmCp  control point
+ * @param: slab   slab of the session contexts
+ * @return: None
+ */
+PRIVATE inline void benchCpDeinit(CmFsmCp *fsmCp, CmSlab *slab)
+{
+    cmFsmCpDeinit(fsmCp);
+    cmSlabDeinit(slab);
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * \file Name: FsmBatchBench.c
+ *
+ * \brief Per-instance versus state-batched FSM driver throughput
+ *
+ * \details
+ * Drives the same population of polling mode instances with
+ * cmFsmDriverAll(), once in pool order and once with the control point
+ * in batch mode. Every state has its own output function, the instances
+ * start in random states and the states cycle through the matrix, so
+ * the pool order jumps between output functions on every step.
+ *
+ * Usage: FsmBatchBench [instances] [passes]
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "BenchCommon.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define BENCH_NUM_STATES   (16)
+#define BENCH_INST_DEFAULT (100000)
+#define BENCH_PASS_DEFAULT (50)
+
+/* One mixing round, constants differ per state so every body is distinct */
+#define BENCH_ROUND(n, r)                                               \
+    ctx->data[(r) & 3] = (ctx->data[(r) & 3] ^ ctx->data[((r) + 1) & 3]) \
+        * (0x9E3779B97F4A7C15ULL + (n) * 0x100000001B3ULL + (r))        \
+        + ((ctx->data[((r) + 2) & 3] >> (((n) + (r)) % 31 + 1)));
+
+#define BENCH_ROUNDS(n, r)                                              \
+    BENCH_ROUND(n, (r))     BENCH_ROUND(n, (r) + 1)                     \
+    BENCH_ROUND(n, (r) + 2) BENCH_ROUND(n, (r) + 3)                     \
+    BENCH_ROUND(n, (r) + 4) BENCH_ROUND(n, (r) + 5)                     \
+    BENCH_ROUND(n, (r) + 6) BENCH_ROUND(n, (r) + 7)
+
+/* About 1.5KB of code per state, the 16 states fill most of the L1i */
+#define BENCH_STATE_FN(n)                                               \
+PRIVATE S16 benchState##n(BENCH_CTX_t *ctx)                             \
+{                                                                       \
+    BENCH_ROUNDS(n, 0)  BENCH_ROUNDS(n, 8)  BENCH_ROUNDS(n, 16)         \
+    BENCH_ROUNDS(n, 24) BENCH_ROUNDS(n, 32) BENCH_ROUNDS(n, 40)         \
+    return SUCCESS;                                                     \
+}
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+struct BENCH_CTX_TAG
+{
+    U64         data[4];
+    CmFsmEntity fsmEnt;
+};
+
+BENCH_STATE_FN(0)  BENCH_STATE_FN(1)  BENCH_STATE_FN(2)  BENCH_STATE_FN(3)
+BENCH_STATE_FN(4)  BENCH_STATE_FN(5)  BENCH_STATE_FN(6)  BENCH_STATE_FN(7)
+BENCH_STATE_FN(8)  BENCH_STATE_FN(9)  BENCH_STATE_FN(10) BENCH_STATE_FN(11)
+BENCH_STATE_FN(12) BENCH_STATE_FN(13) BENCH_STATE_FN(14) BENCH_STATE_FN(15)
+
+static BENCH_FN_t BENCH_FN[BENCH_NUM_STATES] =
+{
+    benchState0,  benchState1,  benchState2,  benchState3,
+    benchState4,  benchState5,  benchState6,  benchState7,
+    benchState8,  benchState9,  benchState10, benchState11,
+    benchState12, benchState13, benchState14, benchState15
+};
+
+static CmFsmStatDesc benchDesc[BENCH_NUM_STATES];
+static CmFsmEntry    benchMt[BENCH_NUM_STATES][CM_FSM_CTRL_MAX];
+
+/**
+ * Run the passes over a fresh population of instances
+ *
+ * @param: batched   TRUE to drive the control point in batch mode
+ * @param: numInst   instances
+ * @param: numPass   driver passes
+ * @param: checksum  output, digest of the instance data
+ * @return: elapsed microseconds, 0 if failed
+ */
+PRIVATE U64 benchRun(bool batched, U32 numInst, U32 numPass, U64 *checksum)
+{
+    CmFsmCp     fsmCp;
+    CmSlab      slab;
+    BENCH_CTX_t *ctx;
+    U64         startUs, elapsedUs;
+    U32         i;
+
+    if (benchCpInit(&fsmCp, &slab, sizeof(BENCH_CTX_t), offsetof(BENCH_CTX_t, fsmEnt),
+                    BENCH_NUM_STATES, benchDesc, &benchMt[0][0], 0, numInst,
+                    CM_SLAB_FLAG_HUGE) != SUCCESS)
+        return 0;
+    if (batched && cmFsmCpBatchInit(&fsmCp) != SUCCESS)
+    {
+        benchCpDeinit(&fsmCp, &slab);
+        return 0;
+    }
+
+    /* Same population in both runs */
+    srand(1);
+    for (i = 0; i < numInst; i++)
+    {
+        ctx = cmFsmInstAlloc(&fsmCp, &slab, "B", rand() % BENCH_NUM_STATES);
+        if (!ctx)
+            return 0;
+        ctx->data[0] = i;
+    }
+
+    startUs = benchNowUs();
+    for (i = 0; i < numPass; i++)
+        cmFsmDriverAll(&fsmCp);
+    elapsedUs = benchNowUs() - startUs;
+
+    *checksum = 0;
+    for (i = 0; i < numInst; i++)
+    {
+        ctx = CM_FSM_GET_CONTEXT(fsmCp.entPool[i]);
+        *checksum += ctx->data[0] ^ ctx->data[1] ^ ctx->data[2] ^ ctx->data[3];
+    }
+
+    benchCpDeinit(&fsmCp, &slab);
+    return elapsedUs ? elapsedUs : 1;
+}
+
+/**
+ * Benchmark entry
+ *
+ * @param: argv[1]  instances, default BENCH_INST_DEFAULT
+ * @param: argv[2]  driver passes, default BENCH_PASS_DEFAULT
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    U32  numInst = BENCH_INST_DEFAULT, numPass = BENCH_PASS_DEFAULT;
+    U32  state, mode;
+    U64  us[2], sum[2];
+    static const S8 *MODE_STR[2] = { "per-instance", "batched" };
+
+    if (argc > 1) numInst = atoi(argv[1]);
+    if (argc > 2) numPass = atoi(argv[2]);
+    if (!numInst || !numPass)
+    {
+        printf("Usage: %s [instances] [passes]\n", argv[0]);
+        return FAILURE;
+    }
+
+    InitSystemLogging(argv[0], LOG_ERR, LOG_OUT_STDOUT);
+
+    /* NORMAL column runs the state function and moves to a fixed next state */
+    for (state = 0; state < BENCH_NUM_STATES; state++)
+    {
+        benchDesc[state].stateStr = "S";
+        benchDesc[state].timeout  = 0;
+        benchMt[state][CM_FSM_EVT_COL(CM_FSM_CTRL_NORMAL)].outputFn  = BENCH_FN[state];
+        benchMt[state][CM_FSM_EVT_COL(CM_FSM_CTRL_NORMAL)].nextState =
+            (state * 7 + 3) % BENCH_NUM_STATES;
+        benchMt[state][CM_FSM_EVT_COL(CM_FSM_CTRL_TIMEOUT)].outputFn  = BENCH_FN[state];
+        benchMt[state][CM_FSM_EVT_COL(CM_FSM_CTRL_TIMEOUT)].nextState = state;
+    }
+
+    for (mode = 0; mode < 2; mode++)
+    {
+        us[mode] = benchRun(mode == 1, numInst, numPass, &sum[mode]);
+        if (!us[mode])
+        {
+            printf("%s run failed\n", MODE_STR[mode]);
+            return FAILURE;
+        }
+        printf("%-12s %u instances x %u passes: %8llu us, %6.2f Msteps/s\n",
+               MODE_STR[mode], numInst, numPass, us[mode],
+               (double)numInst * numPass / us[mode]);
+    }
+
+    if (sum[0] != sum[1])
+    {
+        printf("Checksum mismatch %llx/%llx\n", sum[0], sum[1]);
+        return FAILURE;
+    }
+
+    printf("Speedup %.2fx\n", (double)us[0] / us[1]);
+    return SUCCESS;
+}
@@ -0,0 +1,259 @@
+/*
+ * \file Name: FsmEdfBench.c
+ *
+ * \brief Ready list order versus EDF run queue under overload
+ *
+ * \details
+ * One event mode control point holds urgent sessions, with a short state
+ * timeout, and relaxed ones with a long timeout. Every driver pass posts
+ * a unit of work to each session that has none pending, which offers more
+ * work than the CPU can run within the urgent timeout. Run in ready list
+ * order the urgent sessions time out, run earliest deadline first with a
+ * pass budget they are served first and the relaxed sessions are deferred.
+ *
+ * Usage: FsmEdfBench [instances] [budget us] [seconds]
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "BenchCommon.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define BENCH_INST_DEFAULT    (8192)
+#define BENCH_BUDGET_DEFAULT  (2000)   /* us */
+#define BENCH_SEC_DEFAULT     (1)
+#define BENCH_URGENT_RATIO    (8)      /* One urgent session in 8     */
+#define BENCH_URGENT_TMO      (5)      /* Urgent state timeout (ms)   */
+#define BENCH_RELAXED_TMO     (500)    /* Relaxed state timeout (ms)  */
+#define BENCH_WORK_NS         (1000)   /* Cost of one unit of work    */
+#define BENCH_EVT_WORK        (CM_FSM_EVT_USER)
+#define BENCH_NUM_COLS        (CM_FSM_CTRL_MAX + 1)
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* Two states per class, work and timeouts flip them to rearm the timer */
+enum
+{
+    BENCH_URGENT_A = 0,
+    BENCH_URGENT_B,
+    BENCH_RELAXED_A,
+    BENCH_RELAXED_B,
+    BENCH_NUM_STATES
+};
+
+struct BENCH_CTX_TAG
+{
+    CmTimeNs    deadline;   /* Deadline of the state the work ran in */
+    CmFsmEntity fsmEnt;
+};
+
+/* Results of one class of sessions */
+typedef struct BENCH_RES_TAG
+{
+    U64       workCnt;      /* Units of work run           */
+    U64       tmoCnt;       /* State timeouts, work missed */
+    CmTimeNs  lateMax;      /* Worst lateness of a work    */
+} BENCH_RES_t;
+
+static BENCH_RES_t benchRes[2];   /* Urgent, relaxed */
+
+/**
+ * Class of a session
+ *
+ * @param: ctx  session
+ * @return: 0 urgent, 1 relaxed
+ */
+PRIVATE U32 benchClass(BENCH_CTX_t *ctx)
+{
+    return ctx->fsmEnt.state >= BENCH_RELAXED_A;
+}
+
+/**
+ * Run one unit of work, late if the state deadline already passed
+ * The state timer is rearmed by the transition before the call.
+ *
+ * @param: ctx  session
+ * @return: SUCCESS
+ */
+PRIVATE S16 benchWork(BENCH_CTX_t *ctx)
+{
+    BENCH_RES_t *res = &benchRes[benchClass(ctx)];
+    CmTimeNs    tsNow = cmTimeNow(), tsEnd = tsNow + BENCH_WORK_NS;
+
+    if (tsNow > ctx->deadline && tsNow - ctx->deadline > res->lateMax)
+        res->lateMax = tsNow - ctx->deadline;
+    res->workCnt++;
+    ctx->deadline = ctx->fsmEnt.timestamp;
+
+    while (cmTimeNow() < tsEnd)
+        ;
+    return SUCCESS;
+}
+
+/**
+ * State timed out before its work ran
+ *
+ * @param: ctx  session
+ * @return: SUCCESS
+ */
+PRIVATE S16 benchTimeout(BENCH_CTX_t *ctx)
+{
+    benchRes[benchClass(ctx)].tmoCnt++;
+    ctx->deadline = ctx->fsmEnt.timestamp;
+    return SUCCESS;
+}
+
+static CmFsmStatDesc benchDesc[BENCH_NUM_STATES + 1] =
+{
+    { "URGENT_A",  BENCH_URGENT_TMO  },
+    { "URGENT_B",  BENCH_URGENT_TMO  },
+    { "RELAXED_A", BENCH_RELAXED_TMO },
+    { "RELAXED_B", BENCH_RELAXED_TMO },
+    { "NONE",      0                 }
+};
+
+static CmFsmEntry benchMt[BENCH_NUM_STATES + 1][BENCH_NUM_COLS] =
+{
+    /* NORMAL                       TIMEOUT                                WORK */
+    { { NULL, CM_FSM_STATE_NONE }, { benchTimeout, BENCH_URGENT_B  }, { benchWork, BENCH_URGENT_B  } },
+    { { NULL, CM_FSM_STATE_NONE }, { benchTimeout, BENCH_URGENT_A  }, { benchWork, BENCH_URGENT_A  } },
+    { { NULL, CM_FSM_STATE_NONE }, { benchTimeout, BENCH_RELAXED_B }, { benchWork, BENCH_RELAXED_B } },
+    { { NULL, CM_FSM_STATE_NONE }, { benchTimeout, BENCH_RELAXED_A }, { benchWork, BENCH_RELAXED_A } },
+    { { NULL, CM_FSM_STATE_NONE }, { NULL, CM_FSM_STATE_NONE },       { NULL, CM_FSM_STATE_NONE }  }
+};
+
+/**
+ * Offer work to the sessions for a while
+ *
+ * @param: budgetUs  EDF pass budget, 0 to run the ready list in order
+ * @param: edf       TRUE for the EDF run queue
+ * @param: numInst   sessions
+ * @param: numSec    run time
+ * @param: passCnt   output, driver passes
+ * @return: SUCCESS/FAILURE
+ */
+PRIVATE S16 benchRun(bool edf, U32 budgetUs, U32 numInst, U32 numSec, U64 *passCnt)
+{
+    CmFsmCp     fsmCp;
+    CmSlab      slab;
+    BENCH_CTX_t *ctx;
+    CmFsmEntity *fsmEnt;
+    CmTimeNs    tsEnd;
+    U32         i;
+
+    memset(benchRes, 0, sizeof(benchRes));
+    if (benchCpInit(&fsmCp, &slab, sizeof(BENCH_CTX_t), offsetof(BENCH_CTX_t, fsmEnt),
+                    BENCH_NUM_STATES, benchDesc, &benchMt[0][0], BENCH_NUM_COLS,
+                    numInst, CM_SLAB_FLAG_HUGE) != SUCCESS)
+        return FAILURE;
+    if (edf && cmFsmCpEdfInit(&fsmCp, budgetUs) != SUCCESS)
+    {
+        benchCpDeinit(&fsmCp, &slab);
+        return FAILURE;
+    }
+
+    for (i = 0; i < numInst; i++)
+    {
+        ctx = cmFsmInstAlloc(&fsmCp, &slab, "S", i % BENCH_URGENT_RATIO ?
+                             BENCH_RELAXED_A : BENCH_URGENT_A);
+        if (!ctx)
+            return FAILURE;
+        ctx->deadline = ctx->fsmEnt.timestamp;
+    }
+
+    *passCnt = 0;
+    tsEnd = cmTimeNow() + CM_TIME_FROM_SEC(numSec);
+    while (cmTimeNow() < tsEnd)
+    {
+        for (i = 0; i < numInst; i++)
+        {
+            fsmEnt = fsmCp.entPool[i];
+            if (!fsmEnt->evtCnt)
+                cmFsmPostEvent(fsmEnt, BENCH_EVT_WORK, NULL);
+        }
+        cmFsmDriverAll(&fsmCp);
+        (*passCnt)++;
+    }
+
+    if (edf)
+        printf("  %llu runs, %llu deferred, %llu overloaded passes, %llu missed "
+               "deadlines, worst lateness %llu us\n",
+               fsmCp.edf->runCnt, fsmCp.edf->deferCnt, fsmCp.edf->overCnt,
+               fsmCp.edf->missCnt, CM_TIME_TO_US(fsmCp.edf->lateMax));
+
+    benchCpDeinit(&fsmCp, &slab);
+    return SUCCESS;
+}
+
+/**
+ * Benchmark entry
+ *
+ * @param: argv[1]  sessions, default BENCH_INST_DEFAULT
+ * @param: argv[2]  EDF pass budget in us, default BENCH_BUDGET_DEFAULT
+ * @param: argv[3]  run time of each mode in seconds, default BENCH_SEC_DEFAULT
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    U32  numInst = BENCH_INST_DEFAULT, budgetUs = BENCH_BUDGET_DEFAULT;
+    U32  numSec = BENCH_SEC_DEFAULT, mode, cls;
+    U64  passCnt;
+    static const S8 *MODE_STR[2]  = { "ready list order", "edf" };
+    static const S8 *CLASS_STR[2] = { "urgent", "relaxed" };
+
+    if (argc > 1) numInst  = atoi(argv[1]);
+    if (argc > 2) budgetUs = atoi(argv[2]);
+    if (argc > 3) numSec   = atoi(argv[3]);
+    if (!numInst || !numSec)
+    {
+        printf("Usage: %s [instances] [budget us] [seconds]\n", argv[0]);
+        return FAILURE;
+    }
+
+    InitSystemLogging(argv[0], LOG_ERR, LOG_OUT_STDOUT);
+
+    printf("%u sessions, 1 in %u urgent (%u ms timeout, others %u ms), "
+           "%u ns per work\n", numInst, BENCH_URGENT_RATIO, BENCH_URGENT_TMO,
+           BENCH_RELAXED_TMO, BENCH_WORK_NS);
+
+    for (mode = 0; mode < 2; mode++)
+    {
+        if (mode)
+            printf("%s, budget %u us per pass\n", MODE_STR[mode], budgetUs);
+        else
+            printf("%s\n", MODE_STR[mode]);
+        if (benchRun(mode == 1, budgetUs, numInst, numSec, &passCnt) != SUCCESS)
+        {
+            printf("%s run failed\n", MODE_STR[mode]);
+            return FAILURE;
+        }
+        for (cls = 0; cls < 2; cls++)
+        {
+            printf("  %-8s %8llu works, %8llu timeouts, worst lateness %6llu us\n",
+                   CLASS_STR[cls], benchRes[cls].workCnt, benchRes[cls].tmoCnt,
+                   CM_TIME_TO_US(benchRes[cls].lateMax));
+        }
+        printf("  %llu passes\n", passCnt);
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,269 @@
+/*
+ * \file Name: FsmExecBench.c
+ *
+ * \brief Event mode driver versus the multi-threaded executor
+ *
+ * \details
+ * One event mode control point, thread safe, receives events from a
+ * poster thread while it is driven, once by cmFsmDriverAll() on the main
+ * thread and once by a cmFsmExecDriverAll() executor. One instance in
+ * BENCH_HEAVY_RATIO costs BENCH_HEAVY_MUL times more per event, so the
+ * executor workers have to steal to stay balanced. Every event posted
+ * must be run: the ones left over once the poster stopped are reported
+ * as lost. cmFsmExecDumpStats() then logs the per-worker runs, steals
+ * and busy ratio.
+ *
+ * Usage: FsmExecBench [instances] [workers] [seconds]
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <sched.h>
+#include <pthread.h>
+#include "BenchCommon.h"
+#include "CommonFsmExec.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define BENCH_INST_DEFAULT    (4096)
+#define BENCH_WORKER_DEFAULT  (4)
+#define BENCH_SEC_DEFAULT     (1)
+#define BENCH_WORK_NS         (500)    /* Cost of one event            */
+#define BENCH_HEAVY_RATIO     (16)     /* One heavy instance in 16     */
+#define BENCH_HEAVY_MUL       (16)     /* Cost of a heavy instance     */
+#define BENCH_EVT_WORK        (CM_FSM_EVT_USER)
+#define BENCH_NUM_COLS        (CM_FSM_CTRL_MAX + 1)
+#define BENCH_DRAIN_SEC       (1)      /* Longest drain after the run  */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+enum
+{
+    BENCH_ST_WORK = 0,
+    BENCH_NUM_STATES
+};
+
+struct BENCH_CTX_TAG
+{
+    U32         cost;       /* Work units per event */
+    CmFsmEntity fsmEnt;
+};
+
+/* Poster thread and its counters */
+typedef struct BENCH_POSTER_TAG
+{
+    pthread_t     tid;
+    CmFsmCp       *fsmCp;
+    volatile bool stop;
+    U64           postCnt;  /* Events queued               */
+} BENCH_POSTER_t;
+
+static U64 benchRunCnt;     /* Events run, all threads */
+
+/**
+ * Run one event
+ *
+ * @param: ctx  session
+ * @return: SUCCESS
+ */
+PRIVATE S16 benchWork(BENCH_CTX_t *ctx)
+{
+    CmTimeNs tsEnd = cmTimeNow() + (CmTimeNs)BENCH_WORK_NS * ctx->cost;
+
+    while (cmTimeNow() < tsEnd)
+        ;
+    __atomic_add_fetch(&benchRunCnt, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+static CmFsmStatDesc benchDesc[BENCH_NUM_STATES + 1] =
+{
+    { "WORK", 0 },
+    { "NONE", 0 }
+};
+
+static CmFsmEntry benchMt[BENCH_NUM_STATES + 1][BENCH_NUM_COLS] =
+{
+    /* NORMAL                       TIMEOUT                        WORK */
+    { { NULL, CM_FSM_STATE_NONE }, { NULL, CM_FSM_STATE_NONE }, { benchWork, BENCH_ST_WORK } },
+    { { NULL, CM_FSM_STATE_NONE }, { NULL, CM_FSM_STATE_NONE }, { NULL, CM_FSM_STATE_NONE }  }
+};
+
+/**
+ * Poster thread: keep every instance supplied with events
+ * The queue depth test is only a hint, the post may still be refused.
+ *
+ * @param: arg  poster
+ * @return: NULL
+ */
+PRIVATE void *benchPoster(void *arg)
+{
+    BENCH_POSTER_t *poster = arg;
+    CmFsmCp        *fsmCp = poster->fsmCp;
+    CmFsmEntity    *fsmEnt;
+    U32            i;
+
+    while (!poster->stop)
+    {
+        for (i = 0; i < fsmCp->numInst; i++)
+        {
+            fsmEnt = fsmCp->entPool[i];
+            if (__atomic_load_n(&fsmEnt->evtCnt, __ATOMIC_RELAXED) < CM_FSM_EVT_QUEUE_LEN / 2 &&
+                cmFsmPostEvent(fsmEnt, BENCH_EVT_WORK, NULL) == SUCCESS)
+                poster->postCnt++;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+/**
+ * Drive the control point while the poster runs, then drain it
+ *
+ * @param: numWorkers  executor workers, 0 for cmFsmDriverAll()
+ * @param: numInst     sessions
+ * @param: numSec      run time
+ * @return: SUCCESS, FAILURE on a setup error or a lost event
+ */
+PRIVATE S16 benchRun(U32 numWorkers, U32 numInst, U32 numSec)
+{
+    CmFsmCp         fsmCp;
+    CmFsmExec       exec;
+    CmSlab          slab;
+    BENCH_POSTER_t  poster;
+    BENCH_CTX_t     *ctx;
+    CmTimeNs        tsStart, tsEnd, tsRun;
+    U64             runCnt, lostCnt;
+    U32             i;
+
+    if (benchCpInit(&fsmCp, &slab, sizeof(BENCH_CTX_t), offsetof(BENCH_CTX_t, fsmEnt),
+                    BENCH_NUM_STATES, benchDesc, &benchMt[0][0], BENCH_NUM_COLS,
+                    numInst, 0) != SUCCESS)
+        return FAILURE;
+
+    for (i = 0; i < numInst; i++)
+    {
+        ctx = cmFsmInstAlloc(&fsmCp, &slab, "S", BENCH_ST_WORK);
+        if (!ctx)
+            return FAILURE;
+        ctx->cost = (i % BENCH_HEAVY_RATIO) ? 1 : BENCH_HEAVY_MUL;
+    }
+
+    /* Posted from another thread: the single threaded driver needs the
+     * thread safe paths too, the executor switches them on itself */
+    if (numWorkers)
+    {
+        if (cmFsmExecInit(&exec, &fsmCp, numWorkers) != SUCCESS)
+            return FAILURE;
+    }
+    else
+        fsmCp.mtSafe = TRUE;
+
+    benchRunCnt = 0;
+    memset(&poster, 0, sizeof(poster));
+    poster.fsmCp = &fsmCp;
+    if (pthread_create(&poster.tid, NULL, benchPoster, &poster) != 0)
+        return FAILURE;
+
+    tsStart = cmTimeNow();
+    tsEnd = tsStart + CM_TIME_FROM_SEC(numSec);
+    while (cmTimeNow() < tsEnd)
+    {
+        if (numWorkers)
+            cmFsmExecDriverAll(&exec);
+        else
+            cmFsmDriverAll(&fsmCp);
+    }
+    tsRun = cmTimeNow() - tsStart;
+    runCnt = __atomic_load_n(&benchRunCnt, __ATOMIC_RELAXED);
+
+    poster.stop = TRUE;
+    pthread_join(poster.tid, NULL);
+
+    /* Every event posted must still be run */
+    tsEnd = cmTimeNow() + CM_TIME_FROM_SEC(BENCH_DRAIN_SEC);
+    while (__atomic_load_n(&benchRunCnt, __ATOMIC_RELAXED) < poster.postCnt &&
+           cmTimeNow() < tsEnd)
+    {
+        if (numWorkers)
+            cmFsmExecDriverAll(&exec);
+        else
+            cmFsmDriverAll(&fsmCp);
+    }
+
+    lostCnt = poster.postCnt - __atomic_load_n(&benchRunCnt, __ATOMIC_RELAXED);
+    printf("  %.0f events/s, %llu posted, %llu lost\n",
+           (double)runCnt * 1e9 / tsRun, poster.postCnt, lostCnt);
+
+    if (numWorkers)
+    {
+        cmFsmExecDumpStats(&exec);
+        cmFsmExecDeinit(&exec);
+    }
+
+    benchCpDeinit(&fsmCp, &slab);
+    return lostCnt ? FAILURE : SUCCESS;
+}
+
+/**
+ * Benchmark entry
+ *
+ * @param: argv[1]  sessions, default BENCH_INST_DEFAULT
+ * @param: argv[2]  executor workers, default BENCH_WORKER_DEFAULT
+ * @param: argv[3]  run time of each mode in seconds, default BENCH_SEC_DEFAULT
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    U32 numInst = BENCH_INST_DEFAULT, numWorkers = BENCH_WORKER_DEFAULT;
+    U32 numSec = BENCH_SEC_DEFAULT;
+
+    if (argc > 1) numInst    = atoi(argv[1]);
+    if (argc > 2) numWorkers = atoi(argv[2]);
+    if (argc > 3) numSec     = atoi(argv[3]);
+    if (!numInst || !numWorkers || numWorkers > CM_FSM_EXEC_MAX_WORKERS || !numSec)
+    {
+        printf("Usage: %s [instances] [workers] [seconds]\n", argv[0]);
+        return FAILURE;
+    }
+
+    /* The executor reports its workers as notices */
+    InitSystemLogging(argv[0], LOG_NOTICE, LOG_OUT_STDOUT);
+
+    printf("%u sessions, 1 in %u costs %u x %u ns per event, the others %u ns\n",
+           numInst, BENCH_HEAVY_RATIO, BENCH_HEAVY_MUL, BENCH_WORK_NS, BENCH_WORK_NS);
+
+    printf("cmFsmDriverAll(), main thread\n");
+    if (benchRun(0, numInst, numSec) != SUCCESS)
+    {
+        printf("driver run failed\n");
+        return FAILURE;
+    }
+
+    printf("cmFsmExecDriverAll(), %u workers\n", numWorkers);
+    if (benchRun(numWorkers, numInst, numSec) != SUCCESS)
+    {
+        printf("executor run failed\n");
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,291 @@
+/*
+ * \file Name: FsmTableBench.c
+ *
+ * \brief Dense matrix versus compressed transition table
+ *
+ * \details
+ * Builds one large event mode FSM, every state reacting to a few of the
+ * application events, as a dense matrix and as the compressed table of
+ * CommonFsmSparse.h. Both tables are checked cell by cell, then the same
+ * population of instances is fed the same random events through each.
+ *
+ * Usage: FsmTableBench [states] [columns] [instances] [passes]
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "BenchCommon.h"
+#include "CommonFsmSparse.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define BENCH_STATES_DEFAULT  (4096)
+#define BENCH_COLS_DEFAULT    (128)
+#define BENCH_INST_DEFAULT    (50000)
+#define BENCH_PASS_DEFAULT    (20)
+#define BENCH_TRANS_PER_STATE (6)    /* Events a state reacts to, besides reset */
+#define BENCH_NUM_FN          (8)
+
+#define BENCH_FN(n)                                                     \
+PRIVATE S16 benchFn##n(BENCH_CTX_t *ctx)                                \
+{                                                                       \
+    ctx->acc = ctx->acc * 0x100000001B3ULL + (n) + ctx->fsmEnt.state;    \
+    return SUCCESS;                                                     \
+}
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+struct BENCH_CTX_TAG
+{
+    U64         acc;
+    CmFsmEntity fsmEnt;
+};
+
+BENCH_FN(0) BENCH_FN(1) BENCH_FN(2) BENCH_FN(3)
+BENCH_FN(4) BENCH_FN(5) BENCH_FN(6) BENCH_FN(7)
+
+static BENCH_FN_t BENCH_FNS[BENCH_NUM_FN] =
+{
+    benchFn0, benchFn1, benchFn2, benchFn3,
+    benchFn4, benchFn5, benchFn6, benchFn7
+};
+
+/**
+ * Fill the dense matrix of the bench FSM
+ * The last user event resets every state to state 0, each state also
+ * reacts to BENCH_TRANS_PER_STATE random events. Other cells are empty.
+ *
+ * @param: fsmMt    matrix, (numStates + 1) x numCols
+ * @param: numStates states
+ * @param: numCols  columns
+ * @return: None
+ */
+PRIVATE void benchFillMt(CmFsmEntry *fsmMt, U32 numStates, U32 numCols)
+{
+    CmFsmEntry *cell;
+    U32        state, i;
+
+    for (i = 0; i < (numStates + 1) * numCols; i++)
+    {
+        fsmMt[i].outputFn  = NULL;
+        fsmMt[i].nextState = CM_FSM_STATE_NONE;
+    }
+
+    srand(7);
+    for (state = 0; state < numStates; state++)
+    {
+        cell = &fsmMt[state * numCols + numCols - 1];
+        cell->outputFn  = BENCH_FNS[0];
+        cell->nextState = 0;
+
+        for (i = 0; i < BENCH_TRANS_PER_STATE; i++)
+        {
+            cell = &fsmMt[state * numCols + CM_FSM_CTRL_MAX +
+                          rand() % (numCols - CM_FSM_CTRL_MAX - 1)];
+            cell->outputFn  = BENCH_FNS[rand() % BENCH_NUM_FN];
+            cell->nextState = rand() % numStates;
+        }
+    }
+}
+
+/**
+ * Check the compressed table against the dense matrix, cell by cell
+ *
+ * @param: sp       compressed table
+ * @param: fsmMt    dense matrix
+ * @return: SUCCESS  same cells
+ *          FAILURE  mismatch
+ */
+PRIVATE S16 benchCheck(CmFsmSparse *sp, CmFsmEntry *fsmMt)
+{
+    const CmFsmSparseCell *cell;
+    U32                   row, col;
+
+    for (row = 0; row < sp->numRows; row++)
+    {
+        for (col = 0; col < sp->numCols; col++)
+        {
+            cell = cmFsmSparseGet(sp, row, col);
+            if (sp->fnTab[cell->fnIdx] != fsmMt[row * sp->numCols + col].outputFn ||
+                cell->nextState != fsmMt[row * sp->numCols + col].nextState)
+            {
+                printf("Cell %u/%u differs\n", row, col);
+                return FAILURE;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Feed the same random events to a fresh population of instances
+ *
+ * @param: fsmMt     dense matrix
+ * @param: sp        compressed table, NULL to run on fsmMt
+ * @param: desc      state descriptions
+ * @param: numStates states
+ * @param: numCols   columns
+ * @param: numInst   instances
+ * @param: numPass   driver passes, one event per instance each
+ * @param: checksum  output, digest of the instances
+ * @return: elapsed microseconds, 0 if failed
+ */
+PRIVATE U64 benchRun(
+    CmFsmEntry     *fsmMt,
+    CmFsmSparse    *sp,
+    CmFsmStatDesc  *desc,
+    U32            numStates,
+    U32            numCols,
+    U32            numInst,
+    U32            numPass,
+    U64            *checksum
+)
+{
+    CmFsmCp     fsmCp;
+    CmSlab      slab;
+    BENCH_CTX_t *ctx;
+    U64         startUs, elapsedUs = 0;
+    U32         i, pass, rnd = 1;
+
+    if (benchCpInit(&fsmCp, &slab, sizeof(BENCH_CTX_t), offsetof(BENCH_CTX_t, fsmEnt),
+                    numStates, desc, fsmMt, numCols, numInst, CM_SLAB_FLAG_HUGE) != SUCCESS)
+        return 0;
+    if (cmFsmCpSetSparse(&fsmCp, sp) != SUCCESS)
+    {
+        benchCpDeinit(&fsmCp, &slab);
+        return 0;
+    }
+
+    for (i = 0; i < numInst; i++)
+    {
+        ctx = cmFsmInstAlloc(&fsmCp, &slab, "B", i % numStates);
+        if (!ctx)
+            return 0;
+    }
+
+    /* Same event sequence in both runs, posting is timed as well */
+    startUs = benchNowUs();
+    for (pass = 0; pass < numPass; pass++)
+    {
+        for (i = 0; i < numInst; i++)
+        {
+            rnd = rnd * 1103515245 + 12345;
+            cmFsmPostEvent(fsmCp.entPool[i],
+                           CM_FSM_EVT_USER + (rnd >> 16) % (numCols - CM_FSM_CTRL_MAX),
+                           NULL);
+        }
+        cmFsmDriverAll(&fsmCp);
+    }
+    elapsedUs = benchNowUs() - startUs;
+
+    *checksum = 0;
+    for (i = 0; i < numInst; i++)
+    {
+        ctx = CM_FSM_GET_CONTEXT(fsmCp.entPool[i]);
+        *checksum += ctx->acc ^ ctx->fsmEnt.state;
+    }
+
+    benchCpDeinit(&fsmCp, &slab);
+    return elapsedUs ? elapsedUs : 1;
+}
+
+/**
+ * Benchmark entry
+ *
+ * @param: argv[1]  states, default BENCH_STATES_DEFAULT
+ * @param: argv[2]  columns, default BENCH_COLS_DEFAULT
+ * @param: argv[3]  instances, default BENCH_INST_DEFAULT
+ * @param: argv[4]  driver passes, default BENCH_PASS_DEFAULT
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    U32            numStates = BENCH_STATES_DEFAULT, numCols = BENCH_COLS_DEFAULT;
+    U32            numInst = BENCH_INST_DEFAULT, numPass = BENCH_PASS_DEFAULT;
+    U32            state, mode;
+    U64            us[2], sum[2];
+    CmFsmEntry     *fsmMt;
+    CmFsmStatDesc  *desc;
+    CmFsmSparse    sp;
+    static const S8 *MODE_STR[2] = { "dense", "compressed" };
+
+    if (argc > 1) numStates = atoi(argv[1]);
+    if (argc > 2) numCols   = atoi(argv[2]);
+    if (argc > 3) numInst   = atoi(argv[3]);
+    if (argc > 4) numPass   = atoi(argv[4]);
+    if (numStates < 2 || numStates >= CM_FSM_STATE_NONE ||
+        numCols < CM_FSM_CTRL_MAX + 2 || !numInst || !numPass)
+    {
+        printf("Usage: %s [states] [columns] [instances] [passes]\n", argv[0]);
+        return FAILURE;
+    }
+
+    InitSystemLogging(argv[0], LOG_ERR, LOG_OUT_STDOUT);
+
+    fsmMt = malloc((size_t)(numStates + 1) * numCols * sizeof(CmFsmEntry));
+    desc  = calloc(numStates + 1, sizeof(CmFsmStatDesc));
+    if (!fsmMt || !desc)
+    {
+        printf("Out of memory\n");
+        return FAILURE;
+    }
+    for (state = 0; state <= numStates; state++)
+        desc[state].stateStr = "S";
+
+    benchFillMt(fsmMt, numStates, numCols);
+    if (cmFsmSparseFromDense(&sp, fsmMt, numStates + 1, numCols) != SUCCESS ||
+        benchCheck(&sp, fsmMt) != SUCCESS)
+    {
+        printf("Compressed table build failed\n");
+        return FAILURE;
+    }
+
+    printf("%u states x %u columns: dense %zu bytes, compressed %zu bytes "
+           "(%u exceptions, %u output functions)\n",
+           numStates, numCols, (size_t)(numStates + 1) * numCols * sizeof(CmFsmEntry),
+           sp.memLen, sp.numExc, sp.numFn - 1);
+
+    for (mode = 0; mode < 2; mode++)
+    {
+        us[mode] = benchRun(fsmMt, mode == 1 ? &sp : NULL, desc, numStates,
+                            numCols, numInst, numPass, &sum[mode]);
+        if (!us[mode])
+        {
+            printf("%s run failed\n", MODE_STR[mode]);
+            return FAILURE;
+        }
+        printf("%-10s %u instances x %u passes: %8llu us, %6.2f Mevents/s\n",
+               MODE_STR[mode], numInst, numPass, us[mode],
+               (double)numInst * numPass / us[mode]);
+    }
+
+    if (sum[0] != sum[1])
+    {
+        printf("Checksum mismatch %llx/%llx\n", sum[0], sum[1]);
+        return FAILURE;
+    }
+
+    printf("Speedup %.2fx\n", (double)us[0] / us[1]);
+    cmFsmSparseDeinit(&sp);
+    free(fsmMt);
+    free(desc);
+    return SUCCESS;
+}
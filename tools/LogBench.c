@@ -0,0 +1,210 @@
+/*
+ * \file Name: LogBench.c
+ *
+ * \brief Per-message cost of the logging modes
+ *
+ * \details
+ * Logs the FSM transition message of the game from one thread, with the
+ * rate limit off, in each logging mode: formatted and written at once,
+ * formatted into the group commit file sink, sent with syslog(), sent
+ * by the socket sink, formatted into the asynchronous rings, recorded
+ * in a binary log, recorded by the flight recorder below the verbosity,
+ * and from a disabled call site. The text goes to
+ * /dev/null through stdout, the results are printed on stderr. The two
+ * syslog modes need a daemon, or a stand-in, on the syslog socket.
+ *
+ * Usage: LogBench [messages] [binary log file] [text log file] [syslog socket]
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdlib.h>
+#include "CommonInc.h"
+#include "CommonClock.h"
+#include "SysLogging.h"
+#include "SysLogBin.h"
+#include "SysLogFile.h"
+#include "SysLogSock.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define BENCH_MSG_DEFAULT   (1000000)
+#define BENCH_BIN_DEFAULT   "/tmp/LogBench.bin"
+#define BENCH_FILE_DEFAULT  "/tmp/LogBench.log"
+
+enum
+{
+    BENCH_MODE_SYNC = 0,
+    BENCH_MODE_FILE,
+    BENCH_MODE_SYSLOG,
+    BENCH_MODE_SOCK,
+    BENCH_MODE_ASYNC,
+    BENCH_MODE_BIN,
+    BENCH_MODE_REC,
+    BENCH_MODE_OFF,
+    BENCH_MODE_MAX
+};
+
+/**
+ * Log one message, the call site benchRun() measures
+ *
+ * @param: i  message number
+ * @return: None
+ */
+PRIVATE void benchLog(U32 i)
+{
+    SLOGINFO("FSM %s, STAT %s-->%s timeout %d", "G-FSM-MAIN",
+             "MAIN_ST_INPUT", "MAIN_ST_INPUT", i);
+}
+
+/**
+ * Same message from a call site disabled by main()
+ *
+ * @param: i  message number
+ * @return: None
+ */
+PRIVATE void benchLogOff(U32 i)
+{
+    SLOGINFO("FSM %s, STAT %s-->%s timeout %d", "G-FSM-MAIN",
+             "MAIN_ST_INPUT", "MAIN_ST_INPUT", i);
+}
+
+/**
+ * Log the messages of one mode
+ *
+ * @param: mode    BENCH_MODE_xxx
+ * @param: numMsg  messages
+ * @return: ns per message
+ */
+PRIVATE double benchRun(U32 mode, U32 numMsg)
+{
+    void     (*logFn)(U32) = mode == BENCH_MODE_OFF ? benchLogOff : benchLog;
+    CmTimeNs tsStart;
+    U32      i;
+
+    tsStart = cmTimeNow();
+    for (i = 0; i < numMsg; i++)
+        logFn(i);
+    return (double)(cmTimeNow() - tsStart) / numMsg;
+}
+
+/**
+ * Benchmark entry
+ *
+ * @param: argv[1]  messages per mode, default BENCH_MSG_DEFAULT
+ * @param: argv[2]  binary log file, default BENCH_BIN_DEFAULT
+ * @param: argv[3]  text log file, default BENCH_FILE_DEFAULT
+ * @param: argv[4]  syslog socket of the socket sink, default SL_SOCK_PATH
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    U32          numMsg = BENCH_MSG_DEFAULT, mode;
+    const S8     *binPath = BENCH_BIN_DEFAULT, *filePath = BENCH_FILE_DEFAULT;
+    const S8     *sockPath = SL_SOCK_PATH;
+    double       ns;
+    SlAsyncStats stats;
+    SlFileStats  fileStats;
+    SlSockStats  sockStats;
+    static const S8 *MODE_STR[BENCH_MODE_MAX] =
+        { "formatted", "file", "syslog()", "socket", "async", "binary", "recorder",
+          "disabled" };
+
+    if (argc > 1) numMsg   = atoi(argv[1]);
+    if (argc > 2) binPath  = argv[2];
+    if (argc > 3) filePath = argv[3];
+    if (argc > 4) sockPath = argv[4];
+    if (!numMsg || !freopen("/dev/null", "w", stdout))
+    {
+        fprintf(stderr, "Usage: %s [messages] [binary log file] [text log file]"
+                " [syslog socket]\n", argv[0]);
+        return FAILURE;
+    }
+
+    InitSystemLogging(argv[0], LOG_INFO, LOG_OUT_STDOUT);
+    sl_LogRateLimit(0, 0);
+    sl_LogSiteEnable("benchLogOff", 0);
+
+    for (mode = 0; mode < BENCH_MODE_MAX; mode++)
+    {
+        if (mode == BENCH_MODE_FILE && sl_FileLogStart(filePath, NULL) != 0)
+        {
+            fprintf(stderr, "Can not create %s\n", filePath);
+            return FAILURE;
+        }
+        if (mode == BENCH_MODE_SYSLOG)
+            sl_LogSetOutput(LOG_OUT_SYSLOG);
+        if (mode == BENCH_MODE_SOCK && sl_SockLogStart(sockPath) != 0)
+        {
+            fprintf(stderr, "%-10s no syslog socket %s\n", MODE_STR[mode], sockPath);
+            sl_LogSetOutput(LOG_OUT_STDOUT);
+            continue;
+        }
+        if (mode == BENCH_MODE_ASYNC && sl_AsyncLogStart(0) != 0)
+            return FAILURE;
+        if (mode == BENCH_MODE_BIN && sl_BinLogStart(binPath, 0) != 0)
+        {
+            fprintf(stderr, "Can not create %s\n", binPath);
+            return FAILURE;
+        }
+        if (mode == BENCH_MODE_REC)
+        {
+            /* Only recorded, as INFO is below the verbosity */
+            InitSystemLogging(argv[0], LOG_NOTICE, LOG_OUT_STDOUT);
+            if (sl_FlightRecStart(binPath, 0) != 0)
+                return FAILURE;
+        }
+
+        /* One pass to warm up the buffers, then the measured one */
+        benchRun(mode, numMsg);
+        ns = benchRun(mode, numMsg);
+        fprintf(stderr, "%-10s %8.1f ns/message\n", MODE_STR[mode], ns);
+
+        if (mode == BENCH_MODE_ASYNC)
+        {
+            sl_AsyncLogStop();
+            sl_AsyncLogStats(&stats);
+            fprintf(stderr, "           %llu written, %llu dropped\n",
+                    stats.written, stats.dropped);
+        }
+        if (mode == BENCH_MODE_FILE)
+        {
+            sl_FileLogStop();
+            sl_FileLogStats(&fileStats);
+            fprintf(stderr, "           %llu bytes in %llu writes, %llu stalls\n",
+                    fileStats.bytes, fileStats.commits, fileStats.stalls);
+        }
+        if (mode == BENCH_MODE_SOCK)
+        {
+            sl_SockLogStop();
+            sl_SockLogStats(&sockStats);
+            fprintf(stderr, "           %llu frames in %llu sendmmsg(), %llu dropped, "
+                    "%llu refused\n", sockStats.frames, sockStats.batches,
+                    sockStats.dropped, sockStats.errors);
+            sl_LogSetOutput(LOG_OUT_STDOUT);
+        }
+        if (mode == BENCH_MODE_BIN || mode == BENCH_MODE_REC)
+            sl_BinLogStop();
+        if (mode == BENCH_MODE_REC)
+            InitSystemLogging(argv[0], LOG_INFO, LOG_OUT_STDOUT);
+    }
+
+    unlink(binPath);
+    unlink(filePath);
+    return SUCCESS;
+}
@@ -0,0 +1,376 @@
+/*
+ * \file Name: LogDecode.c
+ *
+ * \brief Formats the records of a binary log
+ *
+ * \details
+ * Reads a file written by sl_BinLogStart(), also one left by a crashed
+ * process, and prints its records oldest first in the text log layout,
+ * with microsecond timestamps. Records the ring already overwrote, or
+ * that were still being written, are skipped.
+ *
+ * Usage: LogDecode <binlog> [-s]   (-s lists the call sites instead)
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "CommonInc.h"
+#include "SysLogBin.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define DECODE_LINE_MAX   (4 * SYS_LOG_BUFFER_SIZE)
+#define DECODE_SPEC_MAX   (64)
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+typedef struct DECODE_SITE_TAG
+{
+    const SlBinSite *ent;
+    const S8        *file;
+    const S8        *func;
+    const S8        *fmt;
+} DECODE_SITE_t;
+
+/**
+ * Read the call site descriptions
+ *
+ * @param: hdr    binary log
+ * @param: sites  output, indexed by site id
+ * @return: SUCCESS/FAILURE
+ */
+PRIVATE S16 decodeSites(const SlBinHdr *hdr, DECODE_SITE_t *sites)
+{
+    const SlBinSite *ent;
+    U64             pos;
+
+    for (pos = 0; pos < hdr->sitePos; pos += ent->len)
+    {
+        ent = (const SlBinSite *)((const S8 *)hdr + hdr->siteOff + pos);
+        if (ent->len < sizeof(SlBinSite) || ent->id == 0 || ent->id > hdr->numSites ||
+            sizeof(SlBinSite) + ent->fileLen + ent->funcLen + ent->fmtLen > ent->len)
+        {
+            printf("Corrupt call site at %llu\n", pos);
+            return FAILURE;
+        }
+        sites[ent->id].ent  = ent;
+        sites[ent->id].file = (const S8 *)(ent + 1);
+        sites[ent->id].func = sites[ent->id].file + ent->fileLen;
+        sites[ent->id].fmt  = sites[ent->id].func + ent->funcLen;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Rewrite the length modifier of an integer conversion for the width
+ * recorded, the log may come from a build where long, size_t or
+ * pointers have another size than here
+ *
+ * @param: spec     conversion, NUL terminated, rewritten in place
+ * @param: argType  SL_ARG_I32 or SL_ARG_I64, as recorded
+ * @return: None
+ */
+PRIVATE void decodeSpecWidth(S8 *spec, U8 argType)
+{
+    S8  *conv = spec + strlen(spec) - 1;
+    S8  *mod = conv;
+
+    while (mod > spec + 1 && strchr("hlLqjzt", mod[-1]))
+        mod--;
+
+    /* 'h' narrows an int, kept; the wider ones become "ll" or nothing */
+    if (argType == SL_ARG_I32 && *mod == 'h')
+        return;
+    if (argType == SL_ARG_I64 && *conv != 'p')
+        snprintf(mod, DECODE_SPEC_MAX - (mod - spec), "ll%c", *conv);
+    else
+    {
+        mod[0] = *conv;
+        mod[1] = '\0';
+    }
+}
+
+/**
+ * Format the message of one record
+ * Every conversion of the call site format is printed on its own, with
+ * the argument bytes read back as the type parsed at record time.
+ *
+ * @param: site  call site
+ * @param: arg   record arguments
+ * @param: end   end of the record
+ * @param: out   output text
+ * @param: size  output size
+ * @return: SUCCESS/FAILURE if the arguments do not match the format
+ */
+PRIVATE S16 decodeMsg(DECODE_SITE_t *site, const U8 *arg, const U8 *end, S8 *out, U32 size)
+{
+    const S8    *p = site->fmt;
+    S8          spec[DECODE_SPEC_MAX], str[SL_BIN_TEXT_MAX + 1];
+    SlBinSpec   sp;
+    S32         star[2], i32, n;
+    S64         i64;
+    double      dbl;
+    long double ldbl;
+    U16         strLen;
+    U32         loc = 0, i, argIdx = 0;
+
+#define DECODE_TAKE(var, len)                        \
+    do {                                             \
+        if (arg + (len) > end) return FAILURE;       \
+        memcpy(&(var), arg, (len));                  \
+        arg += (len);                                \
+    } while (0)
+
+    out[0] = '\0';
+    while (*p && loc < size - 1)
+    {
+        if (*p != '%')
+        {
+            out[loc++] = *p++;
+            out[loc]   = '\0';
+            continue;
+        }
+        if (sl_BinParseSpec(p, &sp) != 0 || sp.len >= DECODE_SPEC_MAX)
+            return FAILURE;
+        memcpy(spec, p, sp.len);
+        spec[sp.len] = '\0';
+        p += sp.len;
+
+        for (i = 0; i < (U32)sp.numStars; i++)
+        {
+            argIdx++;
+            DECODE_TAKE(star[i], 4);
+        }
+
+        /* Integer widths are those of the recording build, not of ours */
+        if (sp.argType == SL_ARG_I32 || sp.argType == SL_ARG_I64)
+        {
+            if (argIdx >= site->ent->numArgs ||
+                (site->ent->argTypes[argIdx] != SL_ARG_I32 &&
+                 site->ent->argTypes[argIdx] != SL_ARG_I64))
+                return FAILURE;
+            sp.argType = site->ent->argTypes[argIdx];
+            decodeSpecWidth(spec, sp.argType);
+        }
+        if (sp.argType != SL_ARG_END)
+            argIdx++;
+
+        switch (sp.argType)
+        {
+        case SL_ARG_END:
+            n = snprintf(out + loc, size - loc, "%%");
+            break;
+        case SL_ARG_I32:
+            DECODE_TAKE(i32, 4);
+            /* %p of a 32-bit build */
+            if (spec[strlen(spec) - 1] == 'p')
+                n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], (void *)(uintptr_t)(U32)i32) :
+                    sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], (void *)(uintptr_t)(U32)i32) :
+                                       snprintf(out + loc, size - loc, spec, (void *)(uintptr_t)(U32)i32);
+            else
+                n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], i32) :
+                    sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], i32) :
+                                       snprintf(out + loc, size - loc, spec, i32);
+            break;
+        case SL_ARG_I64:
+            DECODE_TAKE(i64, 8);
+            /* %p takes a pointer, the other conversions a 64-bit integer */
+            if (spec[strlen(spec) - 1] == 'p')
+                n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], (void *)(uintptr_t)i64) :
+                    sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], (void *)(uintptr_t)i64) :
+                                       snprintf(out + loc, size - loc, spec, (void *)(uintptr_t)i64);
+            else
+                n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], i64) :
+                    sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], i64) :
+                                       snprintf(out + loc, size - loc, spec, i64);
+            break;
+        case SL_ARG_DBL:
+            DECODE_TAKE(dbl, 8);
+            n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], dbl) :
+                sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], dbl) :
+                                   snprintf(out + loc, size - loc, spec, dbl);
+            break;
+        case SL_ARG_LDBL:
+            DECODE_TAKE(ldbl, sizeof(ldbl));
+            n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], ldbl) :
+                sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], ldbl) :
+                                   snprintf(out + loc, size - loc, spec, ldbl);
+            break;
+        case SL_ARG_STR:
+            DECODE_TAKE(strLen, 2);
+            if (strLen > SL_BIN_TEXT_MAX || arg + strLen > end)
+                return FAILURE;
+            memcpy(str, arg, strLen);
+            str[strLen] = '\0';
+            arg += strLen;
+            n = sp.numStars == 2 ? snprintf(out + loc, size - loc, spec, star[0], star[1], str) :
+                sp.numStars == 1 ? snprintf(out + loc, size - loc, spec, star[0], str) :
+                                   snprintf(out + loc, size - loc, spec, str);
+            break;
+        default:
+            return FAILURE;
+        }
+
+        if (n > 0)
+            loc = (loc + n < size) ? loc + n : size - 1;
+    }
+#undef DECODE_TAKE
+    return SUCCESS;
+}
+
+/**
+ * Print one record in the text log layout
+ *
+ * @param: hdr    binary log
+ * @param: sites  call sites
+ * @param: rec    record
+ * @return: SUCCESS/FAILURE if the record could not be decoded
+ */
+PRIVATE S16 decodeRec(const SlBinHdr *hdr, DECODE_SITE_t *sites, const SlBinRec *rec)
+{
+    DECODE_SITE_t *site;
+    S8            msg[DECODE_LINE_MAX];
+    time_t        sec = rec->tsNs / 1000000000ULL;
+    struct tm     tm;
+
+    if (rec->siteId == 0 || rec->siteId > hdr->numSites || !sites[rec->siteId].ent)
+        return FAILURE;
+    site = &sites[rec->siteId];
+    if (decodeMsg(site, (const U8 *)(rec + 1), (const U8 *)rec + rec->len,
+                  msg, sizeof(msg)) != SUCCESS)
+        return FAILURE;
+
+    localtime_r(&sec, &tm);
+    printf("[%d/%d/%d %d:%d:%d.%06llu] %s %u(%u) %s[%s:%s:%d] %s\n",
+           tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
+           tm.tm_sec, (rec->tsNs % 1000000000ULL) / 1000, hdr->procName, hdr->pid,
+           rec->tid, sl_LogTypeStr(site->ent->type), site->file, site->func,
+           site->ent->line, msg);
+    return SUCCESS;
+}
+
+/**
+ * Walk the record ring from the oldest position still in it
+ * A record is only trusted when its position field matches where it
+ * was found, otherwise the walk resyncs on the next aligned slot.
+ *
+ * @param: hdr    binary log
+ * @param: sites  call sites
+ * @return: None
+ */
+PRIVATE void decodeRing(const SlBinHdr *hdr, DECODE_SITE_t *sites)
+{
+    const SlBinRec *rec;
+    U64            pos, head = hdr->head, mask = hdr->dataSize - 1;
+    U64            numRec = 0, numSkip = 0;
+
+    pos = head > hdr->dataSize ? head - hdr->dataSize : 0;
+    while (pos < head)
+    {
+        rec = (const SlBinRec *)((const S8 *)hdr + hdr->dataOff + (pos & mask));
+        if (rec->pos != pos || rec->len < sizeof(SlBinRec) || rec->len % SL_BIN_ALIGN ||
+            (pos & mask) + rec->len > hdr->dataSize)
+        {
+            numSkip++;
+            pos += SL_BIN_ALIGN;
+            continue;
+        }
+        if (rec->siteId != SL_BIN_SITE_PAD)
+        {
+            if (decodeRec(hdr, sites, rec) == SUCCESS)
+                numRec++;
+            else
+                numSkip++;
+        }
+        pos += rec->len;
+    }
+
+    printf("%llu records, %llu slots skipped, %llu call sites, %llu not described\n",
+           numRec, numSkip, (U64)hdr->numSites, hdr->dropped);
+}
+
+/**
+ * Decoder entry
+ *
+ * @param: argv[1]  binary log file
+ * @param: argv[2]  -s to list the call sites
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    const SlBinHdr *hdr;
+    DECODE_SITE_t  *sites;
+    struct stat    st;
+    U32            i;
+    S32            fd;
+
+    if (argc < 2)
+    {
+        printf("Usage: %s <binlog> [-s]\n", argv[0]);
+        return FAILURE;
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SlBinHdr))
+    {
+        printf("Can not read %s\n", argv[1]);
+        return FAILURE;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+    {
+        printf("Can not map %s (%s)\n", argv[1], strerror(errno));
+        return FAILURE;
+    }
+
+    if (hdr->magic != SL_BIN_MAGIC || hdr->version != SL_BIN_VERSION ||
+        hdr->dataSize & (hdr->dataSize - 1) || hdr->siteOff + hdr->siteSize > hdr->dataOff ||
+        hdr->sitePos > hdr->siteSize || hdr->dataOff + hdr->dataSize > (U64)st.st_size)
+    {
+        printf("%s is not a binary log\n", argv[1]);
+        return FAILURE;
+    }
+
+    sites = calloc(hdr->numSites + 1, sizeof(DECODE_SITE_t));
+    if (!sites || decodeSites(hdr, sites) != SUCCESS)
+        return FAILURE;
+
+    if (argc > 2 && strcmp(argv[2], "-s") == 0)
+    {
+        for (i = 1; i <= hdr->numSites; i++)
+            if (sites[i].ent)
+                printf("%4u %s:%s:%d %s%s \"%s\"\n", i, sites[i].file, sites[i].func,
+                       sites[i].ent->line, sl_LogTypeStr(sites[i].ent->type),
+                       sites[i].ent->flags & SL_BIN_SITE_TEXT ? "(text)" : "",
+                       sites[i].fmt);
+        return SUCCESS;
+    }
+
+    decodeRing(hdr, sites);
+    free(sites);
+    return SUCCESS;
+}
@@ -0,0 +1,244 @@
+/*
+ * \file Name: ShardBench.c
+ *
+ * \brief Cross-shard message posting throughput and integrity
+ *
+ * \details
+ * Several threads outside the shards post numbered messages to every
+ * shard at once, so they share the external ring of each destination.
+ * Each shard forwards the messages it gets from outside to the next
+ * shard, which exercises the shard to shard rings. Every message must
+ * arrive, and the ones of one producer in the order it posted them.
+ * Forwarded messages lost to a full ring are counted as drops by the
+ * group, a producer waits for room instead.
+ *
+ * Usage: ShardBench [shards] [producers] [messages per producer]
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * Had you not received a copy of the GNU General Public License yet, write
+ * to the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include "CommonInc.h"
+#include "CommonClock.h"
+#include "CommonShard.h"
+#include "SysLogging.h"
+
+/**
+************************************************************
+*  Macro Definitions
+************************************************************
+*/
+#define BENCH_SHARD_DEFAULT  (4)
+#define BENCH_PROD_DEFAULT   (4)
+#define BENCH_MSG_DEFAULT    (1000000)
+#define BENCH_PROD_MAX       (64)
+#define BENCH_DRAIN_SEC      (5)       /* Longest wait for the last messages */
+#define BENCH_MSG_EXT        (1)       /* Posted by a producer  */
+#define BENCH_MSG_FWD        (2)       /* Forwarded by a shard  */
+
+/**
+************************************************************
+*  Type Definitions
+************************************************************
+*/
+/* Counters of one shard, written by its thread only */
+typedef struct BENCH_SHARD_TAG
+{
+    U64 extCnt;                    /* Messages from the producers      */
+    U64 fwdCnt;                    /* Messages forwarded to this shard */
+    U64 fwdSent;                   /* Forwards queued to the next shard */
+    U64 orderErr;                  /* Producer messages out of order   */
+    U32 nextKey[BENCH_PROD_MAX];   /* Expected key per producer        */
+} __attribute__((aligned(64))) BENCH_SHARD_t;
+
+typedef struct BENCH_PROD_TAG
+{
+    pthread_t  tid;
+    U32        id;
+    U32        numMsg;
+    U64        fullCnt;            /* Posts retried on a full ring */
+    CmShardGrp *grp;
+} BENCH_PROD_t;
+
+static BENCH_SHARD_t benchShards[CM_SHARD_MAX];
+
+/**
+ * Shard init hook, the shards run no FSM
+ *
+ * @param: shard  shard
+ * @return: SUCCESS
+ */
+PRIVATE S16 benchShardInit(CmShard *shard)
+{
+    shard->userData = &benchShards[shard->id];
+    return SUCCESS;
+}
+
+/**
+ * Check the order of a producer message and forward it
+ *
+ * @param: shard  shard
+ * @param: msg    message
+ * @return: None
+ */
+PRIVATE void benchShardMsg(CmShard *shard, CmShardMsg *msg)
+{
+    BENCH_SHARD_t *res = shard->userData;
+    U32           prod = (U32)(uintptr_t)msg->payload;
+
+    if (msg->msgId == BENCH_MSG_FWD)
+    {
+        __atomic_store_n(&res->fwdCnt, res->fwdCnt + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (msg->key != res->nextKey[prod])
+        __atomic_store_n(&res->orderErr, res->orderErr + 1, __ATOMIC_RELAXED);
+    res->nextKey[prod] = msg->key + 1;
+    if (cmShardPost(shard->grp, (shard->id + 1) % shard->grp->numShards,
+                    BENCH_MSG_FWD, msg->key, msg->payload) == SUCCESS)
+        __atomic_store_n(&res->fwdSent, res->fwdSent + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&res->extCnt, res->extCnt + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Producer thread: post numbered messages to every shard in turn
+ *
+ * @param: arg  producer
+ * @return: NULL
+ */
+PRIVATE void *benchProducer(void *arg)
+{
+    BENCH_PROD_t *prod = arg;
+    U32          key, dst;
+
+    for (key = 0; key < prod->numMsg; key++)
+    {
+        for (dst = 0; dst < prod->grp->numShards; dst++)
+        {
+            while (cmShardPost(prod->grp, dst, BENCH_MSG_EXT, key,
+                               (void *)(uintptr_t)prod->id) != SUCCESS)
+            {
+                prod->fullCnt++;
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Sum a counter of the shards
+ *
+ * @param: numShards  shards
+ * @param: offset     offset of the counter in BENCH_SHARD_t
+ * @return: sum
+ */
+PRIVATE U64 benchSum(U32 numShards, size_t offset)
+{
+    U64 sum = 0;
+    U32 i;
+
+    for (i = 0; i < numShards; i++)
+        sum += __atomic_load_n((U64 *)((U8 *)&benchShards[i] + offset), __ATOMIC_RELAXED);
+    return sum;
+}
+
+/**
+ * Benchmark entry
+ *
+ * @param: argv[1]  shards, default BENCH_SHARD_DEFAULT
+ * @param: argv[2]  producer threads, default BENCH_PROD_DEFAULT
+ * @param: argv[3]  messages per producer and shard, default BENCH_MSG_DEFAULT
+ * @return: SUCCESS/FAILURE
+ */
+int main(int argc, char *argv[])
+{
+    CmShardGrp   grp;
+    BENCH_PROD_t prods[BENCH_PROD_MAX];
+    U32          numShards = BENCH_SHARD_DEFAULT, numProd = BENCH_PROD_DEFAULT;
+    U32          numMsg = BENCH_MSG_DEFAULT, i;
+    U64          expected, extCnt, fwdCnt, fwdSent, fullCnt = 0, dropCnt = 0;
+    CmTimeNs     tsStart, tsPosted, tsEnd;
+
+    if (argc > 1) numShards = atoi(argv[1]);
+    if (argc > 2) numProd   = atoi(argv[2]);
+    if (argc > 3) numMsg    = atoi(argv[3]);
+    if (!numShards || numShards > CM_SHARD_MAX || !numProd ||
+        numProd > BENCH_PROD_MAX || !numMsg)
+    {
+        printf("Usage: %s [shards] [producers] [messages per producer]\n", argv[0]);
+        return FAILURE;
+    }
+
+    InitSystemLogging(argv[0], LOG_ERR, LOG_OUT_STDOUT);
+    if (cmShardGrpInit(&grp, numShards, CM_SHARD_RING_DEFAULT, CM_IDLE_BLOCK,
+                       benchShardInit, benchShardMsg, NULL) != SUCCESS)
+    {
+        printf("Failed to start %u shards\n", numShards);
+        return FAILURE;
+    }
+
+    tsStart = cmTimeNow();
+    for (i = 0; i < numProd; i++)
+    {
+        prods[i].id     = i;
+        prods[i].numMsg = numMsg;
+        prods[i].grp    = &grp;
+        prods[i].fullCnt = 0;
+        if (pthread_create(&prods[i].tid, NULL, benchProducer, &prods[i]) != 0)
+        {
+            printf("Failed to start producer %u\n", i);
+            return FAILURE;
+        }
+    }
+    for (i = 0; i < numProd; i++)
+    {
+        pthread_join(prods[i].tid, NULL);
+        fullCnt += prods[i].fullCnt;
+    }
+    tsPosted = cmTimeNow();
+
+    /* Wait for the shards to handle what is still queued */
+    expected = (U64)numProd * numMsg * numShards;
+    do
+    {
+        extCnt  = benchSum(numShards, offsetof(BENCH_SHARD_t, extCnt));
+        fwdCnt  = benchSum(numShards, offsetof(BENCH_SHARD_t, fwdCnt));
+        fwdSent = benchSum(numShards, offsetof(BENCH_SHARD_t, fwdSent));
+        if (extCnt == expected && fwdCnt == fwdSent)
+            break;
+        sched_yield();
+    } while (cmTimeNow() - tsPosted < CM_TIME_FROM_SEC(BENCH_DRAIN_SEC));
+    tsEnd = cmTimeNow();
+
+    for (i = 0; i < numShards; i++)
+        dropCnt += grp.shards[i].dropCnt;
+    cmShardGrpDeinit(&grp);
+
+    printf("%u shards, %u producers, %llu messages posted from outside\n",
+           numShards, numProd, expected);
+    printf("  %.1f M messages/s, %llu posts retried on a full ring\n",
+           (double)(extCnt + fwdCnt) * 1000.0 / (tsEnd - tsStart), fullCnt);
+    printf("  %llu received, %llu out of order, %llu lost\n", extCnt,
+           benchSum(numShards, offsetof(BENCH_SHARD_t, orderErr)), expected - extCnt);
+    printf("  %llu forwarded between shards, %llu dropped on a full ring, %llu lost\n",
+           fwdCnt, dropCnt - fullCnt, fwdSent - fwdCnt);
+
+    return (extCnt == expected && fwdCnt == fwdSent &&
+            !benchSum(numShards, offsetof(BENCH_SHARD_t, orderErr))) ? SUCCESS : FAILURE;
+}